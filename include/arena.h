@@ -0,0 +1,58 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "cnn.h"
+
+/*
+Backing memory of a MemoryRegion (the text parameters and derived weights of a model, the feature maps of a context)
+
+Every region starts on a 64 byte boundary and every weight / bias block and feature map inside it is rounded up to
+ARENA_ALIGNMENT bytes, so each tensor's start and weight_start is cache line aligned.
+Regions of at least ARENA_HUGEPAGE_SIZE bytes are mapped anonymously on a 2 MB boundary:
+  _hugepages_transparent (default) madvise()s the mapping for transparent hugepages,
+  _hugepages_explicit first tries MAP_HUGETLB from the reserved pool (vm.nr_hugepages), then falls back to transparent,
+  _hugepages_off always uses the heap.
+A numa_node >= 0 binds the pages of the region to that node (mbind, before the first touch), a kernel without NUMA
+support or an offline node leaves the region unbound with a warning. Smaller regions come from posix_memalign() unless
+they must be bound. Parameter containers are mapped files and stay in the page cache, see params.h.
+*/
+
+#define ARENA_ALIGNMENT 64
+#define ARENA_HUGEPAGE_SIZE ((size_t)2 << 20)
+
+// Floats a block takes in a region, rounded up so the next block stays ARENA_ALIGNMENT aligned
+static inline size_t arenaFloats(size_t floats) {
+    size_t block = ARENA_ALIGNMENT / sizeof(float);
+    return (floats + block - 1) / block * block;
+}
+
+// Process wide totals over every live region, updated by allocateRegion() / freeRegion()
+typedef struct ArenaStats {
+    size_t regions;
+    size_t bytes;            // requested bytes of the live regions
+    size_t peak_bytes;
+    size_t mapped_bytes;     // bytes reserved by mmap() including the rounding to whole pages
+    size_t hugetlb_bytes;    // of mapped_bytes, backed by the explicit hugepage pool
+    size_t transparent_bytes; // of mapped_bytes, madvise()d for transparent hugepages
+    size_t numa_bound_bytes;
+    size_t fallbacks; // explicit hugepage or NUMA requests that could not be honoured, since process start
+} ArenaStats;
+
+// Allocates floats (rounded up by arenaFloats()) with the region's hugepages / numa_node policy, sets size and memory_start
+int allocateRegion(MemoryRegion* region, size_t floats);
+
+void freeRegion(MemoryRegion* region);
+
+// Derived weights of a model (packed, transformed, blocked, quantized, half, sparse) each take a region with the
+// hugepages / numa_node policy of model->memory_block, kept in the ARENA_ALIGNMENT bytes in front of the returned block
+void* allocateModelBuffer(Model* model, size_t bytes);
+
+// Releases a block of allocateModelBuffer(), nothing for NULL
+void freeModelBuffer(void* buffer);
+
+void snapshotArenaStats(ArenaStats* stats);
+
+// Bytes of hugepages the kernel actually backs the region with (AnonHugePages of /proc/self/smaps), 0 if unknown
+size_t regionHugepageBytes(const MemoryRegion* region);
+
+#endif // ARENA_H
@@ -0,0 +1,28 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "cnn.h"
+
+/*
+Per layer engine selection by measurement, NetworkOptions.autotune
+
+loadModel() times _direct, _im2col_gemm and (3x3 stride 1 only) _winograd on every fp32 convolution layer and keeps the
+fastest instead of the fixed _auto rule. A scratch execution context with the model's options runs a few inference_batch()
+calls of max_batch synthetic images per engine, TinyANN.layer_seconds gives the time of each layer, the minimum over the
+rounds counts. Engines are interleaved round by round so a frequency ramp or a noisy neighbour hits all of them alike.
+The packed / transformed weights of the engines that lost are freed again.
+
+NetworkOptions.tuning_cache names a text file of earlier results, one line per tuned layer:
+  <cpu> <kernels> <threads> <max_batch> <in> <out> <height> <width> <kernel_size> <stride> <padding> <relu> <pooled> <engine>
+cpu is the model name of /proc/cpuinfo (spaces as '_'), kernels the KernelTable picked, the rest the layer shape and the
+fusion it runs with. Layers found there take the stored engine without timing, the others are tuned and appended, so a
+cache written on one machine is simply ignored on another. int8 layers and the _nchwc layout have a single kernel and
+are never tuned.
+*/
+
+#define AUTOTUNE_ROUNDS 5
+
+// Tunes (or looks up) the engine of every fp32 convolution layer of a loaded model, options as passed to loadModel()
+int autotuneModel(Model* model, const NetworkOptions* options);
+
+#endif // AUTOTUNE_H
@@ -0,0 +1,41 @@
+#ifndef BLOCKED_H
+#define BLOCKED_H
+
+#include "cnn.h"
+
+/*
+Channel blocked feature maps (NCHWc), NetworkOptions.layout = _nchwc
+
+A blocked map of C channels is stored as ceil(C / cb) blocks of H x W pixels x cb channels, cb = KernelTable.channel_block
+(the vector width: 16 for AVX-512, 8 for AVX2 and scalar, 4 for NEON), channels past C are zero. One vector load then holds
+the same pixel of cb channels: convolution broadcasts one input value against the weights of cb filters and max_pool
+compares whole vectors, both with contiguous loads for any stride.
+
+Every map from the first convolution's output up to flatten is blocked. The first convolution reads the planar input
+image and writes blocks, flatten converts back to the planar vector the fully connected layers read.
+Convolution weights are packed once per model as [out block][in_f][x][y][cb], zero past out_filters.
+Each output still sums its taps in the in_f, x, y order of convolution_direct(), so results match the direct engine.
+fp32 only, with _nchwc every convolution runs the blocked kernel whatever its conv_engine.
+*/
+
+// Channels rounded up to whole blocks
+size_t blockedChannels(size_t channels, size_t channel_block);
+
+// Floats needed to hold the blocked weights of a convolution layer
+size_t blockedWeightSize(const Tensor* tensor, size_t channel_block);
+
+void packBlockedWeights(const Tensor* tensor, size_t channel_block, float* packed);
+
+// Packs the weights of every fp32 convolution once for _nchwc, nothing for _nchw
+int setModelLayout(Model* model, int layout);
+
+// Sets the layout of every map of the context, INVALID_ARGUMENT when the network cannot run blocked
+int assignLayouts(TinyANN* tinyANN, int layout);
+
+void convolution_blocked(TinyANN* tinyANN, size_t layer_no);
+
+void max_pool_blocked(TinyANN* tinyANN, size_t layer_no);
+
+void flatten_blocked(TinyANN* tinyANN, size_t layer_no);
+
+#endif // BLOCKED_H
@@ -23,6 +23,8 @@ Output Layer ARG_MAX
 
 If you don't want to add an attribute with a layer just write '0'
 CONV2D == C(1) && MAXPOOL = M(2) && FLATTEN == F(3) && FULLY_CONNECTED == N(4)
+DEPTHWISE_CONV2D == D(6) (IN_DIM == OUT_DIM, one KERNEL_SIZE x KERNEL_SIZE filter per channel)
+POINTWISE_CONV2D == P(7) (1x1 convolution: STRIDE 1, PADDING 0, KERNEL_SIZE 1)
 ACTIVATON : RELU(1)
 It is important to flatten the feature_map before sending to FULLY_CONNECTED layer
 
@@ -47,21 +49,53 @@ E.g.
 #define MEMORY_ALLOCATION_FAILED -1
 #define MEMORY_REGION_EXCEEDED -2
 #define FILE_NOT_READABLE -3
+#define INVALID_PARAM_FILE -4
+#define INVALID_ARGUMENT -5
+#define NOT_SUPPORTED -6
 
 // Constants
 #define MAX_LAYER_INFO_SIZE 7
 #define MAX_LINE_SIZE 100
+#define FC_TILE 4
+// Floats the fused workspace starts past its (page aligned) allocation, so its rows do not share the low 12 address bits
+// with the feature map rows conv_row() reads, which stalls store forwarding
+#define FUSION_SKEW 40
 
 enum HiddenLayerAttribute { _operation, _stride, _padding, _kernel_size, _activation, _input, _output };
 
-enum Operations { _convolution = 1, _maxpool, _flatten, _fully_connected };
+// 5 is the output layer line of the config
+enum Operations { _convolution = 1, _maxpool, _flatten, _fully_connected, _depthwise_convolution = 6, _pointwise_convolution };
 
 enum Activations { _relu = 1 };
 
+// _auto runs _winograd on 3x3 stride 1 layers and _direct on the others, _winograd falls back to _direct the same way
+enum ConvEngines { _direct = 0, _im2col_gemm, _winograd, _auto };
+
+// Set per layer by the fusion pass in createExecutionContext()
+enum Fusions { _unfused = 0, _fused_relu, _fused_relu_maxpool };
+
+enum Precisions { _fp32 = 0, _int8 };
+
+// Storage of fully connected weights, computed in fp32 either way (see half.h)
+enum WeightFormats { _weights_fp32 = 0, _weights_fp16, _weights_bf16 };
+
+// Feature map layouts, _nchwc stores channels in blocks of the vector width (see blocked.h)
+enum Layouts { _nchw = 0, _nchwc };
+
+// Hugepage policy of large memory regions, see arena.h
+enum Hugepages { _hugepages_off = 0, _hugepages_transparent, _hugepages_explicit };
+
+// How allocateRegion() obtained a region's memory
+enum MemoryBackings { _backing_none = 0, _backing_heap, _backing_mapped, _backing_transparent, _backing_hugetlb };
+
 typedef struct MemoryRegion {
     size_t size;
     float* memory_start;
     float* memory_used;
+    int hugepages; // policy, set before allocateRegion()
+    int numa_node; // node the pages are bound to, -1 unbound
+    int backing;
+    size_t mapped_bytes; // length of the mapping, 0 for heap memory
 } MemoryRegion;
 
 typedef struct Tensor {
@@ -73,19 +107,108 @@ typedef struct Tensor {
     float* weight_end;
     float* bias_start;
     float* bias_end;
+    size_t batch_stride; // elements of one image, images are stored NCHW without padding
+    int conv_engine;
+    float* packed_weight_start; // weights packed for the _im2col_gemm engine
+    float* winograd_weight_start; // transformed and packed weights of the _winograd engine, see winograd.h
+    float* blocked_weight_start;  // weights packed for the _nchwc layout, see blocked.h
+    struct SparseMatrix* sparse_weights; // CSR copy of the weights of a pruned fc layer, see sparse.h
+    uint16_t* half_weight_start; // fc weights in weight_format, see half.h
+    int weight_format;
+    int layout; // of this layer's input map, set per context by assignLayouts()
+    int fusion; // _fused_relu_maxpool also runs the next (max_pool) layer and writes its output map directly
+    int8_t* qweight_start; // int8 weights, see quantize.h, the layer runs in int8 whenever this is set
+    float* weight_scales;  // one per output channel
+    float input_scale;
     float* start;
     float* end;
 } Tensor;
 
+// Immutable once loaded: network config plus parameters, shared by any number of execution contexts
+typedef struct Model {
+    size_t total_layers;
+    Tensor* tensors; // layer info, shapes and parameters, start/end are unused
+    MemoryRegion memory_block; // parameters parsed from a text file
+    size_t image_filters;
+    size_t image_rows;
+    size_t image_cols;
+    void* param_mapping; // parameters mapped from a binary container
+    size_t param_mapping_size;
+    void* quant_memory; // int8 weights and scales added by quantizeModel()
+    void* half_memory;  // half precision fc weights converted by loadModel()
+} Model;
+
+typedef struct MemoryPlan {
+    size_t peak_bytes;  // feature map bytes actually allocated
+    size_t naive_bytes; // bytes if every feature map had its own buffer
+} MemoryPlan;
+
+// Execution context: feature maps and scratch space of one in-flight inference, cheap to create per thread
 typedef struct TinyANN {
     size_t total_layers;
-    MemoryRegion memory_block;
-    Tensor* tensors;
+    MemoryRegion memory_block; // feature maps only
+    Tensor* tensors; // copy of the model's layers with start/end pointing into memory_block
     size_t image_filters;
     size_t image_rows;
     size_t image_cols;
+    const Model* model;
+    Model* owned_model; // set when initNetwork() loaded a private model
+    size_t max_batch;
+    size_t batch_size;
+    int reuse_activations; // feature maps share memory once they are dead, see createTensors()
+    MemoryPlan memory_plan;
+    float* gemm_workspace;
+    size_t gemm_workspace_size;
+    float* fusion_workspace; // per worker rows of a fused layer's output before pooling
+    size_t fusion_workspace_size;
+    int8_t* int8_workspace; // quantized input of the current int8 layer, then per worker im2col columns
+    size_t int8_input_size;
+    size_t int8_workspace_size;
+    float* activation_ranges; // caller owned, total_layers floats, set while calibrating (see quantize.h)
+    double* layer_seconds;    // caller owned, total_layers doubles, when set inference_batch() adds the wall time of every layer call
+    const struct KernelTable* kernels; // SIMD inner loops picked for this CPU, see kernels.h
+    struct ThreadPool* thread_pool;    // workers that split each layer, see thread_pool.h
+    struct Profiler* profiler;         // NULL unless enableProfiling() (TINYANN_PROFILE builds), see profile.h
 } TinyANN;
 
+typedef TinyANN ExecutionContext;
+
+// Layer a parallelFor() task works on, the context of every per-layer range function (see thread_pool.h)
+typedef struct LayerTask {
+    TinyANN* tinyANN;
+    size_t layer_no;
+} LayerTask;
+
+// 1 for the layers that carry weights and biases (every convolution and fully connected layer)
+int hasWeights(const Tensor* tensor);
+
+// Input channels one output channel's filter reads, 1 for a depthwise convolution
+size_t filterChannels(const Tensor* tensor);
+
+// Weights of the layer, output x filterChannels() x kernel_size x kernel_size
+size_t weightCount(const Tensor* tensor);
+
+// Model fields are read by loadModel(), context fields by createExecutionContext(), initNetwork() uses both
+typedef struct NetworkOptions {
+    // Context
+    size_t max_batch; // images the feature maps are sized for, larger inference_batch() calls are split
+    size_t threads;   // threads per layer including the caller, 0 uses every hardware thread
+    int reuse_activations; // 1 (default) plans feature maps into max(in + out) memory, 0 keeps every map alive
+    int fuse_layers; // 1 (default) runs conv -> relu -> max_pool and conv / fc -> relu as single kernels
+    int precision;   // _int8 runs the int8 weights of a quantized model, an int8 parameter file always runs in int8
+    // Model and context
+    int layout; // _nchwc (fp32 only) blocks the channels of every map between the input and flatten, see blocked.h
+    // Model
+    int conv_engine; // engine of every convolution layer (default _auto), setConvolutionEngine() overrides single layers
+    float sparse_threshold; // fc layers with at least this fraction of zero weights run sparse (default 0.7, > 1 never), see sparse.h
+    int weight_format; // _weights_fp16 / _weights_bf16 store dense fc weights in half precision, a half parameter file always does
+    int autotune; // 1 times every engine of each fp32 convolution layer with the context options above and keeps the fastest, see autotune.h
+    const char* tuning_cache; // file of earlier autotune results (NULL = none), layers found there are not timed again
+    // Memory regions of the model and the context, see arena.h
+    int hugepages; // _hugepages_transparent (default), _hugepages_explicit or _hugepages_off for regions of 2 MB and more
+    int numa_node; // binds the region pages to this node, -1 (default) leaves placement to first touch
+} NetworkOptions;
+
 //=====Memory Region====
 int allocateMemoryRegion(TinyANN* tinyANN);
 
@@ -93,16 +216,57 @@ int createTensors(TinyANN* tinyANN);
 
 int deallocateMemoryRegion(TinyANN* tinyANN);
 
+//=====Model=====
+
+int loadModel(Model* model, const char* network_config_path, const char* param_path, const NetworkOptions* options);
+
+int loadParams(Model* model, const char* param_path);
+
+// Packs (_im2col_gemm) or transforms (_winograd) the layer weights once and makes the engine the default of new contexts
+int setModelConvolutionEngine(Model* model, size_t layer_no, int engine);
+
+int destroyModel(Model* model);
+
+//=====Execution Context=====
+
+// Allocates feature maps for options->max_batch images against a loaded model, the model must outlive the context
+int createExecutionContext(TinyANN* tinyANN, const Model* model, const NetworkOptions* options);
+
+int destroyExecutionContext(TinyANN* tinyANN);
+
 //=====Neural Network=====
 
+NetworkOptions defaultNetworkOptions();
+
+// Loads a private model and one execution context for it
 int initNetwork(TinyANN* tinyANN, const char* network_config_path, const char* param_path);
 
-int loadParams(TinyANN* tinyANN, const char* param_path);
+int initNetworkWithOptions(TinyANN* tinyANN, const char* network_config_path, const char* param_path, const NetworkOptions* options);
 
+// Runs the engine selected for the layer
 void convolution(TinyANN* tinyANN, size_t layer_no);
 
+void convolution_direct(TinyANN* tinyANN, size_t layer_no);
+
+void convolution_gemm(TinyANN* tinyANN, size_t layer_no);
+
+void convolution_winograd(TinyANN* tinyANN, size_t layer_no);
+
+// Per channel sliding window, threads split (image, channel) pairs
+void depthwise_convolution(TinyANN* tinyANN, size_t layer_no);
+
+// 1x1 convolution as a GEMM of the packed weights and the input map itself, no im2col (see gemm.h)
+void pointwise_convolution(TinyANN* tinyANN, size_t layer_no);
+
+// Engine of this context only, a shared model must already hold packed / transformed weights for _im2col_gemm / _winograd
+int setConvolutionEngine(TinyANN* tinyANN, size_t layer_no, int engine);
+
 void max_pool(TinyANN* tinyANN, size_t layer_no);
 
+// Pooled row out_row of one channel of max_pool layer layer_no, rows holds input rows [row_begin, row_end) of that channel
+// and must cover every row of the window that lies inside the map
+void max_pool_row(const TinyANN* tinyANN, size_t layer_no, const float* rows, long row_begin, long row_end, long out_row, float* out);
+
 void relu(TinyANN* tinyANN, size_t layer_no);
 
 void flatten(TinyANN* tinyANN, size_t layer_no);
@@ -111,6 +275,17 @@ void fully_connected(TinyANN* tinyANN, size_t layer_no);
 
 int inference(TinyANN* tinyANN, float* image);
 
+// Classifies n CHW images stored back to back, writing the arg max of each into out_classes
+int inference_batch(TinyANN* tinyANN, const float* images, size_t n, int* out_classes);
+
+// inference_batch() with the k most likely classes of every image, highest first, in out_classes[i * k, i * k + k) and, when
+// out_probabilities is not NULL, their softmax probabilities at the same positions. Computed from the output map without
+// copying or allocating, 1 <= k <= classes
+int inference_batch_topk(TinyANN* tinyANN, const float* images, size_t n, size_t k, int* out_classes, float* out_probabilities);
+
+int inference_topk(TinyANN* tinyANN, const float* image, size_t k, int* out_classes, float* out_probabilities);
+
+// Releases the context, and its model when initNetwork() loaded it
 int destroyNetwork(TinyANN* tinyANN);
 
 #endif // CNN_H
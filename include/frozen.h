@@ -0,0 +1,30 @@
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include "cnn.h"
+
+/*
+Inference specialized for one network topology at build time
+tinyann_codegen (tools/codegen.cpp) turns a network_config.txt into a translation unit where every layer is a
+frozen_kernels.h template instantiated with its fixed shapes: kernel windows are unrolled, loop bounds and strides are
+constants and the feature maps live in two static per-thread buffers sized for the largest map. Layers run in a fixed
+sequence, there is no per-layer dispatch, fusion pass or memory planning at run time.
+CMake generates it for TINYANN_FROZEN_CONFIG into the tinyann_frozen library, link that and call these instead of
+inference() / inference_batch().
+
+Weights still come from a Model loaded by loadModel() (fp32 parameters, text or binary), check it once with
+frozenCheckModel(). Every call runs one image at a time on the calling thread, any number of threads can call at once.
+*/
+
+// SUCCESS when model has the generated topology and fp32 weights, INVALID_ARGUMENT otherwise
+int frozenCheckModel(const Model* model);
+
+// Class of one image (image_filters x image_rows x image_cols floats, planar)
+int frozenInference(const Model* model, const float* image);
+
+int frozenInferenceBatch(const Model* model, const float* images, size_t n, int* out_classes);
+
+// network_config the translation unit was generated from
+const char* frozenNetworkConfig();
+
+#endif // FROZEN_H
@@ -0,0 +1,223 @@
+#ifndef FROZEN_KERNELS_H
+#define FROZEN_KERNELS_H
+
+#include "cnn.h"
+
+/*
+Layer kernels of the generated frozen inference (see frozen.h), every shape is a template parameter
+They compute what convolution_direct(), max_pool(), fully_connected() and the fused paths compute for one image,
+summing in the same order, only with constant bounds the compiler can unroll and vectorize.
+*/
+
+#if defined(__clang__)
+#define FROZEN_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__) && __GNUC__ >= 8
+#define FROZEN_UNROLL _Pragma("GCC unroll 16")
+#else
+#define FROZEN_UNROLL
+#endif
+
+// Output size of a window of k with stride s and padding p over size
+#define FROZEN_OUT_SIZE(size, k, s, p) (1 + ((size) + 2 * (p) - (k)) / (s))
+
+// Output channels a convolution computes together, every input value loaded is used for all of them
+#define FROZEN_CONV_BLOCK(out_c) ((out_c) % 4 == 0 ? 4 : (out_c) % 2 == 0 ? 2 : 1)
+
+// Output row of BLOCK consecutive channels without bias, rows out_stride apart, filters holds their IN_C x K x K weights
+template <size_t IN_C, size_t H, size_t W, size_t K, size_t S, size_t P, size_t BLOCK>
+static inline void frozenConvolutionRows(const float* in, const float* filters, long row, float* out, size_t out_stride) {
+    const long OUT_W = FROZEN_OUT_SIZE(W, K, S, P);
+
+    for (size_t b = 0; b < BLOCK; b++) {
+        for (long col = 0; col < OUT_W; col++) {
+            out[b * out_stride + col] = 0.0f;
+        }
+    }
+
+    for (size_t in_f = 0; in_f < IN_C; in_f++) {
+        FROZEN_UNROLL
+        for (long x = 0; x < (long)K; x++) {
+            long in_y = (long)S * row + x - (long)P;
+            if (in_y < 0 || in_y >= (long)H) {
+                continue;
+            }
+            const float* in_row = in + (in_f * H + in_y) * W;
+
+            FROZEN_UNROLL
+            for (long y = 0; y < (long)K; y++) {
+                // Constant per tap once unrolled: the output columns whose input lies inside the row
+                const long col_begin = y < (long)P ? ((long)P - y + (long)S - 1) / (long)S : 0;
+                const long col_last = (long)W + (long)P > y ? ((long)W + (long)P - y - 1) / (long)S + 1 : 0;
+                const long col_end = col_last < OUT_W ? col_last : OUT_W;
+                float weights[BLOCK];
+                for (size_t b = 0; b < BLOCK; b++) {
+                    weights[b] = filters[b * IN_C * K * K + (in_f * K + x) * K + y];
+                }
+
+                for (long col = col_begin; col < col_end; col++) {
+                    float value = in_row[col * (long)S + y - (long)P];
+                    FROZEN_UNROLL
+                    for (size_t b = 0; b < BLOCK; b++) {
+                        out[b * out_stride + col] += weights[b] * value;
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <size_t IN_C, size_t H, size_t W, size_t OUT_C, size_t K, size_t S, size_t P, bool RELU>
+static inline void frozen_convolution(const float* in, const float* weights, const float* bias, float* out) {
+    const size_t OUT_H = FROZEN_OUT_SIZE(H, K, S, P);
+    const size_t OUT_W = FROZEN_OUT_SIZE(W, K, S, P);
+    const size_t BLOCK = FROZEN_CONV_BLOCK(OUT_C);
+
+    for (size_t f0 = 0; f0 < OUT_C; f0 += BLOCK) {
+        for (size_t row = 0; row < OUT_H; row++) {
+            float* out_row = out + (f0 * OUT_H + row) * OUT_W;
+            frozenConvolutionRows<IN_C, H, W, K, S, P, BLOCK>(in, weights + f0 * IN_C * K * K, row, out_row, OUT_H * OUT_W);
+
+            for (size_t b = 0; b < BLOCK; b++) {
+                for (size_t col = 0; col < OUT_W; col++) {
+                    float value = out_row[b * OUT_H * OUT_W + col] + bias[f0 + b];
+                    out_row[b * OUT_H * OUT_W + col] = RELU && value < 0 ? 0.0f : value;
+                }
+            }
+        }
+    }
+}
+
+// Max of a window over rows [row_begin, row_end) of a map, pixels outside count as the zero padding they stand for
+template <size_t W, size_t K>
+static inline float frozenMaxWindow(const float* rows, long row_begin, long row_end, long top, long left) {
+    float max_val = INT32_MIN;
+
+    FROZEN_UNROLL
+    for (long i = 0; i < (long)K; i++) {
+        FROZEN_UNROLL
+        for (long j = 0; j < (long)K; j++) {
+            long y = top + i;
+            long x = left + j;
+            float value = y >= row_begin && y < row_end && x >= 0 && x < (long)W ? rows[(y - row_begin) * (long)W + x] : 0.0f;
+            max_val = value > max_val ? value : max_val;
+        }
+    }
+    return max_val;
+}
+
+template <size_t C, size_t H, size_t W, size_t K, size_t S, size_t P>
+static inline void frozen_max_pool(const float* in, float* out) {
+    const size_t OUT_H = FROZEN_OUT_SIZE(H, K, S, P);
+    const size_t OUT_W = FROZEN_OUT_SIZE(W, K, S, P);
+
+    for (size_t c = 0; c < C; c++) {
+        for (size_t row = 0; row < OUT_H; row++) {
+            for (size_t col = 0; col < OUT_W; col++) {
+                out[(c * OUT_H + row) * OUT_W + col] =
+                    frozenMaxWindow<W, K>(in + c * H * W, 0, H, (long)(row * S) - (long)P, (long)(col * S) - (long)P);
+            }
+        }
+    }
+}
+
+// conv -> relu -> max_pool, only the conv rows under one pooling window exist at a time (on the stack)
+template <size_t IN_C, size_t H, size_t W, size_t OUT_C, size_t K, size_t S, size_t P, size_t POOL_K, size_t POOL_S, size_t POOL_P>
+static inline void frozen_convolution_max_pool(const float* in, const float* weights, const float* bias, float* out) {
+    const long CONV_H = FROZEN_OUT_SIZE(H, K, S, P);
+    const size_t CONV_W = FROZEN_OUT_SIZE(W, K, S, P);
+    const size_t OUT_H = FROZEN_OUT_SIZE(CONV_H, POOL_K, POOL_S, POOL_P);
+    const size_t OUT_W = FROZEN_OUT_SIZE(CONV_W, POOL_K, POOL_S, POOL_P);
+    const size_t BLOCK = FROZEN_CONV_BLOCK(OUT_C);
+    float band[BLOCK][POOL_K * CONV_W];
+
+    for (size_t f0 = 0; f0 < OUT_C; f0 += BLOCK) {
+        for (size_t pool_row = 0; pool_row < OUT_H; pool_row++) {
+            long top = (long)(pool_row * POOL_S) - (long)POOL_P;
+            long row_begin = top > 0 ? top : 0;
+            long row_end = top + (long)POOL_K < CONV_H ? top + (long)POOL_K : CONV_H;
+
+            for (long row = row_begin; row < row_end; row++) {
+                frozenConvolutionRows<IN_C, H, W, K, S, P, BLOCK>(in, weights + f0 * IN_C * K * K, row, &band[0][(row - row_begin) * CONV_W],
+                                                                  POOL_K * CONV_W);
+            }
+
+            for (size_t b = 0; b < BLOCK; b++) {
+                for (long i = 0; i < (row_end - row_begin) * (long)CONV_W; i++) {
+                    float value = band[b][i] + bias[f0 + b];
+                    band[b][i] = value < 0 ? 0.0f : value;
+                }
+
+                float* out_row = out + ((f0 + b) * OUT_H + pool_row) * OUT_W;
+                for (size_t col = 0; col < OUT_W; col++) {
+                    out_row[col] = frozenMaxWindow<CONV_W, POOL_K>(band[b], row_begin, row_end, top, (long)(col * POOL_S) - (long)POOL_P);
+                }
+            }
+        }
+    }
+}
+
+// FROZEN_FC_LANES partial sums per neuron, a fixed split the compiler keeps in one vector register
+#define FROZEN_FC_LANES 8
+
+template <size_t IN, size_t OUT, bool RELU>
+static inline void frozen_fully_connected(const float* in, const float* weights, const float* bias, float* out) {
+    const size_t VECTOR_END = IN / FROZEN_FC_LANES * FROZEN_FC_LANES;
+
+    for (size_t n = 0; n < OUT; n++) {
+        const float* row = weights + n * IN;
+        float partial[FROZEN_FC_LANES] = {0.0f};
+
+        for (size_t m = 0; m < VECTOR_END; m += FROZEN_FC_LANES) {
+            FROZEN_UNROLL
+            for (size_t lane = 0; lane < FROZEN_FC_LANES; lane++) {
+                partial[lane] += in[m + lane] * row[m + lane];
+            }
+        }
+
+        float sum = 0.0f;
+        for (size_t lane = 0; lane < FROZEN_FC_LANES; lane++) {
+            sum += partial[lane];
+        }
+        for (size_t m = VECTOR_END; m < IN; m++) {
+            sum += in[m] * row[m];
+        }
+
+        float value = sum + bias[n];
+        out[n] = RELU && value < 0 ? 0.0f : value;
+    }
+}
+
+template <size_t C>
+static inline int frozen_argmax(const float* scores) {
+    int max_ind = 0;
+    for (size_t i = 1; i < C; i++) {
+        if (scores[max_ind] < scores[i]) {
+            max_ind = i;
+        }
+    }
+    return max_ind;
+}
+
+// Topology check shared by the generated frozenCheckModel()
+static inline int frozenModelMatches(const Model* model, const size_t image[3], size_t total_layers, const size_t info[][MAX_LAYER_INFO_SIZE]) {
+    int matches = model->image_filters == image[0] && model->image_rows == image[1] && model->image_cols == image[2] &&
+                  model->total_layers == total_layers;
+
+    for (size_t l = 0; matches && l < total_layers; l++) {
+        const Tensor* tensor = &model->tensors[l];
+        for (size_t i = 0; i < MAX_LAYER_INFO_SIZE; i++) {
+            matches &= tensor->info[i] == info[l][i];
+        }
+        if ((tensor->info[_operation] == _convolution || tensor->info[_operation] == _fully_connected) && l + 1 < total_layers) {
+            matches &= tensor->weight_start != NULL && tensor->bias_start != NULL;
+        }
+    }
+
+    if (!matches) {
+        fprintf(stderr, "ERROR TINY_ANN: Model does not match the frozen network or has no fp32 weights\n");
+        return INVALID_ARGUMENT;
+    }
+    return SUCCESS;
+}
+
+#endif // FROZEN_KERNELS_H
@@ -0,0 +1,39 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "cnn.h"
+
+/*
+Cache blocked SGEMM used by the _im2col_gemm convolution engine
+
+C[M x N] = A[M x K] * B[K x N]
+A : convolution weights (out_filters x in_filters * kernel_size * kernel_size), packed once into GEMM_MR row panels
+B : im2col lowering of the input feature maps, packed on the fly into GEMM_NR column panels, GEMM_KC x GEMM_NC at a time
+N : every output pixel of every image in the batch
+Pointwise (1x1) layers use the same packed weights with B = the input map itself, no lowering needed.
+*/
+
+#define GEMM_MR 4
+#define GEMM_NR 16
+#define GEMM_KC 256
+#define GEMM_NC 128
+
+// Floats needed to hold the packed weights of a convolution layer
+size_t packedWeightSize(const Tensor* tensor);
+
+// Floats of scratch space convolution_gemm() needs for this layer
+size_t gemmWorkspaceSize(const Tensor* tensor);
+
+// Pooled rows one work item of a convolution fused with max_pool covers, enough to fill about GEMM_NC columns
+// conv_out is the map between the two layers
+size_t fusedPoolRows(const Tensor* conv_out);
+
+// Conv output rows pool_rows consecutive pooled rows read
+size_t fusedConvRows(const Tensor* conv_out, size_t pool_rows);
+
+void packConvolutionWeights(const Tensor* tensor, float* packed);
+
+// C[GEMM_MR x GEMM_NR] += A panel * B panel over kc, only the leading m_rows x n_cols of C are stored
+void sgemmMicroKernel(size_t kc, const float* a, const float* b, float* c, size_t ldc, size_t m_rows, size_t n_cols);
+
+#endif // GEMM_H
@@ -0,0 +1,86 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include "cnn.h"
+
+/*
+Half precision storage of fully connected weights, NetworkOptions.weight_format
+
+_weights_fp16 (IEEE binary16) or _weights_bf16 (the upper half of an fp32) halve the bytes fully_connected() streams per
+image, the fc_tile_fp16 / fc_tile_bf16 kernels widen the weights to fp32 in registers (F16C, AVX-512F, NEON, scalar shifts)
+and accumulate in fp32 as before, inputs and biases stay fp32.
+loadModel() rounds the fp32 weights of every dense fc layer to nearest even, or a half parameter container (params.h,
+tinyann_convert_params ... fp16|bf16) maps them in place, then the fc layers have no fp32 weights at all: the converted
+copy is dropped from the text parameter region (compacted) or its pages of an fp32 container are given back (madvise).
+Such a model cannot be quantized, written as fp32 or frozen any more.
+Convolution weights are out of scope and stay fp32: they are a small share of the bytes, compute bound and repacked to
+fp32 by every engine anyway.
+*/
+
+static inline float bitsToFloat(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline uint32_t floatToBits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline float fp16ToFloat(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    if (exponent == 0x1f) {
+        return bitsToFloat(sign | 0x7f800000 | (mantissa << 13));
+    }
+    if (exponent == 0) {
+        // Zero and subnormals: mantissa x 2^-24
+        float value = mantissa * (1.0f / 16777216.0f);
+        return sign ? -value : value;
+    }
+    return bitsToFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+// Round to nearest even, overflow goes to infinity like F16C's vcvtps2ph
+static inline uint16_t floatToFp16(float value) {
+    uint32_t bits = floatToBits(value);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude > 0x7f800000) {
+        return sign | 0x7e00;
+    }
+    if (magnitude >= 0x477ff000) {
+        return sign | 0x7c00;
+    }
+    if (magnitude < 0x38800000) {
+        // Below the smallest normal, the subnormal is the value in units of 2^-24
+        return sign | (uint16_t)lrintf(bitsToFloat(magnitude) * 16777216.0f);
+    }
+    uint32_t rounded = magnitude + 0xfff + ((magnitude >> 13) & 1);
+    return sign | (uint16_t)((rounded - 0x38000000) >> 13);
+}
+
+static inline float bf16ToFloat(uint16_t half) { return bitsToFloat((uint32_t)half << 16); }
+
+static inline uint16_t floatToBf16(float value) {
+    uint32_t bits = floatToBits(value);
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        return (uint16_t)((bits >> 16) | 0x40);
+    }
+    return (uint16_t)((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+}
+
+static inline uint16_t floatToHalf(float value, int format) { return format == _weights_bf16 ? floatToBf16(value) : floatToFp16(value); }
+
+static inline float halfToFloat(uint16_t half, int format) { return format == _weights_bf16 ? bf16ToFloat(half) : fp16ToFloat(half); }
+
+// Converts the weights of every dense fp32 fc layer (not int8, not sparse) to format and frees their fp32 copy, nothing for
+// _weights_fp32. Moves the remaining text parameters, so it runs before any execution context borrows the model
+int setModelWeightFormat(Model* model, int format);
+
+#endif // HALF_H
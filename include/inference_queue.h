@@ -0,0 +1,61 @@
+#ifndef INFERENCE_QUEUE_H
+#define INFERENCE_QUEUE_H
+
+#include "cnn.h"
+
+/*
+Asynchronous front end for single image requests arriving at random times
+
+submitInference() copies the image into the queue and returns at once. One scheduler thread owns the execution context:
+it waits for a request, then for more until max_batch are pending or the oldest one has waited max_delay_us, and runs
+them as one inference_batch() call. Callbacks run on the scheduler thread in submit order once their batch is done,
+so they should return quickly. destroyInferenceQueue() runs every request still pending before it returns, including
+those of submitInference() calls still copying their image; calls blocked on max_pending return INVALID_ARGUMENT.
+*/
+
+#define QUEUE_BATCH_BINS 64 // batch_sizes[n] counts batches of n images, larger batches count in the last bin
+#define QUEUE_DEPTH_BINS 32 // depths[0] counts submits to an empty queue, depths[k] submits that found [2^(k-1), 2^k) waiting
+
+typedef struct InferenceQueue InferenceQueue;
+
+// status is what inference_batch() returned for the request's batch, class_id is only valid on SUCCESS
+typedef void (*InferenceCallback)(void* user_data, int status, int class_id);
+
+typedef struct QueueOptions {
+    size_t max_batch;    // images per inference_batch() call, 0 = the context's max_batch
+    size_t max_delay_us; // longest the oldest pending request waits for its batch to fill, 0 runs whatever is pending
+    size_t max_pending;  // submitInference() blocks while this many requests wait, 0 = unbounded
+} QueueOptions;
+
+typedef struct QueueStats {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t batches;
+    size_t depth;     // requests waiting now
+    size_t max_depth; // most requests seen waiting at once
+    uint64_t batch_sizes[QUEUE_BATCH_BINS];
+    uint64_t depths[QUEUE_DEPTH_BINS];
+    double wait_seconds;      // summed over completed requests, submit -> start of their batch
+    double inference_seconds; // summed over batches
+} QueueStats;
+
+QueueOptions defaultQueueOptions();
+
+// Starts the scheduler thread on tinyANN, which must not be used elsewhere until the queue is destroyed, NULL on error
+InferenceQueue* createInferenceQueue(TinyANN* tinyANN, const QueueOptions* options);
+
+// Runs the pending requests, then stops the scheduler thread once no submitInference() call is left inside the queue
+void destroyInferenceQueue(InferenceQueue* queue);
+
+// Queues one CHW image, callback(user_data, ...) is called once with its class, INVALID_ARGUMENT while shutting down
+int submitInference(InferenceQueue* queue, const float* image, InferenceCallback callback, void* user_data);
+
+// Blocking convenience over submitInference(), returns the class of image or a negative error code
+int submitInferenceAndWait(InferenceQueue* queue, const float* image);
+
+void snapshotQueueStats(InferenceQueue* queue, QueueStats* stats);
+
+// Clears the counters and histograms, depth keeps the requests still waiting
+void resetQueueStats(InferenceQueue* queue);
+
+#endif // INFERENCE_QUEUE_H
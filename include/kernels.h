@@ -0,0 +1,94 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "cnn.h"
+#include "half.h"
+#include "quantize.h"
+
+/*
+Inner loops of convolution, fully_connected (dense and sparse), relu, max_pool, the int8 layers, the blocked layout,
+preprocessing and the softmax of the output stage, one table per instruction set
+selectKernels() picks the widest table the CPU supports once at startup, TINYANN_FORCE_ISA (CMake option) pins one
+*/
+
+// exp() of the vector kernels (Cephes expf): x = k ln2 + r with |r| <= ln2 / 2, exp(r) ~ 1 + r + r^2 (C0 r^5 + ... + C5),
+// 2^k built in the exponent bits. About 2 ulp, inputs below EXP_MIN give 2^-126
+#define EXP_MIN -87.3f
+#define EXP_LOG2E 1.44269504088896341f
+#define EXP_LN2_HI 0.693359375f
+#define EXP_LN2_LO -2.12194440e-4f
+#define EXP_C0 1.9875691500e-4f
+#define EXP_C1 1.3981999507e-3f
+#define EXP_C2 8.3334519073e-3f
+#define EXP_C3 4.1665795894e-2f
+#define EXP_C4 1.6666665459e-1f
+#define EXP_C5 5.0000001201e-1f
+
+typedef struct KernelTable {
+    const char* name;
+
+    // C[GEMM_MR x GEMM_NR] += A panel * B panel, see gemm.h
+    void (*gemm_micro_kernel)(size_t kc, const float* a, const float* b, float* c, size_t ldc, size_t m_rows, size_t n_cols);
+
+    // out[j] += weight * in[j * stride] for j < n
+    void (*conv_row)(float* out, const float* in, size_t stride, float weight, size_t n);
+
+    // acc[b][n] = sum over m of in[b * in_stride + m] * weights[n * inputs + m] for b < b_tile, n < n_tile
+    void (*fc_tile)(const float* in, size_t in_stride, size_t b_tile, const float* weights, size_t inputs, size_t n_tile,
+                    float acc[FC_TILE][FC_TILE]);
+
+    // fc_tile with the weights in _weights_fp16 / _weights_bf16 (see half.h), widened to fp32 in registers
+    void (*fc_tile_fp16)(const float* in, size_t in_stride, size_t b_tile, const uint16_t* weights, size_t inputs, size_t n_tile,
+                         float acc[FC_TILE][FC_TILE]);
+    void (*fc_tile_bf16)(const float* in, size_t in_stride, size_t b_tile, const uint16_t* weights, size_t inputs, size_t n_tile,
+                         float acc[FC_TILE][FC_TILE]);
+
+    // acc[b] = sum over j of values[j] * in[b * in_stride + columns[j]] for j < nonzeros, b < b_tile, one row of a sparse fc layer
+    void (*sparse_dot)(const float* values, const uint32_t* columns, size_t nonzeros, const float* in, size_t in_stride, size_t b_tile,
+                       float acc[FC_TILE]);
+
+    // data[j] = max(data[j], 0) for j < n
+    void (*relu)(float* data, size_t n);
+
+    // out[j] = max over the kernel_size x kernel_size window at in[j * stride], rows row_width apart, for j < n
+    void (*max_pool_row)(const float* in, size_t row_width, size_t kernel_size, size_t stride, float* out, size_t n);
+
+    // out[j] = round(in[j] * inv_scale) clamped to [-127, 127] for j < n, ties to even
+    void (*quantize_s8)(const float* in, int8_t* out, float inv_scale, size_t n);
+
+    // acc[r] = sum over i of a[r * a_stride + i] * b[i] for r < QUANT_MR, k is a multiple of QUANT_K_ALIGN
+    void (*dot_s8)(const int8_t* a, size_t a_stride, const int8_t* b, size_t k, int32_t acc[QUANT_MR]);
+
+    // c[r][j] = sum over i of a[r * a_stride + i] * column j at i, for r < QUANT_MR and j < QUANT_NR
+    // b holds the columns in pairs, the QUANT_NR columns' elements (i, i + 1) are b[i * QUANT_NR + 2 * j] and b[i * QUANT_NR + 2 * j + 1]
+    void (*gemm_s8)(const int8_t* a, size_t a_stride, const int8_t* b, size_t k, int32_t c[QUANT_MR][QUANT_NR]);
+
+    // out[j] = src[left[j]] + weights[j] * (src[right[j]] - src[left[j]]) for j < n, the horizontal step of preprocessImage()
+    // left and right are nondecreasing byte offsets, the vector kernels gather 32 bits ending at each byte once left[j] >= 3
+    void (*resample_row)(const uint8_t* src, const uint32_t* left, const uint32_t* right, const float* weights, float* out, size_t n);
+
+    // out[j] = (a[j] + t * (b[j] - a[j])) * scale + bias for j < n, the vertical step of preprocessImage()
+    void (*lerp_normalize_row)(const float* a, const float* b, float t, float scale, float bias, float* out, size_t n);
+
+    // Channels per block of the _nchwc layout (see blocked.h), one vector of the two kernels below
+    size_t channel_block;
+
+    // out[j * channel_block + o] += in[(j * stride + t) * in_step] * weights[t * channel_block + o] for t < taps in order, j < n
+    void (*conv_block_row)(float* out, const float* in, size_t in_step, size_t stride, const float* weights, size_t taps, size_t n);
+
+    // out[j * channel_block + o] = max over the kernel_size x kernel_size window at pixel j * stride, rows row_width pixels apart, for j < n
+    void (*max_pool_block_row)(const float* in, size_t row_width, size_t kernel_size, size_t stride, float* out, size_t n);
+
+    // Sum of exp(in[j] - shift) for j < n with every in[j] <= shift, the softmax denominator of the output stage
+    float (*exp_sum)(const float* in, size_t n, float shift);
+} KernelTable;
+
+const KernelTable* selectKernels();
+
+// NULL when the instruction set was not compiled in
+const KernelTable* scalarKernels();
+const KernelTable* avx2Kernels();
+const KernelTable* avx512Kernels();
+const KernelTable* neonKernels();
+
+#endif // KERNELS_H
@@ -0,0 +1,111 @@
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#include "cnn.h"
+
+/*
+Binary parameter container (native little-endian)
+
+[ParamFileHeader]
+[ParamLayerRecord] x layer_count      (one per convolution / fully connected layer, in network order)
+<zero padding up to header_size>
+[weights of layer a][pad][bias of layer a][pad][weights of layer b] ...
+
+Every block starts on a TINYANN_PARAM_ALIGNMENT byte boundary measured from the start of the file,
+so once the file is mmap'ed (page aligned) weight_start / bias_start can point straight into the mapping.
+The checksum covers every byte after header_size.
+
+The int8 container (quantizeModel() output) has the same layout with its own magic and QuantLayerRecord entries,
+each block being [int8 weights, quantRows() x quantRowStride()][float weight scales][float bias].
+Depthwise and pointwise layers have no int8 kernels and are stored in fp32 there: input_scale 0, weight_rows weightCount(),
+row_stride sizeof(float), the blocks [float weights][float bias] and no scales (scale_offset 0).
+
+The half container has its own magic and ParamLayerRecord entries, the weights of every fully connected layer are
+16 bit in the record's weight_format (fp16 or bf16, see half.h), convolution weights and every bias stay fp32.
+*/
+
+#define TINYANN_PARAM_MAGIC "TANNPRM"
+#define TINYANN_PARAM_MAGIC_SIZE 8 // magics are at most 7 characters, zero padded and not NUL terminated in the file
+#define TINYANN_PARAM_VERSION 1
+#define TINYANN_PARAM_ALIGNMENT 64
+#define TINYANN_QPARAM_MAGIC "TANNQ8"
+#define TINYANN_HPARAM_MAGIC "TANNHLF"
+
+typedef struct ParamFileHeader {
+    char magic[TINYANN_PARAM_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t alignment;
+    uint32_t layer_count;
+    uint32_t header_size;
+    uint64_t data_size;
+    uint64_t checksum;
+} ParamFileHeader;
+
+typedef struct ParamLayerRecord {
+    uint32_t layer_no;
+    uint32_t operation;
+    uint32_t input;
+    uint32_t output;
+    uint32_t kernel_size;
+    uint32_t weight_format; // _weights_fp32, fc layers of a half container _weights_fp16 / _weights_bf16
+    uint64_t weight_offset;
+    uint64_t weight_count;
+    uint64_t bias_offset;
+    uint64_t bias_count;
+} ParamLayerRecord;
+
+typedef struct QuantLayerRecord {
+    uint32_t layer_no;
+    uint32_t operation;
+    uint32_t input;
+    uint32_t output;
+    uint32_t kernel_size;
+    float input_scale;
+    uint64_t weight_offset;
+    uint64_t weight_rows;
+    uint64_t row_stride;
+    uint64_t scale_offset;
+    uint64_t bias_offset;
+} QuantLayerRecord;
+
+// Returns 1 if the file at param_path starts with the binary container magic
+int isBinaryParamFile(const char* param_path);
+
+// Returns 1 if the file at param_path starts with the int8 container magic
+int isQuantizedParamFile(const char* param_path);
+
+// Returns 1 if the file at param_path starts with the half container magic
+int isHalfParamFile(const char* param_path);
+
+// Maps param_path read-only and points every weight_start / bias_start into the mapping (no copy)
+int mapParams(Model* model, const char* param_path);
+
+// Same for an int8 container, the layers get qweight_start / weight_scales / bias_start and no fp32 weights
+int mapQuantizedParams(Model* model, const char* param_path);
+
+// Same for a half container, the fc layers get half_weight_start / weight_format and no fp32 weights
+int mapHalfParams(Model* model, const char* param_path);
+
+int unmapParams(Model* model);
+
+// Drops the fp32 weights of a layer converted to another format (half, sparse) and sets weight_start / weight_end to NULL:
+// the pages of a mapped container holding only them are given back (madvise), text parameters need compactParams() after
+void releaseFloatWeights(Model* model, Tensor* tensor);
+
+// Copies the weight / bias blocks still set into a smaller region of the text parameters and frees the old one,
+// nothing for a mapped container
+int compactParams(Model* model);
+
+// Writes the currently loaded parameters of model in the binary container format
+int writeParamsBinary(const Model* model, const char* param_path);
+
+// Writes the int8 weights, scales and bias of a quantized model in the int8 container format
+int writeParamsInt8(const Model* model, const char* param_path);
+
+// Writes the parameters with the fc weights rounded to format (_weights_fp16 / _weights_bf16) in the half container format,
+// fc layers already converted to that format are written from their halves
+int writeParamsHalf(const Model* model, const char* param_path, int format);
+
+uint64_t paramChecksum(const void* data, size_t size);
+
+#endif // PARAMS_H
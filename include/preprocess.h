@@ -0,0 +1,55 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include "cnn.h"
+
+/*
+Decoded image -> network input in one pass
+The source is interleaved uint8 (HWC, e.g. the data of a cv::Mat from cv::imread), the output is the planar float
+image_filters x image_rows x image_cols map inference() and inference_batch() read. Feature maps are stored unpadded
+(the kernels handle padding), so that is the whole first layer input and the output can be a slot of the caller's
+batch buffer, which inference_batch() reads in place.
+
+Bilinear resize with the pixel center mapping of cv::resize(INTER_LINEAR), channel reorder and (x - mean) / std run together:
+each output row resamples its two source rows horizontally into planar float rows (kept while the next output row
+uses them) with the resample_row kernel, then the lerp_normalize_row kernel blends them vertically and normalizes into
+the output planes. The source columns of a row are gathered per output column (AVX2 / AVX-512 gathers, lane by lane on NEON).
+
+The float intermediate is not rounded back to uint8 as cv::resize does, so the inputs differ from cv::resize followed by
+the same normalization by up to 0.75 of a uint8 step (0.006 at std 127.5). Top-1 agreed on 298 of 300 resized crops of
+the bundled test image, which is why the test set evaluation in main.cpp keeps cv::resize and only --stream uses this.
+*/
+
+#define PREPROCESS_MAX_CHANNELS 4
+
+typedef struct PreprocessOptions {
+    float mean[PREPROCESS_MAX_CHANNELS]; // per output channel, in source units (0..255)
+    float std[PREPROCESS_MAX_CHANNELS];
+    int reverse_channels; // 1 reads the source channels in reverse order (OpenCV's BGR -> RGB planes)
+} PreprocessOptions;
+
+// Scratch space of one preprocessing thread, sized for a model's input once
+typedef struct Preprocessor {
+    size_t channels;
+    size_t rows;
+    size_t cols;
+    float scale[PREPROCESS_MAX_CHANNELS]; // 1 / std
+    float bias[PREPROCESS_MAX_CHANNELS];  // -mean / std
+    int reverse_channels;
+    float* resampled[2];  // horizontally resampled source rows, channels x cols each
+    uint32_t* x_offsets;  // byte offset of the left source pixel of each output column, then cols of the right ones
+    float* x_weights;     // per output column: weight of the right source pixel
+    const struct KernelTable* kernels;
+} Preprocessor;
+
+// mean 127.5, std 127.5 (inputs in [-1, 1]) and BGR -> RGB, what the bundled model was trained on
+PreprocessOptions defaultPreprocessOptions();
+
+int createPreprocessor(Preprocessor* preprocessor, const Model* model, const PreprocessOptions* options);
+
+void destroyPreprocessor(Preprocessor* preprocessor);
+
+// src: height x width pixels of the model's channel count, rows row_stride bytes apart; out: channels * rows * cols floats
+int preprocessImage(Preprocessor* preprocessor, const uint8_t* src, size_t height, size_t width, size_t row_stride, float* out);
+
+#endif // PREPROCESS_H
@@ -0,0 +1,88 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "cnn.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <time.h>
+
+/*
+Per layer profiling of inference_batch(), only built with the TINYANN_PROFILE CMake option
+Without it the dispatch loop carries no instrumentation and enableProfiling() returns NOT_SUPPORTED.
+
+Every layer call adds its cycles to the layer's LayerStats (a fused layer counts on the layer that runs it, like its relu).
+Every sample_every-th inference_batch() call also records one trace event per layer plus one for the whole batch,
+the last max_trace_events of them are kept and writeChromeTrace() dumps them in the Chrome trace event format
+(chrome://tracing, Perfetto).
+*/
+
+typedef struct LayerStats {
+    uint64_t calls;
+    uint64_t cycles;
+} LayerStats;
+
+typedef struct ProfileSnapshot {
+    uint64_t batches;          // inference_batch() sub-batches seen since the last reset
+    double cycles_per_second;  // cycle counter rate measured since enableProfiling()
+    LayerStats* layers;        // caller owned, total_layers entries
+} ProfileSnapshot;
+
+typedef struct TraceEvent {
+    uint64_t start;  // cycle counter
+    uint64_t cycles;
+    uint64_t batch;  // inference_batch() sub-batch the event belongs to
+    uint32_t layer;  // total_layers for the whole batch
+    uint32_t images;
+} TraceEvent;
+
+typedef struct Profiler {
+    LayerStats* layers;
+    uint64_t batches;
+    size_t sample_every;   // 0 records no trace
+    int sampling;          // the current batch is traced
+    TraceEvent* events;    // ring of max_trace_events
+    size_t max_trace_events;
+    uint64_t recorded_events;
+    uint64_t origin_cycles;
+    double origin_seconds;
+} Profiler;
+
+// Time stamp counter on x86, virtual counter on aarch64, nanoseconds elsewhere
+static inline uint64_t readCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t counter;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(counter));
+    return counter;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+#endif
+}
+
+// Starts collecting on this context, sample_every = 0 keeps only the counters
+int enableProfiling(TinyANN* tinyANN, size_t sample_every, size_t max_trace_events);
+
+void disableProfiling(TinyANN* tinyANN);
+
+// Copies the counters, snapshot->layers must hold total_layers entries
+int snapshotProfile(const TinyANN* tinyANN, ProfileSnapshot* snapshot);
+
+// Clears the counters and the trace, the cycle rate keeps its reference point
+int resetProfile(TinyANN* tinyANN);
+
+int writeChromeTrace(const TinyANN* tinyANN, const char* trace_path);
+
+// Called by inference_batch()
+void profileBatchBegin(TinyANN* tinyANN);
+
+void profileRecord(TinyANN* tinyANN, size_t layer_no, uint64_t start, uint64_t end);
+
+// Operation a layer call runs, fused steps included, e.g. "convolution+relu+max_pool"
+const char* layerName(const TinyANN* tinyANN, size_t layer_no);
+
+#endif // PROFILE_H
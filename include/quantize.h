@@ -0,0 +1,43 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include "cnn.h"
+
+/*
+Post-training int8 quantization of convolution and fully connected layers
+
+Weights     : symmetric per output channel, q = round(w / weight_scales[m]) in [-127, 127]
+              rows are quantRowStride() int8 apart (zero padded) and their count is padded to QUANT_MR with zero rows
+Activations : symmetric per layer input, input_scale = largest |x| the layer read during calibration / 127
+Each layer quantizes its fp32 input, runs int8 x int8 -> int32 dot products and stores acc * input_scale * weight_scales[m] + bias
+in fp32, so relu, max_pool and flatten stay as they are.
+
+Calibration: point TinyANN.activation_ranges at total_layers zeroed floats, run fp32 inference over representative images,
+then quantizeModel() the context's model with those ranges.
+*/
+
+#define QUANT_MR 4
+#define QUANT_K_ALIGN 16
+#define QUANT_NR 16
+#define QUANT_NC 64
+
+// int8 weights between two rows of a quantized layer
+size_t quantRowStride(const Tensor* tensor);
+
+// Rows of a quantized layer, output channels rounded up to QUANT_MR
+size_t quantRows(const Tensor* tensor);
+
+// Largest |x| of layer layer_no's input map, merged into tinyANN->activation_ranges[layer_no]
+void recordActivationRange(TinyANN* tinyANN, size_t layer_no);
+
+// Adds int8 weights, per channel scales and input scales to every conv / fc layer of a loaded fp32 model
+int quantizeModel(Model* model, const float* activation_ranges);
+
+// Sizes this context's int8 scratch space for its int8 layers
+int createInt8Workspace(TinyANN* tinyANN);
+
+void convolution_int8(TinyANN* tinyANN, size_t layer_no);
+
+void fully_connected_int8(TinyANN* tinyANN, size_t layer_no);
+
+#endif // QUANTIZE_H
@@ -0,0 +1,41 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "cnn.h"
+
+/*
+Pruned fully connected layers, NetworkOptions.sparse_threshold
+
+loadModel() converts the weights of every fp32 fully connected layer that has at least sparse_threshold zeros (default 0.7)
+to compressed sparse rows: per output neuron the input indices and values of its nonzero weights. fully_connected() then
+only multiplies the nonzeros (KernelTable.sparse_dot gathers their inputs), so a layer pruned to 85% zeros streams
+about a third of the dense weight bytes. The dense weights are dropped like those of half layers (see half.h), so the
+layer's footprint shrinks by the printed bytes: quantizeModel() and writeParamsBinary() / writeParamsHalf() read the CSR
+copy instead, the frozen inference needs dense layers (sparse_threshold > 1). Zero terms are skipped, so results differ
+from the dense kernel by rounding only.
+*/
+
+typedef struct SparseMatrix {
+    size_t rows; // output neurons
+    size_t cols; // inputs
+    size_t nonzeros;
+    uint32_t* row_start; // rows + 1 offsets into columns and values
+    uint32_t* columns;
+    float* values;
+} SparseMatrix;
+
+// Fraction of the weights of a conv / fc layer that are exactly zero
+double zeroFraction(const Tensor* tensor);
+
+// Bytes of the CSR arrays
+size_t sparseWeightBytes(const SparseMatrix* matrix);
+
+// One allocateModelBuffer() block holding the matrix and its arrays, freeModelBuffer() releases it, NULL on allocation failure
+SparseMatrix* createSparseMatrix(Model* model, const float* dense, size_t rows, size_t cols);
+
+// Converts every fp32 fc layer at or above the threshold (> 1 converts none), drops its dense weights and prints the bytes saved
+int setModelSparsity(Model* model, float threshold);
+
+void fully_connected_sparse(TinyANN* tinyANN, size_t layer_no);
+
+#endif // SPARSE_H
@@ -0,0 +1,27 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+/*
+Persistent worker pool used to split one layer across cores
+Workers are started once by createThreadPool() and sleep between parallelFor() calls
+[0, count) is cut into one contiguous chunk per thread, the same way on every call, so results do not depend on timing
+*/
+
+typedef struct ThreadPool ThreadPool;
+
+// Runs items [begin, end), worker is in [0, threadPoolSize()) and can index per thread scratch space
+typedef void (*ParallelTask)(void* context, size_t begin, size_t end, size_t worker);
+
+// threads includes the calling thread, 0 uses every hardware thread
+ThreadPool* createThreadPool(size_t threads);
+
+void destroyThreadPool(ThreadPool* pool);
+
+size_t threadPoolSize(const ThreadPool* pool);
+
+// Returns once every chunk is done, the calling thread runs chunk 0 (a NULL pool runs everything inline)
+void parallelFor(ThreadPool* pool, size_t count, ParallelTask task, void* context);
+
+#endif // THREAD_POOL_H
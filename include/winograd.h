@@ -0,0 +1,32 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+
+#include "cnn.h"
+
+/*
+Winograd F(2x2, 3x3) convolution used by the _winograd engine, 3x3 stride 1 layers only
+
+Each 2x2 output tile is computed from a 4x4 input tile d and each 3x3 filter g as Y = A^T [(G g G^T) . (B^T d B)] A:
+16 multiplies per tile and channel pair instead of 36. The 16 elementwise products summed over the input channels are
+16 independent GEMMs, U[pos] (out_filters x in_filters) * V[pos] (in_filters x tiles), run on the SGEMM micro-kernel of
+gemm.h. U = G g G^T is computed and packed into GEMM_MR row panels once per model, V is transformed on the fly for
+GEMM_NR tiles at a time.
+The sums run in a different order than the direct kernel and the transforms round, results match it to about 1e-5.
+*/
+
+#define WINOGRAD_TILE 2 // output pixels per tile side
+#define WINOGRAD_POSITIONS 16 // 4x4 transformed tile
+
+// 3x3 kernel and stride 1, any padding
+int supportsWinograd(const Tensor* tensor);
+
+// Floats needed to hold the transformed, packed weights of a convolution layer
+size_t winogradWeightSize(const Tensor* tensor);
+
+// Floats of scratch space convolution_winograd() needs per worker for this layer
+size_t winogradWorkspaceSize(const Tensor* tensor);
+
+// U = G g G^T of every filter, packed per position like packConvolutionWeights()
+void transformWinogradWeights(const Tensor* tensor, float* transformed);
+
+#endif // WINOGRAD_H
@@ -0,0 +1,223 @@
+#include "../include/arena.h"
+
+#include <atomic>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+static std::atomic<size_t> live_regions(0);
+static std::atomic<size_t> live_bytes(0);
+static std::atomic<size_t> peak_bytes(0);
+static std::atomic<size_t> mapped_bytes(0);
+static std::atomic<size_t> hugetlb_bytes(0);
+static std::atomic<size_t> transparent_bytes(0);
+static std::atomic<size_t> numa_bound_bytes(0);
+static std::atomic<size_t> fallbacks(0);
+
+static size_t roundUp(size_t size, size_t multiple) { return (size + multiple - 1) / multiple * multiple; }
+
+// Binds [memory, memory + size) to node before any page is touched, 0 when the kernel refuses
+static int bindToNode(void* memory, size_t size, int node) {
+#ifdef SYS_mbind
+    unsigned long mask[16] = {0};
+    if (node < 0 || (size_t)node >= sizeof(mask) * 8) {
+        return 0;
+    }
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_mbind, memory, size, MPOL_BIND, mask, sizeof(mask) * 8, 0) == 0;
+#else
+    (void)memory;
+    (void)size;
+    (void)node;
+    return 0;
+#endif
+}
+
+// Anonymous mapping of size bytes (whole pages) starting on a 2 MB boundary, NULL on failure
+static void* mapAligned(size_t size) {
+    // Over-map by one hugepage and trim both ends, mmap() alone only guarantees page alignment
+    size_t padded = size + ARENA_HUGEPAGE_SIZE;
+    void* mapping = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    uintptr_t start = roundUp((uintptr_t)mapping, ARENA_HUGEPAGE_SIZE);
+    size_t head = start - (uintptr_t)mapping;
+    if (head) {
+        munmap(mapping, head);
+    }
+    if (padded - head > size) {
+        munmap((uint8_t*)start + size, padded - head - size);
+    }
+    return (void*)start;
+}
+
+int allocateRegion(MemoryRegion* region, size_t floats) {
+    size_t size = arenaFloats(floats ? floats : 1) * sizeof(float);
+    int use_mapping = region->hugepages != _hugepages_off && size >= ARENA_HUGEPAGE_SIZE;
+    void* memory = NULL;
+
+    region->backing = _backing_heap;
+    region->mapped_bytes = 0;
+
+    if (use_mapping || region->numa_node >= 0) {
+        // A small region is only mapped to be bound, whole 4 KB pages are enough
+        size_t mapped = roundUp(size, use_mapping ? ARENA_HUGEPAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE));
+
+        if (region->hugepages == _hugepages_explicit && use_mapping) {
+            memory = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (memory == MAP_FAILED) {
+                // Empty or too small vm.nr_hugepages pool
+                memory = NULL;
+                fallbacks++;
+            } else {
+                region->backing = _backing_hugetlb;
+            }
+        }
+        if (memory == NULL) {
+            memory = mapAligned(mapped);
+            if (memory != NULL) {
+                region->backing = _backing_mapped;
+#ifdef MADV_HUGEPAGE
+                // Only a hint, with transparent hugepages set to never the region keeps 4 KB pages
+                if (use_mapping && madvise(memory, mapped, MADV_HUGEPAGE) == 0) {
+                    region->backing = _backing_transparent;
+                }
+#endif
+            }
+        }
+        if (memory == NULL) {
+            fprintf(stderr, "ERROR TINY_ANN: Allocation error in allocateRegion()\n");
+            return MEMORY_ALLOCATION_FAILED;
+        }
+        region->mapped_bytes = mapped;
+        mapped_bytes += mapped;
+        if (region->backing == _backing_hugetlb) {
+            hugetlb_bytes += mapped;
+        } else if (region->backing == _backing_transparent) {
+            transparent_bytes += mapped;
+        }
+
+        if (region->numa_node >= 0) {
+            if (bindToNode(memory, mapped, region->numa_node)) {
+                numa_bound_bytes += mapped;
+            } else {
+                fprintf(stderr, "WARNING TINY_ANN: Memory could not be bound to NUMA node %d, left unbound\n", region->numa_node);
+                region->numa_node = -1;
+                fallbacks++;
+            }
+        }
+    } else if (posix_memalign(&memory, ARENA_ALIGNMENT, size) != 0) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in allocateRegion()\n");
+        return MEMORY_ALLOCATION_FAILED;
+    }
+
+    region->size = size / sizeof(float);
+    region->memory_start = region->memory_used = (float*)memory;
+
+    live_regions++;
+    size_t bytes = live_bytes += size;
+    size_t peak = peak_bytes;
+    while (bytes > peak && !peak_bytes.compare_exchange_weak(peak, bytes)) {
+    }
+
+    return SUCCESS;
+}
+
+void freeRegion(MemoryRegion* region) {
+    if (!region->memory_start) {
+        return;
+    }
+
+    if (region->backing == _backing_heap) {
+        free(region->memory_start);
+    } else {
+        munmap(region->memory_start, region->mapped_bytes);
+        mapped_bytes -= region->mapped_bytes;
+        if (region->backing == _backing_hugetlb) {
+            hugetlb_bytes -= region->mapped_bytes;
+        } else if (region->backing == _backing_transparent) {
+            transparent_bytes -= region->mapped_bytes;
+        }
+        if (region->numa_node >= 0) {
+            numa_bound_bytes -= region->mapped_bytes;
+        }
+    }
+
+    live_regions--;
+    live_bytes -= region->size * sizeof(float);
+    region->memory_start = region->memory_used = NULL;
+    region->size = region->mapped_bytes = 0;
+    region->backing = _backing_none;
+}
+
+void* allocateModelBuffer(Model* model, size_t bytes) {
+    static_assert(sizeof(MemoryRegion) <= ARENA_ALIGNMENT, "the region must fit in front of the buffer");
+
+    MemoryRegion region = model->memory_block;
+    region.memory_start = region.memory_used = NULL;
+    if (allocateRegion(&region, (ARENA_ALIGNMENT + bytes + sizeof(float) - 1) / sizeof(float)) != SUCCESS) {
+        return NULL;
+    }
+    // A node that could not be bound is not tried again for every buffer
+    model->memory_block.numa_node = region.numa_node;
+
+    memcpy(region.memory_start, &region, sizeof(region));
+    return (uint8_t*)region.memory_start + ARENA_ALIGNMENT;
+}
+
+void freeModelBuffer(void* buffer) {
+    if (!buffer) {
+        return;
+    }
+    MemoryRegion region;
+    memcpy(&region, (uint8_t*)buffer - ARENA_ALIGNMENT, sizeof(region));
+    freeRegion(&region);
+}
+
+void snapshotArenaStats(ArenaStats* stats) {
+    stats->regions = live_regions;
+    stats->bytes = live_bytes;
+    stats->peak_bytes = peak_bytes;
+    stats->mapped_bytes = mapped_bytes;
+    stats->hugetlb_bytes = hugetlb_bytes;
+    stats->transparent_bytes = transparent_bytes;
+    stats->numa_bound_bytes = numa_bound_bytes;
+    stats->fallbacks = fallbacks;
+}
+
+size_t regionHugepageBytes(const MemoryRegion* region) {
+    if (region->backing == _backing_hugetlb) {
+        return region->mapped_bytes;
+    }
+    if (region->backing != _backing_transparent) {
+        return 0;
+    }
+
+    FILE* smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == NULL) {
+        return 0;
+    }
+
+    // The AnonHugePages line of the mapping that holds memory_start
+    uintptr_t start = (uintptr_t)region->memory_start;
+    size_t huge_kb = 0;
+    int inside = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), smaps)) {
+        unsigned long low, high;
+        if (sscanf(line, "%lx-%lx ", &low, &high) == 2) {
+            inside = low <= start && start < high;
+        } else if (inside && sscanf(line, "AnonHugePages: %zu kB", &huge_kb) == 1) {
+            break;
+        }
+    }
+    fclose(smaps);
+
+    return huge_kb * 1024;
+}
@@ -0,0 +1,281 @@
+#include "../include/autotune.h"
+#include "../include/arena.h"
+#include "../include/kernels.h"
+
+#include <thread>
+
+#define TUNING_KEY_SIZE 256
+
+// Indexed by ConvEngines, the candidates of a layer
+static const char* engine_names[] = {"direct", "gemm", "winograd"};
+
+static int engineByName(const char* name) {
+    for (int engine = _direct; engine <= _winograd; engine++) {
+        if (strcmp(name, engine_names[engine]) == 0) {
+            return engine;
+        }
+    }
+    return -1;
+}
+
+// Model name of the first CPU in /proc/cpuinfo ("CPU part" on arm64, which has no model name), spaces replaced by '_'
+static void cpuModel(char* name, size_t size) {
+    snprintf(name, size, "unknown");
+
+    FILE* cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (cpuinfo == NULL) {
+        return;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), cpuinfo)) {
+        char* value = strchr(line, ':');
+        int model_name = strncmp(line, "model name", 10) == 0;
+        if (value == NULL || !(model_name || strncmp(line, "CPU part", 8) == 0)) {
+            continue;
+        }
+
+        value += strspn(value + 1, " \t") + 1;
+        value[strcspn(value, "\r\n")] = '\0';
+        snprintf(name, size, "%s%s", model_name ? "" : "part_", value);
+        if (model_name) {
+            break;
+        }
+    }
+    fclose(cpuinfo);
+
+    for (char* c = name; *c; c++) {
+        if (*c == ' ' || *c == '\t') {
+            *c = '_';
+        }
+    }
+}
+
+// Layers with a choice of engine: fp32 convolutions in the _nchw layout
+static int isTunable(const Model* model, const NetworkOptions* options, size_t layer_no) {
+    const Tensor* tensor = &model->tensors[layer_no];
+    if (tensor->info[_operation] != _convolution || !tensor->weight_start || options->layout == _nchwc) {
+        return 0;
+    }
+    return !(options->precision == _int8 && tensor->qweight_start);
+}
+
+// Cache line of a layer without its engine, the fusion flags follow fuseLayers()
+static void layerKey(const Model* model, const NetworkOptions* options, const char* cpu, size_t layer_no, char* key) {
+    const Tensor* tensor = &model->tensors[layer_no];
+    size_t threads = options->threads ? options->threads : std::thread::hardware_concurrency();
+    int relu = tensor->info[_activation] == _relu;
+    int pooled = options->fuse_layers && relu && layer_no + 2 < model->total_layers && model->tensors[layer_no + 1].info[_operation] == _maxpool;
+
+    snprintf(key, TUNING_KEY_SIZE, "%s %s %zu %zu %zu %zu %zu %zu %zu %zu %zu %d %d", cpu, selectKernels()->name, threads ? threads : 1,
+             options->max_batch ? options->max_batch : 1, tensor->info[_input], tensor->info[_output], tensor->height, tensor->width,
+             tensor->info[_kernel_size], tensor->info[_stride], tensor->info[_padding], relu, pooled);
+}
+
+// Engine stored for key, -1 when the cache has none
+static int lookupEngine(const char* cache_path, const char* key) {
+    FILE* cache = cache_path ? fopen(cache_path, "r") : NULL;
+    if (cache == NULL) {
+        return -1;
+    }
+
+    int engine = -1;
+    char line[TUNING_KEY_SIZE + 32];
+    while (engine < 0 && fgets(line, sizeof(line), cache)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char* separator = strrchr(line, ' ');
+        if (line[0] == '#' || separator == NULL) {
+            continue;
+        }
+        *separator = '\0';
+        if (strcmp(line, key) == 0) {
+            engine = engineByName(separator + 1);
+        }
+    }
+    fclose(cache);
+
+    return engine;
+}
+
+static void fillSynthetic(float* data, size_t n, uint32_t seed) {
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        data[i] = (seed >> 8) / (float)(1 << 24) * 2.0f - 1.0f;
+    }
+}
+
+// Times every candidate of the layers with engines[l] == -1 and stores the fastest there
+static int tuneLayers(Model* model, const NetworkOptions* options, int* engines) {
+    // The scratch context borrows the model's weights, so every candidate is packed / transformed on the model first
+    int status = SUCCESS;
+    for (size_t l = 0; l < model->total_layers && status == SUCCESS; l++) {
+        for (int engine = _direct; engine <= _winograd && engines[l] == -1 && status == SUCCESS; engine++) {
+            status = setModelConvolutionEngine(model, l, engine);
+        }
+    }
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    // int8 layers are not tuned, an fp32 scratch context also works before quantizeModel()
+    NetworkOptions tune_options = *options;
+    tune_options.precision = _fp32;
+    TinyANN tinyANN;
+    if ((status = createExecutionContext(&tinyANN, model, &tune_options)) != SUCCESS) {
+        return status;
+    }
+
+    size_t batch = tinyANN.max_batch;
+    size_t image_size = model->image_filters * model->image_rows * model->image_cols;
+    float* images = (float*)malloc(batch * image_size * sizeof(float));
+    int* classes = (int*)malloc(batch * sizeof(int));
+    double* layer_seconds = (double*)calloc(model->total_layers, sizeof(double));
+    double* best = (double*)malloc(model->total_layers * (_winograd + 1) * sizeof(double));
+    if (!images || !classes || !layer_seconds || !best) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in autotuneModel()\n");
+        status = MEMORY_ALLOCATION_FAILED;
+    } else {
+        fillSynthetic(images, batch * image_size, 12345);
+        for (size_t i = 0; i < model->total_layers * (_winograd + 1); i++) {
+            best[i] = -1.0;
+        }
+        tinyANN.layer_seconds = layer_seconds;
+    }
+
+    // Round 0 touches the workspaces and packed weights and is not counted
+    for (size_t round = 0; round <= AUTOTUNE_ROUNDS && status == SUCCESS; round++) {
+        for (int engine = _direct; engine <= _winograd && status == SUCCESS; engine++) {
+            int candidates = 0;
+            for (size_t l = 0; l < model->total_layers && status == SUCCESS; l++) {
+                if (engines[l] == -1) {
+                    status = setConvolutionEngine(&tinyANN, l, engine);
+                    candidates += tinyANN.tensors[l].conv_engine == engine;
+                }
+            }
+            if (status != SUCCESS || candidates == 0) {
+                continue;
+            }
+
+            memset(layer_seconds, 0, model->total_layers * sizeof(double));
+            inference_batch(&tinyANN, images, batch, classes);
+
+            for (size_t l = 0; l < model->total_layers && round > 0; l++) {
+                double* seconds = &best[l * (_winograd + 1) + engine];
+                if (engines[l] == -1 && tinyANN.tensors[l].conv_engine == engine && (*seconds < 0 || layer_seconds[l] < *seconds)) {
+                    *seconds = layer_seconds[l];
+                }
+            }
+        }
+    }
+
+    for (size_t l = 0; l < model->total_layers && status == SUCCESS; l++) {
+        if (engines[l] != -1) {
+            continue;
+        }
+
+        char timings[128] = "";
+        size_t length = 0;
+        for (int engine = _direct; engine <= _winograd; engine++) {
+            double seconds = best[l * (_winograd + 1) + engine];
+            if (seconds < 0) {
+                continue;
+            }
+            if (engines[l] == -1 || seconds < best[l * (_winograd + 1) + engines[l]]) {
+                engines[l] = engine;
+            }
+            length += snprintf(timings + length, sizeof(timings) - length, "%s%s %.3f ms", length ? ", " : "", engine_names[engine], seconds * 1e3);
+        }
+        printf("layer %zu : autotuned %s (%s)\n", l + 1, engine_names[engines[l]], timings);
+    }
+
+    tinyANN.layer_seconds = NULL;
+    destroyExecutionContext(&tinyANN);
+    free(images);
+    free(classes);
+    free(layer_seconds);
+    free(best);
+
+    return status;
+}
+
+int autotuneModel(Model* model, const NetworkOptions* options) {
+    char cpu[128];
+    cpuModel(cpu, sizeof(cpu));
+
+    // engines: -2 no choice of engine, -1 to be timed, tuned: timed here and appended to the cache
+    int* engines = (int*)malloc(model->total_layers * sizeof(int));
+    int* tuned = (int*)malloc(model->total_layers * sizeof(int));
+    char* keys = (char*)malloc(model->total_layers * TUNING_KEY_SIZE);
+    if (!engines || !tuned || !keys) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in autotuneModel()\n");
+        free(engines);
+        free(tuned);
+        free(keys);
+        return MEMORY_ALLOCATION_FAILED;
+    }
+
+    size_t pending = 0;
+    for (size_t l = 0; l < model->total_layers; l++) {
+        engines[l] = -2;
+        tuned[l] = 0;
+        if (!isTunable(model, options, l)) {
+            continue;
+        }
+
+        layerKey(model, options, cpu, l, keys + l * TUNING_KEY_SIZE);
+        engines[l] = lookupEngine(options->tuning_cache, keys + l * TUNING_KEY_SIZE);
+        tuned[l] = engines[l] == -1;
+        if (tuned[l]) {
+            pending++;
+        } else {
+            printf("layer %zu : %s engine from %s\n", l + 1, engine_names[engines[l]], options->tuning_cache);
+        }
+    }
+
+    int status = SUCCESS;
+    if (pending) {
+        status = tuneLayers(model, options, engines);
+    }
+
+    // Keeps the chosen weights only, the candidates that lost were packed / transformed for nothing
+    for (size_t l = 0; l < model->total_layers && status == SUCCESS; l++) {
+        if (engines[l] < 0) {
+            continue;
+        }
+        status = setModelConvolutionEngine(model, l, engines[l]);
+
+        Tensor* tensor = &model->tensors[l];
+        if (tensor->conv_engine != _im2col_gemm) {
+            freeModelBuffer(tensor->packed_weight_start);
+            tensor->packed_weight_start = NULL;
+        }
+        if (tensor->conv_engine != _winograd) {
+            freeModelBuffer(tensor->winograd_weight_start);
+            tensor->winograd_weight_start = NULL;
+        }
+    }
+
+    if (status == SUCCESS && pending && options->tuning_cache) {
+        FILE* cache = fopen(options->tuning_cache, "a");
+        if (cache == NULL) {
+            fprintf(stderr, "WARNING TINY_ANN: Tuning cache (%s) could not be written\n", options->tuning_cache);
+        } else {
+            fseek(cache, 0, SEEK_END);
+            if (ftell(cache) == 0) {
+                fprintf(cache, "# cpu kernels threads max_batch in out height width kernel_size stride padding relu pooled engine\n");
+            }
+            for (size_t l = 0; l < model->total_layers; l++) {
+                if (tuned[l]) {
+                    fprintf(cache, "%s %s\n", keys + l * TUNING_KEY_SIZE, engine_names[engines[l]]);
+                }
+            }
+            fclose(cache);
+        }
+    }
+
+    free(engines);
+    free(keys);
+    free(tuned);
+
+    return status;
+}
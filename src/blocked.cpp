@@ -0,0 +1,344 @@
+#include "../include/blocked.h"
+#include "../include/arena.h"
+#include "../include/kernels.h"
+#include "../include/thread_pool.h"
+
+size_t blockedChannels(size_t channels, size_t channel_block) { return (channels + channel_block - 1) / channel_block * channel_block; }
+
+size_t blockedWeightSize(const Tensor* tensor, size_t channel_block) {
+    return blockedChannels(tensor->info[_output], channel_block) * tensor->info[_input] * tensor->info[_kernel_size] * tensor->info[_kernel_size];
+}
+
+void packBlockedWeights(const Tensor* tensor, size_t channel_block, float* packed) {
+    size_t taps = tensor->info[_input] * tensor->info[_kernel_size] * tensor->info[_kernel_size];
+    size_t out_filters = tensor->info[_output];
+
+    // [out block][in_f, x, y][channel_block]
+    for (size_t ob = 0; ob < out_filters; ob += channel_block) {
+        for (size_t k = 0; k < taps; k++) {
+            for (size_t o = 0; o < channel_block; o++) {
+                *packed++ = ob + o < out_filters ? tensor->weight_start[(ob + o) * taps + k] : 0.0f;
+            }
+        }
+    }
+}
+
+int setModelLayout(Model* model, int layout) {
+    if (layout != _nchwc) {
+        return SUCCESS;
+    }
+    size_t channel_block = selectKernels()->channel_block;
+
+    for (size_t l = 0; l < model->total_layers; l++) {
+        Tensor* tensor = &model->tensors[l];
+
+        // Layers loaded from an int8 parameter file have no fp32 weights to pack
+        if (tensor->info[_operation] != _convolution || !tensor->weight_start || tensor->blocked_weight_start) {
+            continue;
+        }
+
+        void* packed = allocateModelBuffer(model, blockedWeightSize(tensor, channel_block) * sizeof(float));
+        if (packed == NULL) {
+            fprintf(stderr, "ERROR TINY_ANN: Allocation error in setModelLayout()\n");
+            return MEMORY_ALLOCATION_FAILED;
+        }
+        tensor->blocked_weight_start = (float*)packed;
+        packBlockedWeights(tensor, channel_block, tensor->blocked_weight_start);
+    }
+
+    return SUCCESS;
+}
+
+int assignLayouts(TinyANN* tinyANN, int layout) {
+    for (size_t l = 0; l < tinyANN->total_layers; l++) {
+        tinyANN->tensors[l].layout = _nchw;
+    }
+    if (layout != _nchwc) {
+        return SUCCESS;
+    }
+
+    // Convolutions write blocks, max_pool keeps the layout of its input
+    for (size_t l = 1; l < tinyANN->total_layers; l++) {
+        size_t producer = tinyANN->tensors[l - 1].info[_operation];
+        if (producer == _convolution || (producer == _maxpool && tinyANN->tensors[l - 1].layout == _nchwc)) {
+            tinyANN->tensors[l].layout = _nchwc;
+        }
+    }
+
+    for (size_t l = 0; l < tinyANN->total_layers; l++) {
+        Tensor* tensor = &tinyANN->tensors[l];
+        size_t operation = tensor->info[_operation];
+
+        int reads_blocked = operation == _convolution || operation == _maxpool || operation == _flatten;
+        if (tensor->layout == _nchwc && (l + 1 == tinyANN->total_layers || !reads_blocked)) {
+            fprintf(stderr, "ERROR TINY_ANN: The _nchwc layout needs a flatten after the last convolution / max_pool and no depthwise / "
+                            "pointwise layers (layer %zu)\n",
+                    l + 1);
+            return INVALID_ARGUMENT;
+        }
+        if (operation != _convolution) {
+            continue;
+        }
+        if (tensor->qweight_start) {
+            fprintf(stderr, "ERROR TINY_ANN: The _nchwc layout runs fp32 convolutions only, layer %zu is int8\n", l + 1);
+            return INVALID_ARGUMENT;
+        }
+
+        // A shared model is immutable, only a private one can still be packed here
+        if (!tinyANN->model->tensors[l].blocked_weight_start) {
+            if (!tinyANN->owned_model) {
+                fprintf(stderr, "ERROR TINY_ANN: Layer %zu of the shared model was not packed for _nchwc\n", l + 1);
+                return INVALID_ARGUMENT;
+            }
+
+            int status = setModelLayout(tinyANN->owned_model, _nchwc);
+            if (status != SUCCESS) {
+                return status;
+            }
+        }
+        tensor->blocked_weight_start = tinyANN->model->tensors[l].blocked_weight_start;
+    }
+
+    return SUCCESS;
+}
+
+// Output row of channel block ob for one image, bias included, out_row holds out_width pixels x channel_block channels
+static void convolutionBlockedRow(const TinyANN* tinyANN, size_t layer_no, size_t ob, const float* feature_map, long row, float* out_row) {
+    const Tensor* tensor = &tinyANN->tensors[layer_no];
+    size_t channel_block = tinyANN->kernels->channel_block;
+    long out_width = tinyANN->tensors[layer_no + 1].width;
+    long padding = tensor->info[_padding];
+    long height = tensor->height;
+    long width = tensor->width;
+    long kernel_size = tensor->info[_kernel_size];
+    long stride = tensor->info[_stride];
+    size_t in_filters = tensor->info[_input];
+    size_t out_filters = tensor->info[_output];
+    const float* filters = tensor->blocked_weight_start + ob * in_filters * kernel_size * kernel_size * channel_block;
+
+    // The first convolution reads the planar input image
+    size_t in_step = tensor->layout == _nchwc ? channel_block : 1;
+
+    // Columns where every tap of a filter row lands inside the input run all taps in one call, the border ones tap by tap
+    long all_begin = (padding + stride - 1) / stride;
+    long all_end = width + padding >= kernel_size ? (width + padding - kernel_size) / stride + 1 : 0;
+    if (all_end > out_width) {
+        all_end = out_width;
+    }
+    long left_end = all_begin < all_end ? all_begin : out_width;
+    long right_begin = all_begin < all_end ? all_end : out_width;
+
+    memset(out_row, 0, out_width * channel_block * sizeof(float));
+
+    for (size_t in_f = 0; in_f < in_filters; in_f++) {
+        const float* in_plane = tensor->layout == _nchwc
+                                    ? feature_map + (in_f / channel_block) * height * width * channel_block + in_f % channel_block
+                                    : feature_map + in_f * height * width;
+
+        for (long x = 0; x < kernel_size; x++) {
+            long in_y = stride * row + x - padding;
+            if (in_y < 0 || in_y >= height) {
+                continue;
+            }
+            const float* in_row = in_plane + in_y * width * in_step;
+            const float* weights = filters + (in_f * kernel_size + x) * kernel_size * channel_block;
+
+            if (all_begin < all_end) {
+                tinyANN->kernels->conv_block_row(out_row + all_begin * channel_block, in_row + (all_begin * stride - padding) * in_step, in_step,
+                                                 stride, weights, kernel_size, all_end - all_begin);
+            }
+
+            for (long y = 0; y < kernel_size; y++) {
+                long col_begin = y < padding ? (padding - y + stride - 1) / stride : 0;
+                long col_end = width + padding > y ? (width + padding - y - 1) / stride + 1 : 0;
+                if (col_end > out_width) {
+                    col_end = out_width;
+                }
+
+                long ranges[2][2] = {{col_begin, col_end < left_end ? col_end : left_end},
+                                     {col_begin > right_begin ? col_begin : right_begin, col_end}};
+                for (size_t r = 0; r < 2; r++) {
+                    if (ranges[r][0] < ranges[r][1]) {
+                        tinyANN->kernels->conv_block_row(out_row + ranges[r][0] * channel_block,
+                                                         in_row + (ranges[r][0] * stride + y - padding) * in_step, in_step, stride,
+                                                         weights + y * channel_block, 1, ranges[r][1] - ranges[r][0]);
+                    }
+                }
+            }
+        }
+    }
+
+    for (size_t o = 0; o < channel_block && ob * channel_block + o < out_filters; o++) {
+        for (long col = 0; col < out_width; col++) {
+            out_row[col * channel_block + o] += tensor->bias_start[ob * channel_block + o];
+        }
+    }
+}
+
+// Max of one pooling window near the border for every channel of the block, pixels outside count as zero padding
+static void maxPoolBlockedBorder(const float* rows, long row_begin, long row_end, long width, long top, long left, long kernel_size,
+                                 size_t channel_block, float* out) {
+    for (size_t o = 0; o < channel_block; o++) {
+        float max_val = INT32_MIN;
+        for (long i = top; i < top + kernel_size; i++) {
+            for (long j = left; j < left + kernel_size; j++) {
+                float value = i >= row_begin && i < row_end && j >= 0 && j < width ? rows[((i - row_begin) * width + j) * channel_block + o] : 0.0f;
+                if (value > max_val) {
+                    max_val = value;
+                }
+            }
+        }
+        out[o] = max_val;
+    }
+}
+
+// max_pool_row() of a channel block, rows and out hold channel_block channels per pixel
+static void maxPoolBlockedRow(const TinyANN* tinyANN, size_t layer_no, const float* rows, long row_begin, long row_end, long out_row, float* out) {
+    const Tensor* tensor = &tinyANN->tensors[layer_no];
+    size_t channel_block = tinyANN->kernels->channel_block;
+    long padding = tensor->info[_padding];
+    long width = tensor->width;
+    long kernel_size = tensor->info[_kernel_size];
+    long stride = tensor->info[_stride];
+    long out_width = tinyANN->tensors[layer_no + 1].width;
+    long top = out_row * stride - padding;
+
+    long first = (padding + stride - 1) / stride;
+    long last = width + padding >= kernel_size ? (width + padding - kernel_size) / stride + 1 : 0;
+    if (last > out_width) {
+        last = out_width;
+    }
+    if (top < row_begin || top + kernel_size > row_end || first > last) {
+        first = last = out_width;
+    }
+
+    for (long col = 0; col < first; col++) {
+        maxPoolBlockedBorder(rows, row_begin, row_end, width, top, col * stride - padding, kernel_size, channel_block, out + col * channel_block);
+    }
+    if (first < last) {
+        tinyANN->kernels->max_pool_block_row(rows + ((top - row_begin) * width + first * stride - padding) * channel_block, width, kernel_size,
+                                             stride, out + first * channel_block, last - first);
+    }
+    for (long col = last; col < out_width; col++) {
+        maxPoolBlockedBorder(rows, row_begin, row_end, width, top, col * stride - padding, kernel_size, channel_block, out + col * channel_block);
+    }
+}
+
+static void convolutionBlockedRange(void* context, size_t begin, size_t end, size_t worker) {
+    (void)worker;
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    size_t row_size = next->width * tinyANN->kernels->channel_block;
+
+    // Items are (channel block, output row) pairs, each runs for every image of the batch while its filters are in cache
+    for (size_t item = begin; item < end; item++) {
+        size_t ob = item / next->height;
+        size_t row = item % next->height;
+
+        for (size_t b = 0; b < tinyANN->batch_size; b++) {
+            float* out_row = next->start + b * next->batch_stride + (ob * next->height + row) * row_size;
+            convolutionBlockedRow(tinyANN, layer_no, ob, tensor->start + b * tensor->batch_stride, row, out_row);
+            if (tensor->fusion == _fused_relu) {
+                tinyANN->kernels->relu(out_row, row_size);
+            }
+        }
+    }
+}
+
+static void convolutionBlockedPoolRange(void* context, size_t begin, size_t end, size_t worker) {
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* conv_out = &tinyANN->tensors[layer_no + 1];
+    Tensor* pool_out = &tinyANN->tensors[layer_no + 2];
+    long pool_padding = conv_out->info[_padding];
+    long pool_kernel_size = conv_out->info[_kernel_size];
+    long pool_stride = conv_out->info[_stride];
+    size_t row_size = conv_out->width * tinyANN->kernels->channel_block;
+    size_t pooled_row_size = pool_out->width * tinyANN->kernels->channel_block;
+    float* band = tinyANN->fusion_workspace + FUSION_SKEW + worker * tinyANN->fusion_workspace_size;
+
+    // Items are (channel block, pooled row) pairs, only the conv rows under one pooling window exist at a time
+    for (size_t item = begin; item < end; item++) {
+        size_t ob = item / pool_out->height;
+        long pool_row = item % pool_out->height;
+        long top = pool_row * pool_stride - pool_padding;
+        long row_begin = top > 0 ? top : 0;
+        long row_end = top + pool_kernel_size < (long)conv_out->height ? top + pool_kernel_size : conv_out->height;
+
+        for (size_t b = 0; b < tinyANN->batch_size; b++) {
+            for (long row = row_begin; row < row_end; row++) {
+                convolutionBlockedRow(tinyANN, layer_no, ob, tensor->start + b * tensor->batch_stride, row, band + (row - row_begin) * row_size);
+            }
+            if (row_begin < row_end) {
+                tinyANN->kernels->relu(band, (row_end - row_begin) * row_size);
+            }
+            maxPoolBlockedRow(tinyANN, layer_no + 1, band, row_begin, row_end, pool_row,
+                              pool_out->start + b * pool_out->batch_stride + (ob * pool_out->height + pool_row) * pooled_row_size);
+        }
+    }
+}
+
+void convolution_blocked(TinyANN* tinyANN, size_t layer_no) {
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    size_t blocks = blockedChannels(tensor->info[_output], tinyANN->kernels->channel_block) / tinyANN->kernels->channel_block;
+    LayerTask task = {tinyANN, layer_no};
+
+    // Threads split (channel block, row) pairs, pooled rows when fused with max_pool
+    if (tensor->fusion == _fused_relu_maxpool) {
+        parallelFor(tinyANN->thread_pool, blocks * tinyANN->tensors[layer_no + 2].height, convolutionBlockedPoolRange, &task);
+    } else {
+        parallelFor(tinyANN->thread_pool, blocks * tinyANN->tensors[layer_no + 1].height, convolutionBlockedRange, &task);
+    }
+}
+
+static void maxPoolBlockedRange(void* context, size_t begin, size_t end, size_t worker) {
+    (void)worker;
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    size_t channel_block = tinyANN->kernels->channel_block;
+    size_t blocks = blockedChannels(tensor->info[_output], channel_block) / channel_block;
+
+    // Items are (image, channel block) pairs
+    for (size_t item = begin; item < end; item++) {
+        size_t b = item / blocks;
+        size_t ob = item % blocks;
+        const float* feature_map = tensor->start + b * tensor->batch_stride + ob * tensor->height * tensor->width * channel_block;
+        float* new_feature_map = next->start + b * next->batch_stride + ob * next->height * next->width * channel_block;
+
+        for (size_t row = 0; row < next->height; row++) {
+            maxPoolBlockedRow(tinyANN, layer_no, feature_map, 0, tensor->height, row, new_feature_map + row * next->width * channel_block);
+        }
+    }
+}
+
+void max_pool_blocked(TinyANN* tinyANN, size_t layer_no) {
+    size_t channel_block = tinyANN->kernels->channel_block;
+    size_t blocks = blockedChannels(tinyANN->tensors[layer_no].info[_output], channel_block) / channel_block;
+    LayerTask task = {tinyANN, layer_no};
+    parallelFor(tinyANN->thread_pool, tinyANN->batch_size * blocks, maxPoolBlockedRange, &task);
+}
+
+void flatten_blocked(TinyANN* tinyANN, size_t layer_no) {
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    size_t channel_block = tinyANN->kernels->channel_block;
+    size_t pixels = tensor->height * tensor->width;
+
+    // Back to planar CHW, the zero channels past the last block are dropped
+    for (size_t b = 0; b < tinyANN->batch_size; b++) {
+        const float* blocked = tensor->start + b * tensor->batch_stride;
+        float* planar = next->start + b * next->batch_stride;
+
+        for (size_t c = 0; c < tensor->channels; c++) {
+            const float* block = blocked + (c / channel_block) * pixels * channel_block + c % channel_block;
+            for (size_t p = 0; p < pixels; p++) {
+                planar[c * pixels + p] = block[p * channel_block];
+            }
+        }
+    }
+}
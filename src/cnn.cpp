@@ -1,6 +1,118 @@
 #include "../include/cnn.h"
+#include "../include/arena.h"
+#include "../include/autotune.h"
+#include "../include/blocked.h"
+#include "../include/gemm.h"
+#include "../include/half.h"
+#include "../include/kernels.h"
+#include "../include/params.h"
+#include "../include/profile.h"
+#include "../include/quantize.h"
+#include "../include/sparse.h"
+#include "../include/thread_pool.h"
+
+#include <time.h>
+
+NetworkOptions defaultNetworkOptions() {
+    NetworkOptions options;
+    options.max_batch = 1;
+    options.conv_engine = _auto;
+    options.threads = 1;
+    options.reuse_activations = 1;
+    options.fuse_layers = 1;
+    options.precision = _fp32;
+    options.layout = _nchw;
+    options.sparse_threshold = 0.7f;
+    options.weight_format = _weights_fp32;
+    options.hugepages = _hugepages_transparent;
+    options.numa_node = -1;
+    options.autotune = 0;
+    options.tuning_cache = NULL;
+    return options;
+}
 
 int initNetwork(TinyANN* tinyANN, const char* network_config_path, const char* param_path) {
+    return initNetworkWithOptions(tinyANN, network_config_path, param_path, NULL);
+}
+
+int initNetworkWithOptions(TinyANN* tinyANN, const char* network_config_path, const char* param_path, const NetworkOptions* options) {
+    // The network owns a private model, destroyNetwork() releases both
+    Model* model = (Model*)malloc(sizeof(Model));
+    if (!model) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in initNetwork()\n");
+        return MEMORY_ALLOCATION_FAILED;
+    }
+
+    int status = loadModel(model, network_config_path, param_path, options);
+    if (status != SUCCESS) {
+        free(model);
+        return status;
+    }
+
+    if ((status = createExecutionContext(tinyANN, model, options)) != SUCCESS) {
+        destroyModel(model);
+        free(model);
+        return status;
+    }
+    tinyANN->owned_model = model;
+
+    return SUCCESS;
+}
+
+int hasWeights(const Tensor* tensor) {
+    size_t operation = tensor->info[_operation];
+    return operation == _convolution || operation == _fully_connected || operation == _depthwise_convolution ||
+           operation == _pointwise_convolution;
+}
+
+size_t filterChannels(const Tensor* tensor) { return tensor->info[_operation] == _depthwise_convolution ? 1 : tensor->info[_input]; }
+
+size_t weightCount(const Tensor* tensor) {
+    return tensor->info[_output] * filterChannels(tensor) * tensor->info[_kernel_size] * tensor->info[_kernel_size];
+}
+
+// Depthwise and pointwise layers only exist in the shapes their kernels handle
+static int checkSeparableLayers(const Model* model) {
+    for (size_t i = 0; i < model->total_layers; i++) {
+        const size_t* info = model->tensors[i].info;
+        if (info[_operation] == _depthwise_convolution && (info[_input] != info[_output] || info[_stride] == 0)) {
+            fprintf(stderr, "ERROR TINY_ANN: Depthwise layer %zu needs in_dim == out_dim and a stride\n", i + 1);
+            return INVALID_ARGUMENT;
+        }
+        if (info[_operation] == _pointwise_convolution && (info[_kernel_size] != 1 || info[_stride] != 1 || info[_padding] != 0)) {
+            fprintf(stderr, "ERROR TINY_ANN: Pointwise layer %zu needs stride 1, padding 0 and kernel_size 1\n", i + 1);
+            return INVALID_ARGUMENT;
+        }
+    }
+    return SUCCESS;
+}
+
+// Feature map shapes follow from the input dimensions and each layer's kernel, stride and padding
+static void inferTensorShapes(Model* model) {
+    size_t height = model->image_rows;
+    size_t width = model->image_cols;
+
+    for (int i = 0; i < model->total_layers; i++) {
+        model->tensors[i].height = height;
+        model->tensors[i].width = width;
+        model->tensors[i].channels = model->tensors[i].info[_input];
+
+        if (model->tensors[i].info[_operation] == _flatten || model->tensors[i].info[_operation] == _fully_connected) {
+            height = width = 1;
+            continue;
+        }
+
+        height = 1 + (height + 2 * model->tensors[i].info[_padding] - model->tensors[i].info[_kernel_size]) / model->tensors[i].info[_stride];
+        width = 1 + (width + 2 * model->tensors[i].info[_padding] - model->tensors[i].info[_kernel_size]) / model->tensors[i].info[_stride];
+    }
+}
+
+int loadModel(Model* model, const char* network_config_path, const char* param_path, const NetworkOptions* options) {
+    NetworkOptions default_options = defaultNetworkOptions();
+    if (options == NULL) {
+        options = &default_options;
+    }
+
     FILE* network_config = fopen(network_config_path, "rb");
 
     if (network_config == NULL) {
@@ -8,49 +120,136 @@ int initNetwork(TinyANN* tinyANN, const char* network_config_path, const char* p
         return FILE_NOT_READABLE;
     }
 
-    fscanf(network_config, "%ld %ld %ld", &tinyANN->image_filters, &tinyANN->image_rows, &tinyANN->image_cols);
+    fscanf(network_config, "%ld %ld %ld", &model->image_filters, &model->image_rows, &model->image_cols);
 
-    fscanf(network_config, "%ld", &tinyANN->total_layers);
+    fscanf(network_config, "%ld", &model->total_layers);
 
-    tinyANN->tensors = (Tensor*)malloc(tinyANN->total_layers * sizeof(Tensor));
+    model->tensors = (Tensor*)calloc(model->total_layers, sizeof(Tensor));
+    if (!model->tensors) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in loadModel()\n");
+        fclose(network_config);
+        return MEMORY_ALLOCATION_FAILED;
+    }
 
-    for (int i = 0; i < tinyANN->total_layers; i++) {
+    for (int i = 0; i < model->total_layers; i++) {
         for (int j = 0; j < MAX_LAYER_INFO_SIZE; j++) {
-            fscanf(network_config, "%ld", &tinyANN->tensors[i].info[j]);
+            fscanf(network_config, "%ld", &model->tensors[i].info[j]);
         }
     }
 
     fclose(network_config);
 
-    allocateMemoryRegion(tinyANN);
+    model->memory_block.size = 0;
+    model->memory_block.memory_start = model->memory_block.memory_used = NULL;
+    model->memory_block.hugepages = options->hugepages;
+    model->memory_block.numa_node = options->numa_node;
+    model->memory_block.backing = _backing_none;
+    model->memory_block.mapped_bytes = 0;
+    model->param_mapping = NULL;
+    model->param_mapping_size = 0;
+    model->quant_memory = NULL;
+    model->half_memory = NULL;
+
+    inferTensorShapes(model);
+    if (checkSeparableLayers(model) != SUCCESS) {
+        destroyModel(model);
+        return INVALID_ARGUMENT;
+    }
 
-    createTensors(tinyANN);
+    // Binary containers are mapped in place, text files are parsed into the model's own memory region
+    int status;
+    if (isQuantizedParamFile(param_path)) {
+        status = mapQuantizedParams(model, param_path);
+    } else if (isHalfParamFile(param_path)) {
+        status = mapHalfParams(model, param_path);
+    } else if (isBinaryParamFile(param_path)) {
+        status = mapParams(model, param_path);
+    } else {
+        status = loadParams(model, param_path);
+    }
 
-    loadParams(tinyANN, param_path);
+    for (int i = 0; i < model->total_layers && status == SUCCESS; i++) {
+        status = setModelConvolutionEngine(model, i, options->conv_engine);
+    }
+    if (status == SUCCESS) {
+        status = setModelLayout(model, options->layout);
+    }
+    if (status == SUCCESS) {
+        status = setModelSparsity(model, options->sparse_threshold);
+    }
+    if (status == SUCCESS) {
+        status = setModelWeightFormat(model, options->weight_format);
+    }
+    if (status == SUCCESS && options->autotune) {
+        status = autotuneModel(model, options);
+    }
 
-    for (int i = 0; i < tinyANN->total_layers; i++) {
+    if (status != SUCCESS) {
+        destroyModel(model);
+        return status;
+    }
+
+    for (int i = 0; i < model->total_layers; i++) {
         printf("layer %d : ", i + 1);
         for (int j = 0; j < MAX_LAYER_INFO_SIZE; j++) {
-            printf("%ld ", tinyANN->tensors[i].info[j]);
+            printf("%ld ", model->tensors[i].info[j]);
         }
-        printf("%ld %ld %ld \n", tinyANN->tensors[i].channels, tinyANN->tensors[i].height, tinyANN->tensors[i].width);
+        printf("%ld %ld %ld \n", model->tensors[i].channels, model->tensors[i].height, model->tensors[i].width);
     }
 
     return SUCCESS;
 }
 
-int loadParams(TinyANN* tinyANN, const char* param_path) {
+int destroyModel(Model* model) {
+    if (model->tensors) {
+        for (int i = 0; i < model->total_layers; i++) {
+            freeModelBuffer(model->tensors[i].packed_weight_start);
+            freeModelBuffer(model->tensors[i].winograd_weight_start);
+            freeModelBuffer(model->tensors[i].blocked_weight_start);
+            freeModelBuffer(model->tensors[i].sparse_weights);
+        }
+        free(model->tensors);
+        model->tensors = NULL;
+    }
 
-    for (int i = 0; i < tinyANN->total_layers; i++) {
-        if (tinyANN->tensors[i].info[_operation] == _convolution || tinyANN->tensors[i].info[_operation] == _fully_connected) {
-            tinyANN->tensors[i].weight_start = tinyANN->memory_block.memory_used;
-            tinyANN->tensors[i].weight_end = tinyANN->memory_block.memory_used +=
-                (tinyANN->tensors[i].info[_input] * tinyANN->tensors[i].info[_output] * tinyANN->tensors[i].info[_kernel_size] *
-                 tinyANN->tensors[i].info[_kernel_size]);
-            tinyANN->tensors[i].bias_start = tinyANN->memory_block.memory_used;
-            tinyANN->tensors[i].bias_end = tinyANN->memory_block.memory_used += tinyANN->tensors[i].info[_output];
+    unmapParams(model);
+
+    freeModelBuffer(model->quant_memory);
+    model->quant_memory = NULL;
+
+    freeModelBuffer(model->half_memory);
+    model->half_memory = NULL;
+
+    freeRegion(&model->memory_block);
+
+    return SUCCESS;
+}
+
+int loadParams(Model* model, const char* param_path) {
+    size_t memory_size = 0;
+    for (int i = 0; i < model->total_layers; i++) {
+        if (hasWeights(&model->tensors[i])) {
+            memory_size += arenaFloats(weightCount(&model->tensors[i])) + arenaFloats(model->tensors[i].info[_output]);
+        }
+    }
+
+    // Weight and bias blocks are rounded up so every one starts on a cache line, see arena.h
+    int status = allocateRegion(&model->memory_block, memory_size);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    for (int i = 0; i < model->total_layers; i++) {
+        if (hasWeights(&model->tensors[i])) {
+            size_t weight_count = weightCount(&model->tensors[i]);
+            model->tensors[i].weight_start = model->memory_block.memory_used;
+            model->tensors[i].weight_end = model->tensors[i].weight_start + weight_count;
+            model->memory_block.memory_used += arenaFloats(weight_count);
+            model->tensors[i].bias_start = model->memory_block.memory_used;
+            model->tensors[i].bias_end = model->tensors[i].bias_start + model->tensors[i].info[_output];
+            model->memory_block.memory_used += arenaFloats(model->tensors[i].info[_output]);
         } else {
-            tinyANN->tensors[i].weight_start = tinyANN->tensors[i].bias_start = tinyANN->tensors[i].bias_end = tinyANN->tensors[i].weight_end = NULL;
+            model->tensors[i].weight_start = model->tensors[i].bias_start = model->tensors[i].bias_end = model->tensors[i].weight_end = NULL;
         }
     }
 
@@ -58,25 +257,26 @@ int loadParams(TinyANN* tinyANN, const char* param_path) {
 
     if (param_config == NULL) {
         fprintf(stderr, "ERROR TINY_ANN: File (%s) does not exist\n", param_path);
+        return FILE_NOT_READABLE;
     }
 
-    for (int t = 0; t < tinyANN->total_layers; t++) {
-        if (tinyANN->tensors[t].info[_operation] != _convolution && tinyANN->tensors[t].info[_operation] != _fully_connected)
+    for (int t = 0; t < model->total_layers; t++) {
+        if (!hasWeights(&model->tensors[t]))
             continue;
 
         int ind = 0;
-        for (int out = 0; out < tinyANN->tensors[t].info[_output]; out++) {
-            for (int in = 0; in < tinyANN->tensors[t].info[_input]; in++) {
-                for (int r = 0; r < tinyANN->tensors[t].info[_kernel_size]; r++) {
-                    for (int c = 0; c < tinyANN->tensors[t].info[_kernel_size]; c++) {
-                        fscanf(param_config, "%f", &tinyANN->tensors[t].weight_start[ind]);
+        for (int out = 0; out < model->tensors[t].info[_output]; out++) {
+            for (int in = 0; in < filterChannels(&model->tensors[t]); in++) {
+                for (int r = 0; r < model->tensors[t].info[_kernel_size]; r++) {
+                    for (int c = 0; c < model->tensors[t].info[_kernel_size]; c++) {
+                        fscanf(param_config, "%f", &model->tensors[t].weight_start[ind]);
                         ind++;
                     }
                 }
             }
         }
-        for (int out = 0; out < tinyANN->tensors[t].info[_output]; out++) {
-            fscanf(param_config, "%f", &tinyANN->tensors[t].bias_start[out]);
+        for (int out = 0; out < model->tensors[t].info[_output]; out++) {
+            fscanf(param_config, "%f", &model->tensors[t].bias_start[out]);
         }
     }
 
@@ -85,273 +285,747 @@ int loadParams(TinyANN* tinyANN, const char* param_path) {
     return SUCCESS;
 }
 
-int inference(TinyANN* tinyANN, float* image) {
+/*
+Fusion pass over the layer configs
+conv -> relu -> max_pool : the convolution computes a few output rows at a time into fusion_workspace, applies bias and relu
+                           and pools them straight into the max_pool output, the conv output map is never written
+conv -> relu, fc -> relu : relu is applied as each output value is stored instead of in a second sweep
+*/
+static void fuseLayers(TinyANN* tinyANN) {
+    for (size_t l = 0; l + 1 < tinyANN->total_layers; l++) {
+        Tensor* tensor = &tinyANN->tensors[l];
+        if (tensor->info[_activation] != _relu) {
+            continue;
+        }
 
-    size_t padding = tinyANN->tensors[0].info[_padding];
-    size_t pad_height = tinyANN->tensors[0].height + 2 * padding;
-    size_t pad_width = tinyANN->tensors[0].width + 2 * padding;
+        if (tensor->info[_operation] == _convolution && l + 2 < tinyANN->total_layers && tinyANN->tensors[l + 1].info[_operation] == _maxpool) {
+            tensor->fusion = _fused_relu_maxpool;
 
-    for (int f = 0; f < tinyANN->image_filters; f++) {
-        for (int i = 0; i < tinyANN->image_rows; i++) {
-            for (int j = 0; j < tinyANN->image_cols; j++) {
-                tinyANN->tensors[0].start[f * pad_height * pad_width + ((i + padding) * pad_width + (j + padding))] =
-                    image[f * tinyANN->image_rows * tinyANN->image_cols + (i * tinyANN->image_cols + j)];
+            // Every output channel of the conv rows one work item pools, sized for any engine and the blocked layout
+            size_t channels = tinyANN->tensors[l + 1].layout == _nchwc ? blockedChannels(tensor->info[_output], tinyANN->kernels->channel_block)
+                                                                       : tensor->info[_output];
+            size_t band_size = channels * fusedConvRows(&tinyANN->tensors[l + 1], fusedPoolRows(&tinyANN->tensors[l + 1])) *
+                               tinyANN->tensors[l + 1].width;
+            if (band_size > tinyANN->fusion_workspace_size) {
+                tinyANN->fusion_workspace_size = band_size;
             }
+        } else if (hasWeights(tensor)) {
+            tensor->fusion = _fused_relu;
         }
     }
+}
 
-    for (int l = 0; l < tinyANN->total_layers - 1; l++) {
-        if (tinyANN->tensors[l].info[_operation] == _convolution) {
-            convolution(tinyANN, l);
-            if (tinyANN->tensors[l].info[_activation] == _relu) {
-                relu(tinyANN, l + 1);
-            }
-        } else if (tinyANN->tensors[l].info[_operation] == _maxpool) {
-            max_pool(tinyANN, l);
-        } else if (tinyANN->tensors[l].info[_operation] == _flatten) {
-            flatten(tinyANN, l);
-        } else if (tinyANN->tensors[l].info[_operation] == _fully_connected) {
-            fully_connected(tinyANN, l);
-            if (tinyANN->tensors[l].info[_activation] == _relu) {
-                relu(tinyANN, l + 1);
-            }
+int createExecutionContext(TinyANN* tinyANN, const Model* model, const NetworkOptions* options) {
+    NetworkOptions default_options = defaultNetworkOptions();
+    if (options == NULL) {
+        options = &default_options;
+    }
+
+    tinyANN->model = model;
+    tinyANN->owned_model = NULL;
+    tinyANN->total_layers = model->total_layers;
+    tinyANN->image_filters = model->image_filters;
+    tinyANN->image_rows = model->image_rows;
+    tinyANN->image_cols = model->image_cols;
+    tinyANN->max_batch = options->max_batch ? options->max_batch : 1;
+    tinyANN->batch_size = 1;
+    tinyANN->reuse_activations = options->reuse_activations;
+    tinyANN->memory_plan.peak_bytes = tinyANN->memory_plan.naive_bytes = 0;
+    tinyANN->memory_block.memory_start = NULL;
+    tinyANN->memory_block.hugepages = options->hugepages;
+    tinyANN->memory_block.numa_node = options->numa_node;
+    tinyANN->memory_block.backing = _backing_none;
+    tinyANN->gemm_workspace = NULL;
+    tinyANN->gemm_workspace_size = 0;
+    tinyANN->fusion_workspace = NULL;
+    tinyANN->fusion_workspace_size = 0;
+    tinyANN->int8_workspace = NULL;
+    tinyANN->int8_input_size = tinyANN->int8_workspace_size = 0;
+    tinyANN->activation_ranges = NULL;
+    tinyANN->layer_seconds = NULL;
+    tinyANN->kernels = selectKernels();
+    tinyANN->thread_pool = NULL;
+    tinyANN->profiler = NULL;
+
+    // Layer descriptors are copied so start/end can point at this context's feature maps,
+    // the weight pointers inside still refer to the shared model
+    tinyANN->tensors = (Tensor*)malloc(model->total_layers * sizeof(Tensor));
+    if (!tinyANN->tensors) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in createExecutionContext()\n");
+        return MEMORY_ALLOCATION_FAILED;
+    }
+    memcpy(tinyANN->tensors, model->tensors, model->total_layers * sizeof(Tensor));
+
+    // A quantized model still holding its fp32 (dense or sparse) weights runs either way, an int8 parameter file only runs in int8
+    int quantized = 0;
+    for (int i = 0; i < tinyANN->total_layers; i++) {
+        if (options->precision == _fp32 && (tinyANN->tensors[i].weight_start || tinyANN->tensors[i].sparse_weights)) {
+            tinyANN->tensors[i].qweight_start = NULL;
         }
+        quantized |= tinyANN->tensors[i].qweight_start != NULL;
+    }
+    if (options->precision == _int8 && !quantized) {
+        fprintf(stderr, "ERROR TINY_ANN: _int8 precision needs a quantized model, see quantizeModel()\n");
+        free(tinyANN->tensors);
+        tinyANN->tensors = NULL;
+        return INVALID_ARGUMENT;
     }
 
-    int max_ind = 0;
-    for (int i = 1; i < tinyANN->tensors[tinyANN->total_layers - 1].channels; i++) {
-        if (tinyANN->tensors[tinyANN->total_layers - 1].start[max_ind] < tinyANN->tensors[tinyANN->total_layers - 1].start[i]) {
-            max_ind = i;
+    // Layouts decide the size of every map, so they are set before fusion and the memory plan
+    int status = assignLayouts(tinyANN, options->layout);
+    if (status != SUCCESS) {
+        free(tinyANN->tensors);
+        tinyANN->tensors = NULL;
+        return status;
+    }
+
+    tinyANN->thread_pool = createThreadPool(options->threads);
+
+    // Fusion decides which maps exist, so it runs before the memory plan
+    if (options->fuse_layers) {
+        fuseLayers(tinyANN);
+    }
+
+    if (tinyANN->fusion_workspace_size) {
+        tinyANN->fusion_workspace = (float*)malloc((threadPoolSize(tinyANN->thread_pool) * tinyANN->fusion_workspace_size + FUSION_SKEW) * sizeof(float));
+        if (!tinyANN->fusion_workspace) {
+            fprintf(stderr, "ERROR TINY_ANN: Allocation error in createExecutionContext()\n");
+            destroyExecutionContext(tinyANN);
+            return MEMORY_ALLOCATION_FAILED;
         }
     }
 
-#if 0
-    FILE* file = fopen("../extern/out_feature_map.txt", "wb");
+    if ((status = allocateMemoryRegion(tinyANN)) != SUCCESS) {
+        destroyExecutionContext(tinyANN);
+        return status;
+    }
 
-    for (int l = 0; l < tinyANN->total_layers; l++) {
-        padding = tinyANN->tensors[l].info[_padding];
-        pad_height = tinyANN->tensors[l].height + 2 * padding;
-        pad_width = tinyANN->tensors[l].width + 2 * padding;
+    createTensors(tinyANN);
 
-        fprintf(file, "\n==========Layer %d: %ld %ld %ld %ld============\n", l + 1, tinyANN->tensors[l].channels, pad_height, pad_width,
-                tinyANN->tensors[l].info[_padding]);
+    if ((status = createInt8Workspace(tinyANN)) != SUCCESS) {
+        destroyExecutionContext(tinyANN);
+        return status;
+    }
 
-        for (int f = 0; f < tinyANN->tensors[l].channels; f++) {
-            for (int i = 0; i < pad_height; i++) {
-                for (int j = 0; j < pad_width; j++) {
-                    fprintf(file, "%f ", tinyANN->tensors[l].start[f * pad_height * pad_width + (i * pad_width + j)]);
-                }
-                fprintf(file, "\n");
-            }
-            fprintf(file, "\n\n");
+    for (int i = 0; i < tinyANN->total_layers; i++) {
+        if ((status = setConvolutionEngine(tinyANN, i, model->tensors[i].conv_engine)) != SUCCESS) {
+            destroyExecutionContext(tinyANN);
+            return status;
         }
-        fprintf(file, "\n\n\n");
     }
-    fclose(fikle);
-#endif
 
+    return SUCCESS;
+}
+
+static double nowSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+int inference(TinyANN* tinyANN, float* image) {
+    int max_ind = 0;
+    inference_batch(tinyANN, image, 1, &max_ind);
     return max_ind;
 }
 
-void fully_connected(TinyANN* tinyANN, size_t layer_no) {
-    for (int n = 0; n < tinyANN->tensors[layer_no].info[_output]; n++) {
-        tinyANN->tensors[layer_no + 1].start[n] = 0;
-        for (int m = 0; m < tinyANN->tensors[layer_no].info[_input]; m++) {
-            tinyANN->tensors[layer_no + 1].start[n] +=
-                tinyANN->tensors[layer_no].start[m] * tinyANN->tensors[layer_no].weight_start[n * tinyANN->tensors[layer_no].info[_input] + m];
+// Indices of the k highest of n scores in top, highest first, ties keep the lower index
+// A score only moves in when it beats the current k-th, so past the first few classes most cost one comparison
+static void topClasses(const float* scores, size_t n, size_t k, int* top) {
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (kept == k && !(scores[i] > scores[top[k - 1]])) {
+            continue;
+        }
+        size_t j = kept < k ? kept++ : k - 1;
+        for (; j > 0 && scores[i] > scores[top[j - 1]]; j--) {
+            top[j] = top[j - 1];
         }
-        tinyANN->tensors[layer_no + 1].start[n] += tinyANN->tensors[layer_no].bias_start[n];
+        top[j] = (int)i;
     }
 }
 
-void flatten(TinyANN* tinyANN, size_t layer_no) {
-    int i = 0;
-    for (float* ptr = tinyANN->tensors[layer_no].start; ptr != tinyANN->tensors[layer_no].end; ptr++) {
-        tinyANN->tensors[layer_no + 1].start[i++] = *ptr;
+// Top k and their softmax probabilities of every image of the current batch, read straight from the output map
+static void outputStage(const TinyANN* tinyANN, size_t k, int* out_classes, float* out_probabilities) {
+    const Tensor* output = &tinyANN->tensors[tinyANN->total_layers - 1];
+
+    for (size_t b = 0; b < tinyANN->batch_size; b++) {
+        const float* scores = output->start + b * output->batch_stride;
+        int* top = out_classes + b * k;
+        topClasses(scores, output->channels, k, top);
+        if (out_probabilities == NULL) {
+            continue;
+        }
+
+        // Shifted by the largest score, every exp() is at most 1 and the sum at least 1
+        float max_score = scores[top[0]];
+        float inv_sum = 1.0f / tinyANN->kernels->exp_sum(scores, output->channels, max_score);
+        for (size_t j = 0; j < k; j++) {
+            out_probabilities[b * k + j] = expf(scores[top[j]] - max_score) * inv_sum;
+        }
     }
 }
 
-void relu(TinyANN* tinyANN, size_t layer_no) {
+int inference_topk(TinyANN* tinyANN, const float* image, size_t k, int* out_classes, float* out_probabilities) {
+    return inference_batch_topk(tinyANN, image, 1, k, out_classes, out_probabilities);
+}
+
+int inference_batch(TinyANN* tinyANN, const float* images, size_t n, int* out_classes) {
+    return inference_batch_topk(tinyANN, images, n, 1, out_classes, NULL);
+}
+
+int inference_batch_topk(TinyANN* tinyANN, const float* images, size_t n, size_t k, int* out_classes, float* out_probabilities) {
+    if (k == 0 || k > tinyANN->tensors[tinyANN->total_layers - 1].channels) {
+        fprintf(stderr, "ERROR TINY_ANN: Top %zu of %zu classes requested\n", k, tinyANN->tensors[tinyANN->total_layers - 1].channels);
+        return INVALID_ARGUMENT;
+    }
+
+    size_t image_size = tinyANN->image_filters * tinyANN->image_rows * tinyANN->image_cols;
+
+    // Images beyond max_batch are run as further batches
+    for (size_t first = 0; first < n; first += tinyANN->max_batch) {
+        tinyANN->batch_size = n - first < tinyANN->max_batch ? n - first : tinyANN->max_batch;
 
-    size_t padding = tinyANN->tensors[layer_no].info[_padding];
-    size_t pad_height = tinyANN->tensors[layer_no].height + 2 * padding;
-    size_t pad_width = tinyANN->tensors[layer_no].width + 2 * padding;
+        // Feature maps carry no padding, so the caller's images already are the first map and are read in place
+        tinyANN->tensors[0].start = (float*)(images + first * image_size);
+        tinyANN->tensors[0].end = tinyANN->tensors[0].start + tinyANN->batch_size * image_size;
 
-    for (int c = 0; c < tinyANN->tensors[layer_no].channels; c++) {
-        for (int i = 0; i < tinyANN->tensors[layer_no].height; i++) {
-            for (int j = 0; j < tinyANN->tensors[layer_no].width; j++) {
-                if (tinyANN->tensors[layer_no].start[c * pad_height * pad_width + ((i + padding) * pad_width + (j + padding))] < 0) {
-                    tinyANN->tensors[layer_no].start[c * pad_height * pad_width + ((i + padding) * pad_width + (j + padding))] = 0.0f;
+#ifdef TINYANN_PROFILE
+        uint64_t batch_start = 0;
+        if (tinyANN->profiler) {
+            profileBatchBegin(tinyANN);
+            batch_start = readCycleCounter();
+        }
+#endif
+
+        for (int l = 0; l < tinyANN->total_layers - 1; l++) {
+            // A fused layer's time goes to the layer that ran it, like its relu
+            size_t timed_layer = l;
+            double layer_start = tinyANN->layer_seconds ? nowSeconds() : 0.0;
+#ifdef TINYANN_PROFILE
+            uint64_t layer_cycles = tinyANN->profiler ? readCycleCounter() : 0;
+#endif
+
+            if (tinyANN->activation_ranges &&
+                (tinyANN->tensors[l].info[_operation] == _convolution || tinyANN->tensors[l].info[_operation] == _fully_connected)) {
+                recordActivationRange(tinyANN, l);
+            }
+
+            if (tinyANN->tensors[l].info[_operation] == _convolution) {
+                convolution(tinyANN, l);
+                if (tinyANN->tensors[l].fusion == _fused_relu_maxpool) {
+                    l++; // the max_pool layer ran inside convolution()
+                } else if (tinyANN->tensors[l].info[_activation] == _relu && tinyANN->tensors[l].fusion == _unfused) {
+                    relu(tinyANN, l + 1);
+                }
+            } else if (tinyANN->tensors[l].info[_operation] == _maxpool) {
+                max_pool(tinyANN, l);
+            } else if (tinyANN->tensors[l].info[_operation] == _flatten) {
+                flatten(tinyANN, l);
+            } else if (tinyANN->tensors[l].info[_operation] == _fully_connected) {
+                fully_connected(tinyANN, l);
+                if (tinyANN->tensors[l].info[_activation] == _relu && tinyANN->tensors[l].fusion == _unfused) {
+                    relu(tinyANN, l + 1);
                 }
+            } else if (tinyANN->tensors[l].info[_operation] == _depthwise_convolution ||
+                       tinyANN->tensors[l].info[_operation] == _pointwise_convolution) {
+                if (tinyANN->tensors[l].info[_operation] == _depthwise_convolution) {
+                    depthwise_convolution(tinyANN, l);
+                } else {
+                    pointwise_convolution(tinyANN, l);
+                }
+                if (tinyANN->tensors[l].info[_activation] == _relu && tinyANN->tensors[l].fusion == _unfused) {
+                    relu(tinyANN, l + 1);
+                }
+            }
+
+            if (tinyANN->layer_seconds) {
+                tinyANN->layer_seconds[timed_layer] += nowSeconds() - layer_start;
+            }
+#ifdef TINYANN_PROFILE
+            if (tinyANN->profiler) {
+                profileRecord(tinyANN, timed_layer, layer_cycles, readCycleCounter());
+            }
+#endif
+        }
+
+        outputStage(tinyANN, k, out_classes + first * k, out_probabilities ? out_probabilities + first * k : NULL);
+
+#ifdef TINYANN_PROFILE
+        if (tinyANN->profiler) {
+            profileRecord(tinyANN, tinyANN->total_layers, batch_start, readCycleCounter());
+        }
+#endif
+
+#if 0
+        FILE* file = fopen("../extern/out_feature_map.txt", "wb");
+
+        for (int l = 0; l < tinyANN->total_layers; l++) {
+            fprintf(file, "\n==========Layer %d: %ld %ld %ld %ld============\n", l + 1, tinyANN->tensors[l].channels, tinyANN->tensors[l].height,
+                    tinyANN->tensors[l].width, tinyANN->tensors[l].info[_padding]);
+
+            for (int f = 0; f < tinyANN->tensors[l].channels; f++) {
+                for (int i = 0; i < tinyANN->tensors[l].height; i++) {
+                    for (int j = 0; j < tinyANN->tensors[l].width; j++) {
+                        fprintf(file, "%f ", tinyANN->tensors[l].start[(f * tinyANN->tensors[l].height + i) * tinyANN->tensors[l].width + j]);
+                    }
+                    fprintf(file, "\n");
+                }
+                fprintf(file, "\n\n");
             }
+            fprintf(file, "\n\n\n");
         }
+        fclose(fikle);
+#endif
     }
+
+    return SUCCESS;
 }
 
-void max_pool(TinyANN* tinyANN, size_t layer_no) {
-    size_t new_padding = tinyANN->tensors[layer_no + 1].info[_padding];
-    size_t new_pad_height = tinyANN->tensors[layer_no + 1].height + 2 * new_padding;
-    size_t new_pad_width = tinyANN->tensors[layer_no + 1].width + 2 * new_padding;
-
-    size_t padding = tinyANN->tensors[layer_no].info[_padding];
-    size_t pad_height = tinyANN->tensors[layer_no].height + 2 * padding;
-    size_t pad_width = tinyANN->tensors[layer_no].width + 2 * padding;
-    size_t kernel_size = tinyANN->tensors[layer_no].info[_kernel_size];
-    size_t stride = tinyANN->tensors[layer_no].info[_stride];
-    size_t in_filters = tinyANN->tensors[layer_no].info[_input];
-    size_t out_filters = tinyANN->tensors[layer_no].info[_output];
-
-    size_t stride_x, stride_y;
-
-    for (int out_f = 0; out_f < out_filters; out_f++) {
-        for (int row = 0; row < tinyANN->tensors[layer_no + 1].height; row++) {
-            for (int col = 0; col < tinyANN->tensors[layer_no + 1].width; col++) {
-
-                float max_val = INT32_MIN;
-                stride_x = stride * row;
-                stride_y = stride * col;
-
-                for (int x = 0; x < kernel_size; x++) {
-                    for (int y = 0; y < kernel_size; y++) {
-                        if (tinyANN->tensors[layer_no].start[out_f * pad_height * pad_width + ((x + stride_x) * pad_width + (stride_y + y))] >
-                            max_val) {
-                            max_val =
-                                tinyANN->tensors[layer_no].start[out_f * pad_height * pad_width + ((x + stride_x) * pad_width + (stride_y + y))];
-                        }
-                    }
+static void fullyConnectedRange(void* context, size_t begin, size_t end, size_t worker) {
+    (void)worker;
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    size_t inputs = tensor->info[_input];
+    size_t outputs = tensor->info[_output];
+    size_t batch = tinyANN->batch_size;
+
+    // GEMM over the batch: a tile of FC_TILE weight rows stays in cache while it is applied to FC_TILE images at a time
+    for (size_t n0 = begin * FC_TILE; n0 < outputs && n0 < end * FC_TILE; n0 += FC_TILE) {
+        size_t n_tile = outputs - n0 < FC_TILE ? outputs - n0 : FC_TILE;
+
+        for (size_t b0 = 0; b0 < batch; b0 += FC_TILE) {
+            size_t b_tile = batch - b0 < FC_TILE ? batch - b0 : FC_TILE;
+            const float* in = tensor->start + b0 * tensor->batch_stride;
+            float acc[FC_TILE][FC_TILE];
+
+            // Half precision weights are widened in the kernel, see half.h
+            if (tensor->half_weight_start == NULL) {
+                tinyANN->kernels->fc_tile(in, tensor->batch_stride, b_tile, tensor->weight_start + n0 * inputs, inputs, n_tile, acc);
+            } else if (tensor->weight_format == _weights_bf16) {
+                tinyANN->kernels->fc_tile_bf16(in, tensor->batch_stride, b_tile, tensor->half_weight_start + n0 * inputs, inputs, n_tile, acc);
+            } else {
+                tinyANN->kernels->fc_tile_fp16(in, tensor->batch_stride, b_tile, tensor->half_weight_start + n0 * inputs, inputs, n_tile, acc);
+            }
+
+            for (size_t b = 0; b < b_tile; b++) {
+                for (size_t n = 0; n < n_tile; n++) {
+                    float value = acc[b][n] + tensor->bias_start[n0 + n];
+                    next->start[(b0 + b) * next->batch_stride + n0 + n] = tensor->fusion == _fused_relu && value < 0 ? 0.0f : value;
                 }
+            }
+        }
+    }
+}
+
+void fully_connected(TinyANN* tinyANN, size_t layer_no) {
+    if (tinyANN->tensors[layer_no].qweight_start) {
+        fully_connected_int8(tinyANN, layer_no);
+        return;
+    }
+    if (tinyANN->tensors[layer_no].sparse_weights) {
+        fully_connected_sparse(tinyANN, layer_no);
+        return;
+    }
+
+    // Threads split the output neurons, FC_TILE at a time
+    LayerTask task = {tinyANN, layer_no};
+    parallelFor(tinyANN->thread_pool, (tinyANN->tensors[layer_no].info[_output] + FC_TILE - 1) / FC_TILE, fullyConnectedRange, &task);
+}
+
+void flatten(TinyANN* tinyANN, size_t layer_no) {
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+
+    if (tensor->layout == _nchwc) {
+        flatten_blocked(tinyANN, layer_no);
+        return;
+    }
+
+    // Feature maps are stored unpadded, so the planner usually lets both maps share memory and there is nothing to move
+    if (next->start == tensor->start) {
+        return;
+    }
+
+    for (size_t b = 0; b < tinyANN->batch_size; b++) {
+        memcpy(next->start + b * next->batch_stride, tensor->start + b * tensor->batch_stride, tensor->batch_stride * sizeof(float));
+    }
+}
 
-                tinyANN->tensors[layer_no + 1]
-                    .start[out_f * new_pad_height * new_pad_width + ((row + new_padding) * new_pad_width + (col + new_padding))] = max_val;
+void relu(TinyANN* tinyANN, size_t layer_no) {
+    // Feature maps are stored back to back without padding, so the whole batch is one contiguous sweep
+    tinyANN->kernels->relu(tinyANN->tensors[layer_no].start, tinyANN->batch_size * tinyANN->tensors[layer_no].batch_stride);
+}
+
+// Max of one pooling window near the border, pixels outside the map count as the zero padding they stand for
+static float maxPoolBorder(const float* rows, long row_begin, long row_end, long width, long top, long left, long kernel_size) {
+    float max_val = INT32_MIN;
+    for (long i = top; i < top + kernel_size; i++) {
+        for (long j = left; j < left + kernel_size; j++) {
+            float value = i >= row_begin && i < row_end && j >= 0 && j < width ? rows[(i - row_begin) * width + j] : 0.0f;
+            if (value > max_val) {
+                max_val = value;
             }
         }
     }
+    return max_val;
+}
+
+void max_pool_row(const TinyANN* tinyANN, size_t layer_no, const float* rows, long row_begin, long row_end, long out_row, float* out) {
+    const Tensor* tensor = &tinyANN->tensors[layer_no];
+    long padding = tensor->info[_padding];
+    long width = tensor->width;
+    long kernel_size = tensor->info[_kernel_size];
+    long stride = tensor->info[_stride];
+    long out_width = tinyANN->tensors[layer_no + 1].width;
+    long top = out_row * stride - padding;
+
+    // Output columns whose window lies inside the map, the rest is handled one pixel at a time
+    long first = (padding + stride - 1) / stride;
+    long last = width + padding >= kernel_size ? (width + padding - kernel_size) / stride + 1 : 0;
+    if (last > out_width) {
+        last = out_width;
+    }
+    if (top < row_begin || top + kernel_size > row_end || first > last) {
+        first = last = out_width;
+    }
+
+    for (long col = 0; col < first; col++) {
+        out[col] = maxPoolBorder(rows, row_begin, row_end, width, top, col * stride - padding, kernel_size);
+    }
+    if (first < last) {
+        tinyANN->kernels->max_pool_row(rows + (top - row_begin) * width + first * stride - padding, width, kernel_size, stride, out + first,
+                                       last - first);
+    }
+    for (long col = last; col < out_width; col++) {
+        out[col] = maxPoolBorder(rows, row_begin, row_end, width, top, col * stride - padding, kernel_size);
+    }
+}
+
+static void maxPoolRange(void* context, size_t begin, size_t end, size_t worker) {
+    (void)worker;
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    size_t out_filters = tensor->info[_output];
+
+    // Items are (image, channel) pairs
+    for (size_t item = begin; item < end; item++) {
+        size_t b = item / out_filters;
+        size_t out_f = item % out_filters;
+        const float* feature_map = tensor->start + b * tensor->batch_stride + out_f * tensor->height * tensor->width;
+        float* new_feature_map = next->start + b * next->batch_stride + out_f * next->height * next->width;
+
+        for (size_t row = 0; row < next->height; row++) {
+            max_pool_row(tinyANN, layer_no, feature_map, 0, tensor->height, row, new_feature_map + row * next->width);
+        }
+    }
+}
 
-    // Clean up the previous feature map
-    for (float* ptr = tinyANN->tensors[layer_no].start; ptr != tinyANN->tensors[layer_no].end; ptr++) {
-        *ptr = 0.0f;
+void max_pool(TinyANN* tinyANN, size_t layer_no) {
+    if (tinyANN->tensors[layer_no].layout == _nchwc) {
+        max_pool_blocked(tinyANN, layer_no);
+        return;
     }
+
+    LayerTask task = {tinyANN, layer_no};
+    parallelFor(tinyANN->thread_pool, tinyANN->batch_size * tinyANN->tensors[layer_no].info[_output], maxPoolRange, &task);
 }
 
 void convolution(TinyANN* tinyANN, size_t layer_no) {
+    if (tinyANN->tensors[layer_no].qweight_start) {
+        convolution_int8(tinyANN, layer_no);
+    } else if (tinyANN->tensors[layer_no + 1].layout == _nchwc) {
+        convolution_blocked(tinyANN, layer_no);
+    } else if (tinyANN->tensors[layer_no].conv_engine == _im2col_gemm) {
+        convolution_gemm(tinyANN, layer_no);
+    } else if (tinyANN->tensors[layer_no].conv_engine == _winograd) {
+        convolution_winograd(tinyANN, layer_no);
+    } else {
+        convolution_direct(tinyANN, layer_no);
+    }
+}
 
-    size_t new_padding = tinyANN->tensors[layer_no + 1].info[_padding];
-    size_t new_pad_height = tinyANN->tensors[layer_no + 1].height + 2 * new_padding;
-    size_t new_pad_width = tinyANN->tensors[layer_no + 1].width + 2 * new_padding;
+// Adds the kernel_size x kernel_size window of one input channel to output row row, in x, y order
+static void accumulateChannelRow(const TinyANN* tinyANN, size_t layer_no, const float* channel_map, const float* filter, long row, float* out_row) {
+    const Tensor* tensor = &tinyANN->tensors[layer_no];
+    long out_width = tinyANN->tensors[layer_no + 1].width;
+    long padding = tensor->info[_padding];
+    long height = tensor->height;
+    long width = tensor->width;
+    long kernel_size = tensor->info[_kernel_size];
+    long stride = tensor->info[_stride];
+
+    for (long x = 0; x < kernel_size; x++) {
+        long in_y = stride * row + x - padding;
+        if (in_y < 0 || in_y >= height) {
+            continue;
+        }
+        const float* in_row = channel_map + in_y * width;
+
+        for (long y = 0; y < kernel_size; y++) {
+            // Only output columns whose tap lands inside the row, the padding around it would add zeros
+            long col_begin = y < padding ? (padding - y + stride - 1) / stride : 0;
+            long col_end = width + padding > y ? (width + padding - y - 1) / stride + 1 : 0;
+            if (col_end > out_width) {
+                col_end = out_width;
+            }
 
-    size_t padding = tinyANN->tensors[layer_no].info[_padding];
-    size_t pad_height = tinyANN->tensors[layer_no].height + 2 * padding;
-    size_t pad_width = tinyANN->tensors[layer_no].width + 2 * padding;
-    size_t kernel_size = tinyANN->tensors[layer_no].info[_kernel_size];
-    size_t stride = tinyANN->tensors[layer_no].info[_stride];
-    size_t in_filters = tinyANN->tensors[layer_no].info[_input];
-    size_t out_filters = tinyANN->tensors[layer_no].info[_output];
+            if (col_begin < col_end) {
+                tinyANN->kernels->conv_row(out_row + col_begin, in_row + col_begin * stride + y - padding, stride, filter[x * kernel_size + y],
+                                           col_end - col_begin);
+            }
+        }
+    }
+}
 
-    size_t stride_x, stride_y;
+// Output row of channel out_f for one image, bias included
+static void convolutionDirectRow(const TinyANN* tinyANN, size_t layer_no, size_t out_f, const float* feature_map, long row, float* out_row) {
+    const Tensor* tensor = &tinyANN->tensors[layer_no];
+    long out_width = tinyANN->tensors[layer_no + 1].width;
+    size_t taps = tensor->info[_kernel_size] * tensor->info[_kernel_size];
+    size_t in_filters = tensor->info[_input];
+    const float* filter = tensor->weight_start + out_f * in_filters * taps;
 
-    for (int out_f = 0; out_f < out_filters; out_f++) {
-        for (int row = 0; row < tinyANN->tensors[layer_no + 1].height; row++) {
-            for (int col = 0; col < tinyANN->tensors[layer_no + 1].width; col++) {
+    // A whole output row accumulates at once, every pixel still sums in in_f, x, y order
+    memset(out_row, 0, out_width * sizeof(float));
 
-                float dot_product = 0.0f;
-                stride_x = stride * row;
-                stride_y = stride * col;
+    for (size_t in_f = 0; in_f < in_filters; in_f++) {
+        accumulateChannelRow(tinyANN, layer_no, feature_map + in_f * tensor->height * tensor->width, filter + in_f * taps, row, out_row);
+    }
 
-                for (int in_f = 0; in_f < in_filters; in_f++) {
+    for (long col = 0; col < out_width; col++) {
+        out_row[col] += tensor->bias_start[out_f];
+    }
+}
 
-                    for (int x = 0; x < kernel_size; x++) {
-                        for (int y = 0; y < kernel_size; y++) {
+static void convolutionDirectRange(void* context, size_t begin, size_t end, size_t worker) {
+    (void)worker;
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+
+    // The filter of out_f is applied to every image of the batch before moving on, so it is only read from memory once
+    for (size_t out_f = begin; out_f < end; out_f++) {
+        for (size_t b = 0; b < tinyANN->batch_size; b++) {
+            const float* feature_map = tensor->start + b * tensor->batch_stride;
+            float* new_feature_map = next->start + b * next->batch_stride + out_f * next->height * next->width;
+
+            for (size_t row = 0; row < next->height; row++) {
+                convolutionDirectRow(tinyANN, layer_no, out_f, feature_map, row, new_feature_map + row * next->width);
+                if (tensor->fusion == _fused_relu) {
+                    tinyANN->kernels->relu(new_feature_map + row * next->width, next->width);
+                }
+            }
+        }
+    }
+}
 
-                            dot_product +=
-                                tinyANN->tensors[layer_no].start[in_f * pad_height * pad_width + ((x + stride_x) * pad_width + (stride_y + y))] *
-                                tinyANN->tensors[layer_no].weight_start[out_f * in_filters * kernel_size * kernel_size +
-                                                                        (in_f * kernel_size * kernel_size + (x * kernel_size + y))];
-                        }
-                    }
+static void convolutionDirectPoolRange(void* context, size_t begin, size_t end, size_t worker) {
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* conv_out = &tinyANN->tensors[layer_no + 1];
+    Tensor* pool_out = &tinyANN->tensors[layer_no + 2];
+    long pool_padding = conv_out->info[_padding];
+    long pool_kernel_size = conv_out->info[_kernel_size];
+    long pool_stride = conv_out->info[_stride];
+    float* band = tinyANN->fusion_workspace + FUSION_SKEW + worker * tinyANN->fusion_workspace_size;
+
+    for (size_t out_f = begin; out_f < end; out_f++) {
+        for (size_t b = 0; b < tinyANN->batch_size; b++) {
+            const float* feature_map = tensor->start + b * tensor->batch_stride;
+            float* pooled_map = pool_out->start + b * pool_out->batch_stride + out_f * pool_out->height * pool_out->width;
+
+            // Only the conv rows under one pooling window exist at a time, overlapping windows recompute the shared rows
+            for (long pool_row = 0; pool_row < (long)pool_out->height; pool_row++) {
+                long top = pool_row * pool_stride - pool_padding;
+                long row_begin = top > 0 ? top : 0;
+                long row_end = top + pool_kernel_size < (long)conv_out->height ? top + pool_kernel_size : conv_out->height;
+
+                for (long row = row_begin; row < row_end; row++) {
+                    convolutionDirectRow(tinyANN, layer_no, out_f, feature_map, row, band + (row - row_begin) * conv_out->width);
                 }
-                tinyANN->tensors[layer_no + 1]
-                    .start[out_f * new_pad_height * new_pad_width + ((row + new_padding) * new_pad_width + (col + new_padding))] =
-                    dot_product + tinyANN->tensors[layer_no].bias_start[out_f];
+                if (row_begin < row_end) {
+                    tinyANN->kernels->relu(band, (row_end - row_begin) * conv_out->width);
+                }
+                max_pool_row(tinyANN, layer_no + 1, band, row_begin, row_end, pool_row, pooled_map + pool_row * pool_out->width);
+            }
+        }
+    }
+}
+
+void convolution_direct(TinyANN* tinyANN, size_t layer_no) {
+    // Threads split the output channels
+    LayerTask task = {tinyANN, layer_no};
+    parallelFor(tinyANN->thread_pool, tinyANN->tensors[layer_no].info[_output],
+                tinyANN->tensors[layer_no].fusion == _fused_relu_maxpool ? convolutionDirectPoolRange : convolutionDirectRange, &task);
+}
+
+static void depthwiseRange(void* context, size_t begin, size_t end, size_t worker) {
+    (void)worker;
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    size_t channels = tensor->info[_output];
+    size_t taps = tensor->info[_kernel_size] * tensor->info[_kernel_size];
+
+    // Items are (image, channel) pairs, each output channel only reads its own input channel
+    for (size_t item = begin; item < end; item++) {
+        size_t b = item / channels;
+        size_t c = item % channels;
+        const float* channel_map = tensor->start + b * tensor->batch_stride + c * tensor->height * tensor->width;
+        float* out_map = next->start + b * next->batch_stride + c * next->height * next->width;
+
+        for (size_t row = 0; row < next->height; row++) {
+            float* out_row = out_map + row * next->width;
+            for (size_t col = 0; col < next->width; col++) {
+                out_row[col] = tensor->bias_start[c];
             }
+            accumulateChannelRow(tinyANN, layer_no, channel_map, tensor->weight_start + c * taps, row, out_row);
+            if (tensor->fusion == _fused_relu) {
+                tinyANN->kernels->relu(out_row, next->width);
+            }
+        }
+    }
+}
+
+void depthwise_convolution(TinyANN* tinyANN, size_t layer_no) {
+    LayerTask task = {tinyANN, layer_no};
+    parallelFor(tinyANN->thread_pool, tinyANN->batch_size * tinyANN->tensors[layer_no].info[_output], depthwiseRange, &task);
+}
+
+// Floats of one image's feature map, maps are stored without padding (blocked maps round the channels up to whole blocks)
+static size_t featureMapSize(const TinyANN* tinyANN, const Tensor* tensor) {
+    size_t channels = tensor->layout == _nchwc ? blockedChannels(tensor->channels, tinyANN->kernels->channel_block) : tensor->channels;
+    return channels * tensor->height * tensor->width;
+}
+
+// 0 for the caller's input map and for conv outputs a fused max_pool consumes before they reach memory
+static int isMaterialized(const TinyANN* tinyANN, size_t layer_no) {
+    return layer_no > 0 && tinyANN->tensors[layer_no - 1].fusion != _fused_relu_maxpool;
+}
+
+// Floats the region holds for map layer_no, rounded up so every map starts on a cache line
+static size_t plannedSize(const TinyANN* tinyANN, size_t layer_no) {
+    return isMaterialized(tinyANN, layer_no) ? arenaFloats(tinyANN->max_batch * featureMapSize(tinyANN, &tinyANN->tensors[layer_no])) : 0;
+}
+
+/*
+Layer i's feature map is written by layer i - 1 and read by layer i (relu works in place), so only two maps are ever live.
+Maps alternate between the bottom and the top of the region, which keeps every input / output pair apart
+in max(size[i] + size[i + 1]) floats. A flatten output has the same layout as its input and stays on the same side,
+unless the input is blocked and flatten has to convert it.
+Maps a fused layer skips take no memory, the pooled map goes opposite the conv input.
+Without planning every map gets its own slot.
+*/
+static size_t planOffset(const TinyANN* tinyANN, size_t layer_no, size_t region_size) {
+    if (!tinyANN->reuse_activations) {
+        size_t offset = 0;
+        for (size_t i = 0; i < layer_no; i++) {
+            offset += plannedSize(tinyANN, i);
         }
+        return offset;
     }
 
-    // Clean up the previous feature map
-    for (float* ptr = tinyANN->tensors[layer_no].start; ptr != tinyANN->tensors[layer_no].end; ptr++) {
-        *ptr = 0.0f;
+    int top = 0;
+    for (size_t i = 2; i <= layer_no; i++) {
+        if (isMaterialized(tinyANN, i) && (tinyANN->tensors[i - 1].info[_operation] != _flatten || tinyANN->tensors[i - 1].layout == _nchwc)) {
+            top = !top;
+        }
     }
+
+    return top ? region_size - plannedSize(tinyANN, layer_no) : 0;
 }
 
 int createTensors(TinyANN* tinyANN) {
 
     for (int i = 0; i < tinyANN->total_layers; i++) {
-        tinyANN->tensors[i].start = tinyANN->memory_block.memory_used;
-        tinyANN->tensors[i].end = tinyANN->memory_block.memory_used +=
-            (tinyANN->tensors[i].channels * (tinyANN->tensors[i].width + 2 * tinyANN->tensors[i].info[_padding]) *
-             (tinyANN->tensors[i].height + 2 * tinyANN->tensors[i].info[_padding]));
+        tinyANN->tensors[i].batch_stride = featureMapSize(tinyANN, &tinyANN->tensors[i]);
+        tinyANN->tensors[i].start = tinyANN->memory_block.memory_start + planOffset(tinyANN, i, tinyANN->memory_block.size);
+        tinyANN->tensors[i].end = tinyANN->tensors[i].start + tinyANN->max_batch * tinyANN->tensors[i].batch_stride;
+    }
+
+    // The input map is bound to the caller's images by inference_batch(), fused away maps have no memory
+    for (int i = 0; i < tinyANN->total_layers; i++) {
+        if (!isMaterialized(tinyANN, i)) {
+            tinyANN->tensors[i].start = tinyANN->tensors[i].end = NULL;
+        }
     }
+    tinyANN->memory_block.memory_used = tinyANN->memory_block.memory_start + tinyANN->memory_block.size;
 
     return SUCCESS;
 }
 
-int destroyNetwork(TinyANN* tinyANN) {
+int destroyNetwork(TinyANN* tinyANN) { return destroyExecutionContext(tinyANN); }
+
+int destroyExecutionContext(TinyANN* tinyANN) {
     if (tinyANN->tensors) {
         free(tinyANN->tensors);
         tinyANN->tensors = NULL;
     }
 
-    return deallocateMemoryRegion(tinyANN);
+    destroyThreadPool(tinyANN->thread_pool);
+    tinyANN->thread_pool = NULL;
+
+    disableProfiling(tinyANN);
+
+    free(tinyANN->gemm_workspace);
+    tinyANN->gemm_workspace = NULL;
+    tinyANN->gemm_workspace_size = 0;
+
+    free(tinyANN->fusion_workspace);
+    tinyANN->fusion_workspace = NULL;
+    tinyANN->fusion_workspace_size = 0;
+
+    free(tinyANN->int8_workspace);
+    tinyANN->int8_workspace = NULL;
+    tinyANN->int8_input_size = tinyANN->int8_workspace_size = 0;
+
+    deallocateMemoryRegion(tinyANN);
+
+    if (tinyANN->owned_model) {
+        destroyModel(tinyANN->owned_model);
+        free(tinyANN->owned_model);
+        tinyANN->owned_model = NULL;
+    }
+    tinyANN->model = NULL;
+
+    return SUCCESS;
 }
 
 int allocateMemoryRegion(TinyANN* tinyANN) {
     size_t memory_size = 0;
-    size_t height = tinyANN->image_rows;
-    size_t width = tinyANN->image_cols;
 
-    // Memory for feature maps
+    // Memory for feature maps, max_batch images each (parameters live in the model, the input map is the caller's)
+    size_t input_size = 0; // last map that exists, the one map i is computed from
     for (int i = 0; i < tinyANN->total_layers; i++) {
+        size_t size = plannedSize(tinyANN, i);
 
-        tinyANN->tensors[i].height = height;
-        tinyANN->tensors[i].width = width;
-        tinyANN->tensors[i].channels = tinyANN->tensors[i].info[_input];
-
-        if (tinyANN->tensors[i].info[_operation] == _flatten || tinyANN->tensors[i].info[_operation] == _fully_connected) {
-            memory_size += tinyANN->tensors[i].info[_input] * (height + tinyANN->tensors[i].info[_padding] * 2) *
-                           (width + tinyANN->tensors[i].info[_padding] * 2);
-
-            height = width = 1;
+        tinyANN->memory_plan.naive_bytes += size * sizeof(float);
 
-            continue;
+        if (!tinyANN->reuse_activations) {
+            memory_size += size;
+        } else if (input_size + size > memory_size) {
+            memory_size = input_size + size;
         }
-
-        memory_size +=
-            tinyANN->tensors[i].info[_input] * (height + tinyANN->tensors[i].info[_padding] * 2) * (width + tinyANN->tensors[i].info[_padding] * 2);
-        height = 1 + (height + 2 * tinyANN->tensors[i].info[_padding] - tinyANN->tensors[i].info[_kernel_size]) / tinyANN->tensors[i].info[_stride];
-        width = 1 + (width + 2 * tinyANN->tensors[i].info[_padding] - tinyANN->tensors[i].info[_kernel_size]) / tinyANN->tensors[i].info[_stride];
-    }
-
-    // Memory for paramters
-    for (int i = 0; i < tinyANN->total_layers - 1; i++) {
-        if (tinyANN->tensors[i].info[_operation] == _convolution || tinyANN->tensors[i].info[_operation] == _fully_connected) {
-            memory_size += tinyANN->tensors[i].info[_input] * tinyANN->tensors[i].info[_output] * tinyANN->tensors[i].info[_kernel_size] *
-                           tinyANN->tensors[i].info[_kernel_size];
-            memory_size += tinyANN->tensors[i].info[_output];
+        if (size) {
+            input_size = size;
         }
     }
+    tinyANN->memory_plan.peak_bytes = memory_size * sizeof(float);
 
-    tinyANN->memory_block.memory_start = (float*)malloc(memory_size * sizeof(float));
-    if (!tinyANN->memory_block.memory_start) {
-        fprintf(stderr, "ERROR TINY_ANN: Allocation error in allocateMemoryRegion()\n");
-        return MEMORY_ALLOCATION_FAILED;
-    }
-    tinyANN->memory_block.size = memory_size;
-    tinyANN->memory_block.memory_used = tinyANN->memory_block.memory_start;
-
-    return SUCCESS;
+    // Every kernel writes each pixel of its output, nothing relies on this memory starting out zero
+    return allocateRegion(&tinyANN->memory_block, memory_size);
 }
 
 int deallocateMemoryRegion(TinyANN* tinyANN) {
-    if (tinyANN->memory_block.memory_start)
-        free(tinyANN->memory_block.memory_start);
+    freeRegion(&tinyANN->memory_block);
     return SUCCESS;
 }
@@ -0,0 +1,393 @@
+#include "../include/gemm.h"
+#include "../include/arena.h"
+#include "../include/kernels.h"
+#include "../include/thread_pool.h"
+#include "../include/winograd.h"
+
+size_t packedWeightSize(const Tensor* tensor) {
+    size_t depth = tensor->info[_input] * tensor->info[_kernel_size] * tensor->info[_kernel_size];
+    size_t rows = (tensor->info[_output] + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+    return rows * depth;
+}
+
+size_t gemmWorkspaceSize(const Tensor* tensor) {
+    size_t rows = (tensor->info[_output] + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+    return GEMM_KC * GEMM_NC + rows * GEMM_NC;
+}
+
+size_t fusedPoolRows(const Tensor* conv_out) {
+    size_t columns = conv_out->info[_kernel_size] * conv_out->width;
+    return columns < GEMM_NC ? GEMM_NC / columns : 1;
+}
+
+size_t fusedConvRows(const Tensor* conv_out, size_t pool_rows) { return (pool_rows - 1) * conv_out->info[_stride] + conv_out->info[_kernel_size]; }
+
+void packConvolutionWeights(const Tensor* tensor, float* packed) {
+    size_t depth = tensor->info[_input] * tensor->info[_kernel_size] * tensor->info[_kernel_size];
+    size_t out_filters = tensor->info[_output];
+
+    // [row panel][k][GEMM_MR], rows past out_filters are zero
+    for (size_t m0 = 0; m0 < out_filters; m0 += GEMM_MR) {
+        for (size_t k = 0; k < depth; k++) {
+            for (size_t i = 0; i < GEMM_MR; i++) {
+                *packed++ = m0 + i < out_filters ? tensor->weight_start[(m0 + i) * depth + k] : 0.0f;
+            }
+        }
+    }
+}
+
+void sgemmMicroKernel(size_t kc, const float* a, const float* b, float* c, size_t ldc, size_t m_rows, size_t n_cols) {
+    float acc[GEMM_MR][GEMM_NR];
+
+    // Start from C so the sum over k keeps the same order as the direct kernel
+    for (size_t i = 0; i < GEMM_MR; i++) {
+        for (size_t j = 0; j < GEMM_NR; j++) {
+            acc[i][j] = c[i * ldc + j];
+        }
+    }
+
+    for (size_t p = 0; p < kc; p++) {
+        for (size_t i = 0; i < GEMM_MR; i++) {
+            for (size_t j = 0; j < GEMM_NR; j++) {
+                acc[i][j] += a[p * GEMM_MR + i] * b[p * GEMM_NR + j];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < m_rows; i++) {
+        for (size_t j = 0; j < n_cols; j++) {
+            c[i * ldc + j] = acc[i][j];
+        }
+    }
+}
+
+// c_block[m * GEMM_NC + j] = output channel m (without bias) of output column n0 + j, for nc <= GEMM_NC columns of the batch
+static float* convolutionGemmBlock(TinyANN* tinyANN, size_t layer_no, size_t worker, size_t n0, size_t nc) {
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+
+    long padding = tensor->info[_padding];
+    long height = tensor->height;
+    long width = tensor->width;
+    size_t kernel_size = tensor->info[_kernel_size];
+    size_t stride = tensor->info[_stride];
+    size_t out_filters = tensor->info[_output];
+
+    size_t depth = tensor->info[_input] * kernel_size * kernel_size;
+    size_t pixels = next->height * next->width;
+    size_t row_panels = (out_filters + GEMM_MR - 1) / GEMM_MR;
+
+    // Every worker packs into its own slice of the workspace
+    float* packed_b = tinyANN->gemm_workspace + worker * tinyANN->gemm_workspace_size;
+    float* c_block = packed_b + GEMM_KC * GEMM_NC;
+    size_t col_offset[GEMM_NC];
+    long col_top[GEMM_NC];
+    long col_left[GEMM_NC];
+
+    // Image and top left input pixel of every output column in this block, the window may start in the padding
+    for (size_t j = 0; j < nc; j++) {
+        size_t b = (n0 + j) / pixels;
+        size_t pixel = (n0 + j) % pixels;
+        col_offset[j] = b * tensor->batch_stride;
+        col_top[j] = (long)(pixel / next->width) * (long)stride - padding;
+        col_left[j] = (long)(pixel % next->width) * (long)stride - padding;
+    }
+
+    memset(c_block, 0, row_panels * GEMM_MR * GEMM_NC * sizeof(float));
+
+    for (size_t k0 = 0; k0 < depth; k0 += GEMM_KC) {
+        size_t kc = depth - k0 < GEMM_KC ? depth - k0 : GEMM_KC;
+
+        // im2col straight into GEMM_NR wide panels, columns past nc are zero
+        for (size_t j0 = 0; j0 < nc; j0 += GEMM_NR) {
+            float* panel = packed_b + j0 * kc;
+            size_t in_f = k0 / (kernel_size * kernel_size);
+            size_t x = (k0 / kernel_size) % kernel_size;
+            size_t y = k0 % kernel_size;
+
+            for (size_t p = 0; p < kc; p++) {
+                const float* src = tensor->start + in_f * height * width;
+                for (size_t j = 0; j < GEMM_NR; j++) {
+                    long in_y = col_top[j0 + j] + (long)x;
+                    long in_x = col_left[j0 + j] + (long)y;
+                    bool inside = j0 + j < nc && in_y >= 0 && in_y < height && in_x >= 0 && in_x < width;
+                    panel[p * GEMM_NR + j] = inside ? src[col_offset[j0 + j] + in_y * width + in_x] : 0.0f;
+                }
+
+                if (++y == kernel_size) {
+                    y = 0;
+                    if (++x == kernel_size) {
+                        x = 0;
+                        in_f++;
+                    }
+                }
+            }
+        }
+
+        for (size_t mb = 0; mb < row_panels; mb++) {
+            const float* a = tensor->packed_weight_start + mb * GEMM_MR * depth + k0 * GEMM_MR;
+            for (size_t j0 = 0; j0 < nc; j0 += GEMM_NR) {
+                tinyANN->kernels->gemm_micro_kernel(kc, a, packed_b + j0 * kc, c_block + mb * GEMM_MR * GEMM_NC + j0, GEMM_NC, GEMM_MR,
+                                                    nc - j0 < GEMM_NR ? nc - j0 : GEMM_NR);
+            }
+        }
+    }
+
+    return c_block;
+}
+
+static void convolutionGemmRange(void* context, size_t begin, size_t end, size_t worker) {
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    size_t out_filters = tensor->info[_output];
+    size_t pixels = next->height * next->width;
+    size_t columns = tinyANN->batch_size * pixels;
+
+    for (size_t n0 = begin * GEMM_NC; n0 < columns && n0 < end * GEMM_NC; n0 += GEMM_NC) {
+        size_t nc = columns - n0 < GEMM_NC ? columns - n0 : GEMM_NC;
+        const float* c_block = convolutionGemmBlock(tinyANN, layer_no, worker, n0, nc);
+
+        // Scatter the block into the output feature maps
+        for (size_t j = 0; j < nc; j++) {
+            size_t b = (n0 + j) / pixels;
+            size_t pixel = (n0 + j) % pixels;
+            float* dst = next->start + b * next->batch_stride + pixel;
+
+            for (size_t m = 0; m < out_filters; m++) {
+                float value = c_block[m * GEMM_NC + j] + tensor->bias_start[m];
+                dst[m * pixels] = tensor->fusion == _fused_relu && value < 0 ? 0.0f : value;
+            }
+        }
+    }
+}
+
+static void convolutionGemmPoolRange(void* context, size_t begin, size_t end, size_t worker) {
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* conv_out = &tinyANN->tensors[layer_no + 1];
+    Tensor* pool_out = &tinyANN->tensors[layer_no + 2];
+    size_t out_filters = tensor->info[_output];
+    size_t pixels = conv_out->height * conv_out->width;
+    long pool_padding = conv_out->info[_padding];
+    long pool_kernel_size = conv_out->info[_kernel_size];
+    long pool_stride = conv_out->info[_stride];
+    size_t pool_rows = fusedPoolRows(conv_out);
+    size_t groups = (pool_out->height + pool_rows - 1) / pool_rows;
+    float* band = tinyANN->fusion_workspace + FUSION_SKEW + worker * tinyANN->fusion_workspace_size;
+
+    // Items are (image, group of pooled rows) pairs, the conv rows under the group are consecutive output columns
+    for (size_t item = begin; item < end; item++) {
+        size_t b = item / groups;
+        long first_row = (item % groups) * pool_rows;
+        long last_row = first_row + (long)pool_rows < (long)pool_out->height ? first_row + pool_rows : pool_out->height;
+
+        long top = first_row * pool_stride - pool_padding;
+        long bottom = (last_row - 1) * pool_stride - pool_padding + pool_kernel_size;
+        long row_begin = top > 0 ? top : 0;
+        long row_end = bottom < (long)conv_out->height ? bottom : conv_out->height;
+        size_t band_columns = row_begin < row_end ? (row_end - row_begin) * conv_out->width : 0;
+        size_t first_column = b * pixels + row_begin * conv_out->width;
+
+        for (size_t n0 = 0; n0 < band_columns; n0 += GEMM_NC) {
+            size_t nc = band_columns - n0 < GEMM_NC ? band_columns - n0 : GEMM_NC;
+            const float* c_block = convolutionGemmBlock(tinyANN, layer_no, worker, first_column + n0, nc);
+
+            for (size_t m = 0; m < out_filters; m++) {
+                for (size_t j = 0; j < nc; j++) {
+                    band[m * band_columns + n0 + j] = c_block[m * GEMM_NC + j] + tensor->bias_start[m];
+                }
+            }
+        }
+        tinyANN->kernels->relu(band, out_filters * band_columns);
+
+        for (size_t m = 0; m < out_filters; m++) {
+            for (long pool_row = first_row; pool_row < last_row; pool_row++) {
+                max_pool_row(tinyANN, layer_no + 1, band + m * band_columns, row_begin, row_end, pool_row,
+                             pool_out->start + b * pool_out->batch_stride + (m * pool_out->height + pool_row) * pool_out->width);
+            }
+        }
+    }
+}
+
+void convolution_gemm(TinyANN* tinyANN, size_t layer_no) {
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    LayerTask task = {tinyANN, layer_no};
+
+    // Fused with max_pool threads split groups of pooled rows, otherwise the output pixels GEMM_NC columns at a time
+    if (tinyANN->tensors[layer_no].fusion == _fused_relu_maxpool) {
+        size_t pool_rows = fusedPoolRows(next);
+        size_t groups = (tinyANN->tensors[layer_no + 2].height + pool_rows - 1) / pool_rows;
+        parallelFor(tinyANN->thread_pool, tinyANN->batch_size * groups, convolutionGemmPoolRange, &task);
+    } else {
+        size_t columns = tinyANN->batch_size * next->height * next->width;
+        parallelFor(tinyANN->thread_pool, (columns + GEMM_NC - 1) / GEMM_NC, convolutionGemmRange, &task);
+    }
+}
+
+// c_block[m * GEMM_NC + j] = output channel m (without bias) of pixel p0 + j of image b, the input map is B as it is
+static float* pointwiseGemmBlock(TinyANN* tinyANN, size_t layer_no, size_t worker, size_t b, size_t p0, size_t nc) {
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    size_t depth = tensor->info[_input];
+    size_t pixels = tensor->height * tensor->width;
+    size_t row_panels = (tensor->info[_output] + GEMM_MR - 1) / GEMM_MR;
+    const float* in = tensor->start + b * tensor->batch_stride + p0;
+
+    float* packed_b = tinyANN->gemm_workspace + worker * tinyANN->gemm_workspace_size;
+    float* c_block = packed_b + GEMM_KC * GEMM_NC;
+
+    memset(c_block, 0, row_panels * GEMM_MR * GEMM_NC * sizeof(float));
+
+    for (size_t k0 = 0; k0 < depth; k0 += GEMM_KC) {
+        size_t kc = depth - k0 < GEMM_KC ? depth - k0 : GEMM_KC;
+
+        // Channel rows are already contiguous pixels, packing is a copy of GEMM_NR of them per channel
+        for (size_t j0 = 0; j0 < nc; j0 += GEMM_NR) {
+            float* panel = packed_b + j0 * kc;
+            size_t n_cols = nc - j0 < GEMM_NR ? nc - j0 : GEMM_NR;
+
+            for (size_t p = 0; p < kc; p++) {
+                memcpy(panel + p * GEMM_NR, in + (k0 + p) * pixels + j0, n_cols * sizeof(float));
+                memset(panel + p * GEMM_NR + n_cols, 0, (GEMM_NR - n_cols) * sizeof(float));
+            }
+        }
+
+        for (size_t mb = 0; mb < row_panels; mb++) {
+            const float* a = tensor->packed_weight_start + mb * GEMM_MR * depth + k0 * GEMM_MR;
+            for (size_t j0 = 0; j0 < nc; j0 += GEMM_NR) {
+                tinyANN->kernels->gemm_micro_kernel(kc, a, packed_b + j0 * kc, c_block + mb * GEMM_MR * GEMM_NC + j0, GEMM_NC, GEMM_MR,
+                                                    nc - j0 < GEMM_NR ? nc - j0 : GEMM_NR);
+            }
+        }
+    }
+
+    return c_block;
+}
+
+static void pointwiseRange(void* context, size_t begin, size_t end, size_t worker) {
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    size_t out_filters = tensor->info[_output];
+    size_t pixels = next->height * next->width;
+    size_t blocks = (pixels + GEMM_NC - 1) / GEMM_NC;
+
+    // Items are (image, block of GEMM_NC pixels) pairs, so a block never spans two images
+    for (size_t item = begin; item < end; item++) {
+        size_t b = item / blocks;
+        size_t p0 = (item % blocks) * GEMM_NC;
+        size_t nc = pixels - p0 < GEMM_NC ? pixels - p0 : GEMM_NC;
+        const float* c_block = pointwiseGemmBlock(tinyANN, layer_no, worker, b, p0, nc);
+
+        for (size_t m = 0; m < out_filters; m++) {
+            float* dst = next->start + b * next->batch_stride + m * pixels + p0;
+            for (size_t j = 0; j < nc; j++) {
+                float value = c_block[m * GEMM_NC + j] + tensor->bias_start[m];
+                dst[j] = tensor->fusion == _fused_relu && value < 0 ? 0.0f : value;
+            }
+        }
+    }
+}
+
+void pointwise_convolution(TinyANN* tinyANN, size_t layer_no) {
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    LayerTask task = {tinyANN, layer_no};
+    size_t blocks = (next->height * next->width + GEMM_NC - 1) / GEMM_NC;
+    parallelFor(tinyANN->thread_pool, tinyANN->batch_size * blocks, pointwiseRange, &task);
+}
+
+// _auto and _winograd run Winograd where it applies and the direct kernel on every other layer, pointwise layers are always a GEMM
+static int resolveEngine(const Tensor* tensor, int engine) {
+    if (tensor->info[_operation] == _pointwise_convolution) {
+        return _im2col_gemm;
+    }
+    if (engine == _auto || engine == _winograd) {
+        return supportsWinograd(tensor) ? _winograd : _direct;
+    }
+    return engine;
+}
+
+static float* allocateWeights(Model* model, size_t size) {
+    void* weights = allocateModelBuffer(model, size * sizeof(float));
+    if (weights == NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in setModelConvolutionEngine()\n");
+    }
+    return (float*)weights;
+}
+
+int setModelConvolutionEngine(Model* model, size_t layer_no, int engine) {
+    Tensor* tensor = &model->tensors[layer_no];
+
+    // Layers loaded from an int8 parameter file have no fp32 weights to pack
+    if ((tensor->info[_operation] != _convolution && tensor->info[_operation] != _pointwise_convolution) || !tensor->weight_start) {
+        return SUCCESS;
+    }
+    engine = resolveEngine(tensor, engine);
+
+    if (engine == _im2col_gemm && !tensor->packed_weight_start) {
+        if (!(tensor->packed_weight_start = allocateWeights(model, packedWeightSize(tensor)))) {
+            return MEMORY_ALLOCATION_FAILED;
+        }
+        packConvolutionWeights(tensor, tensor->packed_weight_start);
+    }
+
+    if (engine == _winograd && !tensor->winograd_weight_start) {
+        if (!(tensor->winograd_weight_start = allocateWeights(model, winogradWeightSize(tensor)))) {
+            return MEMORY_ALLOCATION_FAILED;
+        }
+        transformWinogradWeights(tensor, tensor->winograd_weight_start);
+    }
+
+    tensor->conv_engine = engine;
+
+    return SUCCESS;
+}
+
+int setConvolutionEngine(TinyANN* tinyANN, size_t layer_no, int engine) {
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+
+    // int8 layers have a single engine of their own
+    if ((tensor->info[_operation] != _convolution && tensor->info[_operation] != _pointwise_convolution) || tensor->qweight_start) {
+        return SUCCESS;
+    }
+    engine = resolveEngine(tensor, engine);
+
+    if (engine == _im2col_gemm || engine == _winograd) {
+        const Tensor* shared = &tinyANN->model->tensors[layer_no];
+
+        // A shared model is immutable, only a private one can still be packed here
+        if (!(engine == _im2col_gemm ? shared->packed_weight_start : shared->winograd_weight_start)) {
+            if (!tinyANN->owned_model) {
+                fprintf(stderr, "ERROR TINY_ANN: Layer %zu of the shared model was not prepared for %s\n", layer_no + 1,
+                        engine == _im2col_gemm ? "_im2col_gemm" : "_winograd");
+                return INVALID_ARGUMENT;
+            }
+
+            int status = setModelConvolutionEngine(tinyANN->owned_model, layer_no, engine);
+            if (status != SUCCESS) {
+                return status;
+            }
+        }
+        tensor->packed_weight_start = shared->packed_weight_start;
+        tensor->winograd_weight_start = shared->winograd_weight_start;
+
+        // gemm_workspace_size is the slice of one worker, both engines use it
+        size_t workspace_size = engine == _im2col_gemm ? gemmWorkspaceSize(tensor) : winogradWorkspaceSize(tensor);
+        if (workspace_size > tinyANN->gemm_workspace_size) {
+            float* workspace = (float*)realloc(tinyANN->gemm_workspace, threadPoolSize(tinyANN->thread_pool) * workspace_size * sizeof(float));
+            if (!workspace) {
+                fprintf(stderr, "ERROR TINY_ANN: Allocation error in setConvolutionEngine()\n");
+                return MEMORY_ALLOCATION_FAILED;
+            }
+            tinyANN->gemm_workspace = workspace;
+            tinyANN->gemm_workspace_size = workspace_size;
+        }
+    }
+
+    tensor->conv_engine = engine;
+
+    return SUCCESS;
+}
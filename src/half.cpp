@@ -0,0 +1,64 @@
+#include "../include/half.h"
+#include "../include/arena.h"
+#include "../include/params.h"
+
+// Every fc layer's half weights start on a 64 byte boundary
+static size_t alignHalves(size_t count) { return (count + 31) & ~(size_t)31; }
+
+static int convertsToHalf(const Tensor* tensor) {
+    return tensor->info[_operation] == _fully_connected && tensor->weight_start && !tensor->qweight_start && !tensor->sparse_weights &&
+           !tensor->half_weight_start;
+}
+
+int setModelWeightFormat(Model* model, int format) {
+    if (format == _weights_fp32) {
+        return SUCCESS;
+    }
+    if (format != _weights_fp16 && format != _weights_bf16) {
+        fprintf(stderr, "ERROR TINY_ANN: Unknown weight format %d\n", format);
+        return INVALID_ARGUMENT;
+    }
+
+    size_t memory_size = 0;
+    for (size_t l = 0; l < model->total_layers; l++) {
+        if (convertsToHalf(&model->tensors[l])) {
+            memory_size += alignHalves(model->tensors[l].weight_end - model->tensors[l].weight_start);
+        }
+    }
+    if (memory_size == 0) {
+        return SUCCESS;
+    }
+
+    void* memory = allocateModelBuffer(model, memory_size * sizeof(uint16_t));
+    if (memory == NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in setModelWeightFormat()\n");
+        return MEMORY_ALLOCATION_FAILED;
+    }
+    freeModelBuffer(model->half_memory);
+    model->half_memory = memory;
+
+    uint16_t* block = (uint16_t*)memory;
+    for (size_t l = 0; l < model->total_layers; l++) {
+        Tensor* tensor = &model->tensors[l];
+        if (!convertsToHalf(tensor)) {
+            continue;
+        }
+
+        size_t count = tensor->weight_end - tensor->weight_start;
+        for (size_t i = 0; i < count; i++) {
+            block[i] = floatToHalf(tensor->weight_start[i], format);
+        }
+        tensor->half_weight_start = block;
+        tensor->weight_format = format;
+        block += alignHalves(count);
+
+        // Same state as a half container: fully_connected() reads half_weight_start only, the fp32 copy goes
+        releaseFloatWeights(model, tensor);
+
+        printf("layer %zu : %s weights, %zu -> %zu bytes\n", l + 1, format == _weights_bf16 ? "bf16" : "fp16", count * sizeof(float),
+               count * sizeof(uint16_t));
+    }
+
+    // Text parameters live in the model's region, mapped containers gave their pages back above
+    return compactParams(model);
+}
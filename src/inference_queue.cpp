@@ -0,0 +1,251 @@
+#include "../include/inference_queue.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+typedef struct PendingRequest {
+    std::vector<float> image;
+    InferenceCallback callback;
+    void* user_data;
+    Clock::time_point submitted;
+} PendingRequest;
+
+struct InferenceQueue {
+    TinyANN* tinyANN;
+    size_t image_size;
+    size_t max_batch;
+    size_t max_delay_us;
+    size_t max_pending;
+
+    std::thread scheduler;
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<PendingRequest> pending;
+    std::vector<std::vector<float> > free_images; // image buffers of completed requests, reused by submitInference()
+    size_t reserved; // submitters that passed the max_pending check and are copying their image
+    size_t blocked;  // submitters waiting for room, the scheduler only exits once neither is left
+    bool stop;
+    QueueStats stats;
+
+    std::vector<float> batch_images; // scheduler only, the batch's images back to back
+};
+
+static size_t depthBin(size_t depth) {
+    size_t bin = 0;
+    while (depth > 0 && bin + 1 < QUEUE_DEPTH_BINS) {
+        depth >>= 1;
+        bin++;
+    }
+    return bin;
+}
+
+static double secondsBetween(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double>(end - start).count();
+}
+
+// Waits for the first request, then until the batch is full, the oldest request is due or the queue is stopping
+// 0 once the queue is stopping with nothing pending and no submitInference() call left inside, which may still queue one
+static size_t takeBatch(InferenceQueue* queue, std::vector<PendingRequest>* batch) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    queue->not_empty.wait(lock, [&] { return (queue->stop && queue->reserved == 0 && queue->blocked == 0) || !queue->pending.empty(); });
+    if (queue->pending.empty()) {
+        return 0;
+    }
+
+    Clock::time_point due = queue->pending.front().submitted + std::chrono::microseconds(queue->max_delay_us);
+    queue->not_empty.wait_until(lock, due, [&] { return queue->stop || queue->pending.size() >= queue->max_batch; });
+
+    size_t n = queue->pending.size() < queue->max_batch ? queue->pending.size() : queue->max_batch;
+    for (size_t i = 0; i < n; i++) {
+        batch->push_back(std::move(queue->pending.front()));
+        queue->pending.pop_front();
+    }
+    queue->stats.depth = queue->pending.size();
+    queue->not_full.notify_all();
+    return n;
+}
+
+static void schedulerLoop(InferenceQueue* queue) {
+    std::vector<PendingRequest> batch;
+    std::vector<int> classes(queue->max_batch);
+
+    for (;;) {
+        size_t n = takeBatch(queue, &batch);
+        if (n == 0) {
+            return;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            memcpy(queue->batch_images.data() + i * queue->image_size, batch[i].image.data(), queue->image_size * sizeof(float));
+        }
+
+        Clock::time_point start = Clock::now();
+        int status = inference_batch(queue->tinyANN, queue->batch_images.data(), n, classes.data());
+        Clock::time_point end = Clock::now();
+
+        for (size_t i = 0; i < n; i++) {
+            batch[i].callback(batch[i].user_data, status, status == SUCCESS ? classes[i] : -1);
+        }
+
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        for (size_t i = 0; i < n; i++) {
+            queue->stats.wait_seconds += secondsBetween(batch[i].submitted, start);
+            queue->free_images.push_back(std::move(batch[i].image));
+        }
+        queue->stats.completed += n;
+        queue->stats.batches++;
+        queue->stats.batch_sizes[n < QUEUE_BATCH_BINS ? n : QUEUE_BATCH_BINS - 1]++;
+        queue->stats.inference_seconds += secondsBetween(start, end);
+        batch.clear();
+    }
+}
+
+QueueOptions defaultQueueOptions() {
+    QueueOptions options;
+    options.max_batch = 0;
+    options.max_delay_us = 2000;
+    options.max_pending = 0;
+    return options;
+}
+
+InferenceQueue* createInferenceQueue(TinyANN* tinyANN, const QueueOptions* options) {
+    if (tinyANN == NULL || options == NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: Inference queue needs an execution context and options\n");
+        return NULL;
+    }
+
+    InferenceQueue* queue = new InferenceQueue();
+    queue->tinyANN = tinyANN;
+    queue->image_size = tinyANN->image_filters * tinyANN->image_rows * tinyANN->image_cols;
+    // Larger batches would only be split again by inference_batch()
+    queue->max_batch = options->max_batch == 0 || options->max_batch > tinyANN->max_batch ? tinyANN->max_batch : options->max_batch;
+    queue->max_delay_us = options->max_delay_us;
+    queue->max_pending = options->max_pending;
+    queue->reserved = 0;
+    queue->blocked = 0;
+    queue->stop = false;
+    memset(&queue->stats, 0, sizeof(queue->stats));
+    queue->batch_images.resize(queue->max_batch * queue->image_size);
+
+    queue->scheduler = std::thread(schedulerLoop, queue);
+    return queue;
+}
+
+void destroyInferenceQueue(InferenceQueue* queue) {
+    if (queue == NULL) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->stop = true;
+    }
+    queue->not_empty.notify_all();
+    queue->not_full.notify_all();
+
+    queue->scheduler.join();
+    delete queue;
+}
+
+int submitInference(InferenceQueue* queue, const float* image, InferenceCallback callback, void* user_data) {
+    if (queue == NULL || image == NULL || callback == NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: Inference request needs a queue, an image and a callback\n");
+        return INVALID_ARGUMENT;
+    }
+
+    PendingRequest request;
+    {
+        std::unique_lock<std::mutex> lock(queue->mutex);
+        queue->blocked++;
+        queue->not_full.wait(lock, [&] {
+            return queue->stop || queue->max_pending == 0 || queue->pending.size() + queue->reserved < queue->max_pending;
+        });
+        queue->blocked--;
+        if (queue->stop) {
+            // The scheduler of a stopping queue waits for the last submitter to leave
+            queue->not_empty.notify_one();
+            return INVALID_ARGUMENT;
+        }
+        queue->reserved++;
+        if (!queue->free_images.empty()) {
+            request.image = std::move(queue->free_images.back());
+            queue->free_images.pop_back();
+        }
+    }
+
+    // The copy runs outside the lock, the scheduler keeps taking batches meanwhile
+    request.image.assign(image, image + queue->image_size);
+    request.callback = callback;
+    request.user_data = user_data;
+    request.submitted = Clock::now();
+
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    size_t depth = queue->pending.size();
+    queue->reserved--;
+    queue->stats.submitted++;
+    queue->stats.depths[depthBin(depth)]++;
+    queue->stats.depth = depth + 1;
+    if (depth + 1 > queue->stats.max_depth) {
+        queue->stats.max_depth = depth + 1;
+    }
+    queue->pending.push_back(std::move(request));
+    // The scheduler only needs waking for a first request or a full batch, it wakes by itself when the oldest is due
+    if (depth == 0 || depth + 1 >= queue->max_batch) {
+        queue->not_empty.notify_one();
+    }
+    return SUCCESS;
+}
+
+// Result slot of submitInferenceAndWait()
+typedef struct WaitingRequest {
+    std::mutex mutex;
+    std::condition_variable done_signal;
+    bool done;
+    int status;
+    int class_id;
+} WaitingRequest;
+
+static void completeWaitingRequest(void* user_data, int status, int class_id) {
+    WaitingRequest* waiting = (WaitingRequest*)user_data;
+    std::lock_guard<std::mutex> lock(waiting->mutex);
+    waiting->status = status;
+    waiting->class_id = class_id;
+    waiting->done = true;
+    waiting->done_signal.notify_one();
+}
+
+int submitInferenceAndWait(InferenceQueue* queue, const float* image) {
+    WaitingRequest waiting;
+    waiting.done = false;
+    waiting.status = SUCCESS;
+    waiting.class_id = -1;
+
+    int status = submitInference(queue, image, completeWaitingRequest, &waiting);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    std::unique_lock<std::mutex> lock(waiting.mutex);
+    waiting.done_signal.wait(lock, [&] { return waiting.done; });
+    return waiting.status == SUCCESS ? waiting.class_id : waiting.status;
+}
+
+void snapshotQueueStats(InferenceQueue* queue, QueueStats* stats) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    *stats = queue->stats;
+}
+
+void resetQueueStats(InferenceQueue* queue) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    size_t depth = queue->stats.depth;
+    memset(&queue->stats, 0, sizeof(queue->stats));
+    queue->stats.depth = depth;
+    queue->stats.max_depth = depth;
+}
@@ -0,0 +1,240 @@
+#include "../include/kernels.h"
+#include "../include/gemm.h"
+
+static void convRowScalar(float* out, const float* in, size_t stride, float weight, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        out[j] += weight * in[j * stride];
+    }
+}
+
+static void fcTileScalar(const float* in, size_t in_stride, size_t b_tile, const float* weights, size_t inputs, size_t n_tile,
+                         float acc[FC_TILE][FC_TILE]) {
+    for (size_t b = 0; b < b_tile; b++) {
+        for (size_t n = 0; n < n_tile; n++) {
+            acc[b][n] = 0.0f;
+        }
+    }
+
+    for (size_t m = 0; m < inputs; m++) {
+        for (size_t b = 0; b < b_tile; b++) {
+            float in_val = in[b * in_stride + m];
+            for (size_t n = 0; n < n_tile; n++) {
+                acc[b][n] += in_val * weights[n * inputs + m];
+            }
+        }
+    }
+}
+
+template <int FORMAT>
+static void fcTileHalfScalar(const float* in, size_t in_stride, size_t b_tile, const uint16_t* weights, size_t inputs, size_t n_tile,
+                             float acc[FC_TILE][FC_TILE]) {
+    for (size_t b = 0; b < b_tile; b++) {
+        for (size_t n = 0; n < n_tile; n++) {
+            acc[b][n] = 0.0f;
+        }
+    }
+
+    for (size_t m = 0; m < inputs; m++) {
+        float w[FC_TILE];
+        for (size_t n = 0; n < n_tile; n++) {
+            w[n] = halfToFloat(weights[n * inputs + m], FORMAT);
+        }
+        for (size_t b = 0; b < b_tile; b++) {
+            float in_val = in[b * in_stride + m];
+            for (size_t n = 0; n < n_tile; n++) {
+                acc[b][n] += in_val * w[n];
+            }
+        }
+    }
+}
+
+static void sparseDotScalar(const float* values, const uint32_t* columns, size_t nonzeros, const float* in, size_t in_stride, size_t b_tile,
+                            float acc[FC_TILE]) {
+    for (size_t b = 0; b < b_tile; b++) {
+        const float* image = in + b * in_stride;
+        float sum = 0.0f;
+        for (size_t j = 0; j < nonzeros; j++) {
+            sum += values[j] * image[columns[j]];
+        }
+        acc[b] = sum;
+    }
+}
+
+static void reluScalar(float* data, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        if (data[j] < 0) {
+            data[j] = 0.0f;
+        }
+    }
+}
+
+static void maxPoolRowScalar(const float* in, size_t row_width, size_t kernel_size, size_t stride, float* out, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        float max_val = INT32_MIN;
+        for (size_t x = 0; x < kernel_size; x++) {
+            for (size_t y = 0; y < kernel_size; y++) {
+                if (in[x * row_width + j * stride + y] > max_val) {
+                    max_val = in[x * row_width + j * stride + y];
+                }
+            }
+        }
+        out[j] = max_val;
+    }
+}
+
+static void quantizeS8Scalar(const float* in, int8_t* out, float inv_scale, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        float value = in[j] * inv_scale;
+        value = value > 127.0f ? 127.0f : (value < -127.0f ? -127.0f : value);
+        out[j] = (int8_t)lrintf(value);
+    }
+}
+
+static void dotS8Scalar(const int8_t* a, size_t a_stride, const int8_t* b, size_t k, int32_t acc[QUANT_MR]) {
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        int32_t sum = 0;
+        for (size_t i = 0; i < k; i++) {
+            sum += (int32_t)a[r * a_stride + i] * b[i];
+        }
+        acc[r] = sum;
+    }
+}
+
+static void gemmS8Scalar(const int8_t* a, size_t a_stride, const int8_t* b, size_t k, int32_t c[QUANT_MR][QUANT_NR]) {
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        for (size_t j = 0; j < QUANT_NR; j++) {
+            int32_t sum = 0;
+            for (size_t i = 0; i < k; i += 2) {
+                sum += (int32_t)a[r * a_stride + i] * b[i * QUANT_NR + 2 * j] + (int32_t)a[r * a_stride + i + 1] * b[i * QUANT_NR + 2 * j + 1];
+            }
+            c[r][j] = sum;
+        }
+    }
+}
+
+static void resampleRowScalar(const uint8_t* src, const uint32_t* left, const uint32_t* right, const float* weights, float* out, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        float a = src[left[j]];
+        out[j] = a + weights[j] * (src[right[j]] - a);
+    }
+}
+
+static void lerpNormalizeRowScalar(const float* a, const float* b, float t, float scale, float bias, float* out, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        out[j] = (a[j] + t * (b[j] - a[j])) * scale + bias;
+    }
+}
+
+// Two SSE vectors, the compiler keeps a block of the loops below in registers
+#define SCALAR_CHANNEL_BLOCK 8
+
+static void convBlockRowScalar(float* out, const float* in, size_t in_step, size_t stride, const float* weights, size_t taps, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        float* pixel = out + j * SCALAR_CHANNEL_BLOCK;
+        for (size_t t = 0; t < taps; t++) {
+            float in_val = in[(j * stride + t) * in_step];
+            for (size_t o = 0; o < SCALAR_CHANNEL_BLOCK; o++) {
+                pixel[o] += in_val * weights[t * SCALAR_CHANNEL_BLOCK + o];
+            }
+        }
+    }
+}
+
+static void maxPoolBlockRowScalar(const float* in, size_t row_width, size_t kernel_size, size_t stride, float* out, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        float max_val[SCALAR_CHANNEL_BLOCK];
+        for (size_t o = 0; o < SCALAR_CHANNEL_BLOCK; o++) {
+            max_val[o] = INT32_MIN;
+        }
+        for (size_t x = 0; x < kernel_size; x++) {
+            for (size_t y = 0; y < kernel_size; y++) {
+                const float* pixel = in + (x * row_width + j * stride + y) * SCALAR_CHANNEL_BLOCK;
+                for (size_t o = 0; o < SCALAR_CHANNEL_BLOCK; o++) {
+                    max_val[o] = pixel[o] > max_val[o] ? pixel[o] : max_val[o];
+                }
+            }
+        }
+        memcpy(out + j * SCALAR_CHANNEL_BLOCK, max_val, sizeof(max_val));
+    }
+}
+
+static float expSumScalar(const float* in, size_t n, float shift) {
+    float sum = 0.0f;
+    for (size_t j = 0; j < n; j++) {
+        sum += expf(in[j] - shift);
+    }
+    return sum;
+}
+
+static const KernelTable scalar_kernels = {
+    "scalar",
+    sgemmMicroKernel,
+    convRowScalar,
+    fcTileScalar,
+    fcTileHalfScalar<_weights_fp16>,
+    fcTileHalfScalar<_weights_bf16>,
+    sparseDotScalar,
+    reluScalar,
+    maxPoolRowScalar,
+    quantizeS8Scalar,
+    dotS8Scalar,
+    gemmS8Scalar,
+    resampleRowScalar,
+    lerpNormalizeRowScalar,
+    SCALAR_CHANNEL_BLOCK,
+    convBlockRowScalar,
+    maxPoolBlockRowScalar,
+    expSumScalar,
+};
+
+const KernelTable* scalarKernels() { return &scalar_kernels; }
+
+static int cpuSupports(const KernelTable* kernels) {
+    if (kernels == NULL) {
+        return 0;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (kernels == avx512Kernels()) {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }
+    if (kernels == avx2Kernels()) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    }
+#endif
+    // NEON is part of the aarch64 baseline
+    return 1;
+}
+
+static const KernelTable* detectKernels() {
+#ifdef TINYANN_FORCE_ISA
+    const KernelTable* forced = NULL;
+    if (strcmp(TINYANN_FORCE_ISA, "scalar") == 0) {
+        forced = scalarKernels();
+    } else if (strcmp(TINYANN_FORCE_ISA, "avx2") == 0) {
+        forced = avx2Kernels();
+    } else if (strcmp(TINYANN_FORCE_ISA, "avx512") == 0) {
+        forced = avx512Kernels();
+    } else if (strcmp(TINYANN_FORCE_ISA, "neon") == 0) {
+        forced = neonKernels();
+    }
+
+    if (cpuSupports(forced)) {
+        return forced;
+    }
+    fprintf(stderr, "ERROR TINY_ANN: Kernels (%s) are not available on this build or CPU, using scalar\n", TINYANN_FORCE_ISA);
+    return scalarKernels();
+#else
+    const KernelTable* candidates[] = {avx512Kernels(), avx2Kernels(), neonKernels()};
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        if (cpuSupports(candidates[i])) {
+            return candidates[i];
+        }
+    }
+    return scalarKernels();
+#endif
+}
+
+const KernelTable* selectKernels() {
+    static const KernelTable* selected = detectKernels();
+    return selected;
+}
@@ -0,0 +1,440 @@
+#include "../include/gemm.h"
+#include "../include/kernels.h"
+
+// Compiled with -mavx2 -mfma -mf16c on x86 (see CMakeLists.txt), empty otherwise
+#if defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+
+#include <immintrin.h>
+
+// Eight floats in[0], in[stride], ..., in[7 * stride], stride 2 reads one float past in[14]
+static inline __m256 loadStrided(const float* in, size_t stride) {
+    if (stride == 1) {
+        return _mm256_loadu_ps(in);
+    }
+    if (stride == 2) {
+        __m256 even = _mm256_shuffle_ps(_mm256_loadu_ps(in), _mm256_loadu_ps(in + 8), _MM_SHUFFLE(2, 0, 2, 0));
+        return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(even), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)stride));
+    return _mm256_i32gather_ps(in, index, 4);
+}
+
+// Last j + 8 the vector loop may reach without loadStrided() reading past in[(n - 1) * stride]
+static inline size_t vectorEnd(size_t n, size_t stride) { return stride == 2 ? (n > 0 ? n - 1 : 0) : n; }
+
+static inline float horizontalSum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+static void gemmMicroKernelAvx2(size_t kc, const float* a, const float* b, float* c, size_t ldc, size_t m_rows, size_t n_cols) {
+    __m256 acc[GEMM_MR][2];
+
+    for (size_t i = 0; i < GEMM_MR; i++) {
+        acc[i][0] = _mm256_loadu_ps(c + i * ldc);
+        acc[i][1] = _mm256_loadu_ps(c + i * ldc + 8);
+    }
+
+    for (size_t p = 0; p < kc; p++) {
+        __m256 b0 = _mm256_loadu_ps(b + p * GEMM_NR);
+        __m256 b1 = _mm256_loadu_ps(b + p * GEMM_NR + 8);
+        for (size_t i = 0; i < GEMM_MR; i++) {
+            __m256 a_val = _mm256_broadcast_ss(a + p * GEMM_MR + i);
+            acc[i][0] = _mm256_fmadd_ps(a_val, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(a_val, b1, acc[i][1]);
+        }
+    }
+
+    if (n_cols == GEMM_NR) {
+        for (size_t i = 0; i < m_rows; i++) {
+            _mm256_storeu_ps(c + i * ldc, acc[i][0]);
+            _mm256_storeu_ps(c + i * ldc + 8, acc[i][1]);
+        }
+        return;
+    }
+
+    float tile[GEMM_NR];
+    for (size_t i = 0; i < m_rows; i++) {
+        _mm256_storeu_ps(tile, acc[i][0]);
+        _mm256_storeu_ps(tile + 8, acc[i][1]);
+        memcpy(c + i * ldc, tile, n_cols * sizeof(float));
+    }
+}
+
+static void convRowAvx2(float* out, const float* in, size_t stride, float weight, size_t n) {
+    __m256 w = _mm256_set1_ps(weight);
+    size_t end = vectorEnd(n, stride);
+    size_t j = 0;
+
+    for (; j + 8 <= end; j += 8) {
+        _mm256_storeu_ps(out + j, _mm256_fmadd_ps(w, loadStrided(in + j * stride, stride), _mm256_loadu_ps(out + j)));
+    }
+    for (; j < n; j++) {
+        out[j] = fmaf(weight, in[j * stride], out[j]);
+    }
+}
+
+static void fcTileAvx2(const float* in, size_t in_stride, size_t b_tile, const float* weights, size_t inputs, size_t n_tile,
+                       float acc[FC_TILE][FC_TILE]) {
+    // Rows past n_tile alias row 0 so the loop bounds stay constant, their sums are dropped
+    const float* rows[FC_TILE];
+    for (size_t n = 0; n < FC_TILE; n++) {
+        rows[n] = weights + (n < n_tile ? n : 0) * inputs;
+    }
+
+    // Two images at a time keeps 8 accumulators + 4 weight vectors within the 16 ymm registers
+    for (size_t b0 = 0; b0 < b_tile; b0 += 2) {
+        const float* in0 = in + b0 * in_stride;
+        const float* in1 = b0 + 1 < b_tile ? in0 + in_stride : in0;
+        __m256 sum[2][FC_TILE];
+        for (size_t n = 0; n < FC_TILE; n++) {
+            sum[0][n] = sum[1][n] = _mm256_setzero_ps();
+        }
+
+        size_t m = 0;
+        for (; m + 8 <= inputs; m += 8) {
+            __m256 x0 = _mm256_loadu_ps(in0 + m);
+            __m256 x1 = _mm256_loadu_ps(in1 + m);
+            for (size_t n = 0; n < FC_TILE; n++) {
+                __m256 w = _mm256_loadu_ps(rows[n] + m);
+                sum[0][n] = _mm256_fmadd_ps(x0, w, sum[0][n]);
+                sum[1][n] = _mm256_fmadd_ps(x1, w, sum[1][n]);
+            }
+        }
+
+        for (size_t b = 0; b < 2 && b0 + b < b_tile; b++) {
+            const float* x = b ? in1 : in0;
+            for (size_t n = 0; n < n_tile; n++) {
+                float total = horizontalSum(sum[b][n]);
+                for (size_t k = m; k < inputs; k++) {
+                    total += x[k] * rows[n][k];
+                }
+                acc[b0 + b][n] = total;
+            }
+        }
+    }
+}
+
+// Eight half weights widened to fp32
+template <int FORMAT>
+static inline __m256 loadHalfAvx2(const uint16_t* weights) {
+    __m128i half = _mm_loadu_si128((const __m128i*)weights);
+    if (FORMAT == _weights_bf16) {
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(half), 16));
+    }
+    return _mm256_cvtph_ps(half);
+}
+
+template <int FORMAT>
+static void fcTileHalfAvx2(const float* in, size_t in_stride, size_t b_tile, const uint16_t* weights, size_t inputs, size_t n_tile,
+                           float acc[FC_TILE][FC_TILE]) {
+    // Rows past n_tile alias row 0 so the loop bounds stay constant, their sums are dropped
+    const uint16_t* rows[FC_TILE];
+    for (size_t n = 0; n < FC_TILE; n++) {
+        rows[n] = weights + (n < n_tile ? n : 0) * inputs;
+    }
+
+    // Two images at a time keeps 8 accumulators + 4 weight vectors within the 16 ymm registers
+    for (size_t b0 = 0; b0 < b_tile; b0 += 2) {
+        const float* in0 = in + b0 * in_stride;
+        const float* in1 = b0 + 1 < b_tile ? in0 + in_stride : in0;
+        __m256 sum[2][FC_TILE];
+        for (size_t n = 0; n < FC_TILE; n++) {
+            sum[0][n] = sum[1][n] = _mm256_setzero_ps();
+        }
+
+        size_t m = 0;
+        for (; m + 8 <= inputs; m += 8) {
+            __m256 x0 = _mm256_loadu_ps(in0 + m);
+            __m256 x1 = _mm256_loadu_ps(in1 + m);
+            for (size_t n = 0; n < FC_TILE; n++) {
+                __m256 w = loadHalfAvx2<FORMAT>(rows[n] + m);
+                sum[0][n] = _mm256_fmadd_ps(x0, w, sum[0][n]);
+                sum[1][n] = _mm256_fmadd_ps(x1, w, sum[1][n]);
+            }
+        }
+
+        for (size_t b = 0; b < 2 && b0 + b < b_tile; b++) {
+            const float* x = b ? in1 : in0;
+            for (size_t n = 0; n < n_tile; n++) {
+                float total = horizontalSum(sum[b][n]);
+                for (size_t k = m; k < inputs; k++) {
+                    total += x[k] * halfToFloat(rows[n][k], FORMAT);
+                }
+                acc[b0 + b][n] = total;
+            }
+        }
+    }
+}
+
+static void sparseDotAvx2(const float* values, const uint32_t* columns, size_t nonzeros, const float* in, size_t in_stride, size_t b_tile,
+                          float acc[FC_TILE]) {
+    __m256 sum[FC_TILE];
+    for (size_t b = 0; b < FC_TILE; b++) {
+        sum[b] = _mm256_setzero_ps();
+    }
+
+    // A gather costs about one load per lane, so images past b_tile are skipped rather than aliased
+    size_t j = 0;
+    for (; j + 8 <= nonzeros; j += 8) {
+        __m256i index = _mm256_loadu_si256((const __m256i*)(columns + j));
+        __m256 w = _mm256_loadu_ps(values + j);
+        for (size_t b = 0; b < b_tile; b++) {
+            sum[b] = _mm256_fmadd_ps(_mm256_i32gather_ps(in + b * in_stride, index, 4), w, sum[b]);
+        }
+    }
+
+    for (size_t b = 0; b < b_tile; b++) {
+        float total = horizontalSum(sum[b]);
+        for (size_t k = j; k < nonzeros; k++) {
+            total += values[k] * in[b * in_stride + columns[k]];
+        }
+        acc[b] = total;
+    }
+}
+
+static void reluAvx2(float* data, size_t n) {
+    __m256 zero = _mm256_setzero_ps();
+    size_t j = 0;
+
+    // max(0, x) keeps NaN like the scalar comparison
+    for (; j + 8 <= n; j += 8) {
+        _mm256_storeu_ps(data + j, _mm256_max_ps(zero, _mm256_loadu_ps(data + j)));
+    }
+    for (; j < n; j++) {
+        if (data[j] < 0) {
+            data[j] = 0.0f;
+        }
+    }
+}
+
+static void maxPoolRowAvx2(const float* in, size_t row_width, size_t kernel_size, size_t stride, float* out, size_t n) {
+    size_t end = vectorEnd(n, stride);
+    size_t j = 0;
+
+    for (; j + 8 <= end; j += 8) {
+        __m256 max_val = _mm256_set1_ps((float)INT32_MIN);
+        for (size_t x = 0; x < kernel_size; x++) {
+            for (size_t y = 0; y < kernel_size; y++) {
+                // max(v, max_val) only takes v when v > max_val, same as the scalar kernel
+                max_val = _mm256_max_ps(loadStrided(in + x * row_width + j * stride + y, stride), max_val);
+            }
+        }
+        _mm256_storeu_ps(out + j, max_val);
+    }
+
+    for (; j < n; j++) {
+        float max_val = INT32_MIN;
+        for (size_t x = 0; x < kernel_size; x++) {
+            for (size_t y = 0; y < kernel_size; y++) {
+                if (in[x * row_width + j * stride + y] > max_val) {
+                    max_val = in[x * row_width + j * stride + y];
+                }
+            }
+        }
+        out[j] = max_val;
+    }
+}
+
+static void quantizeS8Avx2(const float* in, int8_t* out, float inv_scale, size_t n) {
+    __m256 scale = _mm256_set1_ps(inv_scale);
+    __m256 low = _mm256_set1_ps(-127.0f);
+    __m256 high = _mm256_set1_ps(127.0f);
+    size_t j = 0;
+
+    // Default rounding mode of the conversion is to nearest even, the same as lrintf()
+    for (; j + 8 <= n; j += 8) {
+        __m256i value = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + j), scale), low), high));
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+        _mm_storel_epi64((__m128i*)(out + j), _mm_packs_epi16(packed, packed));
+    }
+    for (; j < n; j++) {
+        float value = in[j] * inv_scale;
+        value = value > 127.0f ? 127.0f : (value < -127.0f ? -127.0f : value);
+        out[j] = (int8_t)lrintf(value);
+    }
+}
+
+static inline int32_t horizontalSumEpi32(__m256i v) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+static void dotS8Avx2(const int8_t* a, size_t a_stride, const int8_t* b, size_t k, int32_t acc[QUANT_MR]) {
+    __m256i sum[QUANT_MR];
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        sum[r] = _mm256_setzero_si256();
+    }
+
+    // Widened to 16 bit, madd adds neighbouring products into 32 bit lanes (at most 2 * 127 * 127, no overflow)
+    for (size_t i = 0; i < k; i += QUANT_K_ALIGN) {
+        __m256i b_val = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b + i)));
+        for (size_t r = 0; r < QUANT_MR; r++) {
+            __m256i a_val = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + r * a_stride + i)));
+            sum[r] = _mm256_add_epi32(sum[r], _mm256_madd_epi16(a_val, b_val));
+        }
+    }
+
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        acc[r] = horizontalSumEpi32(sum[r]);
+    }
+}
+
+static void gemmS8Avx2(const int8_t* a, size_t a_stride, const int8_t* b, size_t k, int32_t c[QUANT_MR][QUANT_NR]) {
+    __m256i acc[QUANT_MR][2];
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        acc[r][0] = acc[r][1] = _mm256_setzero_si256();
+    }
+
+    // Eight pairs of each weight row are widened at once, every pair is broadcast against the 16 bit pairs of all columns
+    for (size_t i = 0; i < k; i += QUANT_K_ALIGN) {
+        __m256i a_val[QUANT_MR];
+        for (size_t r = 0; r < QUANT_MR; r++) {
+            a_val[r] = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + r * a_stride + i)));
+        }
+
+        for (int p = 0; p < QUANT_K_ALIGN / 2; p++) {
+            const int8_t* b_pair = b + (i + 2 * p) * QUANT_NR;
+            __m256i b0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)b_pair));
+            __m256i b1 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b_pair + 16)));
+            __m256i index = _mm256_set1_epi32(p);
+            for (size_t r = 0; r < QUANT_MR; r++) {
+                __m256i a_pair = _mm256_permutevar8x32_epi32(a_val[r], index);
+                acc[r][0] = _mm256_add_epi32(acc[r][0], _mm256_madd_epi16(a_pair, b0));
+                acc[r][1] = _mm256_add_epi32(acc[r][1], _mm256_madd_epi16(a_pair, b1));
+            }
+        }
+    }
+
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        _mm256_storeu_si256((__m256i*)c[r], acc[r][0]);
+        _mm256_storeu_si256((__m256i*)(c[r] + 8), acc[r][1]);
+    }
+}
+
+// Each lane gathers the 4 bytes ending at its pixel (left[j] >= 3 keeps that inside the row) and keeps the top one
+static inline __m256 gatherBytes(const uint8_t* src, const uint32_t* offsets) {
+    __m256i bytes = _mm256_i32gather_epi32((const int*)(src - 3), _mm256_loadu_si256((const __m256i*)offsets), 1);
+    return _mm256_cvtepi32_ps(_mm256_srli_epi32(bytes, 24));
+}
+
+static void resampleRowAvx2(const uint8_t* src, const uint32_t* left, const uint32_t* right, const float* weights, float* out, size_t n) {
+    size_t j = 0;
+    for (; j < n && left[j] < 3; j++) {
+        float a = src[left[j]];
+        out[j] = a + weights[j] * (src[right[j]] - a);
+    }
+    for (; j + 8 <= n; j += 8) {
+        __m256 a = gatherBytes(src, left + j);
+        _mm256_storeu_ps(out + j, _mm256_fmadd_ps(_mm256_loadu_ps(weights + j), _mm256_sub_ps(gatherBytes(src, right + j), a), a));
+    }
+    for (; j < n; j++) {
+        float a = src[left[j]];
+        out[j] = a + weights[j] * (src[right[j]] - a);
+    }
+}
+
+static void lerpNormalizeRowAvx2(const float* a, const float* b, float t, float scale, float bias, float* out, size_t n) {
+    __m256 t_vec = _mm256_set1_ps(t);
+    __m256 scale_vec = _mm256_set1_ps(scale);
+    __m256 bias_vec = _mm256_set1_ps(bias);
+    size_t j = 0;
+
+    for (; j + 8 <= n; j += 8) {
+        __m256 a_vec = _mm256_loadu_ps(a + j);
+        __m256 value = _mm256_fmadd_ps(t_vec, _mm256_sub_ps(_mm256_loadu_ps(b + j), a_vec), a_vec);
+        _mm256_storeu_ps(out + j, _mm256_fmadd_ps(value, scale_vec, bias_vec));
+    }
+    for (; j < n; j++) {
+        out[j] = (a[j] + t * (b[j] - a[j])) * scale + bias;
+    }
+}
+
+// One output pixel's 8 channels stay in a register across its taps
+static void convBlockRowAvx2(float* out, const float* in, size_t in_step, size_t stride, const float* weights, size_t taps, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        const float* pixel = in + j * stride * in_step;
+        __m256 acc = _mm256_loadu_ps(out + j * 8);
+        for (size_t t = 0; t < taps; t++) {
+            acc = _mm256_fmadd_ps(_mm256_broadcast_ss(pixel + t * in_step), _mm256_loadu_ps(weights + t * 8), acc);
+        }
+        _mm256_storeu_ps(out + j * 8, acc);
+    }
+}
+
+static void maxPoolBlockRowAvx2(const float* in, size_t row_width, size_t kernel_size, size_t stride, float* out, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        __m256 max_val = _mm256_set1_ps((float)INT32_MIN);
+        for (size_t x = 0; x < kernel_size; x++) {
+            for (size_t y = 0; y < kernel_size; y++) {
+                max_val = _mm256_max_ps(_mm256_loadu_ps(in + (x * row_width + j * stride + y) * 8), max_val);
+            }
+        }
+        _mm256_storeu_ps(out + j * 8, max_val);
+    }
+}
+
+static inline __m256 expAvx2(__m256 x) {
+    x = _mm256_max_ps(x, _mm256_set1_ps(EXP_MIN));
+    __m256 k = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(EXP_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(k, _mm256_set1_ps(EXP_LN2_HI), x);
+    r = _mm256_fnmadd_ps(k, _mm256_set1_ps(EXP_LN2_LO), r);
+
+    __m256 p = _mm256_fmadd_ps(_mm256_set1_ps(EXP_C0), r, _mm256_set1_ps(EXP_C1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_C2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_C3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_C4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_C5));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+    __m256i scale = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(scale));
+}
+
+static float expSumAvx2(const float* in, size_t n, float shift) {
+    __m256 shift_vec = _mm256_set1_ps(shift);
+    __m256 sum = _mm256_setzero_ps();
+    size_t j = 0;
+
+    for (; j + 8 <= n; j += 8) {
+        sum = _mm256_add_ps(sum, expAvx2(_mm256_sub_ps(_mm256_loadu_ps(in + j), shift_vec)));
+    }
+    float total = horizontalSum(sum);
+    for (; j < n; j++) {
+        total += expf(in[j] - shift);
+    }
+    return total;
+}
+
+static const KernelTable avx2_kernels = {
+    "avx2",
+    gemmMicroKernelAvx2,
+    convRowAvx2,
+    fcTileAvx2,
+    fcTileHalfAvx2<_weights_fp16>,
+    fcTileHalfAvx2<_weights_bf16>,
+    sparseDotAvx2,
+    reluAvx2,
+    maxPoolRowAvx2,
+    quantizeS8Avx2,
+    dotS8Avx2,
+    gemmS8Avx2,
+    resampleRowAvx2,
+    lerpNormalizeRowAvx2,
+    8,
+    convBlockRowAvx2,
+    maxPoolBlockRowAvx2,
+    expSumAvx2,
+};
+
+const KernelTable* avx2Kernels() { return &avx2_kernels; }
+
+#else
+
+const KernelTable* avx2Kernels() { return NULL; }
+
+#endif
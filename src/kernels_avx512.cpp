@@ -0,0 +1,427 @@
+#include "../include/gemm.h"
+#include "../include/kernels.h"
+
+// Compiled with -mavx512f -mavx512bw -mfma on x86 (see CMakeLists.txt), empty otherwise
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__FMA__)
+
+// GCC 12's avx512fintrin.h passes _mm*_undefined_*() as merge sources and then warns about them under -Wall (GCC bug 105593)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+static inline __mmask16 tailMask(size_t count) { return (__mmask16)((1u << count) - 1); }
+
+static inline __m512i strideIndex(size_t stride) {
+    return _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32((int)stride));
+}
+
+// Index vector loadStrided() expects: the even lanes of two loads for stride 2, gather offsets otherwise
+static inline __m512i loadIndex(size_t stride) {
+    if (stride == 2) {
+        return _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    }
+    return strideIndex(stride);
+}
+
+// Sixteen floats in[0], in[stride], ..., in[15 * stride], stride 2 reads one float past in[30]
+static inline __m512 loadStrided(const float* in, size_t stride, __m512i index) {
+    if (stride == 1) {
+        return _mm512_loadu_ps(in);
+    }
+    if (stride == 2) {
+        return _mm512_permutex2var_ps(_mm512_loadu_ps(in), index, _mm512_loadu_ps(in + 16));
+    }
+    return _mm512_i32gather_ps(index, in, 4);
+}
+
+// Only the lanes in mask are read
+static inline __m512 maskLoadStrided(__m512 src, __mmask16 mask, const float* in, size_t stride, __m512i index) {
+    if (stride == 1) {
+        return _mm512_mask_loadu_ps(src, mask, in);
+    }
+    return _mm512_mask_i32gather_ps(src, mask, index, in, 4);
+}
+
+static inline size_t vectorEnd(size_t n, size_t stride) { return stride == 2 ? (n > 0 ? n - 1 : 0) : n; }
+
+static void gemmMicroKernelAvx512(size_t kc, const float* a, const float* b, float* c, size_t ldc, size_t m_rows, size_t n_cols) {
+    __m512 acc[GEMM_MR];
+
+    for (size_t i = 0; i < GEMM_MR; i++) {
+        acc[i] = _mm512_loadu_ps(c + i * ldc);
+    }
+
+    for (size_t p = 0; p < kc; p++) {
+        __m512 b_row = _mm512_loadu_ps(b + p * GEMM_NR);
+        for (size_t i = 0; i < GEMM_MR; i++) {
+            acc[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[p * GEMM_MR + i]), b_row, acc[i]);
+        }
+    }
+
+    __mmask16 mask = tailMask(n_cols);
+    for (size_t i = 0; i < m_rows; i++) {
+        _mm512_mask_storeu_ps(c + i * ldc, mask, acc[i]);
+    }
+}
+
+static void convRowAvx512(float* out, const float* in, size_t stride, float weight, size_t n) {
+    __m512 w = _mm512_set1_ps(weight);
+    __m512i index = loadIndex(stride);
+    __m512i gather_index = strideIndex(stride);
+    size_t end = vectorEnd(n, stride);
+    size_t j = 0;
+
+    for (; j + 16 <= end; j += 16) {
+        _mm512_storeu_ps(out + j, _mm512_fmadd_ps(w, loadStrided(in + j * stride, stride, index), _mm512_loadu_ps(out + j)));
+    }
+    for (; j < n; j += 16) {
+        __mmask16 mask = tailMask(n - j < 16 ? n - j : 16);
+        __m512 v = maskLoadStrided(_mm512_setzero_ps(), mask, in + j * stride, stride, gather_index);
+        _mm512_mask_storeu_ps(out + j, mask, _mm512_fmadd_ps(w, v, _mm512_maskz_loadu_ps(mask, out + j)));
+    }
+}
+
+static void fcTileAvx512(const float* in, size_t in_stride, size_t b_tile, const float* weights, size_t inputs, size_t n_tile,
+                         float acc[FC_TILE][FC_TILE]) {
+    // Rows and images past the tile alias the first one so the loop bounds stay constant, their sums are dropped
+    const float* rows[FC_TILE];
+    const float* images[FC_TILE];
+    for (size_t n = 0; n < FC_TILE; n++) {
+        rows[n] = weights + (n < n_tile ? n : 0) * inputs;
+        images[n] = in + (n < b_tile ? n : 0) * in_stride;
+    }
+
+    __m512 sum[FC_TILE][FC_TILE];
+    for (size_t b = 0; b < FC_TILE; b++) {
+        for (size_t n = 0; n < FC_TILE; n++) {
+            sum[b][n] = _mm512_setzero_ps();
+        }
+    }
+
+    for (size_t m = 0; m < inputs; m += 16) {
+        __mmask16 mask = tailMask(inputs - m < 16 ? inputs - m : 16);
+        __m512 w[FC_TILE];
+        for (size_t n = 0; n < FC_TILE; n++) {
+            w[n] = _mm512_maskz_loadu_ps(mask, rows[n] + m);
+        }
+        for (size_t b = 0; b < FC_TILE; b++) {
+            __m512 x = _mm512_maskz_loadu_ps(mask, images[b] + m);
+            for (size_t n = 0; n < FC_TILE; n++) {
+                sum[b][n] = _mm512_fmadd_ps(x, w[n], sum[b][n]);
+            }
+        }
+    }
+
+    for (size_t b = 0; b < b_tile; b++) {
+        for (size_t n = 0; n < n_tile; n++) {
+            acc[b][n] = _mm512_reduce_add_ps(sum[b][n]);
+        }
+    }
+}
+
+// Sixteen half weights widened to fp32, only the lanes in mask are read
+template <int FORMAT>
+static inline __m512 loadHalfAvx512(__mmask16 mask, const uint16_t* weights) {
+    __m256i half = _mm512_castsi512_si256(_mm512_maskz_loadu_epi16((__mmask32)mask, weights));
+    if (FORMAT == _weights_bf16) {
+        return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(half), 16));
+    }
+    return _mm512_cvtph_ps(half);
+}
+
+template <int FORMAT>
+static void fcTileHalfAvx512(const float* in, size_t in_stride, size_t b_tile, const uint16_t* weights, size_t inputs, size_t n_tile,
+                             float acc[FC_TILE][FC_TILE]) {
+    // Rows and images past the tile alias the first one so the loop bounds stay constant, their sums are dropped
+    const uint16_t* rows[FC_TILE];
+    const float* images[FC_TILE];
+    for (size_t n = 0; n < FC_TILE; n++) {
+        rows[n] = weights + (n < n_tile ? n : 0) * inputs;
+        images[n] = in + (n < b_tile ? n : 0) * in_stride;
+    }
+
+    __m512 sum[FC_TILE][FC_TILE];
+    for (size_t b = 0; b < FC_TILE; b++) {
+        for (size_t n = 0; n < FC_TILE; n++) {
+            sum[b][n] = _mm512_setzero_ps();
+        }
+    }
+
+    for (size_t m = 0; m < inputs; m += 16) {
+        __mmask16 mask = tailMask(inputs - m < 16 ? inputs - m : 16);
+        __m512 w[FC_TILE];
+        for (size_t n = 0; n < FC_TILE; n++) {
+            w[n] = loadHalfAvx512<FORMAT>(mask, rows[n] + m);
+        }
+        for (size_t b = 0; b < FC_TILE; b++) {
+            __m512 x = _mm512_maskz_loadu_ps(mask, images[b] + m);
+            for (size_t n = 0; n < FC_TILE; n++) {
+                sum[b][n] = _mm512_fmadd_ps(x, w[n], sum[b][n]);
+            }
+        }
+    }
+
+    for (size_t b = 0; b < b_tile; b++) {
+        for (size_t n = 0; n < n_tile; n++) {
+            acc[b][n] = _mm512_reduce_add_ps(sum[b][n]);
+        }
+    }
+}
+
+static void sparseDotAvx512(const float* values, const uint32_t* columns, size_t nonzeros, const float* in, size_t in_stride,
+                            size_t b_tile, float acc[FC_TILE]) {
+    __m512 sum[FC_TILE];
+    for (size_t b = 0; b < FC_TILE; b++) {
+        sum[b] = _mm512_setzero_ps();
+    }
+
+    // A gather costs about one load per lane, so images past b_tile are skipped rather than aliased
+    for (size_t j = 0; j < nonzeros; j += 16) {
+        __mmask16 mask = tailMask(nonzeros - j < 16 ? nonzeros - j : 16);
+        __m512i index = _mm512_maskz_loadu_epi32(mask, columns + j);
+        __m512 w = _mm512_maskz_loadu_ps(mask, values + j);
+        for (size_t b = 0; b < b_tile; b++) {
+            __m512 x = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, index, in + b * in_stride, 4);
+            sum[b] = _mm512_fmadd_ps(x, w, sum[b]);
+        }
+    }
+
+    for (size_t b = 0; b < b_tile; b++) {
+        acc[b] = _mm512_reduce_add_ps(sum[b]);
+    }
+}
+
+static void reluAvx512(float* data, size_t n) {
+    __m512 zero = _mm512_setzero_ps();
+
+    // max(0, x) keeps NaN like the scalar comparison
+    for (size_t j = 0; j < n; j += 16) {
+        __mmask16 mask = tailMask(n - j < 16 ? n - j : 16);
+        _mm512_mask_storeu_ps(data + j, mask, _mm512_max_ps(zero, _mm512_maskz_loadu_ps(mask, data + j)));
+    }
+}
+
+static void maxPoolRowAvx512(const float* in, size_t row_width, size_t kernel_size, size_t stride, float* out, size_t n) {
+    __m512i index = loadIndex(stride);
+    __m512i gather_index = strideIndex(stride);
+    size_t end = vectorEnd(n, stride);
+    size_t j = 0;
+
+    // max(v, max_val) only takes v when v > max_val, same as the scalar kernel
+    for (; j + 16 <= end; j += 16) {
+        __m512 max_val = _mm512_set1_ps((float)INT32_MIN);
+        for (size_t x = 0; x < kernel_size; x++) {
+            for (size_t y = 0; y < kernel_size; y++) {
+                max_val = _mm512_max_ps(loadStrided(in + x * row_width + j * stride + y, stride, index), max_val);
+            }
+        }
+        _mm512_storeu_ps(out + j, max_val);
+    }
+
+    for (; j < n; j += 16) {
+        __mmask16 mask = tailMask(n - j < 16 ? n - j : 16);
+        __m512 max_val = _mm512_set1_ps((float)INT32_MIN);
+        for (size_t x = 0; x < kernel_size; x++) {
+            for (size_t y = 0; y < kernel_size; y++) {
+                __m512 v = maskLoadStrided(max_val, mask, in + x * row_width + j * stride + y, stride, gather_index);
+                max_val = _mm512_max_ps(v, max_val);
+            }
+        }
+        _mm512_mask_storeu_ps(out + j, mask, max_val);
+    }
+}
+
+static void quantizeS8Avx512(const float* in, int8_t* out, float inv_scale, size_t n) {
+    __m512 scale = _mm512_set1_ps(inv_scale);
+    __m512 low = _mm512_set1_ps(-127.0f);
+    __m512 high = _mm512_set1_ps(127.0f);
+    size_t j = 0;
+
+    for (; j + 16 <= n; j += 16) {
+        __m512 value = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(in + j), scale), low), high);
+        _mm_storeu_si128((__m128i*)(out + j), _mm512_cvtsepi32_epi8(_mm512_cvtps_epi32(value)));
+    }
+    for (; j < n; j++) {
+        float value = in[j] * inv_scale;
+        value = value > 127.0f ? 127.0f : (value < -127.0f ? -127.0f : value);
+        out[j] = (int8_t)lrintf(value);
+    }
+}
+
+// 32 int8 at p, or 16 followed by zeros
+static inline __m512i loadS8AsS16(const int8_t* p, int half) {
+    if (half) {
+        return _mm512_cvtepi8_epi16(_mm256_inserti128_si256(_mm256_setzero_si256(), _mm_loadu_si128((const __m128i*)p), 0));
+    }
+    return _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i*)p));
+}
+
+static void dotS8Avx512(const int8_t* a, size_t a_stride, const int8_t* b, size_t k, int32_t acc[QUANT_MR]) {
+    __m512i sum[QUANT_MR];
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        sum[r] = _mm512_setzero_si512();
+    }
+
+    // 32 int8 widened to 16 bit per step, k is only a multiple of 16 so the last step may be half a vector
+    for (size_t i = 0; i < k; i += 32) {
+        int half = k - i < 32;
+        __m512i b_val = loadS8AsS16(b + i, half);
+        for (size_t r = 0; r < QUANT_MR; r++) {
+            sum[r] = _mm512_add_epi32(sum[r], _mm512_madd_epi16(loadS8AsS16(a + r * a_stride + i, half), b_val));
+        }
+    }
+
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        acc[r] = _mm512_reduce_add_epi32(sum[r]);
+    }
+}
+
+static void gemmS8Avx512(const int8_t* a, size_t a_stride, const int8_t* b, size_t k, int32_t c[QUANT_MR][QUANT_NR]) {
+    __m512i acc[QUANT_MR];
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        acc[r] = _mm512_setzero_si512();
+    }
+
+    // Eight pairs of each weight row are widened at once, every pair is broadcast against the 16 bit pairs of all columns
+    for (size_t i = 0; i < k; i += QUANT_K_ALIGN) {
+        __m512i a_val[QUANT_MR];
+        for (size_t r = 0; r < QUANT_MR; r++) {
+            a_val[r] = _mm512_castsi256_si512(_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + r * a_stride + i))));
+        }
+
+        for (int p = 0; p < QUANT_K_ALIGN / 2; p++) {
+            __m512i b_val = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i*)(b + (i + 2 * p) * QUANT_NR)));
+            __m512i index = _mm512_set1_epi32(p);
+            for (size_t r = 0; r < QUANT_MR; r++) {
+                acc[r] = _mm512_add_epi32(acc[r], _mm512_madd_epi16(_mm512_permutexvar_epi32(index, a_val[r]), b_val));
+            }
+        }
+    }
+
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        _mm512_storeu_si512(c[r], acc[r]);
+    }
+}
+
+// Each lane gathers the 4 bytes ending at its pixel (left[j] >= 3 keeps that inside the row) and keeps the top one
+static inline __m512 gatherBytes(const uint8_t* src, const uint32_t* offsets, __mmask16 mask) {
+    __m512i index = _mm512_maskz_loadu_epi32(mask, offsets);
+    __m512i bytes = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, index, (const int*)(src - 3), 1);
+    return _mm512_cvtepi32_ps(_mm512_srli_epi32(bytes, 24));
+}
+
+static void resampleRowAvx512(const uint8_t* src, const uint32_t* left, const uint32_t* right, const float* weights, float* out, size_t n) {
+    size_t j = 0;
+    for (; j < n && left[j] < 3; j++) {
+        float a = src[left[j]];
+        out[j] = a + weights[j] * (src[right[j]] - a);
+    }
+    for (; j < n; j += 16) {
+        __mmask16 mask = tailMask(n - j < 16 ? n - j : 16);
+        __m512 a = gatherBytes(src, left + j, mask);
+        __m512 value = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, weights + j), _mm512_sub_ps(gatherBytes(src, right + j, mask), a), a);
+        _mm512_mask_storeu_ps(out + j, mask, value);
+    }
+}
+
+static void lerpNormalizeRowAvx512(const float* a, const float* b, float t, float scale, float bias, float* out, size_t n) {
+    __m512 t_vec = _mm512_set1_ps(t);
+    __m512 scale_vec = _mm512_set1_ps(scale);
+    __m512 bias_vec = _mm512_set1_ps(bias);
+
+    for (size_t j = 0; j < n; j += 16) {
+        __mmask16 mask = tailMask(n - j < 16 ? n - j : 16);
+        __m512 a_vec = _mm512_maskz_loadu_ps(mask, a + j);
+        __m512 value = _mm512_fmadd_ps(t_vec, _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, b + j), a_vec), a_vec);
+        _mm512_mask_storeu_ps(out + j, mask, _mm512_fmadd_ps(value, scale_vec, bias_vec));
+    }
+}
+
+// One output pixel's 16 channels stay in a register across its taps
+static void convBlockRowAvx512(float* out, const float* in, size_t in_step, size_t stride, const float* weights, size_t taps, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        const float* pixel = in + j * stride * in_step;
+        __m512 acc = _mm512_loadu_ps(out + j * 16);
+        for (size_t t = 0; t < taps; t++) {
+            acc = _mm512_fmadd_ps(_mm512_set1_ps(pixel[t * in_step]), _mm512_loadu_ps(weights + t * 16), acc);
+        }
+        _mm512_storeu_ps(out + j * 16, acc);
+    }
+}
+
+static void maxPoolBlockRowAvx512(const float* in, size_t row_width, size_t kernel_size, size_t stride, float* out, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        __m512 max_val = _mm512_set1_ps((float)INT32_MIN);
+        for (size_t x = 0; x < kernel_size; x++) {
+            for (size_t y = 0; y < kernel_size; y++) {
+                max_val = _mm512_max_ps(_mm512_loadu_ps(in + (x * row_width + j * stride + y) * 16), max_val);
+            }
+        }
+        _mm512_storeu_ps(out + j * 16, max_val);
+    }
+}
+
+static inline __m512 expAvx512(__m512 x) {
+    x = _mm512_max_ps(x, _mm512_set1_ps(EXP_MIN));
+    __m512 k = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(EXP_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(k, _mm512_set1_ps(EXP_LN2_HI), x);
+    r = _mm512_fnmadd_ps(k, _mm512_set1_ps(EXP_LN2_LO), r);
+
+    __m512 p = _mm512_fmadd_ps(_mm512_set1_ps(EXP_C0), r, _mm512_set1_ps(EXP_C1));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_C2));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_C3));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_C4));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_C5));
+    p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+    __m512i scale = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(k), _mm512_set1_epi32(127)), 23);
+    return _mm512_mul_ps(p, _mm512_castsi512_ps(scale));
+}
+
+static float expSumAvx512(const float* in, size_t n, float shift) {
+    __m512 shift_vec = _mm512_set1_ps(shift);
+    __m512 sum = _mm512_setzero_ps();
+
+    // Lanes past n are loaded as shift and left out of the sum
+    for (size_t j = 0; j < n; j += 16) {
+        __mmask16 mask = tailMask(n - j < 16 ? n - j : 16);
+        __m512 x = _mm512_sub_ps(_mm512_mask_loadu_ps(shift_vec, mask, in + j), shift_vec);
+        sum = _mm512_mask_add_ps(sum, mask, sum, expAvx512(x));
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+static const KernelTable avx512_kernels = {
+    "avx512",
+    gemmMicroKernelAvx512,
+    convRowAvx512,
+    fcTileAvx512,
+    fcTileHalfAvx512<_weights_fp16>,
+    fcTileHalfAvx512<_weights_bf16>,
+    sparseDotAvx512,
+    reluAvx512,
+    maxPoolRowAvx512,
+    quantizeS8Avx512,
+    dotS8Avx512,
+    gemmS8Avx512,
+    resampleRowAvx512,
+    lerpNormalizeRowAvx512,
+    16,
+    convBlockRowAvx512,
+    maxPoolBlockRowAvx512,
+    expSumAvx512,
+};
+
+const KernelTable* avx512Kernels() { return &avx512_kernels; }
+
+#else
+
+const KernelTable* avx512Kernels() { return NULL; }
+
+#endif
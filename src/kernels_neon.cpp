@@ -0,0 +1,413 @@
+#include "../include/gemm.h"
+#include "../include/kernels.h"
+
+// NEON is always available on aarch64, empty on other targets. TINYANN_NEON_EMULATION builds the kernels anywhere against
+// the scalar <arm_neon.h> of tests/neon, only for tinyann_test_kernels
+#if (defined(__aarch64__) && defined(__ARM_NEON)) || defined(TINYANN_NEON_EMULATION)
+
+#include <arm_neon.h>
+
+// Four floats in[0], in[stride], in[2 * stride], in[3 * stride], stride 2 reads one float past in[6]
+static inline float32x4_t loadStrided(const float* in, size_t stride) {
+    if (stride == 1) {
+        return vld1q_f32(in);
+    }
+    if (stride == 2) {
+        return vld2q_f32(in).val[0];
+    }
+    float lanes[4] = {in[0], in[stride], in[2 * stride], in[3 * stride]};
+    return vld1q_f32(lanes);
+}
+
+static inline size_t vectorEnd(size_t n, size_t stride) { return stride == 2 ? (n > 0 ? n - 1 : 0) : n; }
+
+static void gemmMicroKernelNeon(size_t kc, const float* a, const float* b, float* c, size_t ldc, size_t m_rows, size_t n_cols) {
+    float32x4_t acc[GEMM_MR][GEMM_NR / 4];
+
+    for (size_t i = 0; i < GEMM_MR; i++) {
+        for (size_t v = 0; v < GEMM_NR / 4; v++) {
+            acc[i][v] = vld1q_f32(c + i * ldc + v * 4);
+        }
+    }
+
+    for (size_t p = 0; p < kc; p++) {
+        float32x4_t b_row[GEMM_NR / 4];
+        for (size_t v = 0; v < GEMM_NR / 4; v++) {
+            b_row[v] = vld1q_f32(b + p * GEMM_NR + v * 4);
+        }
+        float32x4_t a_col = vld1q_f32(a + p * GEMM_MR);
+        for (size_t v = 0; v < GEMM_NR / 4; v++) {
+            acc[0][v] = vfmaq_laneq_f32(acc[0][v], b_row[v], a_col, 0);
+            acc[1][v] = vfmaq_laneq_f32(acc[1][v], b_row[v], a_col, 1);
+            acc[2][v] = vfmaq_laneq_f32(acc[2][v], b_row[v], a_col, 2);
+            acc[3][v] = vfmaq_laneq_f32(acc[3][v], b_row[v], a_col, 3);
+        }
+    }
+
+    float tile[GEMM_NR];
+    for (size_t i = 0; i < m_rows; i++) {
+        for (size_t v = 0; v < GEMM_NR / 4; v++) {
+            vst1q_f32(tile + v * 4, acc[i][v]);
+        }
+        memcpy(c + i * ldc, tile, n_cols * sizeof(float));
+    }
+}
+
+static void convRowNeon(float* out, const float* in, size_t stride, float weight, size_t n) {
+    size_t end = vectorEnd(n, stride);
+    size_t j = 0;
+
+    for (; j + 4 <= end; j += 4) {
+        vst1q_f32(out + j, vfmaq_n_f32(vld1q_f32(out + j), loadStrided(in + j * stride, stride), weight));
+    }
+    for (; j < n; j++) {
+        out[j] = fmaf(weight, in[j * stride], out[j]);
+    }
+}
+
+static void fcTileNeon(const float* in, size_t in_stride, size_t b_tile, const float* weights, size_t inputs, size_t n_tile,
+                       float acc[FC_TILE][FC_TILE]) {
+    // Rows and images past the tile alias the first one so the loop bounds stay constant, their sums are dropped
+    const float* rows[FC_TILE];
+    const float* images[FC_TILE];
+    for (size_t n = 0; n < FC_TILE; n++) {
+        rows[n] = weights + (n < n_tile ? n : 0) * inputs;
+        images[n] = in + (n < b_tile ? n : 0) * in_stride;
+    }
+
+    float32x4_t sum[FC_TILE][FC_TILE];
+    for (size_t b = 0; b < FC_TILE; b++) {
+        for (size_t n = 0; n < FC_TILE; n++) {
+            sum[b][n] = vdupq_n_f32(0.0f);
+        }
+    }
+
+    size_t m = 0;
+    for (; m + 4 <= inputs; m += 4) {
+        float32x4_t w[FC_TILE];
+        for (size_t n = 0; n < FC_TILE; n++) {
+            w[n] = vld1q_f32(rows[n] + m);
+        }
+        for (size_t b = 0; b < FC_TILE; b++) {
+            float32x4_t x = vld1q_f32(images[b] + m);
+            for (size_t n = 0; n < FC_TILE; n++) {
+                sum[b][n] = vfmaq_f32(sum[b][n], x, w[n]);
+            }
+        }
+    }
+
+    for (size_t b = 0; b < b_tile; b++) {
+        for (size_t n = 0; n < n_tile; n++) {
+            float total = vaddvq_f32(sum[b][n]);
+            for (size_t k = m; k < inputs; k++) {
+                total += images[b][k] * rows[n][k];
+            }
+            acc[b][n] = total;
+        }
+    }
+}
+
+// Four half weights widened to fp32
+template <int FORMAT>
+static inline float32x4_t loadHalfNeon(const uint16_t* weights) {
+    uint16x4_t half = vld1_u16(weights);
+    if (FORMAT == _weights_bf16) {
+        return vreinterpretq_f32_u32(vshll_n_u16(half, 16));
+    }
+    return vcvt_f32_f16(vreinterpret_f16_u16(half));
+}
+
+template <int FORMAT>
+static void fcTileHalfNeon(const float* in, size_t in_stride, size_t b_tile, const uint16_t* weights, size_t inputs, size_t n_tile,
+                           float acc[FC_TILE][FC_TILE]) {
+    // Rows and images past the tile alias the first one so the loop bounds stay constant, their sums are dropped
+    const uint16_t* rows[FC_TILE];
+    const float* images[FC_TILE];
+    for (size_t n = 0; n < FC_TILE; n++) {
+        rows[n] = weights + (n < n_tile ? n : 0) * inputs;
+        images[n] = in + (n < b_tile ? n : 0) * in_stride;
+    }
+
+    float32x4_t sum[FC_TILE][FC_TILE];
+    for (size_t b = 0; b < FC_TILE; b++) {
+        for (size_t n = 0; n < FC_TILE; n++) {
+            sum[b][n] = vdupq_n_f32(0.0f);
+        }
+    }
+
+    size_t m = 0;
+    for (; m + 4 <= inputs; m += 4) {
+        float32x4_t w[FC_TILE];
+        for (size_t n = 0; n < FC_TILE; n++) {
+            w[n] = loadHalfNeon<FORMAT>(rows[n] + m);
+        }
+        for (size_t b = 0; b < FC_TILE; b++) {
+            float32x4_t x = vld1q_f32(images[b] + m);
+            for (size_t n = 0; n < FC_TILE; n++) {
+                sum[b][n] = vfmaq_f32(sum[b][n], x, w[n]);
+            }
+        }
+    }
+
+    for (size_t b = 0; b < b_tile; b++) {
+        for (size_t n = 0; n < n_tile; n++) {
+            float total = vaddvq_f32(sum[b][n]);
+            for (size_t k = m; k < inputs; k++) {
+                total += images[b][k] * halfToFloat(rows[n][k], FORMAT);
+            }
+            acc[b][n] = total;
+        }
+    }
+}
+
+static void sparseDotNeon(const float* values, const uint32_t* columns, size_t nonzeros, const float* in, size_t in_stride, size_t b_tile,
+                          float acc[FC_TILE]) {
+    for (size_t b = 0; b < b_tile; b++) {
+        const float* image = in + b * in_stride;
+        float32x4_t sum = vdupq_n_f32(0.0f);
+
+        // NEON has no gather, the four inputs are loaded lane by lane
+        size_t j = 0;
+        for (; j + 4 <= nonzeros; j += 4) {
+            float32x4_t x = vld1q_dup_f32(image + columns[j]);
+            x = vld1q_lane_f32(image + columns[j + 1], x, 1);
+            x = vld1q_lane_f32(image + columns[j + 2], x, 2);
+            x = vld1q_lane_f32(image + columns[j + 3], x, 3);
+            sum = vfmaq_f32(sum, x, vld1q_f32(values + j));
+        }
+
+        float total = vaddvq_f32(sum);
+        for (; j < nonzeros; j++) {
+            total += values[j] * image[columns[j]];
+        }
+        acc[b] = total;
+    }
+}
+
+static void reluNeon(float* data, size_t n) {
+    float32x4_t zero = vdupq_n_f32(0.0f);
+    size_t j = 0;
+
+    for (; j + 4 <= n; j += 4) {
+        vst1q_f32(data + j, vmaxq_f32(zero, vld1q_f32(data + j)));
+    }
+    for (; j < n; j++) {
+        if (data[j] < 0) {
+            data[j] = 0.0f;
+        }
+    }
+}
+
+static void maxPoolRowNeon(const float* in, size_t row_width, size_t kernel_size, size_t stride, float* out, size_t n) {
+    size_t end = vectorEnd(n, stride);
+    size_t j = 0;
+
+    for (; j + 4 <= end; j += 4) {
+        float32x4_t max_val = vdupq_n_f32((float)INT32_MIN);
+        for (size_t x = 0; x < kernel_size; x++) {
+            for (size_t y = 0; y < kernel_size; y++) {
+                max_val = vmaxq_f32(max_val, loadStrided(in + x * row_width + j * stride + y, stride));
+            }
+        }
+        vst1q_f32(out + j, max_val);
+    }
+
+    for (; j < n; j++) {
+        float max_val = INT32_MIN;
+        for (size_t x = 0; x < kernel_size; x++) {
+            for (size_t y = 0; y < kernel_size; y++) {
+                if (in[x * row_width + j * stride + y] > max_val) {
+                    max_val = in[x * row_width + j * stride + y];
+                }
+            }
+        }
+        out[j] = max_val;
+    }
+}
+
+static void quantizeS8Neon(const float* in, int8_t* out, float inv_scale, size_t n) {
+    float32x4_t low = vdupq_n_f32(-127.0f);
+    float32x4_t high = vdupq_n_f32(127.0f);
+    size_t j = 0;
+
+    for (; j + 8 <= n; j += 8) {
+        float32x4_t v0 = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(in + j), inv_scale), low), high);
+        float32x4_t v1 = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(in + j + 4), inv_scale), low), high);
+        int16x8_t packed = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(v0)), vqmovn_s32(vcvtnq_s32_f32(v1)));
+        vst1_s8(out + j, vqmovn_s16(packed));
+    }
+    for (; j < n; j++) {
+        float value = in[j] * inv_scale;
+        value = value > 127.0f ? 127.0f : (value < -127.0f ? -127.0f : value);
+        out[j] = (int8_t)lrintf(value);
+    }
+}
+
+static void dotS8Neon(const int8_t* a, size_t a_stride, const int8_t* b, size_t k, int32_t acc[QUANT_MR]) {
+    int32x4_t sum[QUANT_MR];
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        sum[r] = vdupq_n_s32(0);
+    }
+
+    // Two products per 16 bit lane (at most 2 * 127 * 127, no overflow) before widening into the 32 bit sums
+    for (size_t i = 0; i < k; i += QUANT_K_ALIGN) {
+        int8x16_t b_val = vld1q_s8(b + i);
+        for (size_t r = 0; r < QUANT_MR; r++) {
+            int8x16_t a_val = vld1q_s8(a + r * a_stride + i);
+            int16x8_t products = vmull_s8(vget_low_s8(a_val), vget_low_s8(b_val));
+            sum[r] = vpadalq_s16(sum[r], vmlal_high_s8(products, a_val, b_val));
+        }
+    }
+
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        acc[r] = vaddvq_s32(sum[r]);
+    }
+}
+
+static void gemmS8Neon(const int8_t* a, size_t a_stride, const int8_t* b, size_t k, int32_t c[QUANT_MR][QUANT_NR]) {
+    int32x4_t acc[QUANT_MR][4];
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        for (int q = 0; q < 4; q++) {
+            acc[r][q] = vdupq_n_s32(0);
+        }
+    }
+
+    // Every weight pair is repeated across a vector, the products of one column pair are added into its 32 bit lane
+    for (size_t i = 0; i < k; i += 2) {
+        int8x16_t b0 = vld1q_s8(b + i * QUANT_NR);
+        int8x16_t b1 = vld1q_s8(b + i * QUANT_NR + 16);
+        for (size_t r = 0; r < QUANT_MR; r++) {
+            int16_t pair;
+            memcpy(&pair, a + r * a_stride + i, sizeof(pair));
+            int8x16_t a_pair = vreinterpretq_s8_s16(vdupq_n_s16(pair));
+            acc[r][0] = vpadalq_s16(acc[r][0], vmull_s8(vget_low_s8(a_pair), vget_low_s8(b0)));
+            acc[r][1] = vpadalq_s16(acc[r][1], vmull_high_s8(a_pair, b0));
+            acc[r][2] = vpadalq_s16(acc[r][2], vmull_s8(vget_low_s8(a_pair), vget_low_s8(b1)));
+            acc[r][3] = vpadalq_s16(acc[r][3], vmull_high_s8(a_pair, b1));
+        }
+    }
+
+    for (size_t r = 0; r < QUANT_MR; r++) {
+        for (int q = 0; q < 4; q++) {
+            vst1q_s32(c[r] + 4 * q, acc[r][q]);
+        }
+    }
+}
+
+// NEON has no gather, the lanes are loaded one by one and only the blend is vectorized
+static void resampleRowNeon(const uint8_t* src, const uint32_t* left, const uint32_t* right, const float* weights, float* out, size_t n) {
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        float a[4], b[4];
+        for (size_t k = 0; k < 4; k++) {
+            a[k] = src[left[j + k]];
+            b[k] = src[right[j + k]];
+        }
+        float32x4_t a_vec = vld1q_f32(a);
+        vst1q_f32(out + j, vfmaq_f32(a_vec, vld1q_f32(weights + j), vsubq_f32(vld1q_f32(b), a_vec)));
+    }
+    for (; j < n; j++) {
+        float a = src[left[j]];
+        out[j] = a + weights[j] * (src[right[j]] - a);
+    }
+}
+
+static void lerpNormalizeRowNeon(const float* a, const float* b, float t, float scale, float bias, float* out, size_t n) {
+    float32x4_t scale_vec = vdupq_n_f32(scale);
+    float32x4_t bias_vec = vdupq_n_f32(bias);
+    size_t j = 0;
+
+    for (; j + 4 <= n; j += 4) {
+        float32x4_t a_vec = vld1q_f32(a + j);
+        float32x4_t value = vfmaq_n_f32(a_vec, vsubq_f32(vld1q_f32(b + j), a_vec), t);
+        vst1q_f32(out + j, vfmaq_f32(bias_vec, value, scale_vec));
+    }
+    for (; j < n; j++) {
+        out[j] = (a[j] + t * (b[j] - a[j])) * scale + bias;
+    }
+}
+
+// One output pixel's 4 channels stay in a register across its taps
+static void convBlockRowNeon(float* out, const float* in, size_t in_step, size_t stride, const float* weights, size_t taps, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        const float* pixel = in + j * stride * in_step;
+        float32x4_t acc = vld1q_f32(out + j * 4);
+        for (size_t t = 0; t < taps; t++) {
+            acc = vfmaq_n_f32(acc, vld1q_f32(weights + t * 4), pixel[t * in_step]);
+        }
+        vst1q_f32(out + j * 4, acc);
+    }
+}
+
+static void maxPoolBlockRowNeon(const float* in, size_t row_width, size_t kernel_size, size_t stride, float* out, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        float32x4_t max_val = vdupq_n_f32((float)INT32_MIN);
+        for (size_t x = 0; x < kernel_size; x++) {
+            for (size_t y = 0; y < kernel_size; y++) {
+                max_val = vmaxq_f32(max_val, vld1q_f32(in + (x * row_width + j * stride + y) * 4));
+            }
+        }
+        vst1q_f32(out + j * 4, max_val);
+    }
+}
+
+static inline float32x4_t expNeon(float32x4_t x) {
+    x = vmaxq_f32(x, vdupq_n_f32(EXP_MIN));
+    float32x4_t k = vrndnq_f32(vmulq_f32(x, vdupq_n_f32(EXP_LOG2E)));
+    float32x4_t r = vfmsq_f32(x, k, vdupq_n_f32(EXP_LN2_HI));
+    r = vfmsq_f32(r, k, vdupq_n_f32(EXP_LN2_LO));
+
+    float32x4_t p = vfmaq_f32(vdupq_n_f32(EXP_C1), vdupq_n_f32(EXP_C0), r);
+    p = vfmaq_f32(vdupq_n_f32(EXP_C2), p, r);
+    p = vfmaq_f32(vdupq_n_f32(EXP_C3), p, r);
+    p = vfmaq_f32(vdupq_n_f32(EXP_C4), p, r);
+    p = vfmaq_f32(vdupq_n_f32(EXP_C5), p, r);
+    p = vfmaq_f32(vaddq_f32(r, vdupq_n_f32(1.0f)), p, vmulq_f32(r, r));
+
+    int32x4_t scale = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(k), vdupq_n_s32(127)), 23);
+    return vmulq_f32(p, vreinterpretq_f32_s32(scale));
+}
+
+static float expSumNeon(const float* in, size_t n, float shift) {
+    float32x4_t shift_vec = vdupq_n_f32(shift);
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    size_t j = 0;
+
+    for (; j + 4 <= n; j += 4) {
+        sum = vaddq_f32(sum, expNeon(vsubq_f32(vld1q_f32(in + j), shift_vec)));
+    }
+    float total = vaddvq_f32(sum);
+    for (; j < n; j++) {
+        total += expf(in[j] - shift);
+    }
+    return total;
+}
+
+static const KernelTable neon_kernels = {
+    "neon",
+    gemmMicroKernelNeon,
+    convRowNeon,
+    fcTileNeon,
+    fcTileHalfNeon<_weights_fp16>,
+    fcTileHalfNeon<_weights_bf16>,
+    sparseDotNeon,
+    reluNeon,
+    maxPoolRowNeon,
+    quantizeS8Neon,
+    dotS8Neon,
+    gemmS8Neon,
+    resampleRowNeon,
+    lerpNormalizeRowNeon,
+    4,
+    convBlockRowNeon,
+    maxPoolBlockRowNeon,
+    expSumNeon,
+};
+
+const KernelTable* neonKernels() { return &neon_kernels; }
+
+#else
+
+const KernelTable* neonKernels() { return NULL; }
+
+#endif
@@ -1,10 +1,117 @@
 #include "../include/cnn.h"
+#include "../include/params.h"
+#include "../include/preprocess.h"
+#include "../include/quantize.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <dirent.h>
+#include <mutex>
 #include <opencv4/opencv2/opencv.hpp>
+#include <thread>
+#include <time.h>
+
+/*
+Dataset evaluation runs as a pipeline of three stages joined by bounded queues:
+  scan       one thread walks the dataset directories and queues image paths
+  decode     workers read, resize (cv::resize) and normalize images
+  inference  workers with one ExecutionContext each classify up to max_batch decoded images per call
+A full queue blocks its producer, so a slow stage throttles the ones before it instead of buffering the whole dataset.
+Every image is classified exactly once and only counts are kept, so the accuracy does not depend on the stage sizes.
+*/
+
+// Images of a dataset the scan queues: every one, or one side of the split used when no calibration directory is given
+enum ImageSubset { _all_images, _calibration_images, _held_out_images };
+
+// One image in CALIBRATION_SPLIT calibrates, chosen by file name so the split does not depend on the scan order
+#define CALIBRATION_SPLIT 5
+
+typedef struct EvaluationOptions {
+    size_t decoders;    // decode workers, 0 uses the hardware threads left after inference
+    size_t workers;     // inference workers, one execution context each
+    size_t queue_depth; // capacity of each queue
+    int subset;         // ImageSubset
+} EvaluationOptions;
+
+// One image on its way through the pipeline
+typedef struct EvaluationItem {
+    std::string path;
+    std::string class_name;
+    std::vector<float> image; // set by the decode stage, empty if the image could not be read
+} EvaluationItem;
+
+// Blocking FIFO of bounded size, consumers drain it after the last producer closes it
+typedef struct StageQueue {
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<EvaluationItem> items;
+    size_t capacity;
+    size_t producers; // open producers, the queue is closed at 0
+} StageQueue;
+
+typedef struct StageStats {
+    size_t items;
+    double busy_seconds;    // time in the stage's own work, not waiting on its queues
+    double blocked_seconds; // time waiting for room in the next stage's queue
+} StageStats;
+
+static double nowSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void initQueue(StageQueue* queue, size_t capacity, size_t producers) {
+    queue->capacity = capacity > 0 ? capacity : 1;
+    queue->producers = producers;
+}
+
+static void pushItem(StageQueue* queue, EvaluationItem& item, StageStats* stats) {
+    double start = nowSeconds();
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    queue->not_full.wait(lock, [&] { return queue->items.size() < queue->capacity; });
+    queue->items.push_back(std::move(item));
+    queue->not_empty.notify_one();
+    stats->blocked_seconds += nowSeconds() - start;
+}
+
+// Blocks until an item arrives unless wait is 0, returns 0 once the queue is empty and closed (or empty without wait)
+static int popItem(StageQueue* queue, EvaluationItem* item, int wait) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (wait) {
+        queue->not_empty.wait(lock, [&] { return !queue->items.empty() || queue->producers == 0; });
+    }
+    if (queue->items.empty()) {
+        return 0;
+    }
+    *item = std::move(queue->items.front());
+    queue->items.pop_front();
+    queue->not_full.notify_one();
+    return 1;
+}
 
-void loadDataset(TinyANN* tinyANN, const char* dataset_path, cv::Mat& image, float* flatten_image, int* test_set_size, int* true_positives,
-                 std::vector<std::string>& classes) {
+static void closeProducer(StageQueue* queue) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (--queue->producers == 0) {
+        queue->not_empty.notify_all();
+    }
+}
+
+static int inSubset(const char* file_name, int subset) {
+    if (subset == _all_images) {
+        return 1;
+    }
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (const char* c = file_name; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return (hash % CALIBRATION_SPLIT == 0) == (subset == _calibration_images);
+}
+
+// Queues every .jpg / .jpeg of subset below dataset_path, the class of an image is the name of the directory holding it
+static void scanDataset(const char* dataset_path, int subset, StageQueue* paths, StageStats* stats) {
     DIR* directory;
     struct dirent* entry;
 
@@ -15,6 +122,9 @@ void loadDataset(TinyANN* tinyANN, const char* dataset_path, cv::Mat& image, flo
         return;
     }
 
+    const char* class_name = strrchr(dataset_path, '/');
+    class_name = class_name ? class_name + 1 : dataset_path;
+
     // Read the directory entries
     while ((entry = readdir(directory)) != NULL) {
         if (entry->d_type == DT_DIR) { // Check if it's a subdirectory
@@ -30,71 +140,414 @@ void loadDataset(TinyANN* tinyANN, const char* dataset_path, cv::Mat& image, flo
             strncat(subfolderPath, entry->d_name, sizeof(subfolderPath) - strlen(subfolderPath) - 1);
 
             // Read images recursively in the subfolder
-            loadDataset(tinyANN, subfolderPath, image, flatten_image, test_set_size, true_positives, classes);
+            scanDataset(subfolderPath, subset, paths, stats);
         } else if (entry->d_type == DT_REG) { // Check if it's a regular file
             // Get the file name
             const char* fileName = entry->d_name;
 
             // Check if the file is an image (you can add more image formats if needed)
             const char* extension = strrchr(fileName, '.');
-            if (extension != NULL && (strcasecmp(extension, ".jpg") == 0 || strcasecmp(extension, ".jpeg") == 0)) {
+            if (extension != NULL && (strcasecmp(extension, ".jpg") == 0 || strcasecmp(extension, ".jpeg") == 0) && inSubset(fileName, subset)) {
 
                 // Construct the full image path
                 char imagePath[256];
                 snprintf(imagePath, sizeof(imagePath), "%s/%s", dataset_path, fileName);
-                // std::cout << imagePath << std::endl;
 
-                // Read the image
-                image = cv::imread(imagePath, cv::IMREAD_COLOR);
+                EvaluationItem item;
+                item.path = imagePath;
+                item.class_name = class_name;
+                pushItem(paths, item, stats);
+                stats->items++;
+            }
+        }
+    }
 
-                if (image.empty()) {
-                    std::cout << "Error: Could not read the image.\n";
-                    return;
-                }
+    // Close the directory
+    closedir(directory);
+}
 
-                // Preprocessing
-                cv::Size new_size(tinyANN->image_rows, tinyANN->image_cols);
-                cv::resize(image, image, new_size);
+// cv::resize, then BGR -> planar RGB in [-1, 1], the same input (bit for bit) the reported accuracy was always measured on
+static void resizeAndNormalize(const cv::Mat& image, cv::Mat& resized, const Model* model, float* flatten_image) {
+    cv::resize(image, resized, cv::Size(model->image_cols, model->image_rows));
+    size_t filters = model->image_filters;
+    size_t ind = 0;
+    for (size_t f = 0; f < filters; f++) {
+        for (size_t i = 0; i < model->image_rows; i++) {
+            const uchar* row = resized.ptr<uchar>(i);
+            for (size_t j = 0; j < model->image_cols; j++) {
+                flatten_image[ind++] = ((float)row[j * filters + filters - f - 1] - (255 * 0.5f)) / (255 * 0.5f);
+            }
+        }
+    }
+}
 
-                cv::Mat channels[tinyANN->image_filters];
-                cv::split(image, channels);
+// Each decoder reuses one resized image, cv::resize only allocates it for the first image
+static void decodeWorker(const Model* model, StageQueue* paths, StageQueue* decoded, StageStats* stats) {
+    size_t image_size = model->image_filters * model->image_rows * model->image_cols;
+    cv::Mat resized;
+    EvaluationItem item;
+
+    while (popItem(paths, &item, 1)) {
+        double start = nowSeconds();
+        cv::Mat image = cv::imread(item.path.c_str(), model->image_filters == 1 ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR);
+        if (image.empty() || (size_t)image.channels() != model->image_filters) {
+            fprintf(stderr, "Error: Could not read the image %s\n", item.path.c_str());
+        } else {
+            item.image.resize(image_size);
+            resizeAndNormalize(image, resized, model, item.image.data());
+        }
+        stats->busy_seconds += nowSeconds() - start;
+        stats->items++;
 
-                int ind = 0;
-                for (int f = 0; f < tinyANN->image_filters; f++) {
-                    for (int i = 0; i < tinyANN->image_rows; i++) {
-                        for (int j = 0; j < tinyANN->image_cols; j++) {
-                            flatten_image[ind++] = ((float)channels[tinyANN->image_filters - f - 1].at<uchar>(i, j) - (255 * 0.5f)) / (255 * 0.5f);
-                        }
-                    }
-                }
+        pushItem(decoded, item, stats);
+    }
+    closeProducer(decoded);
+}
 
-                // Perform forward pass
-                int res = inference(tinyANN, flatten_image);
+typedef struct InferenceWorker {
+    ExecutionContext context;
+    std::vector<float> activation_ranges; // per worker calibration ranges, merged after the pipeline drains
+    StageStats stats;
+    int true_positives;
+    int test_set_size;
+} InferenceWorker;
+
+// Gathers whatever decoded images are ready, up to max_batch, into one inference_batch() call
+static void inferenceWorker(InferenceWorker* worker, StageQueue* decoded, const std::vector<std::string>* classes) {
+    ExecutionContext* context = &worker->context;
+    size_t image_size = context->image_filters * context->image_rows * context->image_cols;
+    std::vector<float> images(context->max_batch * image_size);
+    std::vector<int> labels(context->max_batch);
+    std::vector<std::string> class_names(context->max_batch);
+    EvaluationItem item;
+
+    while (popItem(decoded, &item, 1)) {
+        size_t batch = 0;
+        do {
+            if (item.image.empty()) {
+                continue;
+            }
+            memcpy(&images[batch * image_size], item.image.data(), image_size * sizeof(float));
+            class_names[batch++] = item.class_name;
+        } while (batch < context->max_batch && popItem(decoded, &item, 0));
 
-                const char* class_name = strrchr(dataset_path, '/') + 1;
-                if (strcmp(class_name, classes[res].c_str()) == 0) {
-                    (*true_positives)++;
-                }
-                (*test_set_size)++;
+        if (batch == 0) {
+            continue;
+        }
 
-                image.release();
+        double start = nowSeconds();
+        inference_batch(context, images.data(), batch, labels.data());
+        worker->stats.busy_seconds += nowSeconds() - start;
+        worker->stats.items += batch;
+
+        for (size_t b = 0; b < batch; b++) {
+            if (labels[b] >= 0 && (size_t)labels[b] < classes->size() && class_names[b] == (*classes)[labels[b]]) {
+                worker->true_positives++;
             }
+            worker->test_set_size++;
         }
     }
+}
 
-    // Close the directory
-    closedir(directory);
+// capacity: images/s the stage would sustain with its workers always busy, the smallest one bounds the pipeline
+static void printStage(const char* name, size_t workers, const StageStats& stats, double wall_seconds) {
+    double capacity = stats.busy_seconds > 0 ? stats.items * workers / stats.busy_seconds : 0.0;
+    double utilization = wall_seconds > 0 ? 100.0 * stats.busy_seconds / (workers * wall_seconds) : 0.0;
+    printf("%-10s %8zu %8zu %10.3f %10.3f %12.1f %6.1f%%\n", name, workers, stats.items, stats.busy_seconds, stats.blocked_seconds, capacity,
+           utilization);
+}
+
+// Runs the test set through the pipeline, returns the accuracy in percent
+// activation_ranges (total_layers floats) is set to the calibration ranges when not NULL
+float evaluate(const Model* model, const NetworkOptions* options, const EvaluationOptions* pipeline, const char* images_path,
+               const std::vector<std::string>& classes, int* test_set_size, float* activation_ranges) {
+    size_t workers = pipeline->workers > 0 ? pipeline->workers : 1;
+    size_t decoders = pipeline->decoders;
+    if (decoders == 0) {
+        size_t hardware = std::thread::hardware_concurrency();
+        decoders = hardware > workers ? hardware - workers : 1;
+    }
+
+    *test_set_size = 0;
+
+    std::vector<InferenceWorker> inference_workers(workers);
+    for (size_t w = 0; w < workers; w++) {
+        InferenceWorker* worker = &inference_workers[w];
+        if (createExecutionContext(&worker->context, model, options) != SUCCESS) {
+            for (size_t i = 0; i < w; i++) {
+                destroyExecutionContext(&inference_workers[i].context);
+            }
+            return 0.0f;
+        }
+        if (activation_ranges) {
+            worker->activation_ranges.assign(model->total_layers, 0.0f);
+            worker->context.activation_ranges = worker->activation_ranges.data();
+        }
+        worker->stats.items = 0;
+        worker->stats.busy_seconds = 0.0;
+        worker->stats.blocked_seconds = 0.0;
+        worker->true_positives = 0;
+        worker->test_set_size = 0;
+    }
+
+    StageQueue paths;
+    StageQueue decoded;
+    initQueue(&paths, pipeline->queue_depth, 1);
+    initQueue(&decoded, pipeline->queue_depth, decoders);
+
+    std::vector<StageStats> decode_stats(decoders);
+    std::vector<std::thread> threads;
+    StageStats scan_stats = {0, 0.0, 0.0};
+    double start = nowSeconds();
+
+    for (size_t d = 0; d < decoders; d++) {
+        decode_stats[d].items = 0;
+        decode_stats[d].busy_seconds = 0.0;
+        decode_stats[d].blocked_seconds = 0.0;
+        threads.push_back(std::thread(decodeWorker, model, &paths, &decoded, &decode_stats[d]));
+    }
+    for (size_t w = 0; w < workers; w++) {
+        threads.push_back(std::thread(inferenceWorker, &inference_workers[w], &decoded, &classes));
+    }
+
+    scanDataset(images_path, pipeline->subset, &paths, &scan_stats);
+    scan_stats.busy_seconds = nowSeconds() - start - scan_stats.blocked_seconds;
+    closeProducer(&paths);
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    double wall_seconds = nowSeconds() - start;
+
+    // Ranges are maxima, so merging per worker ranges gives the same result as one context seeing every image
+    StageStats decode_total = {0, 0.0, 0.0};
+    StageStats inference_total = {0, 0.0, 0.0};
+    int true_positives = 0;
+    for (size_t d = 0; d < decoders; d++) {
+        decode_total.items += decode_stats[d].items;
+        decode_total.busy_seconds += decode_stats[d].busy_seconds;
+        decode_total.blocked_seconds += decode_stats[d].blocked_seconds;
+    }
+    if (activation_ranges) {
+        memset(activation_ranges, 0, model->total_layers * sizeof(float));
+    }
+    for (size_t w = 0; w < workers; w++) {
+        InferenceWorker* worker = &inference_workers[w];
+        inference_total.items += worker->stats.items;
+        inference_total.busy_seconds += worker->stats.busy_seconds;
+        true_positives += worker->true_positives;
+        *test_set_size += worker->test_set_size;
+        for (size_t l = 0; activation_ranges && l < model->total_layers; l++) {
+            activation_ranges[l] = std::max(activation_ranges[l], worker->activation_ranges[l]);
+        }
+        destroyExecutionContext(&worker->context);
+    }
+
+    printf("%-10s %8s %8s %10s %10s %12s %7s\n", "stage", "workers", "images", "busy s", "blocked s", "capacity/s", "busy");
+    printStage("scan", 1, scan_stats, wall_seconds);
+    printStage("decode", decoders, decode_total, wall_seconds);
+    printStage("inference", workers, inference_total, wall_seconds);
+    printf("%.3f s, %.1f images/s\n", wall_seconds, wall_seconds > 0 ? *test_set_size / wall_seconds : 0.0);
+
+    return *test_set_size ? (float)true_positives / *test_set_size * 100 : 0.0f;
+}
+
+/*
+Streaming mode: classifies the frames of a video file (or camera URL) read through cv::VideoCapture, or raw frames
+piped on stdin, one at a time on a single execution context
+The frame, converted frame, raw read buffer and network input are allocated on the first frames and reused, so after
+warmup a frame does no heap allocation (tests/test_steady_state.cpp checks the library side of that loop).
+*/
+
+#define FRAME_HISTOGRAM_BINS 5000
+#define FRAME_HISTOGRAM_STEP 20e-6 // seconds per bin, the last bin holds everything from 100 ms up
+
+typedef struct StreamOptions {
+    const char* source; // video file or URL for cv::VideoCapture, "-" reads raw frames from stdin
+    size_t frame_rows;  // raw frames: rows x cols interleaved uint8 pixels of the model's channel count (BGR for 3)
+    size_t frame_cols;
+    size_t warmup;     // frames run before statistics start
+    size_t max_frames; // 0 runs until the stream ends
+} StreamOptions;
+
+// Fixed size, so recording a frame never allocates
+typedef struct FrameStats {
+    size_t frames;
+    double total_seconds;
+    double max_seconds;
+    size_t histogram[FRAME_HISTOGRAM_BINS];
+} FrameStats;
+
+static void recordFrame(FrameStats* stats, double seconds) {
+    size_t bin = (size_t)(seconds / FRAME_HISTOGRAM_STEP);
+    stats->histogram[bin < FRAME_HISTOGRAM_BINS ? bin : FRAME_HISTOGRAM_BINS - 1]++;
+    stats->frames++;
+    stats->total_seconds += seconds;
+    stats->max_seconds = std::max(stats->max_seconds, seconds);
+}
+
+// Upper edge of the bin holding the nearest rank percentile, in ms
+static double framePercentile(const FrameStats* stats, double p) {
+    size_t rank = (size_t)(p * stats->frames + 0.999999);
+    size_t seen = 0;
+    for (size_t bin = 0; bin < FRAME_HISTOGRAM_BINS; bin++) {
+        seen += stats->histogram[bin];
+        if (seen >= rank && seen > 0) {
+            return std::min((bin + 1) * FRAME_HISTOGRAM_STEP, stats->max_seconds) * 1e3;
+        }
+    }
+    return stats->max_seconds * 1e3;
+}
+
+static void printFrameStats(const char* name, const FrameStats* stats) {
+    printf("%-11s %10.3f %10.3f %10.3f %10.3f\n", name, stats->frames ? stats->total_seconds / stats->frames * 1e3 : 0.0,
+           framePercentile(stats, 0.50), framePercentile(stats, 0.99), stats->max_seconds * 1e3);
+}
+
+// Where frames come from, every buffer is kept across frames
+typedef struct FrameSource {
+    const StreamOptions* options;
+    size_t channels;
+    cv::VideoCapture capture;
+    cv::Mat frame;
+    cv::Mat converted;         // gray frame for a 1 channel network
+    std::vector<uint8_t> raw;  // one frame read from stdin
+} FrameSource;
+
+// One frame as interleaved pixels of the model's channel count, data stays valid until the next call, 0 at the end of the stream
+static int readFrame(FrameSource* source, const uint8_t** data, size_t* rows, size_t* cols, size_t* row_stride) {
+    if (!source->raw.empty()) {
+        if (fread(source->raw.data(), 1, source->raw.size(), stdin) != source->raw.size()) {
+            return 0;
+        }
+        *data = source->raw.data();
+        *rows = source->options->frame_rows;
+        *cols = source->options->frame_cols;
+        *row_stride = source->options->frame_cols * source->channels;
+        return 1;
+    }
+
+    // read() and cvtColor() keep their output buffers while the frame size stays the same
+    if (!source->capture.read(source->frame) || source->frame.empty()) {
+        return 0;
+    }
+    const cv::Mat* image = &source->frame;
+    if ((size_t)image->channels() != source->channels) {
+        if (source->channels != 1 || image->channels() != 3) {
+            fprintf(stderr, "Error: %d channel frames do not fit a %zu channel network\n", image->channels(), source->channels);
+            return 0;
+        }
+        cv::cvtColor(source->frame, source->converted, cv::COLOR_BGR2GRAY);
+        image = &source->converted;
+    }
+
+    *data = image->data;
+    *rows = image->rows;
+    *cols = image->cols;
+    *row_stride = image->step;
+    return 1;
+}
+
+int streamNetwork(const Model* model, const NetworkOptions* options, const StreamOptions* stream, const std::vector<std::string>& classes) {
+    ExecutionContext context;
+    if (createExecutionContext(&context, model, options) != SUCCESS) {
+        return 1;
+    }
+
+    Preprocessor preprocessor;
+    PreprocessOptions preprocess_options = defaultPreprocessOptions();
+    if (createPreprocessor(&preprocessor, model, &preprocess_options) != SUCCESS) {
+        destroyExecutionContext(&context);
+        return 1;
+    }
+
+    size_t channels = model->image_filters;
+    FrameSource source;
+    source.options = stream;
+    source.channels = channels;
+    if (strcmp(stream->source, "-") == 0) {
+        if (stream->frame_rows == 0 || stream->frame_cols == 0) {
+            fprintf(stderr, "Error: raw frames on stdin need --frame-size ROWSxCOLS\n");
+            destroyPreprocessor(&preprocessor);
+            destroyExecutionContext(&context);
+            return 1;
+        }
+        source.raw.resize(stream->frame_rows * stream->frame_cols * channels);
+    } else if (!source.capture.open(stream->source)) {
+        fprintf(stderr, "Error: Could not open the video %s\n", stream->source);
+        destroyPreprocessor(&preprocessor);
+        destroyExecutionContext(&context);
+        return 1;
+    }
+
+    std::vector<float> input(channels * model->image_rows * model->image_cols);
+    std::vector<size_t> class_counts(classes.size() + 1); // the last entry counts labels outside classes.txt
+    // Heap allocated, the histograms are too large for the stack
+    std::vector<FrameStats> stats(4);
+    memset(stats.data(), 0, stats.size() * sizeof(FrameStats));
+    FrameStats* read_stats = &stats[0];
+    FrameStats* preprocess_stats = &stats[1];
+    FrameStats* inference_stats = &stats[2];
+    FrameStats* frame_stats = &stats[3];
+
+    size_t frames = 0;
+    double steady_start = nowSeconds();
+    for (; stream->max_frames == 0 || frames < stream->max_frames; frames++) {
+        if (frames == stream->warmup) {
+            steady_start = nowSeconds();
+        }
+
+        const uint8_t* data;
+        size_t rows, cols, row_stride;
+        double start = nowSeconds();
+        if (!readFrame(&source, &data, &rows, &cols, &row_stride)) {
+            break;
+        }
+        double decoded = nowSeconds();
+        if (preprocessImage(&preprocessor, data, rows, cols, row_stride, input.data()) != SUCCESS) {
+            break;
+        }
+        double preprocessed = nowSeconds();
+        int label = inference(&context, input.data());
+        double end = nowSeconds();
+
+        class_counts[label >= 0 && (size_t)label < classes.size() ? label : classes.size()]++;
+        if (frames >= stream->warmup) {
+            recordFrame(read_stats, decoded - start);
+            recordFrame(preprocess_stats, preprocessed - decoded);
+            recordFrame(inference_stats, end - preprocessed);
+            recordFrame(frame_stats, end - start);
+        }
+    }
+    double steady_seconds = nowSeconds() - steady_start;
+
+    printf("%zu frames, %zu after %zu warmup frames, %.1f frames/s\n", frames, frame_stats->frames, stream->warmup,
+           steady_seconds > 0 ? frame_stats->frames / steady_seconds : 0.0);
+    printf("%-11s %10s %10s %10s %10s\n", "ms/frame", "mean", "p50", "p99", "max");
+    printFrameStats("read", read_stats);
+    printFrameStats("preprocess", preprocess_stats);
+    printFrameStats("inference", inference_stats);
+    printFrameStats("total", frame_stats);
+    for (size_t c = 0; c < classes.size(); c++) {
+        if (class_counts[c] > 0) {
+            printf("%-20s %8zu\n", classes[c].c_str(), class_counts[c]);
+        }
+    }
+
+    destroyPreprocessor(&preprocessor);
+    destroyExecutionContext(&context);
+    return 0;
 }
 
 void writeParamToFile(TinyANN* tinyANN, const char* path) {
     FILE* param_out = fopen(path, "wb");
 
     for (int t = 0; t < tinyANN->total_layers; t++) {
-        if (tinyANN->tensors[t].info[_operation] != _convolution && tinyANN->tensors[t].info[_operation] != _fully_connected)
+        if (!hasWeights(&tinyANN->tensors[t]))
             continue;
 
         size_t out_filters = tinyANN->tensors[t].info[_output];
-        size_t in_filters = tinyANN->tensors[t].info[_input];
+        size_t in_filters = filterChannels(&tinyANN->tensors[t]);
         size_t kernel_size = tinyANN->tensors[t].info[_kernel_size];
 
         for (int out = 0; out < out_filters; out++) {
@@ -149,27 +602,170 @@ std::vector<std::string> loadClasses(const int total_classes, const char* classe
     return classes;
 }
 
-int main() {
+// Calibrates activation scales on calibration_path, writes the int8 parameters to quant_param_path and compares both precisions
+// calibration_path NULL splits images_path: the calibration images are not part of the test images the accuracy is reported on
+int quantizeNetwork(const char* network_config_path, const char* param_path, const char* quant_param_path, const char* calibration_path,
+                    const char* images_path, const char* classes_path, const NetworkOptions* options, const EvaluationOptions* pipeline) {
+    Model model;
+    NetworkOptions fp32_options = *options;
+    fp32_options.precision = _fp32;
+    fp32_options.weight_format = _weights_fp32; // calibration and quantizeModel() need the fp32 fc weights
+    if (loadModel(&model, network_config_path, param_path, &fp32_options) != SUCCESS) {
+        return 1;
+    }
+    std::vector<std::string> classes = loadClasses(model.tensors[model.total_layers - 1].channels, classes_path);
+
+    EvaluationOptions calibration_pipeline = *pipeline;
+    EvaluationOptions test_pipeline = *pipeline;
+    calibration_pipeline.subset = calibration_path ? _all_images : _calibration_images;
+    test_pipeline.subset = calibration_path ? _all_images : _held_out_images;
+    if (calibration_path && strcmp(calibration_path, images_path) == 0) {
+        fprintf(stderr, "WARNING TINYANN: Calibrating on the test set, the int8 accuracy below is optimistic\n");
+    }
+
+    std::vector<float> activation_ranges(model.total_layers);
+    int calibration_size = 0;
+    evaluate(&model, &fp32_options, &calibration_pipeline, calibration_path ? calibration_path : images_path, classes, &calibration_size,
+             activation_ranges.data());
+    if (calibration_path) {
+        printf("Calibration Images = %d (%s)\n", calibration_size, calibration_path);
+    } else {
+        printf("Calibration Images = %d (1 in %d of %s, left out of the test images)\n", calibration_size, CALIBRATION_SPLIT, images_path);
+    }
+
+    // _fp32 contexts ignore the int8 weights, so the same model still gives the fp32 accuracy
+    if (quantizeModel(&model, activation_ranges.data()) != SUCCESS || writeParamsInt8(&model, quant_param_path) != SUCCESS) {
+        destroyModel(&model);
+        return 1;
+    }
+    printf("Wrote %s\n", quant_param_path);
+
+    int test_set_size = 0;
+    float fp32_accuracy = evaluate(&model, &fp32_options, &test_pipeline, images_path, classes, &test_set_size, NULL);
+    destroyModel(&model);
+
+    Model int8_model;
+    NetworkOptions int8_options = *options;
+    int8_options.precision = _int8;
+    if (loadModel(&int8_model, network_config_path, quant_param_path, &int8_options) != SUCCESS) {
+        return 1;
+    }
+    float int8_accuracy = evaluate(&int8_model, &int8_options, &test_pipeline, images_path, classes, &test_set_size, NULL);
+    destroyModel(&int8_model);
+
+    printf("Total Images = %d%s\n", test_set_size, calibration_path ? "" : " (without the calibration images)");
+    printf("Accuracy fp32 = %f\n", fp32_accuracy);
+    printf("Accuracy int8 = %f\n", int8_accuracy);
+    printf("Difference = %f\n", int8_accuracy - fp32_accuracy);
+
+    return 0;
+}
+
+static void printUsage(const char* program) {
+    fprintf(stderr, "Usage: %s [--images dir] [--quantize [calibration_dir]] [--decoders N] [--workers N] [--threads N] [--batch N]\n", program);
+    fprintf(stderr, "       [--queue N] [--autotune [tuning_cache]]\n");
+    fprintf(stderr, "       %s --stream video|- [--frame-size ROWSxCOLS] [--warmup N] [--frames N] [--threads N]\n", program);
+}
+
+int main(int argc, char** argv) {
 
     const char* network_config_path = "../extern/network_config.txt";
     const char* images_path = "../extern/test_data";
     const char* param_path = "../extern/parameters.txt";
+    const char* quant_param_path = "../extern/parameters.int8.bin";
     const char* classes_path = "../extern/classes.txt";
 
-    int test_set_size = 0;
-    int true_positives = 0;
-    TinyANN tinyANN;
-    cv::Mat image;
+    // --images dir : test set to evaluate, one directory per class
+    // --quantize [calibration_dir] : int8 post-training quantization, calibrated on calibration_dir, or without one on
+    //                                1 in CALIBRATION_SPLIT test images that are then left out of the reported accuracy
+    // --decoders / --workers : pipeline stage sizes, --threads / --batch : threads and images per inference_batch() of each worker
+    // --stream video|- : classifies the frames of a video, or raw frames of --frame-size on stdin, instead of the test set
+    // --autotune [tuning_cache] : times the convolution engines of every layer at load, reusing and extending the cache if given
+    int quantize = 0;
+    const char* calibration_path = NULL;
+    NetworkOptions options = defaultNetworkOptions();
+    EvaluationOptions pipeline = {0, 1, 64, _all_images};
+    StreamOptions stream = {NULL, 0, 0, 10, 0};
+
+    for (int i = 1; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--quantize") == 0) {
+            quantize = 1;
+            if (value != NULL && strncmp(value, "--", 2) != 0) {
+                calibration_path = value;
+                i++;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--autotune") == 0) {
+            options.autotune = 1;
+            if (value != NULL && strncmp(value, "--", 2) != 0) {
+                options.tuning_cache = value;
+                i++;
+            }
+            continue;
+        }
+        if (value == NULL) {
+            printUsage(argv[0]);
+            return 1;
+        }
 
-    initNetwork(&tinyANN, network_config_path, param_path);
-    float flatten_image[tinyANN.image_filters * tinyANN.image_rows * tinyANN.image_cols];
+        if (strcmp(argv[i], "--images") == 0) {
+            images_path = value;
+        } else if (strcmp(argv[i], "--decoders") == 0) {
+            pipeline.decoders = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--workers") == 0) {
+            pipeline.workers = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            options.threads = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            options.max_batch = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--queue") == 0) {
+            pipeline.queue_depth = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream.source = value;
+        } else if (strcmp(argv[i], "--frame-size") == 0) {
+            if (sscanf(value, "%zux%zu", &stream.frame_rows, &stream.frame_cols) != 2) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--warmup") == 0) {
+            stream.warmup = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--frames") == 0) {
+            stream.max_frames = strtoul(value, NULL, 10);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+    if (options.max_batch == 0) {
+        options.max_batch = 1;
+    }
 
-    std::vector<std::string> classes = loadClasses(tinyANN.tensors[tinyANN.total_layers - 1].channels, classes_path);
-    loadDataset(&tinyANN, images_path, image, flatten_image, &test_set_size, &true_positives, classes);
+    if (quantize) {
+        return quantizeNetwork(network_config_path, param_path, quant_param_path, calibration_path, images_path, classes_path, &options, &pipeline);
+    }
+
+    Model model;
+    if (loadModel(&model, network_config_path, param_path, &options) != SUCCESS) {
+        return 1;
+    }
+
+    std::vector<std::string> classes = loadClasses(model.tensors[model.total_layers - 1].channels, classes_path);
+
+    if (stream.source) {
+        int status = streamNetwork(&model, &options, &stream, classes);
+        destroyModel(&model);
+        return status;
+    }
+
+    int test_set_size = 0;
+    float accuracy = evaluate(&model, &options, &pipeline, images_path, classes, &test_set_size, NULL);
 
     printf("Total Images = %d\n", test_set_size);
-    printf("Accuracy = %f\n", (float)true_positives / test_set_size * 100);
+    printf("Accuracy = %f\n", accuracy);
 
-    destroyNetwork(&tinyANN);
+    destroyModel(&model);
     return 0;
 }
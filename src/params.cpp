@@ -0,0 +1,567 @@
+#include "../include/params.h"
+#include "../include/arena.h"
+#include "../include/half.h"
+#include "../include/quantize.h"
+#include "../include/sparse.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t alignOffset(size_t offset) { return (offset + TINYANN_PARAM_ALIGNMENT - 1) & ~(size_t)(TINYANN_PARAM_ALIGNMENT - 1); }
+
+uint64_t paramChecksum(const void* data, size_t size) {
+    // Fletcher style running sums over 32 bit words, cheap enough to verify on every startup
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t sum1 = 0, sum2 = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= size; i += 4) {
+        uint32_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        sum1 += word;
+        sum2 += sum1;
+    }
+    for (; i < size; i++) {
+        sum1 += bytes[i];
+        sum2 += sum1;
+    }
+
+    return (sum2 << 32) ^ sum1;
+}
+
+static int hasMagic(const char* param_path, const char* expected) {
+    FILE* param_file = fopen(param_path, "rb");
+    if (param_file == NULL)
+        return 0;
+
+    char magic[TINYANN_PARAM_MAGIC_SIZE];
+    size_t read = fread(magic, 1, TINYANN_PARAM_MAGIC_SIZE, param_file);
+    fclose(param_file);
+
+    char padded[TINYANN_PARAM_MAGIC_SIZE] = {0};
+    memcpy(padded, expected, strlen(expected));
+
+    return read == TINYANN_PARAM_MAGIC_SIZE && memcmp(magic, padded, TINYANN_PARAM_MAGIC_SIZE) == 0;
+}
+
+int isBinaryParamFile(const char* param_path) { return hasMagic(param_path, TINYANN_PARAM_MAGIC); }
+
+int isQuantizedParamFile(const char* param_path) { return hasMagic(param_path, TINYANN_QPARAM_MAGIC); }
+
+int isHalfParamFile(const char* param_path) { return hasMagic(param_path, TINYANN_HPARAM_MAGIC); }
+
+// Maps param_path and checks everything the header describes, the records are left to the caller
+static int mapContainer(const char* param_path, const char* expected_magic, size_t record_size, void** mapping, size_t* mapping_size) {
+    int fd = open(param_path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR TINY_ANN: File (%s) does not exist\n", param_path);
+        return FILE_NOT_READABLE;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(ParamFileHeader)) {
+        fprintf(stderr, "ERROR TINY_ANN: File (%s) is not a parameter container\n", param_path);
+        close(fd);
+        return INVALID_PARAM_FILE;
+    }
+
+    size_t file_size = (size_t)file_stat.st_size;
+    void* base = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "ERROR TINY_ANN: Could not map (%s)\n", param_path);
+        return FILE_NOT_READABLE;
+    }
+
+    const ParamFileHeader* header = (const ParamFileHeader*)base;
+    char magic[TINYANN_PARAM_MAGIC_SIZE] = {0};
+    memcpy(magic, expected_magic, strlen(expected_magic));
+
+    const char* error = NULL;
+    if (memcmp(header->magic, magic, TINYANN_PARAM_MAGIC_SIZE) != 0) {
+        error = "bad magic";
+    } else if (header->version != TINYANN_PARAM_VERSION) {
+        error = "unsupported version";
+    } else if (header->alignment != TINYANN_PARAM_ALIGNMENT || header->header_size % TINYANN_PARAM_ALIGNMENT != 0) {
+        error = "unsupported alignment";
+    } else if (sizeof(ParamFileHeader) + (size_t)header->layer_count * record_size > header->header_size ||
+               (size_t)header->header_size + header->data_size != file_size) {
+        error = "truncated file";
+    } else if (paramChecksum((const uint8_t*)base + header->header_size, header->data_size) != header->checksum) {
+        error = "checksum mismatch";
+    }
+
+    if (error != NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: Parameter file (%s) rejected: %s\n", param_path, error);
+        munmap(base, file_size);
+        return INVALID_PARAM_FILE;
+    }
+
+    *mapping = base;
+    *mapping_size = file_size;
+
+    return SUCCESS;
+}
+
+// An aligned block of bytes inside the data section
+static int blockInRange(const ParamFileHeader* header, size_t file_size, uint64_t offset, uint64_t bytes) {
+    return offset % TINYANN_PARAM_ALIGNMENT == 0 && offset >= header->header_size && offset + bytes <= file_size;
+}
+
+// Weight format a layer must have in a container, half containers store fc weights as 16 bit
+static int formatMatches(const Tensor* tensor, int half, uint32_t format) {
+    if (half && tensor->info[_operation] == _fully_connected) {
+        return format == _weights_fp16 || format == _weights_bf16;
+    }
+    return format == _weights_fp32;
+}
+
+// Shared by the fp32 and the half container, they only differ in magic and in the fc weight blocks
+static int mapFloatContainer(Model* model, const char* param_path, const char* magic) {
+    int half = strcmp(magic, TINYANN_HPARAM_MAGIC) == 0;
+    void* mapping;
+    size_t file_size;
+    int status = mapContainer(param_path, magic, sizeof(ParamLayerRecord), &mapping, &file_size);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    const uint8_t* base = (const uint8_t*)mapping;
+    const ParamFileHeader* header = (const ParamFileHeader*)base;
+    const ParamLayerRecord* records = (const ParamLayerRecord*)(base + sizeof(ParamFileHeader));
+
+    const char* error = NULL;
+    size_t record_no = 0;
+    for (size_t i = 0; error == NULL && i < model->total_layers; i++) {
+        Tensor* tensor = &model->tensors[i];
+
+        tensor->half_weight_start = NULL;
+        tensor->weight_format = _weights_fp32;
+        if (!hasWeights(tensor)) {
+            tensor->weight_start = tensor->bias_start = tensor->bias_end = tensor->weight_end = NULL;
+            continue;
+        }
+
+        if (record_no == header->layer_count) {
+            error = "fewer layers than the network config";
+            break;
+        }
+
+        const ParamLayerRecord* record = &records[record_no++];
+        size_t weight_count = weightCount(tensor);
+        size_t weight_size = record->weight_format == _weights_fp32 ? sizeof(float) : sizeof(uint16_t);
+
+        if (record->layer_no != i || record->operation != tensor->info[_operation] || record->input != tensor->info[_input] ||
+            record->output != tensor->info[_output] || record->kernel_size != tensor->info[_kernel_size] || record->weight_count != weight_count ||
+            record->bias_count != tensor->info[_output]) {
+            error = "layer shapes do not match the network config";
+        } else if (!formatMatches(tensor, half, record->weight_format)) {
+            error = "unsupported weight format";
+        } else if (!blockInRange(header, file_size, record->weight_offset, record->weight_count * weight_size) ||
+                   !blockInRange(header, file_size, record->bias_offset, record->bias_count * sizeof(float))) {
+            error = "layer block out of range";
+        } else {
+            if (record->weight_format == _weights_fp32) {
+                tensor->weight_start = (float*)(base + record->weight_offset);
+                tensor->weight_end = tensor->weight_start + record->weight_count;
+            } else {
+                tensor->weight_start = tensor->weight_end = NULL;
+                tensor->half_weight_start = (uint16_t*)(base + record->weight_offset);
+                tensor->weight_format = (int)record->weight_format;
+            }
+            tensor->bias_start = (float*)(base + record->bias_offset);
+            tensor->bias_end = tensor->bias_start + record->bias_count;
+        }
+    }
+
+    if (error == NULL && record_no != header->layer_count) {
+        error = "more layers than the network config";
+    }
+
+    if (error != NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: Parameter file (%s) rejected: %s\n", param_path, error);
+        munmap(mapping, file_size);
+        return INVALID_PARAM_FILE;
+    }
+
+    model->param_mapping = mapping;
+    model->param_mapping_size = file_size;
+
+    return SUCCESS;
+}
+
+int mapParams(Model* model, const char* param_path) { return mapFloatContainer(model, param_path, TINYANN_PARAM_MAGIC); }
+
+int mapHalfParams(Model* model, const char* param_path) { return mapFloatContainer(model, param_path, TINYANN_HPARAM_MAGIC); }
+
+// Layers quantizeModel() leaves in fp32, their int8 container records hold the fp32 weights
+static int keepsFp32(const Tensor* tensor) {
+    return tensor->info[_operation] == _depthwise_convolution || tensor->info[_operation] == _pointwise_convolution;
+}
+
+int mapQuantizedParams(Model* model, const char* param_path) {
+    void* mapping;
+    size_t file_size;
+    int status = mapContainer(param_path, TINYANN_QPARAM_MAGIC, sizeof(QuantLayerRecord), &mapping, &file_size);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    const uint8_t* base = (const uint8_t*)mapping;
+    const ParamFileHeader* header = (const ParamFileHeader*)base;
+    const QuantLayerRecord* records = (const QuantLayerRecord*)(base + sizeof(ParamFileHeader));
+
+    const char* error = NULL;
+    size_t record_no = 0;
+    for (size_t i = 0; error == NULL && i < model->total_layers; i++) {
+        Tensor* tensor = &model->tensors[i];
+        tensor->weight_start = tensor->weight_end = tensor->bias_start = tensor->bias_end = NULL;
+
+        if (!hasWeights(tensor)) {
+            continue;
+        }
+
+        if (record_no == header->layer_count) {
+            error = "fewer layers than the network config";
+            break;
+        }
+
+        const QuantLayerRecord* record = &records[record_no++];
+        size_t outputs = tensor->info[_output];
+        int fp32 = keepsFp32(tensor);
+
+        if (record->layer_no != i || record->operation != tensor->info[_operation] || record->input != tensor->info[_input] ||
+            record->output != outputs || record->kernel_size != tensor->info[_kernel_size] ||
+            record->weight_rows != (fp32 ? weightCount(tensor) : quantRows(tensor)) ||
+            record->row_stride != (fp32 ? sizeof(float) : quantRowStride(tensor))) {
+            error = "layer shapes do not match the network config";
+        } else if (fp32) {
+            if (record->input_scale != 0.0f) {
+                error = "depthwise / pointwise layer with an input scale";
+            } else if (!blockInRange(header, file_size, record->weight_offset, record->weight_rows * record->row_stride) ||
+                       !blockInRange(header, file_size, record->bias_offset, outputs * sizeof(float))) {
+                error = "layer block out of range";
+            } else {
+                tensor->weight_start = (float*)(base + record->weight_offset);
+                tensor->weight_end = tensor->weight_start + record->weight_rows;
+                tensor->bias_start = (float*)(base + record->bias_offset);
+                tensor->bias_end = tensor->bias_start + outputs;
+            }
+        } else if (!(record->input_scale > 0.0f)) {
+            error = "invalid input scale";
+        } else if (!blockInRange(header, file_size, record->weight_offset, record->weight_rows * record->row_stride) ||
+                   !blockInRange(header, file_size, record->scale_offset, outputs * sizeof(float)) ||
+                   !blockInRange(header, file_size, record->bias_offset, outputs * sizeof(float))) {
+            error = "layer block out of range";
+        } else {
+            tensor->qweight_start = (int8_t*)(base + record->weight_offset);
+            tensor->weight_scales = (float*)(base + record->scale_offset);
+            tensor->input_scale = record->input_scale;
+            tensor->bias_start = (float*)(base + record->bias_offset);
+            tensor->bias_end = tensor->bias_start + outputs;
+        }
+    }
+
+    if (error == NULL && record_no != header->layer_count) {
+        error = "more layers than the network config";
+    }
+
+    if (error != NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: Parameter file (%s) rejected: %s\n", param_path, error);
+        munmap(mapping, file_size);
+        return INVALID_PARAM_FILE;
+    }
+
+    model->param_mapping = mapping;
+    model->param_mapping_size = file_size;
+
+    return SUCCESS;
+}
+
+int unmapParams(Model* model) {
+    if (model->param_mapping) {
+        munmap(model->param_mapping, model->param_mapping_size);
+        model->param_mapping = NULL;
+        model->param_mapping_size = 0;
+    }
+    return SUCCESS;
+}
+
+void releaseFloatWeights(Model* model, Tensor* tensor) {
+    // Only the pages fully inside the block go, they are read again from the file if ever touched
+    if (model->param_mapping && tensor->weight_start) {
+        uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+        uintptr_t first = ((uintptr_t)tensor->weight_start + page - 1) & ~(page - 1);
+        uintptr_t last = (uintptr_t)tensor->weight_end & ~(page - 1);
+        if (last > first) {
+            madvise((void*)first, last - first, MADV_DONTNEED);
+        }
+    }
+    tensor->weight_start = tensor->weight_end = NULL;
+}
+
+int compactParams(Model* model) {
+    if (!model->memory_block.memory_start) {
+        return SUCCESS;
+    }
+
+    size_t memory_size = 0;
+    for (size_t l = 0; l < model->total_layers; l++) {
+        const Tensor* tensor = &model->tensors[l];
+        if (tensor->bias_start) {
+            memory_size += arenaFloats(tensor->weight_end - tensor->weight_start) + arenaFloats(tensor->bias_end - tensor->bias_start);
+        }
+    }
+
+    MemoryRegion region = model->memory_block;
+    region.memory_start = region.memory_used = NULL;
+    int status = allocateRegion(&region, memory_size);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    for (size_t l = 0; l < model->total_layers; l++) {
+        Tensor* tensor = &model->tensors[l];
+        if (!tensor->bias_start) {
+            continue;
+        }
+        size_t weight_count = tensor->weight_end - tensor->weight_start;
+        size_t bias_count = tensor->bias_end - tensor->bias_start;
+        if (tensor->weight_start) {
+            memcpy(region.memory_used, tensor->weight_start, weight_count * sizeof(float));
+            tensor->weight_start = region.memory_used;
+            tensor->weight_end = tensor->weight_start + weight_count;
+            region.memory_used += arenaFloats(weight_count);
+        }
+        memcpy(region.memory_used, tensor->bias_start, bias_count * sizeof(float));
+        tensor->bias_start = region.memory_used;
+        tensor->bias_end = tensor->bias_start + bias_count;
+        region.memory_used += arenaFloats(bias_count);
+    }
+
+    freeRegion(&model->memory_block);
+    model->memory_block = region;
+    return SUCCESS;
+}
+
+// Header, layer_count records, padding up to header_size, then data_size bytes of data
+static int writeContainer(const char* param_path, const ParamFileHeader* header, const void* records, size_t record_size, const uint8_t* data) {
+    FILE* param_out = fopen(param_path, "wb");
+    if (param_out == NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: File (%s) could not be opened for writing\n", param_path);
+        return FILE_NOT_READABLE;
+    }
+
+    int status = SUCCESS;
+    size_t padding = header->header_size - sizeof(ParamFileHeader) - header->layer_count * record_size;
+    uint8_t zeros[TINYANN_PARAM_ALIGNMENT] = {0};
+
+    if (fwrite(header, sizeof(ParamFileHeader), 1, param_out) != 1 ||
+        fwrite(records, record_size, header->layer_count, param_out) != header->layer_count || fwrite(zeros, 1, padding, param_out) != padding ||
+        fwrite(data, 1, header->data_size, param_out) != header->data_size) {
+        fprintf(stderr, "ERROR TINY_ANN: Write error for (%s)\n", param_path);
+        status = FILE_NOT_READABLE;
+    }
+    fclose(param_out);
+
+    return status;
+}
+
+static void initHeader(ParamFileHeader* header, const char* magic, const Model* model, size_t record_size) {
+    memset(header, 0, sizeof(ParamFileHeader));
+    memcpy(header->magic, magic, strlen(magic));
+    header->version = TINYANN_PARAM_VERSION;
+    header->alignment = TINYANN_PARAM_ALIGNMENT;
+
+    for (size_t i = 0; i < model->total_layers; i++) {
+        if (hasWeights(&model->tensors[i]))
+            header->layer_count++;
+    }
+    header->header_size = (uint32_t)alignOffset(sizeof(ParamFileHeader) + header->layer_count * record_size);
+}
+
+// Writes the nonzeros of a sparse layer into its zeroed weight block, as fp32 or rounded to format
+static void expandSparseWeights(const SparseMatrix* matrix, uint8_t* block, int format) {
+    for (size_t r = 0; r < matrix->rows; r++) {
+        for (size_t k = matrix->row_start[r]; k < matrix->row_start[r + 1]; k++) {
+            size_t index = r * matrix->cols + matrix->columns[k];
+            if (format == _weights_fp32) {
+                ((float*)block)[index] = matrix->values[k];
+            } else {
+                ((uint16_t*)block)[index] = floatToHalf(matrix->values[k], format);
+            }
+        }
+    }
+}
+
+// fp32 container for _weights_fp32, otherwise the half container with the fc weights rounded to format
+static int writeFloatContainer(const Model* model, const char* param_path, int format) {
+    ParamFileHeader header;
+    initHeader(&header, format == _weights_fp32 ? TINYANN_PARAM_MAGIC : TINYANN_HPARAM_MAGIC, model, sizeof(ParamLayerRecord));
+
+    ParamLayerRecord* records = (ParamLayerRecord*)calloc(header.layer_count ? header.layer_count : 1, sizeof(ParamLayerRecord));
+    if (!records) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in writeFloatContainer()\n");
+        return MEMORY_ALLOCATION_FAILED;
+    }
+
+    // Lay out every block on an aligned offset
+    size_t offset = header.header_size;
+    size_t record_no = 0;
+    for (size_t i = 0; i < model->total_layers; i++) {
+        const Tensor* tensor = &model->tensors[i];
+        if (!hasWeights(tensor))
+            continue;
+
+        // A layer converted by setModelWeightFormat() only has its halves left, written as they are in the same format,
+        // one converted by setModelSparsity() its CSR copy, expanded again
+        int halves_only = !tensor->weight_start && tensor->half_weight_start && tensor->weight_format == format;
+        int sparse_only = !tensor->weight_start && tensor->sparse_weights;
+        if (!tensor->weight_start && !halves_only && !sparse_only) {
+            fprintf(stderr, "ERROR TINY_ANN: Layer %zu has no fp32 weights to write\n", i + 1);
+            free(records);
+            return INVALID_ARGUMENT;
+        }
+
+        ParamLayerRecord* record = &records[record_no++];
+        record->layer_no = (uint32_t)i;
+        record->operation = (uint32_t)tensor->info[_operation];
+        record->input = (uint32_t)tensor->info[_input];
+        record->output = (uint32_t)tensor->info[_output];
+        record->kernel_size = (uint32_t)tensor->info[_kernel_size];
+        record->weight_format = tensor->info[_operation] == _fully_connected ? format : _weights_fp32;
+        record->weight_count = tensor->weight_start ? (size_t)(tensor->weight_end - tensor->weight_start) : weightCount(tensor);
+        record->bias_count = tensor->bias_end - tensor->bias_start;
+        record->weight_offset = offset;
+        offset = alignOffset(offset + record->weight_count * (record->weight_format == _weights_fp32 ? sizeof(float) : sizeof(uint16_t)));
+        record->bias_offset = offset;
+        offset = alignOffset(offset + record->bias_count * sizeof(float));
+    }
+    header.data_size = offset - header.header_size;
+
+    uint8_t* data = (uint8_t*)calloc(header.data_size ? header.data_size : 1, 1);
+    if (!data) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in writeFloatContainer()\n");
+        free(records);
+        return MEMORY_ALLOCATION_FAILED;
+    }
+
+    record_no = 0;
+    for (size_t i = 0; i < model->total_layers; i++) {
+        const Tensor* tensor = &model->tensors[i];
+        if (!hasWeights(tensor))
+            continue;
+
+        ParamLayerRecord* record = &records[record_no++];
+        if (!tensor->weight_start && tensor->sparse_weights) {
+            expandSparseWeights(tensor->sparse_weights, data + (record->weight_offset - header.header_size), record->weight_format);
+        } else if (record->weight_format == _weights_fp32) {
+            memcpy(data + (record->weight_offset - header.header_size), tensor->weight_start, record->weight_count * sizeof(float));
+        } else if (!tensor->weight_start) {
+            memcpy(data + (record->weight_offset - header.header_size), tensor->half_weight_start, record->weight_count * sizeof(uint16_t));
+        } else {
+            uint16_t* half = (uint16_t*)(data + (record->weight_offset - header.header_size));
+            for (size_t k = 0; k < record->weight_count; k++) {
+                half[k] = floatToHalf(tensor->weight_start[k], format);
+            }
+        }
+        memcpy(data + (record->bias_offset - header.header_size), tensor->bias_start, record->bias_count * sizeof(float));
+    }
+    header.checksum = paramChecksum(data, header.data_size);
+
+    int status = writeContainer(param_path, &header, records, sizeof(ParamLayerRecord), data);
+
+    free(data);
+    free(records);
+
+    return status;
+}
+
+int writeParamsBinary(const Model* model, const char* param_path) { return writeFloatContainer(model, param_path, _weights_fp32); }
+
+int writeParamsHalf(const Model* model, const char* param_path, int format) {
+    if (format != _weights_fp16 && format != _weights_bf16) {
+        fprintf(stderr, "ERROR TINY_ANN: Unknown weight format %d\n", format);
+        return INVALID_ARGUMENT;
+    }
+    return writeFloatContainer(model, param_path, format);
+}
+
+int writeParamsInt8(const Model* model, const char* param_path) {
+    ParamFileHeader header;
+    initHeader(&header, TINYANN_QPARAM_MAGIC, model, sizeof(QuantLayerRecord));
+
+    QuantLayerRecord* records = (QuantLayerRecord*)calloc(header.layer_count ? header.layer_count : 1, sizeof(QuantLayerRecord));
+    if (!records) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in writeParamsInt8()\n");
+        return MEMORY_ALLOCATION_FAILED;
+    }
+
+    size_t offset = header.header_size;
+    size_t record_no = 0;
+    for (size_t i = 0; i < model->total_layers; i++) {
+        const Tensor* tensor = &model->tensors[i];
+        if (!hasWeights(tensor))
+            continue;
+
+        int fp32 = keepsFp32(tensor);
+        if (fp32 ? !tensor->weight_start : !tensor->qweight_start) {
+            fprintf(stderr, "ERROR TINY_ANN: Layer %zu is not %s, run quantizeModel() first\n", i + 1, fp32 ? "loaded" : "quantized");
+            free(records);
+            return INVALID_ARGUMENT;
+        }
+
+        QuantLayerRecord* record = &records[record_no++];
+        record->layer_no = (uint32_t)i;
+        record->operation = (uint32_t)tensor->info[_operation];
+        record->input = (uint32_t)tensor->info[_input];
+        record->output = (uint32_t)tensor->info[_output];
+        record->kernel_size = (uint32_t)tensor->info[_kernel_size];
+        record->input_scale = fp32 ? 0.0f : tensor->input_scale;
+        record->weight_rows = fp32 ? weightCount(tensor) : quantRows(tensor);
+        record->row_stride = fp32 ? sizeof(float) : quantRowStride(tensor);
+        record->weight_offset = offset;
+        offset = alignOffset(offset + record->weight_rows * record->row_stride);
+        if (!fp32) {
+            record->scale_offset = offset;
+            offset = alignOffset(offset + record->output * sizeof(float));
+        }
+        record->bias_offset = offset;
+        offset = alignOffset(offset + record->output * sizeof(float));
+    }
+    header.data_size = offset - header.header_size;
+
+    uint8_t* data = (uint8_t*)calloc(header.data_size ? header.data_size : 1, 1);
+    if (!data) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in writeParamsInt8()\n");
+        free(records);
+        return MEMORY_ALLOCATION_FAILED;
+    }
+
+    record_no = 0;
+    for (size_t i = 0; i < model->total_layers; i++) {
+        const Tensor* tensor = &model->tensors[i];
+        if (!hasWeights(tensor))
+            continue;
+
+        QuantLayerRecord* record = &records[record_no++];
+        if (keepsFp32(tensor)) {
+            memcpy(data + (record->weight_offset - header.header_size), tensor->weight_start, record->weight_rows * record->row_stride);
+        } else {
+            memcpy(data + (record->weight_offset - header.header_size), tensor->qweight_start, record->weight_rows * record->row_stride);
+            memcpy(data + (record->scale_offset - header.header_size), tensor->weight_scales, record->output * sizeof(float));
+        }
+        memcpy(data + (record->bias_offset - header.header_size), tensor->bias_start, record->output * sizeof(float));
+    }
+    header.checksum = paramChecksum(data, header.data_size);
+
+    int status = writeContainer(param_path, &header, records, sizeof(QuantLayerRecord), data);
+
+    free(data);
+    free(records);
+
+    return status;
+}
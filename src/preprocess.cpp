@@ -0,0 +1,144 @@
+#include "../include/preprocess.h"
+#include "../include/kernels.h"
+
+PreprocessOptions defaultPreprocessOptions() {
+    PreprocessOptions options;
+    for (size_t c = 0; c < PREPROCESS_MAX_CHANNELS; c++) {
+        options.mean[c] = 255 * 0.5f;
+        options.std[c] = 255 * 0.5f;
+    }
+    options.reverse_channels = 1;
+
+    return options;
+}
+
+int createPreprocessor(Preprocessor* preprocessor, const Model* model, const PreprocessOptions* options) {
+    preprocessor->channels = model->image_filters;
+    preprocessor->rows = model->image_rows;
+    preprocessor->cols = model->image_cols;
+    preprocessor->resampled[0] = NULL;
+    preprocessor->resampled[1] = NULL;
+    preprocessor->x_offsets = NULL;
+    preprocessor->x_weights = NULL;
+    preprocessor->kernels = selectKernels();
+
+    if (preprocessor->channels == 0 || preprocessor->channels > PREPROCESS_MAX_CHANNELS) {
+        fprintf(stderr, "ERROR TINY_ANN: Preprocessing supports 1 to %d channels, the model has %zu\n", PREPROCESS_MAX_CHANNELS,
+                preprocessor->channels);
+        return INVALID_ARGUMENT;
+    }
+
+    for (size_t c = 0; c < preprocessor->channels; c++) {
+        if (options->std[c] == 0.0f) {
+            fprintf(stderr, "ERROR TINY_ANN: Preprocessing std of channel %zu is 0\n", c);
+            return INVALID_ARGUMENT;
+        }
+        preprocessor->scale[c] = 1.0f / options->std[c];
+        preprocessor->bias[c] = -options->mean[c] / options->std[c];
+    }
+    preprocessor->reverse_channels = options->reverse_channels;
+
+    size_t row_size = preprocessor->channels * preprocessor->cols;
+    preprocessor->resampled[0] = (float*)malloc(2 * row_size * sizeof(float));
+    preprocessor->x_offsets = (uint32_t*)malloc(2 * preprocessor->cols * sizeof(uint32_t));
+    preprocessor->x_weights = (float*)malloc(preprocessor->cols * sizeof(float));
+    if (!preprocessor->resampled[0] || !preprocessor->x_offsets || !preprocessor->x_weights) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in createPreprocessor()\n");
+        destroyPreprocessor(preprocessor);
+        return MEMORY_ALLOCATION_FAILED;
+    }
+    preprocessor->resampled[1] = preprocessor->resampled[0] + row_size;
+
+    return SUCCESS;
+}
+
+void destroyPreprocessor(Preprocessor* preprocessor) {
+    free(preprocessor->resampled[0]);
+    free(preprocessor->x_offsets);
+    free(preprocessor->x_weights);
+    preprocessor->resampled[0] = NULL;
+    preprocessor->resampled[1] = NULL;
+    preprocessor->x_offsets = NULL;
+    preprocessor->x_weights = NULL;
+}
+
+// Source pixel left of / above output pixel i and the weight of the next one, (i + 0.5) * in / out - 0.5 clamped to the edges
+static size_t sourceCoordinate(size_t i, size_t out_size, size_t in_size, float* weight) {
+    double position = (i + 0.5) * in_size / out_size - 0.5;
+    *weight = 0.0f;
+
+    if (position <= 0.0) {
+        return 0;
+    }
+    size_t first = (size_t)position;
+    if (first >= in_size - 1) {
+        return in_size - 1;
+    }
+    *weight = (float)(position - first);
+    return first;
+}
+
+// One source row -> channels planes of cols floats, in channel order of the output
+static void resampleRow(const Preprocessor* preprocessor, const uint8_t* src_row, float* planes) {
+    size_t channels = preprocessor->channels;
+    size_t cols = preprocessor->cols;
+
+    for (size_t c = 0; c < channels; c++) {
+        const uint8_t* src_channel = src_row + (preprocessor->reverse_channels ? channels - 1 - c : c);
+        preprocessor->kernels->resample_row(src_channel, preprocessor->x_offsets, preprocessor->x_offsets + cols, preprocessor->x_weights,
+                                            planes + c * cols, cols);
+    }
+}
+
+int preprocessImage(Preprocessor* preprocessor, const uint8_t* src, size_t height, size_t width, size_t row_stride, float* out) {
+    if (src == NULL || height == 0 || width == 0 || row_stride < width * preprocessor->channels || width * preprocessor->channels > INT32_MAX) {
+        fprintf(stderr, "ERROR TINY_ANN: Invalid source image in preprocessImage()\n");
+        return INVALID_ARGUMENT;
+    }
+
+    size_t channels = preprocessor->channels;
+    size_t rows = preprocessor->rows;
+    size_t cols = preprocessor->cols;
+
+    for (size_t x = 0; x < cols; x++) {
+        size_t first = sourceCoordinate(x, cols, width, &preprocessor->x_weights[x]);
+        preprocessor->x_offsets[x] = (uint32_t)(first * channels);
+        preprocessor->x_offsets[cols + x] = (uint32_t)((preprocessor->x_weights[x] > 0.0f ? first + 1 : first) * channels);
+    }
+
+    // Source rows held in the two resampled rows, downscaling skips rows no output row reads, upscaling reuses them
+    float* resampled[2] = {preprocessor->resampled[0], preprocessor->resampled[1]};
+    size_t held[2] = {height, height};
+
+    for (size_t y = 0; y < rows; y++) {
+        float y_weight;
+        size_t top = sourceCoordinate(y, rows, height, &y_weight);
+        size_t bottom = y_weight > 0.0f ? top + 1 : top;
+
+        if (held[0] != top) {
+            if (held[1] == top) {
+                float* swap = resampled[0];
+                resampled[0] = resampled[1];
+                resampled[1] = swap;
+                held[0] = top;
+                held[1] = height;
+            } else {
+                resampleRow(preprocessor, src + top * row_stride, resampled[0]);
+                held[0] = top;
+            }
+        }
+        if (bottom != top && held[1] != bottom) {
+            resampleRow(preprocessor, src + bottom * row_stride, resampled[1]);
+            held[1] = bottom;
+        }
+
+        const float* upper = resampled[0];
+        const float* lower = bottom != top ? resampled[1] : upper;
+        for (size_t c = 0; c < channels; c++) {
+            preprocessor->kernels->lerp_normalize_row(upper + c * cols, lower + c * cols, y_weight, preprocessor->scale[c], preprocessor->bias[c],
+                                                      out + (c * rows + y) * cols, cols);
+        }
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,192 @@
+#include "../include/profile.h"
+
+static double nowSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+const char* layerName(const TinyANN* tinyANN, size_t layer_no) {
+    const Tensor* tensor = &tinyANN->tensors[layer_no];
+    int relu = tensor->info[_activation] == _relu;
+    int int8 = tensor->qweight_start != NULL;
+
+    switch (tensor->info[_operation]) {
+    case _convolution:
+        if (tensor->fusion == _fused_relu_maxpool) {
+            return int8 ? "convolution_int8+relu+max_pool" : "convolution+relu+max_pool";
+        }
+        if (relu) {
+            return int8 ? "convolution_int8+relu" : "convolution+relu";
+        }
+        return int8 ? "convolution_int8" : "convolution";
+    case _depthwise_convolution:
+        return relu ? "depthwise_convolution+relu" : "depthwise_convolution";
+    case _pointwise_convolution:
+        return relu ? "pointwise_convolution+relu" : "pointwise_convolution";
+    case _maxpool:
+        return "max_pool";
+    case _flatten:
+        return "flatten";
+    case _fully_connected:
+        if (!int8 && tensor->sparse_weights) {
+            return relu ? "fully_connected_sparse+relu" : "fully_connected_sparse";
+        }
+        if (!int8 && tensor->half_weight_start) {
+            if (tensor->weight_format == _weights_bf16) {
+                return relu ? "fully_connected_bf16+relu" : "fully_connected_bf16";
+            }
+            return relu ? "fully_connected_fp16+relu" : "fully_connected_fp16";
+        }
+        if (relu) {
+            return int8 ? "fully_connected_int8+relu" : "fully_connected+relu";
+        }
+        return int8 ? "fully_connected_int8" : "fully_connected";
+    }
+    return "output";
+}
+
+int enableProfiling(TinyANN* tinyANN, size_t sample_every, size_t max_trace_events) {
+#ifndef TINYANN_PROFILE
+    (void)tinyANN;
+    (void)sample_every;
+    (void)max_trace_events;
+    fprintf(stderr, "ERROR TINY_ANN: Profiling is not compiled in, configure with -DTINYANN_PROFILE=ON\n");
+    return NOT_SUPPORTED;
+#else
+    disableProfiling(tinyANN);
+
+    Profiler* profiler = (Profiler*)calloc(1, sizeof(Profiler));
+    if (!profiler) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in enableProfiling()\n");
+        return MEMORY_ALLOCATION_FAILED;
+    }
+    profiler->layers = (LayerStats*)calloc(tinyANN->total_layers, sizeof(LayerStats));
+    profiler->sample_every = max_trace_events ? sample_every : 0;
+    profiler->max_trace_events = profiler->sample_every ? max_trace_events : 0;
+    profiler->events = profiler->max_trace_events ? (TraceEvent*)malloc(max_trace_events * sizeof(TraceEvent)) : NULL;
+    if (!profiler->layers || (profiler->max_trace_events && !profiler->events)) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in enableProfiling()\n");
+        free(profiler->layers);
+        free(profiler);
+        return MEMORY_ALLOCATION_FAILED;
+    }
+
+    profiler->origin_cycles = readCycleCounter();
+    profiler->origin_seconds = nowSeconds();
+    tinyANN->profiler = profiler;
+
+    return SUCCESS;
+#endif
+}
+
+void disableProfiling(TinyANN* tinyANN) {
+    Profiler* profiler = tinyANN->profiler;
+    if (profiler) {
+        free(profiler->layers);
+        free(profiler->events);
+        free(profiler);
+        tinyANN->profiler = NULL;
+    }
+}
+
+// Counter ticks per second between enableProfiling() and now
+static double cyclesPerSecond(const Profiler* profiler) {
+    double seconds = nowSeconds() - profiler->origin_seconds;
+    uint64_t cycles = readCycleCounter() - profiler->origin_cycles;
+    return seconds > 0.0 && cycles > 0 ? cycles / seconds : 1e9;
+}
+
+int snapshotProfile(const TinyANN* tinyANN, ProfileSnapshot* snapshot) {
+    const Profiler* profiler = tinyANN->profiler;
+    if (!profiler) {
+        fprintf(stderr, "ERROR TINY_ANN: Profiling is not enabled on this context\n");
+        return INVALID_ARGUMENT;
+    }
+
+    snapshot->batches = profiler->batches;
+    snapshot->cycles_per_second = cyclesPerSecond(profiler);
+    memcpy(snapshot->layers, profiler->layers, tinyANN->total_layers * sizeof(LayerStats));
+
+    return SUCCESS;
+}
+
+int resetProfile(TinyANN* tinyANN) {
+    Profiler* profiler = tinyANN->profiler;
+    if (!profiler) {
+        fprintf(stderr, "ERROR TINY_ANN: Profiling is not enabled on this context\n");
+        return INVALID_ARGUMENT;
+    }
+
+    memset(profiler->layers, 0, tinyANN->total_layers * sizeof(LayerStats));
+    profiler->batches = 0;
+    profiler->recorded_events = 0;
+
+    return SUCCESS;
+}
+
+void profileBatchBegin(TinyANN* tinyANN) {
+    Profiler* profiler = tinyANN->profiler;
+    profiler->sampling = profiler->sample_every && profiler->batches % profiler->sample_every == 0;
+    profiler->batches++;
+}
+
+void profileRecord(TinyANN* tinyANN, size_t layer_no, uint64_t start, uint64_t end) {
+    Profiler* profiler = tinyANN->profiler;
+
+    if (layer_no < tinyANN->total_layers) {
+        profiler->layers[layer_no].calls++;
+        profiler->layers[layer_no].cycles += end - start;
+    }
+
+    if (profiler->sampling) {
+        TraceEvent* event = &profiler->events[profiler->recorded_events++ % profiler->max_trace_events];
+        event->start = start;
+        event->cycles = end - start;
+        event->batch = profiler->batches - 1;
+        event->layer = (uint32_t)layer_no;
+        event->images = (uint32_t)tinyANN->batch_size;
+    }
+}
+
+int writeChromeTrace(const TinyANN* tinyANN, const char* trace_path) {
+    const Profiler* profiler = tinyANN->profiler;
+    if (!profiler) {
+        fprintf(stderr, "ERROR TINY_ANN: Profiling is not enabled on this context\n");
+        return INVALID_ARGUMENT;
+    }
+
+    FILE* trace = fopen(trace_path, "wb");
+    if (trace == NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: File (%s) could not be opened for writing\n", trace_path);
+        return FILE_NOT_READABLE;
+    }
+
+    // Complete ("X") events in microseconds since enableProfiling(), the batch event encloses its layers
+    double cycles_per_us = cyclesPerSecond(profiler) * 1e-6;
+    uint64_t kept = profiler->recorded_events < profiler->max_trace_events ? profiler->recorded_events : profiler->max_trace_events;
+    const char* separator = "\n";
+
+    fprintf(trace, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for (uint64_t i = profiler->recorded_events - kept; i < profiler->recorded_events; i++) {
+        const TraceEvent* event = &profiler->events[i % profiler->max_trace_events];
+        const char* name = event->layer < tinyANN->total_layers ? layerName(tinyANN, event->layer) : "inference_batch";
+
+        fprintf(trace, "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f, \"dur\": %.3f, ", separator, name,
+                event->layer < tinyANN->total_layers ? "layer" : "batch", (event->start - profiler->origin_cycles) / cycles_per_us,
+                event->cycles / cycles_per_us);
+        if (event->layer < tinyANN->total_layers) {
+            fprintf(trace, "\"args\": {\"layer\": %u, \"batch\": %llu, \"images\": %u}}", event->layer + 1, (unsigned long long)event->batch,
+                    event->images);
+        } else {
+            fprintf(trace, "\"args\": {\"batch\": %llu, \"images\": %u}}", (unsigned long long)event->batch, event->images);
+        }
+        separator = ",\n";
+    }
+    fprintf(trace, "\n]}\n");
+
+    int status = ferror(trace) ? FILE_NOT_READABLE : SUCCESS;
+    fclose(trace);
+
+    return status;
+}
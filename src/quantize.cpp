@@ -0,0 +1,339 @@
+#include "../include/quantize.h"
+#include "../include/arena.h"
+#include "../include/gemm.h"
+#include "../include/kernels.h"
+#include "../include/sparse.h"
+#include "../include/thread_pool.h"
+
+// Depthwise and pointwise layers have no int8 kernels and keep running in fp32
+static int hasParams(const Tensor* tensor) { return tensor->info[_operation] == _convolution || tensor->info[_operation] == _fully_connected; }
+
+static size_t alignBytes(size_t bytes) { return (bytes + 63) & ~(size_t)63; }
+
+size_t quantRowStride(const Tensor* tensor) {
+    size_t depth = tensor->info[_input] * tensor->info[_kernel_size] * tensor->info[_kernel_size];
+    return (depth + QUANT_K_ALIGN - 1) / QUANT_K_ALIGN * QUANT_K_ALIGN;
+}
+
+size_t quantRows(const Tensor* tensor) { return (tensor->info[_output] + QUANT_MR - 1) / QUANT_MR * QUANT_MR; }
+
+void recordActivationRange(TinyANN* tinyANN, size_t layer_no) {
+    const Tensor* tensor = &tinyANN->tensors[layer_no];
+    size_t n = tinyANN->batch_size * tensor->batch_stride;
+    float range = tinyANN->activation_ranges[layer_no];
+
+    for (size_t i = 0; i < n; i++) {
+        float value = fabsf(tensor->start[i]);
+        if (value > range) {
+            range = value;
+        }
+    }
+    tinyANN->activation_ranges[layer_no] = range;
+}
+
+// Symmetric per output channel, the largest weight maps to 127. columns places the weights in row (NULL: one after the other)
+static float quantizeRow(const float* weights, const uint32_t* columns, size_t count, int8_t* row) {
+    float max_abs = 0.0f;
+    for (size_t k = 0; k < count; k++) {
+        if (fabsf(weights[k]) > max_abs) {
+            max_abs = fabsf(weights[k]);
+        }
+    }
+
+    float scale = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+    for (size_t k = 0; k < count; k++) {
+        long q = lrintf(weights[k] / scale);
+        row[columns ? columns[k] : k] = (int8_t)(q > 127 ? 127 : (q < -127 ? -127 : q));
+    }
+    return scale;
+}
+
+int quantizeModel(Model* model, const float* activation_ranges) {
+    size_t memory_size = 0;
+    for (size_t i = 0; i < model->total_layers; i++) {
+        const Tensor* tensor = &model->tensors[i];
+        if (!hasParams(tensor))
+            continue;
+
+        if (!tensor->weight_start && !tensor->sparse_weights) {
+            fprintf(stderr, "ERROR TINY_ANN: Layer %zu has no fp32 weights to quantize\n", i + 1);
+            return INVALID_ARGUMENT;
+        }
+        memory_size += alignBytes(quantRows(tensor) * quantRowStride(tensor)) + alignBytes(tensor->info[_output] * sizeof(float));
+    }
+
+    void* memory = allocateModelBuffer(model, memory_size);
+    if (memory == NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in quantizeModel()\n");
+        return MEMORY_ALLOCATION_FAILED;
+    }
+    memset(memory, 0, memory_size); // padding rows and columns stay zero
+
+    freeModelBuffer(model->quant_memory);
+    model->quant_memory = memory;
+
+    uint8_t* block = (uint8_t*)memory;
+    for (size_t i = 0; i < model->total_layers; i++) {
+        Tensor* tensor = &model->tensors[i];
+        if (!hasParams(tensor))
+            continue;
+
+        size_t depth = tensor->info[_input] * tensor->info[_kernel_size] * tensor->info[_kernel_size];
+        size_t row_stride = quantRowStride(tensor);
+
+        tensor->qweight_start = (int8_t*)block;
+        block += alignBytes(quantRows(tensor) * row_stride);
+        tensor->weight_scales = (float*)block;
+        block += alignBytes(tensor->info[_output] * sizeof(float));
+
+        // A sparse fc layer only has its nonzeros left, the zeros quantize to the zeroed row anyway
+        const SparseMatrix* sparse = tensor->weight_start ? NULL : tensor->sparse_weights;
+        for (size_t m = 0; m < tensor->info[_output]; m++) {
+            int8_t* row = tensor->qweight_start + m * row_stride;
+            if (sparse) {
+                size_t begin = sparse->row_start[m];
+                tensor->weight_scales[m] =
+                    quantizeRow(sparse->values + begin, sparse->columns + begin, sparse->row_start[m + 1] - begin, row);
+            } else {
+                tensor->weight_scales[m] = quantizeRow(tensor->weight_start + m * depth, NULL, depth, row);
+            }
+        }
+
+        // A layer calibration never reached (or that only saw zeros) keeps a unit scale
+        float range = activation_ranges ? activation_ranges[i] : 0.0f;
+        tensor->input_scale = range > 0.0f ? range / 127.0f : 1.0f;
+    }
+
+    return SUCCESS;
+}
+
+int createInt8Workspace(TinyANN* tinyANN) {
+    size_t input_size = 0;
+    size_t column_size = 0;
+
+    // The quantized input of one layer for max_batch images, then per worker QUANT_NC packed im2col columns and one being gathered
+    for (size_t i = 0; i < tinyANN->total_layers; i++) {
+        const Tensor* tensor = &tinyANN->tensors[i];
+        if (!tensor->qweight_start)
+            continue;
+
+        size_t row_stride = quantRowStride(tensor);
+        size_t size = tinyANN->max_batch * (tensor->info[_operation] == _convolution ? tensor->channels * tensor->height * tensor->width : row_stride);
+        if (size > input_size) {
+            input_size = size;
+        }
+        if (tensor->info[_operation] == _convolution && (QUANT_NC + 1) * row_stride > column_size) {
+            column_size = (QUANT_NC + 1) * row_stride;
+        }
+    }
+
+    if (!input_size) {
+        return SUCCESS;
+    }
+
+    tinyANN->int8_input_size = alignBytes(input_size);
+    tinyANN->int8_workspace_size = column_size;
+
+    void* workspace = NULL;
+    if (posix_memalign(&workspace, 64, tinyANN->int8_input_size + threadPoolSize(tinyANN->thread_pool) * column_size) != 0) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in createInt8Workspace()\n");
+        return MEMORY_ALLOCATION_FAILED;
+    }
+    tinyANN->int8_workspace = (int8_t*)workspace;
+
+    return SUCCESS;
+}
+
+static void quantizeMapRange(void* context, size_t begin, size_t end, size_t worker) {
+    (void)worker;
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    const Tensor* tensor = &tinyANN->tensors[((LayerTask*)context)->layer_no];
+
+    for (size_t b = begin; b < end; b++) {
+        tinyANN->kernels->quantize_s8(tensor->start + b * tensor->batch_stride, tinyANN->int8_workspace + b * tensor->batch_stride,
+                                      1.0f / tensor->input_scale, tensor->batch_stride);
+    }
+}
+
+// Stores rows [m0, m0 + QUANT_MR) of n_cols columns from their int32 sums acc[r * acc_stride + j] to out[(m0 + r) * out_stride + j]
+static void storeInt8Outputs(const Tensor* tensor, size_t m0, const int32_t* acc, size_t acc_stride, size_t n_cols, float* out, size_t out_stride) {
+    size_t outputs = tensor->info[_output];
+    int fused_relu = tensor->fusion != _unfused;
+
+    for (size_t r = 0; r < QUANT_MR && m0 + r < outputs; r++) {
+        float scale = tensor->input_scale * tensor->weight_scales[m0 + r];
+        float bias = tensor->bias_start[m0 + r];
+        float* out_row = out + (m0 + r) * out_stride;
+
+        for (size_t j = 0; j < n_cols; j++) {
+            float value = acc[r * acc_stride + j] * scale + bias;
+            out_row[j] = fused_relu && value < 0 ? 0.0f : value;
+        }
+    }
+}
+
+/*
+Output pixels [pixel, pixel + n_cols) of image b, n_cols <= QUANT_NC, every channel m is written to out[m * out_stride + j] (bias and fused relu included)
+The pixels are lowered into int8 im2col columns padded to row_stride and packed QUANT_NR columns to a strip in the pair layout gemm_s8() reads
+*/
+static void convolutionInt8Block(TinyANN* tinyANN, size_t layer_no, size_t worker, size_t b, size_t pixel, size_t n_cols, float* out, size_t out_stride) {
+    const Tensor* tensor = &tinyANN->tensors[layer_no];
+    const Tensor* next = &tinyANN->tensors[layer_no + 1];
+    long padding = tensor->info[_padding];
+    long height = tensor->height;
+    long width = tensor->width;
+    long kernel_size = tensor->info[_kernel_size];
+    long stride = tensor->info[_stride];
+    size_t in_filters = tensor->info[_input];
+    size_t row_stride = quantRowStride(tensor);
+    const int8_t* feature_map = tinyANN->int8_workspace + b * tensor->batch_stride;
+    int8_t* strips = tinyANN->int8_workspace + tinyANN->int8_input_size + worker * tinyANN->int8_workspace_size;
+    int8_t* col = strips + QUANT_NC * row_stride;
+
+    if (n_cols % QUANT_NR) {
+        memset(strips + n_cols / QUANT_NR * QUANT_NR * row_stride, 0, QUANT_NR * row_stride);
+    }
+
+    for (size_t j = 0; j < n_cols; j++) {
+        long top = (long)((pixel + j) / next->width) * stride - padding;
+        long left = (long)((pixel + j) % next->width) * stride - padding;
+        size_t k = 0;
+
+        // Taps in the padding are zero, windows away from the left / right border copy whole kernel rows
+        int inside = left >= 0 && left + kernel_size <= width;
+        for (size_t in_f = 0; in_f < in_filters; in_f++) {
+            for (long x = 0; x < kernel_size; x++, k += kernel_size) {
+                long in_y = top + x;
+                if (in_y < 0 || in_y >= height) {
+                    memset(col + k, 0, kernel_size);
+                    continue;
+                }
+
+                const int8_t* in_row = feature_map + (in_f * height + in_y) * width;
+                for (long y = 0; y < kernel_size; y++) {
+                    col[k + y] = inside || (left + y >= 0 && left + y < width) ? in_row[left + y] : 0;
+                }
+            }
+        }
+        memset(col + k, 0, row_stride - k);
+
+        int8_t* packed = strips + j / QUANT_NR * QUANT_NR * row_stride + 2 * (j % QUANT_NR);
+        for (size_t i = 0; i < row_stride; i += 2) {
+            memcpy(packed + i * QUANT_NR, col + i, 2);
+        }
+    }
+
+    for (size_t m0 = 0; m0 < tensor->info[_output]; m0 += QUANT_MR) {
+        const int8_t* weights = tensor->qweight_start + m0 * row_stride;
+        for (size_t j0 = 0; j0 < n_cols; j0 += QUANT_NR) {
+            int32_t acc[QUANT_MR][QUANT_NR];
+            tinyANN->kernels->gemm_s8(weights, row_stride, strips + j0 * row_stride, row_stride, acc);
+            storeInt8Outputs(tensor, m0, &acc[0][0], QUANT_NR, n_cols - j0 < QUANT_NR ? n_cols - j0 : QUANT_NR, out + j0, out_stride);
+        }
+    }
+}
+
+static void convolutionInt8Range(void* context, size_t begin, size_t end, size_t worker) {
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    size_t pixels = next->height * next->width;
+    size_t blocks = (pixels + QUANT_NC - 1) / QUANT_NC;
+
+    // Items are (image, block of QUANT_NC output pixels) pairs
+    for (size_t item = begin; item < end; item++) {
+        size_t b = item / blocks;
+        size_t pixel = (item % blocks) * QUANT_NC;
+        convolutionInt8Block(tinyANN, layer_no, worker, b, pixel, pixels - pixel < QUANT_NC ? pixels - pixel : QUANT_NC,
+                             next->start + b * next->batch_stride + pixel, pixels);
+    }
+}
+
+// Same work split as convolutionGemmPoolRange()
+static void convolutionInt8PoolRange(void* context, size_t begin, size_t end, size_t worker) {
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    const Tensor* tensor = &tinyANN->tensors[layer_no];
+    const Tensor* conv_out = &tinyANN->tensors[layer_no + 1];
+    Tensor* pool_out = &tinyANN->tensors[layer_no + 2];
+    long pool_padding = conv_out->info[_padding];
+    long pool_kernel_size = conv_out->info[_kernel_size];
+    long pool_stride = conv_out->info[_stride];
+    size_t pool_rows = fusedPoolRows(conv_out);
+    size_t groups = (pool_out->height + pool_rows - 1) / pool_rows;
+    float* band = tinyANN->fusion_workspace + FUSION_SKEW + worker * tinyANN->fusion_workspace_size;
+
+    for (size_t item = begin; item < end; item++) {
+        size_t b = item / groups;
+        long first_row = (item % groups) * pool_rows;
+        long last_row = first_row + (long)pool_rows < (long)pool_out->height ? first_row + pool_rows : pool_out->height;
+
+        long top = first_row * pool_stride - pool_padding;
+        long bottom = (last_row - 1) * pool_stride - pool_padding + pool_kernel_size;
+        long row_begin = top > 0 ? top : 0;
+        long row_end = bottom < (long)conv_out->height ? bottom : conv_out->height;
+        size_t band_columns = row_begin < row_end ? (row_end - row_begin) * conv_out->width : 0;
+
+        for (size_t n0 = 0; n0 < band_columns; n0 += QUANT_NC) {
+            convolutionInt8Block(tinyANN, layer_no, worker, b, row_begin * conv_out->width + n0,
+                                 band_columns - n0 < QUANT_NC ? band_columns - n0 : QUANT_NC, band + n0, band_columns);
+        }
+
+        for (size_t m = 0; m < tensor->info[_output]; m++) {
+            for (long pool_row = first_row; pool_row < last_row; pool_row++) {
+                max_pool_row(tinyANN, layer_no + 1, band + m * band_columns, row_begin, row_end, pool_row,
+                             pool_out->start + b * pool_out->batch_stride + (m * pool_out->height + pool_row) * pool_out->width);
+            }
+        }
+    }
+}
+
+void convolution_int8(TinyANN* tinyANN, size_t layer_no) {
+    LayerTask task = {tinyANN, layer_no};
+    const Tensor* next = &tinyANN->tensors[layer_no + 1];
+
+    parallelFor(tinyANN->thread_pool, tinyANN->batch_size, quantizeMapRange, &task);
+
+    if (tinyANN->tensors[layer_no].fusion == _fused_relu_maxpool) {
+        size_t pool_rows = fusedPoolRows(next);
+        size_t groups = (tinyANN->tensors[layer_no + 2].height + pool_rows - 1) / pool_rows;
+        parallelFor(tinyANN->thread_pool, tinyANN->batch_size * groups, convolutionInt8PoolRange, &task);
+    } else {
+        size_t blocks = (next->height * next->width + QUANT_NC - 1) / QUANT_NC;
+        parallelFor(tinyANN->thread_pool, tinyANN->batch_size * blocks, convolutionInt8Range, &task);
+    }
+}
+
+static void fullyConnectedInt8Range(void* context, size_t begin, size_t end, size_t worker) {
+    (void)worker;
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    const Tensor* tensor = &tinyANN->tensors[((LayerTask*)context)->layer_no];
+    Tensor* next = &tinyANN->tensors[((LayerTask*)context)->layer_no + 1];
+    size_t row_stride = quantRowStride(tensor);
+
+    // Items are groups of QUANT_MR output neurons, each applied to every image
+    for (size_t group = begin; group < end; group++) {
+        const int8_t* weights = tensor->qweight_start + group * QUANT_MR * row_stride;
+        for (size_t b = 0; b < tinyANN->batch_size; b++) {
+            int32_t acc[QUANT_MR];
+            tinyANN->kernels->dot_s8(weights, row_stride, tinyANN->int8_workspace + b * row_stride, row_stride, acc);
+            storeInt8Outputs(tensor, group * QUANT_MR, acc, 1, 1, next->start + b * next->batch_stride, 1);
+        }
+    }
+}
+
+void fully_connected_int8(TinyANN* tinyANN, size_t layer_no) {
+    const Tensor* tensor = &tinyANN->tensors[layer_no];
+    size_t inputs = tensor->info[_input];
+    size_t row_stride = quantRowStride(tensor);
+
+    // One input vector per image, zero padded to row_stride
+    for (size_t b = 0; b < tinyANN->batch_size; b++) {
+        int8_t* row = tinyANN->int8_workspace + b * row_stride;
+        tinyANN->kernels->quantize_s8(tensor->start + b * tensor->batch_stride, row, 1.0f / tensor->input_scale, inputs);
+        memset(row + inputs, 0, row_stride - inputs);
+    }
+
+    LayerTask task = {tinyANN, layer_no};
+    parallelFor(tinyANN->thread_pool, quantRows(tensor) / QUANT_MR, fullyConnectedInt8Range, &task);
+}
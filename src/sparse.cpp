@@ -0,0 +1,118 @@
+#include "../include/sparse.h"
+#include "../include/arena.h"
+#include "../include/kernels.h"
+#include "../include/params.h"
+#include "../include/thread_pool.h"
+
+double zeroFraction(const Tensor* tensor) {
+    size_t count = tensor->weight_end - tensor->weight_start;
+    size_t zeros = 0;
+    for (size_t i = 0; i < count; i++) {
+        zeros += tensor->weight_start[i] == 0.0f;
+    }
+    return count ? (double)zeros / count : 0.0;
+}
+
+size_t sparseWeightBytes(const SparseMatrix* matrix) {
+    return (matrix->rows + 1) * sizeof(uint32_t) + matrix->nonzeros * (sizeof(uint32_t) + sizeof(float));
+}
+
+SparseMatrix* createSparseMatrix(Model* model, const float* dense, size_t rows, size_t cols) {
+    size_t nonzeros = 0;
+    for (size_t i = 0; i < rows * cols; i++) {
+        nonzeros += dense[i] != 0.0f;
+    }
+
+    // The float values go first after the header, so every array stays 4 byte aligned
+    SparseMatrix* matrix =
+        (SparseMatrix*)allocateModelBuffer(model, sizeof(SparseMatrix) + nonzeros * sizeof(float) + (rows + 1 + nonzeros) * sizeof(uint32_t));
+    if (!matrix) {
+        fprintf(stderr, "ERROR TINY_ANN: Allocation error in createSparseMatrix()\n");
+        return NULL;
+    }
+    matrix->rows = rows;
+    matrix->cols = cols;
+    matrix->nonzeros = nonzeros;
+    matrix->values = (float*)(matrix + 1);
+    matrix->row_start = (uint32_t*)(matrix->values + nonzeros);
+    matrix->columns = matrix->row_start + rows + 1;
+
+    size_t k = 0;
+    for (size_t r = 0; r < rows; r++) {
+        matrix->row_start[r] = k;
+        for (size_t c = 0; c < cols; c++) {
+            if (dense[r * cols + c] != 0.0f) {
+                matrix->columns[k] = c;
+                matrix->values[k] = dense[r * cols + c];
+                k++;
+            }
+        }
+    }
+    matrix->row_start[rows] = k;
+
+    return matrix;
+}
+
+int setModelSparsity(Model* model, float threshold) {
+    size_t converted = 0;
+    for (size_t l = 0; l < model->total_layers; l++) {
+        Tensor* tensor = &model->tensors[l];
+        if (tensor->info[_operation] != _fully_connected || tensor->weight_start == NULL || tensor->sparse_weights) {
+            continue;
+        }
+
+        double zeros = zeroFraction(tensor);
+        if (zeros < threshold) {
+            continue;
+        }
+
+        tensor->sparse_weights = createSparseMatrix(model, tensor->weight_start, tensor->info[_output], tensor->info[_input]);
+        if (!tensor->sparse_weights) {
+            return MEMORY_ALLOCATION_FAILED;
+        }
+        printf("layer %zu : sparse, %.1f%% zeros, weights %zu -> %zu bytes\n", l + 1, zeros * 100.0,
+               (size_t)(tensor->weight_end - tensor->weight_start) * sizeof(float), sparseWeightBytes(tensor->sparse_weights));
+
+        // fully_connected() only reads the CSR copy from now on
+        releaseFloatWeights(model, tensor);
+        converted++;
+    }
+
+    return converted ? compactParams(model) : SUCCESS;
+}
+
+static void sparseRange(void* context, size_t begin, size_t end, size_t worker) {
+    (void)worker;
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    const SparseMatrix* matrix = tensor->sparse_weights;
+    size_t batch = tinyANN->batch_size;
+
+    // Each row's nonzeros are loaded once per FC_TILE images, their inputs are gathered from every image of the tile
+    for (size_t n = begin; n < end; n++) {
+        size_t row_begin = matrix->row_start[n];
+        size_t nonzeros = matrix->row_start[n + 1] - row_begin;
+
+        for (size_t b0 = 0; b0 < batch; b0 += FC_TILE) {
+            size_t b_tile = batch - b0 < FC_TILE ? batch - b0 : FC_TILE;
+            float acc[FC_TILE];
+
+            tinyANN->kernels->sparse_dot(matrix->values + row_begin, matrix->columns + row_begin, nonzeros,
+                                         tensor->start + b0 * tensor->batch_stride, tensor->batch_stride, b_tile, acc);
+
+            for (size_t b = 0; b < b_tile; b++) {
+                float value = acc[b] + tensor->bias_start[n];
+                next->start[(b0 + b) * next->batch_stride + n] = tensor->fusion == _fused_relu && value < 0 ? 0.0f : value;
+            }
+        }
+    }
+}
+
+void fully_connected_sparse(TinyANN* tinyANN, size_t layer_no) {
+    // Threads split the output neurons
+    LayerTask task = {tinyANN, layer_no};
+    parallelFor(tinyANN->thread_pool, tinyANN->tensors[layer_no].info[_output], sparseRange, &task);
+}
@@ -0,0 +1,119 @@
+#include "../include/thread_pool.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+
+    ParallelTask task;
+    void* context;
+    size_t count;
+    size_t generation;
+    size_t pending;
+    bool stop;
+};
+
+static void runChunk(ThreadPool* pool, size_t chunk) {
+    size_t threads = pool->workers.size() + 1;
+    size_t begin = pool->count * chunk / threads;
+    size_t end = pool->count * (chunk + 1) / threads;
+
+    if (begin < end) {
+        pool->task(pool->context, begin, end, chunk);
+    }
+}
+
+static void workerLoop(ThreadPool* pool, size_t chunk) {
+    size_t seen = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->start.wait(lock, [&] { return pool->stop || pool->generation != seen; });
+            if (pool->stop) {
+                return;
+            }
+            seen = pool->generation;
+        }
+
+        runChunk(pool, chunk);
+
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        if (--pool->pending == 0) {
+            pool->done.notify_one();
+        }
+    }
+}
+
+ThreadPool* createThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    ThreadPool* pool = new ThreadPool();
+    pool->task = NULL;
+    pool->context = NULL;
+    pool->count = 0;
+    pool->generation = 0;
+    pool->pending = 0;
+    pool->stop = false;
+
+    for (size_t i = 1; i < threads; i++) {
+        pool->workers.push_back(std::thread(workerLoop, pool, i));
+    }
+
+    return pool;
+}
+
+void destroyThreadPool(ThreadPool* pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->stop = true;
+    }
+    pool->start.notify_all();
+
+    for (size_t i = 0; i < pool->workers.size(); i++) {
+        pool->workers[i].join();
+    }
+
+    delete pool;
+}
+
+size_t threadPoolSize(const ThreadPool* pool) { return pool ? pool->workers.size() + 1 : 1; }
+
+void parallelFor(ThreadPool* pool, size_t count, ParallelTask task, void* context) {
+    if (pool == NULL || pool->workers.empty() || count <= 1) {
+        if (count > 0) {
+            task(context, 0, count, 0);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->task = task;
+        pool->context = context;
+        pool->count = count;
+        pool->pending = pool->workers.size();
+        pool->generation++;
+    }
+    pool->start.notify_all();
+
+    runChunk(pool, 0);
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->done.wait(lock, [&] { return pool->pending == 0; });
+}
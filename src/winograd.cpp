@@ -0,0 +1,252 @@
+#include "../include/winograd.h"
+#include "../include/gemm.h"
+#include "../include/kernels.h"
+#include "../include/thread_pool.h"
+
+int supportsWinograd(const Tensor* tensor) {
+    return tensor->info[_operation] == _convolution && tensor->info[_kernel_size] == 3 && tensor->info[_stride] == 1;
+}
+
+// Output channels rounded up to whole GEMM_MR row panels
+static size_t winogradRows(const Tensor* tensor) { return (tensor->info[_output] + GEMM_MR - 1) / GEMM_MR * GEMM_MR; }
+
+size_t winogradWeightSize(const Tensor* tensor) { return WINOGRAD_POSITIONS * winogradRows(tensor) * tensor->info[_input]; }
+
+size_t winogradWorkspaceSize(const Tensor* tensor) { return WINOGRAD_POSITIONS * (tensor->info[_input] + winogradRows(tensor)) * GEMM_NR; }
+
+void transformWinogradWeights(const Tensor* tensor, float* transformed) {
+    size_t in_filters = tensor->info[_input];
+    size_t out_filters = tensor->info[_output];
+    size_t rows = winogradRows(tensor);
+
+    // [position][row panel][in_f][GEMM_MR], rows past out_filters are zero
+    memset(transformed, 0, winogradWeightSize(tensor) * sizeof(float));
+
+    for (size_t out_f = 0; out_f < out_filters; out_f++) {
+        for (size_t in_f = 0; in_f < in_filters; in_f++) {
+            const float* g = tensor->weight_start + (out_f * in_filters + in_f) * 9;
+            float gg[4][3];
+            float u[4][4];
+
+            // G g, G = [1 0 0; 1/2 1/2 1/2; 1/2 -1/2 1/2; 0 0 1]
+            for (size_t k = 0; k < 3; k++) {
+                gg[0][k] = g[k];
+                gg[1][k] = 0.5f * (g[k] + g[3 + k] + g[6 + k]);
+                gg[2][k] = 0.5f * (g[k] - g[3 + k] + g[6 + k]);
+                gg[3][k] = g[6 + k];
+            }
+            // (G g) G^T
+            for (size_t i = 0; i < 4; i++) {
+                u[i][0] = gg[i][0];
+                u[i][1] = 0.5f * (gg[i][0] + gg[i][1] + gg[i][2]);
+                u[i][2] = 0.5f * (gg[i][0] - gg[i][1] + gg[i][2]);
+                u[i][3] = gg[i][2];
+            }
+
+            size_t panel = out_f / GEMM_MR;
+            for (size_t pos = 0; pos < WINOGRAD_POSITIONS; pos++) {
+                transformed[((pos * rows + panel * GEMM_MR) * in_filters + in_f * GEMM_MR) + out_f % GEMM_MR] = u[pos / 4][pos % 4];
+            }
+        }
+    }
+}
+
+/*
+m_block[(pos * rows + m) * GEMM_NR + j] = position pos of the transformed output of channel m for tile t0 + j, nc <= GEMM_NR tiles
+Tile t of one image's feature_map covers output rows first_row + 2 * (t / tile_cols) + {0, 1} and columns 2 * (t % tile_cols) + {0, 1}
+*/
+static float* winogradBlock(TinyANN* tinyANN, size_t layer_no, size_t worker, const float* feature_map, long first_row, size_t tile_cols,
+                            size_t t0, size_t nc) {
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    long padding = tensor->info[_padding];
+    long height = tensor->height;
+    long width = tensor->width;
+    size_t in_filters = tensor->info[_input];
+    size_t rows = winogradRows(tensor);
+
+    // Every worker transforms into its own slice of the workspace
+    float* v = tinyANN->gemm_workspace + worker * tinyANN->gemm_workspace_size;
+    float* m_block = v + WINOGRAD_POSITIONS * in_filters * GEMM_NR;
+
+    for (size_t in_f = 0; in_f < in_filters; in_f++) {
+        const float* src = feature_map + in_f * height * width;
+
+        for (size_t j = 0; j < GEMM_NR; j++) {
+            float d[4][4] = {{0.0f}};
+            float bd[4][4];
+
+            // Input tile, pixels in the padding and columns past nc stay zero
+            if (j < nc) {
+                long top = first_row + WINOGRAD_TILE * (long)((t0 + j) / tile_cols) - padding;
+                long left = WINOGRAD_TILE * (long)((t0 + j) % tile_cols) - padding;
+                for (long i = 0; i < 4; i++) {
+                    for (long k = 0; k < 4; k++) {
+                        if (top + i >= 0 && top + i < height && left + k >= 0 && left + k < width) {
+                            d[i][k] = src[(top + i) * width + left + k];
+                        }
+                    }
+                }
+            }
+
+            // B^T d, B^T = [1 0 -1 0; 0 1 1 0; 0 -1 1 0; 0 1 0 -1]
+            for (size_t k = 0; k < 4; k++) {
+                bd[0][k] = d[0][k] - d[2][k];
+                bd[1][k] = d[1][k] + d[2][k];
+                bd[2][k] = d[2][k] - d[1][k];
+                bd[3][k] = d[1][k] - d[3][k];
+            }
+            // (B^T d) B
+            for (size_t i = 0; i < 4; i++) {
+                float* dst = v + ((i * 4) * in_filters + in_f) * GEMM_NR + j;
+                dst[0 * in_filters * GEMM_NR] = bd[i][0] - bd[i][2];
+                dst[1 * in_filters * GEMM_NR] = bd[i][1] + bd[i][2];
+                dst[2 * in_filters * GEMM_NR] = bd[i][2] - bd[i][1];
+                dst[3 * in_filters * GEMM_NR] = bd[i][1] - bd[i][3];
+            }
+        }
+    }
+
+    memset(m_block, 0, WINOGRAD_POSITIONS * rows * GEMM_NR * sizeof(float));
+
+    for (size_t pos = 0; pos < WINOGRAD_POSITIONS; pos++) {
+        const float* u = tensor->winograd_weight_start + pos * rows * in_filters;
+
+        for (size_t k0 = 0; k0 < in_filters; k0 += GEMM_KC) {
+            size_t kc = in_filters - k0 < GEMM_KC ? in_filters - k0 : GEMM_KC;
+            for (size_t m0 = 0; m0 < rows; m0 += GEMM_MR) {
+                tinyANN->kernels->gemm_micro_kernel(kc, u + m0 * in_filters + k0 * GEMM_MR, v + (pos * in_filters + k0) * GEMM_NR,
+                                                    m_block + (pos * rows + m0) * GEMM_NR, GEMM_NR, GEMM_MR, GEMM_NR);
+            }
+        }
+    }
+
+    return m_block;
+}
+
+// y = A^T M A of one tile, A^T = [1 1 1 0; 0 1 -1 -1], m holds its 16 positions pos_stride apart
+static void winogradOutputTile(const float* m, size_t pos_stride, float y[2][2]) {
+    float am[2][4];
+
+    for (size_t k = 0; k < 4; k++) {
+        am[0][k] = m[k * pos_stride] + m[(4 + k) * pos_stride] + m[(8 + k) * pos_stride];
+        am[1][k] = m[(4 + k) * pos_stride] - m[(8 + k) * pos_stride] - m[(12 + k) * pos_stride];
+    }
+    for (size_t i = 0; i < 2; i++) {
+        y[i][0] = am[i][0] + am[i][1] + am[i][2];
+        y[i][1] = am[i][1] - am[i][2] - am[i][3];
+    }
+}
+
+static void convolutionWinogradRange(void* context, size_t begin, size_t end, size_t worker) {
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    size_t out_filters = tensor->info[_output];
+    size_t rows = winogradRows(tensor);
+    size_t tile_cols = (next->width + WINOGRAD_TILE - 1) / WINOGRAD_TILE;
+    size_t tiles = (next->height + WINOGRAD_TILE - 1) / WINOGRAD_TILE * tile_cols;
+    size_t blocks = (tiles + GEMM_NR - 1) / GEMM_NR;
+
+    // Items are (image, block of GEMM_NR tiles) pairs
+    for (size_t item = begin; item < end; item++) {
+        size_t b = item / blocks;
+        size_t t0 = (item % blocks) * GEMM_NR;
+        size_t nc = tiles - t0 < GEMM_NR ? tiles - t0 : GEMM_NR;
+        const float* m_block = winogradBlock(tinyANN, layer_no, worker, tensor->start + b * tensor->batch_stride, 0, tile_cols, t0, nc);
+
+        for (size_t m = 0; m < out_filters; m++) {
+            float* dst = next->start + b * next->batch_stride + m * next->height * next->width;
+
+            for (size_t j = 0; j < nc; j++) {
+                size_t top = WINOGRAD_TILE * ((t0 + j) / tile_cols);
+                size_t left = WINOGRAD_TILE * ((t0 + j) % tile_cols);
+                float y[2][2];
+                winogradOutputTile(m_block + m * GEMM_NR + j, rows * GEMM_NR, y);
+
+                // Tiles at the bottom and right edge of an odd sized map hang over it
+                for (size_t i = 0; i < WINOGRAD_TILE && top + i < next->height; i++) {
+                    for (size_t k = 0; k < WINOGRAD_TILE && left + k < next->width; k++) {
+                        float value = y[i][k] + tensor->bias_start[m];
+                        dst[(top + i) * next->width + left + k] = tensor->fusion == _fused_relu && value < 0 ? 0.0f : value;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void convolutionWinogradPoolRange(void* context, size_t begin, size_t end, size_t worker) {
+    TinyANN* tinyANN = ((LayerTask*)context)->tinyANN;
+    size_t layer_no = ((LayerTask*)context)->layer_no;
+    Tensor* tensor = &tinyANN->tensors[layer_no];
+    Tensor* conv_out = &tinyANN->tensors[layer_no + 1];
+    Tensor* pool_out = &tinyANN->tensors[layer_no + 2];
+    size_t out_filters = tensor->info[_output];
+    size_t rows = winogradRows(tensor);
+    long pool_padding = conv_out->info[_padding];
+    long pool_kernel_size = conv_out->info[_kernel_size];
+    long pool_stride = conv_out->info[_stride];
+    size_t pool_rows = fusedPoolRows(conv_out);
+    size_t groups = (pool_out->height + pool_rows - 1) / pool_rows;
+    size_t tile_cols = (conv_out->width + WINOGRAD_TILE - 1) / WINOGRAD_TILE;
+    float* band = tinyANN->fusion_workspace + FUSION_SKEW + worker * tinyANN->fusion_workspace_size;
+
+    // Items are (image, group of pooled rows) pairs like the _im2col_gemm engine, tiles start at the first conv row of the band
+    for (size_t item = begin; item < end; item++) {
+        size_t b = item / groups;
+        long first_row = (item % groups) * pool_rows;
+        long last_row = first_row + (long)pool_rows < (long)pool_out->height ? first_row + pool_rows : pool_out->height;
+
+        long top = first_row * pool_stride - pool_padding;
+        long bottom = (last_row - 1) * pool_stride - pool_padding + pool_kernel_size;
+        long row_begin = top > 0 ? top : 0;
+        long row_end = bottom < (long)conv_out->height ? bottom : conv_out->height;
+        size_t band_rows = row_begin < row_end ? row_end - row_begin : 0;
+        size_t band_columns = band_rows * conv_out->width;
+        size_t tiles = (band_rows + WINOGRAD_TILE - 1) / WINOGRAD_TILE * tile_cols;
+
+        for (size_t t0 = 0; t0 < tiles; t0 += GEMM_NR) {
+            size_t nc = tiles - t0 < GEMM_NR ? tiles - t0 : GEMM_NR;
+            const float* m_block = winogradBlock(tinyANN, layer_no, worker, tensor->start + b * tensor->batch_stride, row_begin, tile_cols, t0, nc);
+
+            for (size_t m = 0; m < out_filters; m++) {
+                for (size_t j = 0; j < nc; j++) {
+                    size_t tile_top = WINOGRAD_TILE * ((t0 + j) / tile_cols);
+                    size_t left = WINOGRAD_TILE * ((t0 + j) % tile_cols);
+                    float y[2][2];
+                    winogradOutputTile(m_block + m * GEMM_NR + j, rows * GEMM_NR, y);
+
+                    for (size_t i = 0; i < WINOGRAD_TILE && tile_top + i < band_rows; i++) {
+                        for (size_t k = 0; k < WINOGRAD_TILE && left + k < conv_out->width; k++) {
+                            band[m * band_columns + (tile_top + i) * conv_out->width + left + k] = y[i][k] + tensor->bias_start[m];
+                        }
+                    }
+                }
+            }
+        }
+        tinyANN->kernels->relu(band, out_filters * band_columns);
+
+        for (size_t m = 0; m < out_filters; m++) {
+            for (long pool_row = first_row; pool_row < last_row; pool_row++) {
+                max_pool_row(tinyANN, layer_no + 1, band + m * band_columns, row_begin, row_end, pool_row,
+                             pool_out->start + b * pool_out->batch_stride + (m * pool_out->height + pool_row) * pool_out->width);
+            }
+        }
+    }
+}
+
+void convolution_winograd(TinyANN* tinyANN, size_t layer_no) {
+    Tensor* next = &tinyANN->tensors[layer_no + 1];
+    LayerTask task = {tinyANN, layer_no};
+
+    // Fused with max_pool threads split groups of pooled rows, otherwise blocks of GEMM_NR tiles
+    if (tinyANN->tensors[layer_no].fusion == _fused_relu_maxpool) {
+        size_t pool_rows = fusedPoolRows(next);
+        size_t groups = (tinyANN->tensors[layer_no + 2].height + pool_rows - 1) / pool_rows;
+        parallelFor(tinyANN->thread_pool, tinyANN->batch_size * groups, convolutionWinogradPoolRange, &task);
+    } else {
+        size_t tiles = (next->height + WINOGRAD_TILE - 1) / WINOGRAD_TILE * ((next->width + WINOGRAD_TILE - 1) / WINOGRAD_TILE);
+        parallelFor(tinyANN->thread_pool, tinyANN->batch_size * ((tiles + GEMM_NR - 1) / GEMM_NR), convolutionWinogradRange, &task);
+    }
+}
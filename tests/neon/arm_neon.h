@@ -0,0 +1,291 @@
+#ifndef TINYANN_NEON_EMULATION_H
+#define TINYANN_NEON_EMULATION_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+Scalar stand-in for <arm_neon.h>, so src/kernels_neon.cpp compiles and runs on hosts without an aarch64 compiler
+
+Only the types and intrinsics the NEON kernels use, with the aarch64 semantics they rely on: fused multiply-add, round to
+nearest even conversions, saturating narrows, pairwise horizontal sums, little endian reinterprets. tinyann_test_kernels
+builds kernels_neon.cpp against this directory with TINYANN_NEON_EMULATION, it is never part of the library.
+*/
+
+typedef struct float32x4_t { float v[4]; } float32x4_t;
+typedef struct float32x4x2_t { float32x4_t val[2]; } float32x4x2_t;
+typedef struct int32x4_t { int32_t v[4]; } int32x4_t;
+typedef struct uint32x4_t { uint32_t v[4]; } uint32x4_t;
+typedef struct int16x4_t { int16_t v[4]; } int16x4_t;
+typedef struct int16x8_t { int16_t v[8]; } int16x8_t;
+typedef struct uint16x4_t { uint16_t v[4]; } uint16x4_t;
+typedef struct float16x4_t { uint16_t v[4]; } float16x4_t; // IEEE binary16 bits
+typedef struct int8x8_t { int8_t v[8]; } int8x8_t;
+typedef struct int8x16_t { int8_t v[16]; } int8x16_t;
+
+// float32x4_t
+
+static inline float32x4_t vld1q_f32(const float* p) {
+    float32x4_t r;
+    memcpy(r.v, p, sizeof(r.v));
+    return r;
+}
+
+static inline void vst1q_f32(float* p, float32x4_t a) { memcpy(p, a.v, sizeof(a.v)); }
+
+static inline float32x4_t vdupq_n_f32(float x) {
+    float32x4_t r = {{x, x, x, x}};
+    return r;
+}
+
+static inline float32x4_t vld1q_dup_f32(const float* p) { return vdupq_n_f32(*p); }
+
+static inline float32x4_t vld1q_lane_f32(const float* p, float32x4_t a, int lane) {
+    a.v[lane] = *p;
+    return a;
+}
+
+static inline float32x4x2_t vld2q_f32(const float* p) {
+    float32x4x2_t r;
+    for (int i = 0; i < 4; i++) {
+        r.val[0].v[i] = p[2 * i];
+        r.val[1].v[i] = p[2 * i + 1];
+    }
+    return r;
+}
+
+#define TINYANN_NEON_LANEWISE(name, expression)                                                                                            \
+    static inline float32x4_t name(float32x4_t a, float32x4_t b) {                                                                         \
+        float32x4_t r;                                                                                                                     \
+        for (int i = 0; i < 4; i++) {                                                                                                      \
+            r.v[i] = expression;                                                                                                           \
+        }                                                                                                                                  \
+        return r;                                                                                                                          \
+    }
+
+TINYANN_NEON_LANEWISE(vaddq_f32, a.v[i] + b.v[i])
+TINYANN_NEON_LANEWISE(vsubq_f32, a.v[i] - b.v[i])
+TINYANN_NEON_LANEWISE(vmulq_f32, a.v[i] * b.v[i])
+TINYANN_NEON_LANEWISE(vmaxq_f32, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+TINYANN_NEON_LANEWISE(vminq_f32, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+
+#undef TINYANN_NEON_LANEWISE
+
+static inline float32x4_t vmulq_n_f32(float32x4_t a, float x) { return vmulq_f32(a, vdupq_n_f32(x)); }
+
+// a + b * c, one rounding like fmla
+static inline float32x4_t vfmaq_f32(float32x4_t a, float32x4_t b, float32x4_t c) {
+    for (int i = 0; i < 4; i++) {
+        a.v[i] = fmaf(b.v[i], c.v[i], a.v[i]);
+    }
+    return a;
+}
+
+static inline float32x4_t vfmsq_f32(float32x4_t a, float32x4_t b, float32x4_t c) {
+    for (int i = 0; i < 4; i++) {
+        a.v[i] = fmaf(-b.v[i], c.v[i], a.v[i]);
+    }
+    return a;
+}
+
+static inline float32x4_t vfmaq_n_f32(float32x4_t a, float32x4_t b, float x) { return vfmaq_f32(a, b, vdupq_n_f32(x)); }
+
+static inline float32x4_t vfmaq_laneq_f32(float32x4_t a, float32x4_t b, float32x4_t c, int lane) { return vfmaq_n_f32(a, b, c.v[lane]); }
+
+// faddp twice: (a0 + a1) + (a2 + a3)
+static inline float vaddvq_f32(float32x4_t a) { return (a.v[0] + a.v[1]) + (a.v[2] + a.v[3]); }
+
+static inline float32x4_t vrndnq_f32(float32x4_t a) {
+    for (int i = 0; i < 4; i++) {
+        a.v[i] = nearbyintf(a.v[i]);
+    }
+    return a;
+}
+
+// Conversions to int32 saturate, vcvtq truncates, vcvtnq rounds to nearest even
+static inline int32_t saturateS32(float x) {
+    if (x != x) {
+        return 0;
+    }
+    return x >= 2147483648.0f ? INT32_MAX : (x < -2147483648.0f ? INT32_MIN : (int32_t)x);
+}
+
+static inline int32x4_t vcvtq_s32_f32(float32x4_t a) {
+    int32x4_t r;
+    for (int i = 0; i < 4; i++) {
+        r.v[i] = saturateS32(truncf(a.v[i]));
+    }
+    return r;
+}
+
+static inline int32x4_t vcvtnq_s32_f32(float32x4_t a) {
+    int32x4_t r;
+    for (int i = 0; i < 4; i++) {
+        r.v[i] = saturateS32(nearbyintf(a.v[i]));
+    }
+    return r;
+}
+
+static inline float32x4_t vreinterpretq_f32_s32(int32x4_t a) {
+    float32x4_t r;
+    memcpy(r.v, a.v, sizeof(r.v));
+    return r;
+}
+
+static inline float32x4_t vreinterpretq_f32_u32(uint32x4_t a) {
+    float32x4_t r;
+    memcpy(r.v, a.v, sizeof(r.v));
+    return r;
+}
+
+// Half precision
+
+static inline uint16x4_t vld1_u16(const uint16_t* p) {
+    uint16x4_t r;
+    memcpy(r.v, p, sizeof(r.v));
+    return r;
+}
+
+static inline uint32x4_t vshll_n_u16(uint16x4_t a, int shift) {
+    uint32x4_t r;
+    for (int i = 0; i < 4; i++) {
+        r.v[i] = (uint32_t)a.v[i] << shift;
+    }
+    return r;
+}
+
+static inline float16x4_t vreinterpret_f16_u16(uint16x4_t a) {
+    float16x4_t r;
+    memcpy(r.v, a.v, sizeof(r.v));
+    return r;
+}
+
+// fcvtl: exact widening, subnormals included
+static inline float32x4_t vcvt_f32_f16(float16x4_t a) {
+    float32x4_t r;
+    for (int i = 0; i < 4; i++) {
+        int exponent = (a.v[i] >> 10) & 0x1f;
+        int mantissa = a.v[i] & 0x3ff;
+        float value;
+        if (exponent == 0x1f) {
+            value = mantissa ? NAN : INFINITY;
+        } else if (exponent == 0) {
+            value = ldexpf((float)mantissa, -24);
+        } else {
+            value = ldexpf((float)(mantissa | 0x400), exponent - 25);
+        }
+        r.v[i] = (a.v[i] & 0x8000) ? -value : value;
+    }
+    return r;
+}
+
+// Integer vectors
+
+static inline int32x4_t vdupq_n_s32(int32_t x) {
+    int32x4_t r = {{x, x, x, x}};
+    return r;
+}
+
+static inline int32x4_t vaddq_s32(int32x4_t a, int32x4_t b) {
+    for (int i = 0; i < 4; i++) {
+        a.v[i] = (int32_t)((uint32_t)a.v[i] + (uint32_t)b.v[i]);
+    }
+    return a;
+}
+
+static inline int32x4_t vshlq_n_s32(int32x4_t a, int shift) {
+    for (int i = 0; i < 4; i++) {
+        a.v[i] = (int32_t)((uint32_t)a.v[i] << shift);
+    }
+    return a;
+}
+
+static inline int32_t vaddvq_s32(int32x4_t a) { return (int32_t)((uint32_t)a.v[0] + a.v[1] + a.v[2] + a.v[3]); }
+
+static inline void vst1q_s32(int32_t* p, int32x4_t a) { memcpy(p, a.v, sizeof(a.v)); }
+
+static inline int16x4_t vqmovn_s32(int32x4_t a) {
+    int16x4_t r;
+    for (int i = 0; i < 4; i++) {
+        r.v[i] = (int16_t)(a.v[i] > INT16_MAX ? INT16_MAX : (a.v[i] < INT16_MIN ? INT16_MIN : a.v[i]));
+    }
+    return r;
+}
+
+static inline int16x8_t vcombine_s16(int16x4_t low, int16x4_t high) {
+    int16x8_t r;
+    memcpy(r.v, low.v, sizeof(low.v));
+    memcpy(r.v + 4, high.v, sizeof(high.v));
+    return r;
+}
+
+static inline int16x8_t vdupq_n_s16(int16_t x) {
+    int16x8_t r;
+    for (int i = 0; i < 8; i++) {
+        r.v[i] = x;
+    }
+    return r;
+}
+
+static inline int8x8_t vqmovn_s16(int16x8_t a) {
+    int8x8_t r;
+    for (int i = 0; i < 8; i++) {
+        r.v[i] = (int8_t)(a.v[i] > INT8_MAX ? INT8_MAX : (a.v[i] < INT8_MIN ? INT8_MIN : a.v[i]));
+    }
+    return r;
+}
+
+static inline void vst1_s8(int8_t* p, int8x8_t a) { memcpy(p, a.v, sizeof(a.v)); }
+
+static inline int8x16_t vld1q_s8(const int8_t* p) {
+    int8x16_t r;
+    memcpy(r.v, p, sizeof(r.v));
+    return r;
+}
+
+static inline int8x16_t vreinterpretq_s8_s16(int16x8_t a) {
+    int8x16_t r;
+    memcpy(r.v, a.v, sizeof(r.v));
+    return r;
+}
+
+static inline int8x8_t vget_low_s8(int8x16_t a) {
+    int8x8_t r;
+    memcpy(r.v, a.v, sizeof(r.v));
+    return r;
+}
+
+static inline int16x8_t vmull_s8(int8x8_t a, int8x8_t b) {
+    int16x8_t r;
+    for (int i = 0; i < 8; i++) {
+        r.v[i] = (int16_t)(a.v[i] * b.v[i]);
+    }
+    return r;
+}
+
+static inline int16x8_t vmull_high_s8(int8x16_t a, int8x16_t b) {
+    int16x8_t r;
+    for (int i = 0; i < 8; i++) {
+        r.v[i] = (int16_t)(a.v[i + 8] * b.v[i + 8]);
+    }
+    return r;
+}
+
+// Wraps on overflow like smlal2
+static inline int16x8_t vmlal_high_s8(int16x8_t acc, int8x16_t a, int8x16_t b) {
+    int16x8_t products = vmull_high_s8(a, b);
+    for (int i = 0; i < 8; i++) {
+        acc.v[i] = (int16_t)(uint16_t)((uint16_t)acc.v[i] + (uint16_t)products.v[i]);
+    }
+    return acc;
+}
+
+static inline int32x4_t vpadalq_s16(int32x4_t acc, int16x8_t a) {
+    for (int i = 0; i < 4; i++) {
+        acc.v[i] = (int32_t)((uint32_t)acc.v[i] + (uint32_t)(a.v[2 * i] + a.v[2 * i + 1]));
+    }
+    return acc;
+}
+
+#endif // TINYANN_NEON_EMULATION_H
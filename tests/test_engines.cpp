@@ -0,0 +1,115 @@
+#include "../include/cnn.h"
+#include "test_util.h"
+
+#include <vector>
+
+/*
+_im2col_gemm and _winograd against convolution_direct on odd shapes
+
+Every shape runs unfused and fused with relu -> max_pool, with 1 and 3 threads and a batch of 2. The engines sum in a
+different order, so outputs may differ by rounding: at most ENGINE_TOLERANCE relative to the largest output of the layer.
+*/
+
+#define ENGINE_TOLERANCE 1e-5f
+
+typedef struct ConvShape {
+    size_t channels, rows, cols, outputs, kernel_size, stride, padding;
+} ConvShape;
+
+static const ConvShape shapes[] = {
+    {3, 17, 23, 5, 3, 1, 1}, {7, 9, 13, 6, 3, 1, 0}, {5, 31, 7, 9, 3, 1, 2}, {1, 5, 5, 3, 3, 1, 1},     {9, 33, 35, 17, 3, 1, 1},
+    {6, 19, 11, 10, 3, 2, 1}, {4, 13, 15, 7, 5, 1, 2}, {3, 8, 9, 5, 1, 1, 0}, {2, 12, 10, 33, 3, 1, 1}, {16, 7, 7, 13, 3, 1, 1},
+};
+
+static const char* engine_names[] = {"direct", "gemm", "winograd"};
+
+static int checkShape(const ConvShape* shape, int fused, size_t threads) {
+    size_t out_rows = (shape->rows + 2 * shape->padding - shape->kernel_size) / shape->stride + 1;
+    size_t out_cols = (shape->cols + 2 * shape->padding - shape->kernel_size) / shape->stride + 1;
+    size_t flat = fused ? shape->outputs * ((out_rows - 2) / 2 + 1) * ((out_cols - 2) / 2 + 1) : shape->outputs * out_rows * out_cols;
+
+    char pool[64] = "";
+    if (fused) {
+        snprintf(pool, sizeof(pool), "2 2 0 2 0 %zu %zu\n", shape->outputs, shape->outputs);
+    }
+    char config[512];
+    snprintf(config, sizeof(config), "%zu %zu %zu\n%d\n1 %zu %zu %zu %d %zu %zu\n%s3 1 0 0 0 %zu %zu\n4 1 0 1 0 %zu 3\n5 1 0 1 1 3 1\n",
+             shape->channels, shape->rows, shape->cols, fused ? 5 : 4, shape->stride, shape->padding, shape->kernel_size, fused,
+             shape->channels, shape->outputs, pool, shape->outputs, flat, flat);
+    if (writeTestNetwork("test_engines_config.txt", "test_engines_params.txt", config, 0.5f, 7) != SUCCESS) {
+        return 1;
+    }
+
+    NetworkOptions options = defaultNetworkOptions();
+    options.max_batch = 2;
+    options.threads = threads;
+    options.fuse_layers = fused;
+    options.conv_engine = _direct;
+
+    TinyANN tinyANN;
+    if (initNetworkWithOptions(&tinyANN, "test_engines_config.txt", "test_engines_params.txt", &options) != SUCCESS) {
+        fprintf(stderr, "FAIL: network of shape %zux%zux%zu could not be loaded\n", shape->channels, shape->rows, shape->cols);
+        return 1;
+    }
+
+    size_t image_size = shape->channels * shape->rows * shape->cols;
+    std::vector<float> images(2 * image_size);
+    fillRandom(images.data(), images.size(), 11);
+
+    tinyANN.batch_size = 2;
+    tinyANN.tensors[0].start = images.data();
+    tinyANN.tensors[0].end = images.data() + images.size();
+
+    // A fused layer writes the max_pool output map only
+    const Tensor* output = &tinyANN.tensors[tinyANN.tensors[0].fusion == _fused_relu_maxpool ? 2 : 1];
+    size_t output_size = 2 * output->batch_stride;
+
+    convolution_direct(&tinyANN, 0);
+    std::vector<float> expected(output->start, output->start + output_size);
+    float largest = 1e-30f;
+    for (size_t i = 0; i < output_size; i++) {
+        largest = fabsf(expected[i]) > largest ? fabsf(expected[i]) : largest;
+    }
+
+    int failures = 0;
+    for (int engine = _im2col_gemm; engine <= _winograd; engine++) {
+        if (setConvolutionEngine(&tinyANN, 0, engine) != SUCCESS) {
+            fprintf(stderr, "FAIL: %s could not be set up\n", engine_names[engine]);
+            failures++;
+            continue;
+        }
+        memset(output->start, 0, output_size * sizeof(float));
+        convolution(&tinyANN, 0);
+
+        float error = 0.0f;
+        for (size_t i = 0; i < output_size; i++) {
+            float difference = fabsf(output->start[i] - expected[i]);
+            error = difference > error || difference != difference ? difference : error;
+        }
+        if (!(error <= ENGINE_TOLERANCE * largest)) {
+            fprintf(stderr, "FAIL: %s on %zux%zux%zu -> %zu, kernel %zu stride %zu padding %zu, %s, %zu threads: error %g of %g\n",
+                    engine_names[tinyANN.tensors[0].conv_engine], shape->channels, shape->rows, shape->cols, shape->outputs,
+                    shape->kernel_size, shape->stride, shape->padding, fused ? "relu + max_pool fused" : "unfused", threads, error, largest);
+            failures++;
+        }
+    }
+
+    destroyNetwork(&tinyANN);
+    return failures;
+}
+
+int main() {
+    int failures = 0;
+    size_t checks = 0;
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        for (int fused = 0; fused <= 1; fused++) {
+            for (size_t threads = 1; threads <= 3; threads += 2) {
+                failures += checkShape(&shapes[s], fused, threads);
+                checks++;
+            }
+        }
+    }
+
+    printf("%zu engine checks, %d failures\n", checks, failures);
+    return failures != 0;
+}
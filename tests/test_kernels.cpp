@@ -0,0 +1,334 @@
+#include "../include/gemm.h"
+#include "../include/kernels.h"
+#include "test_util.h"
+
+#include <vector>
+
+/*
+Every entry of the vector kernel tables against the scalar table
+
+The AVX2 / AVX-512 tables run when the CPU has them. The NEON table runs natively on aarch64, elsewhere CMake builds
+kernels_neon.cpp into this check against the scalar intrinsics of tests/neon (TINYANN_NEON_EMULATION), so its kernels are
+exercised on every host. Float kernels sum in a different order than the scalar ones and may differ by rounding: at most
+KERNEL_TOLERANCE per accumulated term of magnitude <= 1. The integer, relu and max_pool kernels must be bit identical.
+*/
+
+#define KERNEL_TOLERANCE 1e-6f
+
+static const size_t lengths[] = {1, 3, 4, 5, 8, 15, 16, 17, 31, 64, 100};
+
+static int hostRuns(const KernelTable* kernels) {
+    if (kernels == NULL) {
+        return 0;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (kernels == avx512Kernels()) {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }
+    if (kernels == avx2Kernels()) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    }
+#endif
+    return 1;
+}
+
+// Number of values out of tolerance, the first one is reported
+static int compare(const KernelTable* kernels, const char* kernel, size_t case_no, const float* got, const float* expected, size_t n,
+                   float tolerance) {
+    int failures = 0;
+    for (size_t i = 0; i < n; i++) {
+        float difference = fabsf(got[i] - expected[i]);
+        if (!(difference <= tolerance)) {
+            if (failures == 0) {
+                fprintf(stderr, "FAIL: %s %s case %zu: [%zu] = %g, scalar %g\n", kernels->name, kernel, case_no, i, got[i], expected[i]);
+            }
+            failures++;
+        }
+    }
+    return failures != 0;
+}
+
+static int compareInt(const KernelTable* kernels, const char* kernel, size_t case_no, const int32_t* got, const int32_t* expected, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (got[i] != expected[i]) {
+            fprintf(stderr, "FAIL: %s %s case %zu: [%zu] = %d, scalar %d\n", kernels->name, kernel, case_no, i, got[i], expected[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void fillInt8(int8_t* data, size_t n, uint32_t seed) {
+    for (size_t i = 0; i < n; i++) {
+        data[i] = (int8_t)lrintf(randomUniform(&seed) * 127.0f);
+    }
+}
+
+static int checkGemm(const KernelTable* kernels, const KernelTable* scalar) {
+    int failures = 0;
+    size_t case_no = 0;
+    for (size_t kc = 1; kc <= 67; kc += 11) {
+        for (size_t m_rows = 1; m_rows <= GEMM_MR; m_rows++) {
+            for (size_t n_cols = 1; n_cols <= GEMM_NR; n_cols += 5, case_no++) {
+                size_t ldc = GEMM_NR + 3;
+                std::vector<float> a(kc * GEMM_MR), b(kc * GEMM_NR), c(GEMM_MR * ldc);
+                fillRandom(a.data(), a.size(), case_no + 1);
+                fillRandom(b.data(), b.size(), case_no + 2);
+                fillRandom(c.data(), c.size(), case_no + 3);
+                std::vector<float> expected = c;
+                scalar->gemm_micro_kernel(kc, a.data(), b.data(), expected.data(), ldc, m_rows, n_cols);
+                kernels->gemm_micro_kernel(kc, a.data(), b.data(), c.data(), ldc, m_rows, n_cols);
+                failures += compare(kernels, "gemm_micro_kernel", case_no, c.data(), expected.data(), c.size(), KERNEL_TOLERANCE * (kc + 1));
+            }
+        }
+    }
+    return failures;
+}
+
+static int checkRows(const KernelTable* kernels, const KernelTable* scalar) {
+    int failures = 0;
+    size_t case_no = 0;
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t n = lengths[l];
+        for (size_t stride = 1; stride <= 3; stride++, case_no++) {
+            std::vector<float> in(n * stride + 8), out(n), expected(n);
+            fillRandom(in.data(), in.size(), case_no + 1);
+            fillRandom(out.data(), n, case_no + 2);
+            expected = out;
+            scalar->conv_row(expected.data(), in.data(), stride, 0.37f, n);
+            kernels->conv_row(out.data(), in.data(), stride, 0.37f, n);
+            failures += compare(kernels, "conv_row", case_no, out.data(), expected.data(), n, KERNEL_TOLERANCE);
+
+            // kernel_size rows of the window, stride 3 windows do not overlap
+            for (size_t kernel_size = 1; kernel_size <= 3; kernel_size++) {
+                size_t row_width = n * stride + kernel_size + 8;
+                std::vector<float> window(kernel_size * row_width);
+                fillRandom(window.data(), window.size(), case_no + kernel_size);
+                scalar->max_pool_row(window.data(), row_width, kernel_size, stride, expected.data(), n);
+                kernels->max_pool_row(window.data(), row_width, kernel_size, stride, out.data(), n);
+                failures += compare(kernels, "max_pool_row", case_no, out.data(), expected.data(), n, 0.0f);
+            }
+        }
+
+        std::vector<float> data(n), expected(n);
+        fillRandom(data.data(), n, case_no + 5);
+        expected = data;
+        scalar->relu(expected.data(), n);
+        kernels->relu(data.data(), n);
+        failures += compare(kernels, "relu", case_no, data.data(), expected.data(), n, 0.0f);
+
+        // Values around the softmax shift of the output stage, down to exp() underflow
+        std::vector<float> logits(n);
+        fillRandom(logits.data(), n, case_no + 6);
+        for (size_t i = 0; i < n; i++) {
+            logits[i] = logits[i] * 50.0f - 50.0f;
+        }
+        float sum = kernels->exp_sum(logits.data(), n, 0.0f), expected_sum = scalar->exp_sum(logits.data(), n, 0.0f);
+        failures += compare(kernels, "exp_sum", case_no, &sum, &expected_sum, 1, 4e-7f * n * expected_sum);
+
+        std::vector<float> a(n), b(n);
+        fillRandom(a.data(), n, case_no + 7);
+        fillRandom(b.data(), n, case_no + 8);
+        scalar->lerp_normalize_row(a.data(), b.data(), 0.3f, 1.7f, -0.2f, expected.data(), n);
+        kernels->lerp_normalize_row(a.data(), b.data(), 0.3f, 1.7f, -0.2f, data.data(), n);
+        failures += compare(kernels, "lerp_normalize_row", case_no, data.data(), expected.data(), n, 4 * KERNEL_TOLERANCE);
+    }
+    return failures;
+}
+
+static int checkFc(const KernelTable* kernels, const KernelTable* scalar) {
+    static const size_t inputs_list[] = {1, 7, 8, 9, 17, 100, 1033};
+    int failures = 0;
+    size_t case_no = 0;
+    for (size_t i = 0; i < sizeof(inputs_list) / sizeof(inputs_list[0]); i++) {
+        size_t inputs = inputs_list[i], in_stride = inputs + 3;
+        std::vector<float> in(FC_TILE * in_stride), weights(FC_TILE * inputs);
+        std::vector<uint16_t> fp16(weights.size()), bf16(weights.size());
+        fillRandom(in.data(), in.size(), i + 1);
+        fillRandom(weights.data(), weights.size(), i + 2);
+        for (size_t k = 0; k < weights.size(); k++) {
+            fp16[k] = floatToFp16(weights[k]);
+            bf16[k] = floatToBf16(weights[k]);
+        }
+
+        for (size_t b_tile = 1; b_tile <= FC_TILE; b_tile++) {
+            for (size_t n_tile = 1; n_tile <= FC_TILE; n_tile++, case_no++) {
+                float acc[FC_TILE][FC_TILE], expected[FC_TILE][FC_TILE];
+                memset(acc, 0, sizeof(acc));
+                memset(expected, 0, sizeof(expected));
+                float tolerance = KERNEL_TOLERANCE * (inputs + 1);
+
+                scalar->fc_tile(in.data(), in_stride, b_tile, weights.data(), inputs, n_tile, expected);
+                kernels->fc_tile(in.data(), in_stride, b_tile, weights.data(), inputs, n_tile, acc);
+                failures += compare(kernels, "fc_tile", case_no, acc[0], expected[0], FC_TILE * FC_TILE, tolerance);
+
+                scalar->fc_tile_fp16(in.data(), in_stride, b_tile, fp16.data(), inputs, n_tile, expected);
+                kernels->fc_tile_fp16(in.data(), in_stride, b_tile, fp16.data(), inputs, n_tile, acc);
+                failures += compare(kernels, "fc_tile_fp16", case_no, acc[0], expected[0], FC_TILE * FC_TILE, tolerance);
+
+                scalar->fc_tile_bf16(in.data(), in_stride, b_tile, bf16.data(), inputs, n_tile, expected);
+                kernels->fc_tile_bf16(in.data(), in_stride, b_tile, bf16.data(), inputs, n_tile, acc);
+                failures += compare(kernels, "fc_tile_bf16", case_no, acc[0], expected[0], FC_TILE * FC_TILE, tolerance);
+            }
+
+            // Every third input of a row is a nonzero
+            std::vector<float> values;
+            std::vector<uint32_t> columns;
+            for (size_t k = 0; k < inputs; k += 3) {
+                values.push_back(weights[k]);
+                columns.push_back((uint32_t)k);
+            }
+            float acc[FC_TILE] = {0}, expected[FC_TILE] = {0};
+            scalar->sparse_dot(values.data(), columns.data(), values.size(), in.data(), in_stride, b_tile, expected);
+            kernels->sparse_dot(values.data(), columns.data(), values.size(), in.data(), in_stride, b_tile, acc);
+            failures += compare(kernels, "sparse_dot", case_no, acc, expected, FC_TILE, KERNEL_TOLERANCE * (values.size() + 1));
+        }
+    }
+    return failures;
+}
+
+static int checkInt8(const KernelTable* kernels, const KernelTable* scalar) {
+    int failures = 0;
+    size_t case_no = 0;
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++, case_no++) {
+        size_t n = lengths[l];
+        std::vector<float> in(n);
+        fillRandom(in.data(), n, case_no + 1);
+        in[0] = 2.5f / 100.0f; // a tie, rounds to even
+        std::vector<int8_t> out(n), expected(n);
+        scalar->quantize_s8(in.data(), expected.data(), 100.0f, n);
+        kernels->quantize_s8(in.data(), out.data(), 100.0f, n);
+        for (size_t i = 0; i < n; i++) {
+            if (out[i] != expected[i]) {
+                fprintf(stderr, "FAIL: %s quantize_s8 case %zu: [%zu] = %d, scalar %d\n", kernels->name, case_no, i, out[i], expected[i]);
+                failures++;
+                break;
+            }
+        }
+    }
+
+    for (size_t k = QUANT_K_ALIGN; k <= 8 * QUANT_K_ALIGN; k += 3 * QUANT_K_ALIGN, case_no++) {
+        size_t a_stride = k + QUANT_K_ALIGN;
+        std::vector<int8_t> a(QUANT_MR * a_stride), b(k * QUANT_NR);
+        fillInt8(a.data(), a.size(), case_no + 1);
+        fillInt8(b.data(), b.size(), case_no + 2);
+        a[0] = b[0] = -128 + 1; // the largest products
+
+        int32_t dot[QUANT_MR], expected_dot[QUANT_MR];
+        scalar->dot_s8(a.data(), a_stride, b.data(), k, expected_dot);
+        kernels->dot_s8(a.data(), a_stride, b.data(), k, dot);
+        failures += compareInt(kernels, "dot_s8", case_no, dot, expected_dot, QUANT_MR);
+
+        int32_t c[QUANT_MR][QUANT_NR], expected_c[QUANT_MR][QUANT_NR];
+        scalar->gemm_s8(a.data(), a_stride, b.data(), k, expected_c);
+        kernels->gemm_s8(a.data(), a_stride, b.data(), k, c);
+        failures += compareInt(kernels, "gemm_s8", case_no, c[0], expected_c[0], QUANT_MR * QUANT_NR);
+    }
+    return failures;
+}
+
+static int checkResample(const KernelTable* kernels, const KernelTable* scalar) {
+    int failures = 0;
+    size_t case_no = 0;
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t n = lengths[l];
+        // Downscaling and upscaling a 3 channel row, the offsets start at the first bytes like column 0 of an image
+        for (size_t source_cols = 2; source_cols <= 3 * n; source_cols += n + 1, case_no++) {
+            std::vector<uint8_t> src(3 * source_cols);
+            for (size_t i = 0; i < src.size(); i++) {
+                src[i] = (uint8_t)(i * 37 + case_no);
+            }
+            std::vector<uint32_t> left(n), right(n);
+            std::vector<float> weights(n), out(n), expected(n);
+            for (size_t j = 0; j < n; j++) {
+                float x = (j / 3 + 0.5f) * source_cols / (n / 3 + 1) - 0.5f;
+                size_t col = x > 0 ? (size_t)x : 0;
+                col = col + 1 < source_cols ? col : source_cols - 1;
+                left[j] = (uint32_t)(col * 3 + j % 3);
+                right[j] = (uint32_t)((col + 1 < source_cols ? col + 1 : col) * 3 + j % 3);
+                weights[j] = x > 0 ? x - (float)(size_t)x : 0.0f;
+            }
+            for (size_t j = 1; j < n; j++) {
+                left[j] = left[j] < left[j - 1] ? left[j - 1] : left[j];
+                right[j] = right[j] < right[j - 1] ? right[j - 1] : right[j];
+            }
+            scalar->resample_row(src.data(), left.data(), right.data(), weights.data(), expected.data(), n);
+            kernels->resample_row(src.data(), left.data(), right.data(), weights.data(), out.data(), n);
+            failures += compare(kernels, "resample_row", case_no, out.data(), expected.data(), n, 255 * 2 * KERNEL_TOLERANCE);
+        }
+    }
+    return failures;
+}
+
+// The scalar table has its own channel_block, the blocked kernels are checked against their definition in kernels.h
+static int checkBlocked(const KernelTable* kernels) {
+    size_t block = kernels->channel_block;
+    int failures = 0;
+    size_t case_no = 0;
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t n = lengths[l];
+        for (size_t stride = 1; stride <= 2; stride++) {
+            for (size_t taps = 1; taps <= 9; taps += 4, case_no++) {
+                size_t in_step = block + 1;
+                std::vector<float> in(((n - 1) * stride + taps) * in_step), weights(taps * block), out(n * block);
+                fillRandom(in.data(), in.size(), case_no + 1);
+                fillRandom(weights.data(), weights.size(), case_no + 2);
+                fillRandom(out.data(), out.size(), case_no + 3);
+                std::vector<float> expected = out;
+                for (size_t j = 0; j < n; j++) {
+                    for (size_t t = 0; t < taps; t++) {
+                        for (size_t o = 0; o < block; o++) {
+                            expected[j * block + o] += in[(j * stride + t) * in_step] * weights[t * block + o];
+                        }
+                    }
+                }
+                kernels->conv_block_row(out.data(), in.data(), in_step, stride, weights.data(), taps, n);
+                failures += compare(kernels, "conv_block_row", case_no, out.data(), expected.data(), out.size(), KERNEL_TOLERANCE * (taps + 1));
+            }
+
+            for (size_t kernel_size = 1; kernel_size <= 3; kernel_size++, case_no++) {
+                size_t row_width = (n - 1) * stride + kernel_size;
+                std::vector<float> in(kernel_size * row_width * block), out(n * block), expected(n * block);
+                fillRandom(in.data(), in.size(), case_no + 4);
+                for (size_t j = 0; j < n; j++) {
+                    for (size_t o = 0; o < block; o++) {
+                        float max_val = INT32_MIN;
+                        for (size_t x = 0; x < kernel_size; x++) {
+                            for (size_t y = 0; y < kernel_size; y++) {
+                                float value = in[(x * row_width + j * stride + y) * block + o];
+                                max_val = value > max_val ? value : max_val;
+                            }
+                        }
+                        expected[j * block + o] = max_val;
+                    }
+                }
+                kernels->max_pool_block_row(in.data(), row_width, kernel_size, stride, out.data(), n);
+                failures += compare(kernels, "max_pool_block_row", case_no, out.data(), expected.data(), out.size(), 0.0f);
+            }
+        }
+    }
+    return failures;
+}
+
+int main() {
+    const KernelTable* scalar = scalarKernels();
+    const KernelTable* tables[] = {avx2Kernels(), avx512Kernels(), neonKernels()};
+
+    int failures = 0;
+    size_t checked = 0;
+    for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+        if (!hostRuns(tables[t])) {
+            continue;
+        }
+        int table_failures = checkGemm(tables[t], scalar) + checkRows(tables[t], scalar) + checkFc(tables[t], scalar) +
+                             checkInt8(tables[t], scalar) + checkResample(tables[t], scalar) + checkBlocked(tables[t]);
+        printf("%s kernels: %d failures\n", tables[t]->name, table_failures);
+        failures += table_failures;
+        checked++;
+    }
+
+    if (checked == 0) {
+        printf("no vector kernels on this build, skipped\n");
+    }
+    return failures != 0;
+}
@@ -0,0 +1,127 @@
+#include "../include/cnn.h"
+#include "../include/params.h"
+#include "../include/quantize.h"
+#include "test_util.h"
+
+#include <vector>
+
+/*
+int8 container round trip of a network with depthwise and pointwise layers
+
+quantizeModel() quantizes the convolution / fc layers of an fp32 model calibrated on random images, writeParamsInt8()
+stores it with the depthwise / pointwise layers in fp32, and loadModel() of that file must give the same model:
+bit identical fp32 weights of the separable layers and the same top-2 classes and probabilities as the in-memory one.
+*/
+
+// Standard conv, depthwise 3x3 (stride 1 and 2), pointwise, max_pool and two fc layers
+static const char* network_config = "3 24 20\n"
+                                    "10\n"
+                                    "1 2 1 3 1 3 8\n"
+                                    "6 1 1 3 1 8 8\n"
+                                    "7 1 0 1 1 8 16\n"
+                                    "6 2 1 3 1 16 16\n"
+                                    "7 1 0 1 1 16 12\n"
+                                    "2 2 0 2 0 12 12\n"
+                                    "3 1 0 0 0 12 360\n"
+                                    "4 1 0 1 1 360 10\n"
+                                    "4 1 0 1 0 10 5\n"
+                                    "5 1 0 1 1 5 1\n";
+
+#define IMAGES 6
+
+static int runTop2(const Model* model, const float* images, int* classes, float* probabilities) {
+    NetworkOptions options = defaultNetworkOptions();
+    options.max_batch = IMAGES;
+    options.precision = _int8;
+
+    ExecutionContext context;
+    if (createExecutionContext(&context, model, &options) != SUCCESS) {
+        return 1;
+    }
+    int status = inference_batch_topk(&context, images, IMAGES, 2, classes, probabilities);
+    destroyExecutionContext(&context);
+    return status != SUCCESS;
+}
+
+int main() {
+    if (writeTestNetwork("test_quantize_config.txt", "test_quantize_params.txt", network_config, 0.4f, 13) != SUCCESS) {
+        return 1;
+    }
+
+    NetworkOptions options = defaultNetworkOptions();
+    options.max_batch = IMAGES;
+    Model model;
+    if (loadModel(&model, "test_quantize_config.txt", "test_quantize_params.txt", &options) != SUCCESS) {
+        fprintf(stderr, "FAIL: fp32 model could not be loaded\n");
+        return 1;
+    }
+
+    size_t image_size = model.image_filters * model.image_rows * model.image_cols;
+    std::vector<float> images(IMAGES * image_size);
+    fillRandom(images.data(), images.size(), 17);
+
+    // Calibration on the same images
+    std::vector<float> activation_ranges(model.total_layers, 0.0f);
+    ExecutionContext calibration;
+    int failures = createExecutionContext(&calibration, &model, &options) != SUCCESS;
+    if (!failures) {
+        std::vector<int> classes(IMAGES);
+        calibration.activation_ranges = activation_ranges.data();
+        failures += inference_batch(&calibration, images.data(), IMAGES, classes.data()) != SUCCESS;
+        calibration.activation_ranges = NULL;
+        destroyExecutionContext(&calibration);
+    }
+    if (failures || quantizeModel(&model, activation_ranges.data()) != SUCCESS ||
+        writeParamsInt8(&model, "test_quantize_int8.bin") != SUCCESS) {
+        fprintf(stderr, "FAIL: quantization or writeParamsInt8() failed\n");
+        destroyModel(&model);
+        return 1;
+    }
+
+    Model loaded;
+    if (loadModel(&loaded, "test_quantize_config.txt", "test_quantize_int8.bin", &options) != SUCCESS) {
+        fprintf(stderr, "FAIL: int8 container could not be loaded\n");
+        destroyModel(&model);
+        return 1;
+    }
+
+    for (size_t l = 0; l < model.total_layers; l++) {
+        const Tensor* expected = &model.tensors[l];
+        const Tensor* tensor = &loaded.tensors[l];
+        if (!hasWeights(expected)) {
+            continue;
+        }
+        if (!expected->qweight_start != !tensor->qweight_start) {
+            fprintf(stderr, "FAIL: layer %zu is %s after loading\n", l + 1, tensor->qweight_start ? "int8" : "fp32");
+            failures++;
+        } else if (!tensor->qweight_start && (!tensor->weight_start || memcmp(tensor->weight_start, expected->weight_start,
+                                                                                 weightCount(tensor) * sizeof(float)) != 0)) {
+            fprintf(stderr, "FAIL: fp32 weights of layer %zu differ after loading\n", l + 1);
+            failures++;
+        } else if (memcmp(tensor->bias_start, expected->bias_start, tensor->info[_output] * sizeof(float)) != 0) {
+            fprintf(stderr, "FAIL: biases of layer %zu differ after loading\n", l + 1);
+            failures++;
+        }
+    }
+
+    int expected_classes[IMAGES * 2], classes[IMAGES * 2];
+    float expected_probabilities[IMAGES * 2], probabilities[IMAGES * 2];
+    if (runTop2(&model, images.data(), expected_classes, expected_probabilities) || runTop2(&loaded, images.data(), classes, probabilities)) {
+        fprintf(stderr, "FAIL: int8 inference failed\n");
+        failures++;
+    } else {
+        for (size_t i = 0; i < IMAGES * 2; i++) {
+            if (classes[i] != expected_classes[i] || fabsf(probabilities[i] - expected_probabilities[i]) > 1e-6f) {
+                fprintf(stderr, "FAIL: image %zu rank %zu: class %d (%g) after loading, %d (%g) before\n", i / 2, i % 2, classes[i], probabilities[i],
+                        expected_classes[i], expected_probabilities[i]);
+                failures++;
+            }
+        }
+    }
+
+    destroyModel(&loaded);
+    destroyModel(&model);
+
+    printf("int8 round trip: %d failures\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,243 @@
+#include "../include/cnn.h"
+#include "../include/preprocess.h"
+#include "test_util.h"
+
+#include <atomic>
+#include <errno.h>
+#include <vector>
+
+// The frame loop of tinyann_cpp --stream is checked as it ships, main() is renamed out of the way
+#define main tinyannMain
+#include "../src/main.cpp"
+#undef main
+
+/*
+No heap allocation per image once warm:
+- preprocessImage() into the batch buffer, then inference_batch(), inference_batch_topk() and inference(), on every
+  engine / layout and 1 or 3 threads
+- streamNetwork() of main.cpp reading raw frames from stdin (--stream - --frame-size), as the same run with more frames
+  must allocate exactly as often
+
+This executable replaces glibc's allocation entry points with counting wrappers (operator new, the C++ runtime and
+OpenCV go through malloc). The library and tinyann_cpp never do that, the check lives here only.
+*/
+
+#define WARMUP_ROUNDS 3
+#define COUNTED_ROUNDS 20
+
+#if defined(__GLIBC__)
+static std::atomic<size_t> heap_allocations(0);
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void* __libc_valloc(size_t size);
+void* __libc_pvalloc(size_t size);
+
+void* malloc(size_t size) noexcept {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) noexcept {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) noexcept {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept { return memalign(alignment, size); }
+
+void* valloc(size_t size) noexcept {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_valloc(size);
+}
+
+void* pvalloc(size_t size) noexcept {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_pvalloc(size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size) noexcept {
+    void* memory = memalign(alignment, size);
+    if (memory == NULL) {
+        return ENOMEM;
+    }
+    *pointer = memory;
+    return 0;
+}
+}
+
+static size_t heapAllocations() { return heap_allocations.load(std::memory_order_relaxed); }
+#else
+static size_t heapAllocations() { return 0; }
+#endif
+
+// conv -> relu -> max_pool (fused), 3x3 stride 1 (winograd under _auto), stride 2, two fc layers
+static const char* network_config = "3 32 32\n"
+                                    "8\n"
+                                    "1 1 1 3 1 3 8\n"
+                                    "2 2 0 2 0 8 8\n"
+                                    "1 1 1 3 1 8 12\n"
+                                    "1 2 1 3 1 12 16\n"
+                                    "3 1 0 0 0 16 1024\n"
+                                    "4 1 0 1 1 1024 20\n"
+                                    "4 1 0 1 0 20 6\n"
+                                    "5 1 0 1 1 6 1\n";
+
+#define BATCH 3
+#define SOURCE_ROWS 45
+#define SOURCE_COLS 61
+
+// Allocations of COUNTED_ROUNDS warm rounds of the per-image loop, -1 when the context cannot be set up
+static long countRounds(const Model* model, const NetworkOptions* options, const uint8_t* source) {
+    ExecutionContext context;
+    if (createExecutionContext(&context, model, options) != SUCCESS) {
+        return -1;
+    }
+    Preprocessor preprocessor;
+    PreprocessOptions preprocess_options = defaultPreprocessOptions();
+    if (createPreprocessor(&preprocessor, model, &preprocess_options) != SUCCESS) {
+        destroyExecutionContext(&context);
+        return -1;
+    }
+
+    size_t image_size = model->image_filters * model->image_rows * model->image_cols;
+    std::vector<float> batch(BATCH * image_size);
+    int classes[BATCH];
+    float probabilities[BATCH * 2];
+
+    size_t counted_from = 0;
+    for (size_t round = 0; round < WARMUP_ROUNDS + COUNTED_ROUNDS; round++) {
+        if (round == WARMUP_ROUNDS) {
+            counted_from = heapAllocations();
+        }
+        for (size_t i = 0; i < BATCH; i++) {
+            preprocessImage(&preprocessor, source + i * SOURCE_COLS, SOURCE_ROWS, SOURCE_COLS, 3 * SOURCE_COLS, &batch[i * image_size]);
+        }
+        inference_batch(&context, batch.data(), BATCH, classes);
+        inference_batch_topk(&context, batch.data(), BATCH, 2, classes, probabilities);
+        inference(&context, batch.data());
+    }
+    long allocations = (long)(heapAllocations() - counted_from);
+
+    destroyPreprocessor(&preprocessor);
+    destroyExecutionContext(&context);
+    return allocations;
+}
+
+#define FRAME_ROWS 40
+#define FRAME_COLS 52
+#define STREAM_WARMUP 3
+
+// Allocations of one streamNetwork() run over the first frames of the raw frame file on stdin, -1 if it fails
+static long countStream(const Model* model, const NetworkOptions* options, size_t frames) {
+    static const char* class_names[] = {"a", "b", "c", "d", "e", "f"};
+    std::vector<std::string> classes(class_names, class_names + 6);
+    StreamOptions stream = {"-", FRAME_ROWS, FRAME_COLS, STREAM_WARMUP, frames};
+    rewind(stdin);
+
+    size_t before = heapAllocations();
+    int status = streamNetwork(model, options, &stream, classes);
+    size_t after = heapAllocations();
+    return status == 0 ? (long)(after - before) : -1;
+}
+
+// The extra frames of the longer run must not allocate, the first run warms up stdin and stdout
+static int checkStream(const uint8_t* source) {
+    FILE* frames = fopen("test_steady_state_frames.raw", "wb");
+    if (frames == NULL) {
+        fprintf(stderr, "FAIL: raw frames could not be written\n");
+        return 1;
+    }
+    for (size_t f = 0; f < STREAM_WARMUP + COUNTED_ROUNDS; f++) {
+        for (size_t r = 0; r < FRAME_ROWS; r++) {
+            fwrite(source + f + r * 3 * SOURCE_COLS, 1, 3 * FRAME_COLS, frames);
+        }
+    }
+    fclose(frames);
+    if (freopen("test_steady_state_frames.raw", "rb", stdin) == NULL) {
+        fprintf(stderr, "FAIL: raw frames could not be read\n");
+        return 1;
+    }
+
+    int failures = 0;
+    for (size_t threads = 1; threads <= 3; threads += 2) {
+        NetworkOptions options = defaultNetworkOptions();
+        options.threads = threads;
+        Model model;
+        if (loadModel(&model, "test_steady_state_config.txt", "test_steady_state_params.txt", &options) != SUCCESS) {
+            fprintf(stderr, "FAIL: model could not be loaded\n");
+            return 1;
+        }
+        countStream(&model, &options, STREAM_WARMUP + 1);
+        long short_run = countStream(&model, &options, STREAM_WARMUP + 1);
+        long long_run = countStream(&model, &options, STREAM_WARMUP + COUNTED_ROUNDS);
+        if (short_run < 0 || long_run != short_run) {
+            fprintf(stderr, "FAIL: stream, %zu threads: %ld allocations over %d frames, %ld over %d\n", threads, short_run, STREAM_WARMUP + 1,
+                    long_run, STREAM_WARMUP + COUNTED_ROUNDS);
+            failures++;
+        }
+        destroyModel(&model);
+    }
+    return failures;
+}
+
+int main() {
+#if defined(__GLIBC__)
+    if (writeTestNetwork("test_steady_state_config.txt", "test_steady_state_params.txt", network_config, 0.3f, 5) != SUCCESS) {
+        return 1;
+    }
+
+    // Every image of the batch starts a few pixels further into one larger source
+    std::vector<uint8_t> source(SOURCE_ROWS * 3 * SOURCE_COLS + BATCH * SOURCE_COLS);
+    for (size_t i = 0; i < source.size(); i++) {
+        source[i] = (uint8_t)(i * 31 + i / 7);
+    }
+
+    static const char* engine_names[] = {"direct", "gemm", "winograd", "auto"};
+    int failures = 0;
+    for (int layout = _nchw; layout <= _nchwc; layout++) {
+        for (int engine = _direct; engine <= _auto; engine++) {
+            for (size_t threads = 1; threads <= 3; threads += 2) {
+                NetworkOptions options = defaultNetworkOptions();
+                options.max_batch = BATCH;
+                options.threads = threads;
+                options.layout = layout;
+                options.conv_engine = engine;
+
+                Model model;
+                if (loadModel(&model, "test_steady_state_config.txt", "test_steady_state_params.txt", &options) != SUCCESS) {
+                    fprintf(stderr, "FAIL: model could not be loaded\n");
+                    return 1;
+                }
+                long allocations = countRounds(&model, &options, source.data());
+                if (allocations != 0) {
+                    fprintf(stderr, "FAIL: %s layout, %s engine, %zu threads: %ld allocations in %d warm rounds\n", layout ? "nchwc" : "nchw",
+                            engine_names[engine], threads, allocations, COUNTED_ROUNDS);
+                    failures++;
+                }
+                destroyModel(&model);
+            }
+        }
+    }
+
+    failures += checkStream(source.data());
+
+    printf("steady state allocation checks: %d failures\n", failures);
+    return failures != 0;
+#else
+    printf("allocations are only counted on glibc, skipped\n");
+    return 0;
+#endif
+}
@@ -0,0 +1,71 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include "../include/cnn.h"
+
+/*
+Helpers of the self-checks in tests/, each check is one executable registered with ctest (see CMakeLists.txt)
+A check prints FAIL lines for what went wrong and returns non-zero, networks are written next to it as text files.
+*/
+
+static inline float randomUniform(uint32_t* seed) {
+    *seed = *seed * 1664525u + 1013904223u;
+    return (*seed >> 8) / (float)(1 << 24) * 2.0f - 1.0f;
+}
+
+static inline void fillRandom(float* data, size_t n, uint32_t seed) {
+    for (size_t i = 0; i < n; i++) {
+        data[i] = randomUniform(&seed);
+    }
+}
+
+// Writes config verbatim to config_path and weights / biases in [-scale, scale] for its layers to param_path (parameters.txt layout)
+static inline int writeTestNetwork(const char* config_path, const char* param_path, const char* config, float scale, uint32_t seed) {
+    FILE* config_file = fopen(config_path, "w");
+    FILE* param_file = fopen(param_path, "w");
+    if (config_file == NULL || param_file == NULL) {
+        fprintf(stderr, "FAIL: cannot write %s / %s\n", config_path, param_path);
+        if (config_file) {
+            fclose(config_file);
+        }
+        if (param_file) {
+            fclose(param_file);
+        }
+        return FILE_NOT_READABLE;
+    }
+    fputs(config, config_file);
+    fclose(config_file);
+
+    size_t channels, rows, cols, layers;
+    const char* line = config;
+    int consumed = 0;
+    sscanf(line, "%zu %zu %zu %zu%n", &channels, &rows, &cols, &layers, &consumed);
+    line += consumed;
+
+    for (size_t l = 0; l < layers; l++) {
+        size_t info[MAX_LAYER_INFO_SIZE] = {0};
+        sscanf(line, "%zu %zu %zu %zu %zu %zu %zu%n", &info[_operation], &info[_stride], &info[_padding], &info[_kernel_size],
+               &info[_activation], &info[_input], &info[_output], &consumed);
+        line += consumed;
+
+        size_t weights = 0;
+        if (info[_operation] == _convolution) {
+            weights = info[_output] * info[_input] * info[_kernel_size] * info[_kernel_size];
+        } else if (info[_operation] == _depthwise_convolution) {
+            weights = info[_output] * info[_kernel_size] * info[_kernel_size];
+        } else if (info[_operation] == _pointwise_convolution || info[_operation] == _fully_connected) {
+            weights = info[_output] * info[_input];
+        } else {
+            continue;
+        }
+        for (size_t i = 0; i < weights + info[_output]; i++) {
+            fprintf(param_file, "%.8g ", scale * randomUniform(&seed));
+        }
+        fprintf(param_file, "\n");
+    }
+    fclose(param_file);
+
+    return SUCCESS;
+}
+
+#endif // TEST_UTIL_H
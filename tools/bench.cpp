@@ -0,0 +1,431 @@
+#include "../include/cnn.h"
+#include "../include/arena.h"
+#ifdef TINYANN_FROZEN
+#include "../include/frozen.h"
+#endif
+#include "../include/kernels.h"
+#include "../include/profile.h"
+#include "../include/quantize.h"
+#include "../include/sparse.h"
+
+#include <algorithm>
+#include <time.h>
+#include <vector>
+
+/*
+Latency and per-layer throughput of a network on synthetic inputs
+
+Usage: tinyann_bench <network_config> <params> [--batch N] [--threads N] [--warmup N] [--iterations N]
+                     [--engine direct|gemm|winograd|auto] [--layout nchw|nchwc] [--precision fp32|int8] [--no-fuse]
+                     [--sparse-threshold F] [--weights fp32|fp16|bf16] [--hugepages off|transparent|explicit] [--numa-node N]
+                     [--autotune] [--tuning-cache path] [--json path] [--trace path] [--frozen]
+
+Every timed iteration is one inference_batch() call of --batch images. Per-layer times come from TinyANN.layer_seconds,
+a fused layer is reported on the layer that ran it. FLOPs count a multiply-add as 2 (max_pool: one per compared value),
+bytes are the input map, output map and parameters one call touches once.
+--precision int8 with fp32 params calibrates on the warmup images and quantizes in memory.
+--sparse-threshold sets NetworkOptions.sparse_threshold, sparse fc layers count only their nonzero weights.
+--weights sets NetworkOptions.weight_format, half precision fc layers count 2 bytes per weight.
+--hugepages and --numa-node set the memory region policy (arena.h), the feature map region's backing is reported.
+--autotune picks the engine of every convolution layer by timing (autotune.h), --tuning-cache keeps the choices across runs.
+--trace writes a Chrome trace of the timed iterations, the library must be built with -DTINYANN_PROFILE=ON.
+--frozen times the generated inference of frozen.h (TINYANN_FROZEN_CONFIG) instead, it has no per-layer times.
+*/
+
+typedef struct BenchOptions {
+    const char* network_config_path;
+    const char* param_path;
+    const char* json_path;
+    const char* trace_path;
+    int frozen;
+    size_t warmup;
+    size_t iterations;
+    NetworkOptions network;
+} BenchOptions;
+
+typedef struct LayerCost {
+    const char* name;
+    double flops;
+    double bytes;
+} LayerCost;
+
+static double nowSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Indexed by ConvEngines
+static const char* engine_names[] = {"direct", "gemm", "winograd", "auto"};
+
+static int engineByName(const char* name) {
+    for (int engine = _direct; engine <= _auto; engine++) {
+        if (strcmp(name, engine_names[engine]) == 0) {
+            return engine;
+        }
+    }
+    return -1;
+}
+
+// Indexed by WeightFormats
+static const char* weight_format_names[] = {"fp32", "fp16", "bf16"};
+
+static int weightFormatByName(const char* name) {
+    for (int format = _weights_fp32; format <= _weights_bf16; format++) {
+        if (strcmp(name, weight_format_names[format]) == 0) {
+            return format;
+        }
+    }
+    return -1;
+}
+
+// Indexed by Hugepages
+static const char* hugepage_names[] = {"off", "transparent", "explicit"};
+
+static int hugepagesByName(const char* name) {
+    for (int policy = _hugepages_off; policy <= _hugepages_explicit; policy++) {
+        if (strcmp(name, hugepage_names[policy]) == 0) {
+            return policy;
+        }
+    }
+    return -1;
+}
+
+// Indexed by MemoryBackings
+static const char* backing_names[] = {"none", "heap", "mapped", "transparent hugepages", "hugetlb"};
+
+static int parseOptions(int argc, char** argv, BenchOptions* options) {
+    if (argc < 3) {
+        return 0;
+    }
+
+    options->network_config_path = argv[1];
+    options->param_path = argv[2];
+    options->json_path = NULL;
+    options->trace_path = NULL;
+    options->frozen = 0;
+    options->warmup = 5;
+    options->iterations = 50;
+    options->network = defaultNetworkOptions();
+    options->network.max_batch = 1;
+
+    for (int i = 3; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--no-fuse") == 0) {
+            options->network.fuse_layers = 0;
+            continue;
+        }
+        if (strcmp(argv[i], "--autotune") == 0) {
+            options->network.autotune = 1;
+            continue;
+        }
+#ifdef TINYANN_FROZEN
+        if (strcmp(argv[i], "--frozen") == 0) {
+            options->frozen = 1;
+            continue;
+        }
+#endif
+        if (value == NULL) {
+            return 0;
+        }
+
+        if (strcmp(argv[i], "--batch") == 0) {
+            options->network.max_batch = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            options->network.threads = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--warmup") == 0) {
+            options->warmup = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--iterations") == 0) {
+            options->iterations = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--engine") == 0 && engineByName(value) >= 0) {
+            options->network.conv_engine = engineByName(value);
+        } else if (strcmp(argv[i], "--layout") == 0 && (strcmp(value, "nchw") == 0 || strcmp(value, "nchwc") == 0)) {
+            options->network.layout = strcmp(value, "nchwc") == 0 ? _nchwc : _nchw;
+        } else if (strcmp(argv[i], "--precision") == 0 && (strcmp(value, "fp32") == 0 || strcmp(value, "int8") == 0)) {
+            options->network.precision = strcmp(value, "int8") == 0 ? _int8 : _fp32;
+        } else if (strcmp(argv[i], "--sparse-threshold") == 0) {
+            options->network.sparse_threshold = strtof(value, NULL);
+        } else if (strcmp(argv[i], "--weights") == 0 && weightFormatByName(value) >= 0) {
+            options->network.weight_format = weightFormatByName(value);
+        } else if (strcmp(argv[i], "--hugepages") == 0 && hugepagesByName(value) >= 0) {
+            options->network.hugepages = hugepagesByName(value);
+        } else if (strcmp(argv[i], "--numa-node") == 0) {
+            options->network.numa_node = atoi(value);
+        } else if (strcmp(argv[i], "--tuning-cache") == 0) {
+            options->network.tuning_cache = value;
+            options->network.autotune = 1;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            options->json_path = value;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            options->trace_path = value;
+        } else {
+            return 0;
+        }
+        i++;
+    }
+
+    return options->network.max_batch > 0 && options->iterations > 0;
+}
+
+static void fillSynthetic(float* data, size_t n, uint32_t seed) {
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        data[i] = (seed >> 8) / (float)(1 << 24) * 2.0f - 1.0f;
+    }
+}
+
+// Work of one call of layer l on a batch, a conv fused with max_pool includes the pool
+static LayerCost layerCost(const TinyANN* tinyANN, size_t l, size_t batch) {
+    const Tensor* tensor = &tinyANN->tensors[l];
+    const Tensor* next = &tinyANN->tensors[l + 1];
+    double in_bytes = (double)batch * tensor->channels * tensor->height * tensor->width * sizeof(float);
+    double out_bytes = (double)batch * next->channels * next->height * next->width * sizeof(float);
+    double outputs = (double)batch * next->channels * next->height * next->width;
+    double kernel_size = tensor->info[_kernel_size];
+    double param_bytes = 0.0;
+    LayerCost cost = {layerName(tinyANN, l), 0.0, 0.0};
+
+    if (hasWeights(tensor)) {
+        double weights = (double)weightCount(tensor);
+        size_t channels = tensor->info[_output];
+        param_bytes = tensor->qweight_start ? weights + 2 * channels * sizeof(float) : (weights + channels) * sizeof(float);
+        if (!tensor->qweight_start && tensor->sparse_weights) {
+            param_bytes = sparseWeightBytes(tensor->sparse_weights) + channels * sizeof(float);
+        } else if (!tensor->qweight_start && tensor->half_weight_start) {
+            param_bytes = weights * sizeof(uint16_t) + channels * sizeof(float);
+        }
+    }
+
+    switch (tensor->info[_operation]) {
+    case _convolution:
+        cost.flops = 2.0 * outputs * tensor->info[_input] * kernel_size * kernel_size;
+        if (tensor->fusion == _fused_relu_maxpool) {
+            const Tensor* pooled = &tinyANN->tensors[l + 2];
+            double pool_kernel = next->info[_kernel_size];
+            cost.flops += (double)batch * pooled->channels * pooled->height * pooled->width * pool_kernel * pool_kernel;
+            out_bytes = (double)batch * pooled->channels * pooled->height * pooled->width * sizeof(float);
+        }
+        break;
+    case _depthwise_convolution:
+        cost.flops = 2.0 * outputs * kernel_size * kernel_size;
+        break;
+    case _pointwise_convolution:
+        cost.flops = 2.0 * outputs * tensor->info[_input];
+        break;
+    case _maxpool:
+        cost.flops = outputs * kernel_size * kernel_size;
+        break;
+    case _fully_connected:
+        cost.flops = 2.0 * outputs * tensor->info[_input];
+        if (!tensor->qweight_start && tensor->sparse_weights) {
+            cost.flops = 2.0 * batch * tensor->sparse_weights->nonzeros;
+        }
+        break;
+    default:
+        // flatten moves nothing when it shares its input's memory
+        return cost;
+    }
+
+    cost.bytes = in_bytes + out_bytes + param_bytes;
+    return cost;
+}
+
+// One timed call, through the interpreter or the generated frozen inference
+static void runBatch(const BenchOptions* options, TinyANN* tinyANN, const float* images, size_t batch, int* classes) {
+#ifdef TINYANN_FROZEN
+    if (options->frozen) {
+        frozenInferenceBatch(tinyANN->model, images, batch, classes);
+        return;
+    }
+#endif
+    inference_batch(tinyANN, images, batch, classes);
+}
+
+// Nearest rank percentile of sorted values
+static double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = (size_t)(p * sorted.size() + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        fprintf(stderr,
+                "Usage: %s <network_config> <params> [--batch N] [--threads N] [--warmup N] [--iterations N]\n"
+                "       [--engine direct|gemm|winograd|auto] [--layout nchw|nchwc] [--precision fp32|int8] [--no-fuse]\n"
+                "       [--sparse-threshold F] [--weights fp32|fp16|bf16] [--hugepages off|transparent|explicit] [--numa-node N]\n"
+                "       [--autotune] [--tuning-cache path] [--json path] [--trace path] [--frozen]\n",
+                argv[0]);
+        return 1;
+    }
+
+    Model model;
+    if (loadModel(&model, options.network_config_path, options.param_path, &options.network) != SUCCESS) {
+        return 1;
+    }
+
+#ifdef TINYANN_FROZEN
+    if (options.frozen && (options.network.precision == _int8 || frozenCheckModel(&model) != SUCCESS)) {
+        fprintf(stderr, "ERROR TINY_ANN: --frozen runs fp32 models of %s only\n", frozenNetworkConfig());
+        destroyModel(&model);
+        return 1;
+    }
+#endif
+
+    size_t batch = options.network.max_batch;
+    size_t image_size = model.image_filters * model.image_rows * model.image_cols;
+    std::vector<float> images(batch * image_size);
+    std::vector<int> classes(batch);
+    fillSynthetic(images.data(), images.size(), 12345);
+
+    // int8 from fp32 params: calibrate on the benchmark input and quantize the model before the timed context exists
+    int has_int8 = 0;
+    for (size_t i = 0; i < model.total_layers; i++) {
+        has_int8 |= model.tensors[i].qweight_start != NULL;
+    }
+    if (options.network.precision == _int8 && !has_int8) {
+        NetworkOptions calibration_options = options.network;
+        calibration_options.precision = _fp32;
+        std::vector<float> ranges(model.total_layers, 0.0f);
+
+        TinyANN calibration;
+        if (createExecutionContext(&calibration, &model, &calibration_options) != SUCCESS) {
+            destroyModel(&model);
+            return 1;
+        }
+        calibration.activation_ranges = ranges.data();
+        inference_batch(&calibration, images.data(), batch, classes.data());
+        destroyExecutionContext(&calibration);
+
+        if (quantizeModel(&model, ranges.data()) != SUCCESS) {
+            destroyModel(&model);
+            return 1;
+        }
+    }
+
+    TinyANN tinyANN;
+    if (createExecutionContext(&tinyANN, &model, &options.network) != SUCCESS) {
+        destroyModel(&model);
+        return 1;
+    }
+
+    for (size_t i = 0; i < options.warmup; i++) {
+        runBatch(&options, &tinyANN, images.data(), batch, classes.data());
+    }
+
+    // Every timed iteration is traced, the ring holds all of their layer and batch events
+    if (options.trace_path && enableProfiling(&tinyANN, 1, options.iterations * (tinyANN.total_layers + 1)) != SUCCESS) {
+        destroyExecutionContext(&tinyANN);
+        destroyModel(&model);
+        return 1;
+    }
+
+    std::vector<double> layer_seconds(tinyANN.total_layers, 0.0);
+    std::vector<double> latencies(options.iterations);
+    tinyANN.layer_seconds = layer_seconds.data();
+
+    double total_start = nowSeconds();
+    for (size_t i = 0; i < options.iterations; i++) {
+        double start = nowSeconds();
+        runBatch(&options, &tinyANN, images.data(), batch, classes.data());
+        latencies[i] = nowSeconds() - start;
+    }
+    double total_seconds = nowSeconds() - total_start;
+    tinyANN.layer_seconds = NULL;
+
+    std::vector<double> sorted = latencies;
+    std::sort(sorted.begin(), sorted.end());
+    double p50 = percentile(sorted, 0.50) * 1e3;
+    double p99 = percentile(sorted, 0.99) * 1e3;
+    double images_per_second = batch * options.iterations / total_seconds;
+    const char* engine = options.frozen ? "frozen" : options.network.autotune ? "autotuned" : engine_names[options.network.conv_engine];
+    const char* precision = options.network.precision == _int8 || has_int8 ? "int8" : "fp32";
+
+    const char* layout = options.network.layout == _nchwc ? "nchwc" : "nchw";
+
+    // A half parameter file sets the fc weight format whatever --weights says
+    int weight_format = _weights_fp32;
+    for (size_t i = 0; i < model.total_layers; i++) {
+        if (model.tensors[i].half_weight_start) {
+            weight_format = model.tensors[i].weight_format;
+        }
+    }
+    const char* weights = weight_format_names[weight_format];
+
+    printf("\n%s  batch %zu  threads %zu  engine %s  layout %s  precision %s  weights %s  fuse %d  kernels %s\n", options.network_config_path,
+           batch, options.network.threads, engine, layout, precision, weights, options.network.fuse_layers, tinyANN.kernels->name);
+    printf("latency p50 %.3f ms  p99 %.3f ms  (%zu iterations)  %.1f images/s\n", p50, p99, options.iterations, images_per_second);
+
+    ArenaStats arena;
+    snapshotArenaStats(&arena);
+    size_t huge_bytes = regionHugepageBytes(&tinyANN.memory_block);
+    printf("feature maps %.2f MB %s (%.2f MB in hugepages, NUMA node %d)  regions %zu  %.2f MB  fallbacks %zu\n\n",
+           tinyANN.memory_block.size * sizeof(float) / 1048576.0, backing_names[tinyANN.memory_block.backing], huge_bytes / 1048576.0,
+           tinyANN.memory_block.numa_node, arena.regions, arena.bytes / 1048576.0, arena.fallbacks);
+    if (!options.frozen) {
+        printf("%-6s %-32s %10s %7s %10s %10s\n", "layer", "operation", "ms/call", "share", "GFLOP/s", "GB/s");
+    }
+
+    // The frozen inference has no per-layer times
+    double layer_total = 0.0;
+    size_t timed_layers = options.frozen ? 0 : tinyANN.total_layers;
+    for (size_t l = 0; l < timed_layers; l++) {
+        layer_total += layer_seconds[l];
+    }
+
+    for (size_t l = 0; l + 1 < timed_layers; l++) {
+        // The max_pool of a fused conv has no call of its own
+        if (l > 0 && tinyANN.tensors[l - 1].fusion == _fused_relu_maxpool) {
+            continue;
+        }
+        LayerCost cost = layerCost(&tinyANN, l, batch);
+        double seconds = layer_seconds[l] / options.iterations;
+        double share = layer_total > 0 ? 100.0 * layer_seconds[l] / layer_total : 0.0;
+        printf("%-6zu %-32s %10.4f %6.1f%% %10.2f %10.2f\n", l + 1, cost.name, seconds * 1e3, share, seconds > 0 ? cost.flops / seconds * 1e-9 : 0.0,
+               seconds > 0 ? cost.bytes / seconds * 1e-9 : 0.0);
+    }
+
+    if (options.json_path) {
+        FILE* json = fopen(options.json_path, "wb");
+        if (json == NULL) {
+            fprintf(stderr, "ERROR TINY_ANN: File (%s) could not be opened for writing\n", options.json_path);
+        } else {
+            fprintf(json, "{\n  \"network_config\": \"%s\",\n  \"batch\": %zu,\n  \"threads\": %zu,\n  \"engine\": \"%s\",\n  \"layout\": \"%s\",\n",
+                    options.network_config_path, batch, options.network.threads, engine, layout);
+            fprintf(json, "  \"precision\": \"%s\",\n  \"weights\": \"%s\",\n  \"fuse_layers\": %d,\n  \"kernels\": \"%s\",\n  \"warmup\": %zu,\n",
+                    precision, weights, options.network.fuse_layers, tinyANN.kernels->name, options.warmup);
+            fprintf(json, "  \"iterations\": %zu,\n  \"latency_ms\": {\"p50\": %.6f, \"p99\": %.6f, \"min\": %.6f, \"max\": %.6f, \"mean\": %.6f},\n",
+                    options.iterations, p50, p99, sorted.front() * 1e3, sorted.back() * 1e3, total_seconds / options.iterations * 1e3);
+            fprintf(json, "  \"images_per_second\": %.3f,\n", images_per_second);
+            fprintf(json, "  \"memory\": {\"feature_map_bytes\": %zu, \"backing\": \"%s\", \"hugepage_bytes\": %zu, \"numa_node\": %d, ",
+                    tinyANN.memory_block.size * sizeof(float), backing_names[tinyANN.memory_block.backing], huge_bytes, tinyANN.memory_block.numa_node);
+            fprintf(json, "\"regions\": %zu, \"region_bytes\": %zu, \"mapped_bytes\": %zu, \"fallbacks\": %zu},\n  \"layers\": [", arena.regions,
+                    arena.bytes, arena.mapped_bytes, arena.fallbacks);
+
+            const char* separator = "\n";
+            for (size_t l = 0; l + 1 < timed_layers; l++) {
+                if (l > 0 && tinyANN.tensors[l - 1].fusion == _fused_relu_maxpool) {
+                    continue;
+                }
+                LayerCost cost = layerCost(&tinyANN, l, batch);
+                double seconds = layer_seconds[l] / options.iterations;
+                fprintf(json, "%s    {\"layer\": %zu, \"operation\": \"%s\", \"ms_per_call\": %.6f, \"flops\": %.0f, \"bytes\": %.0f, ", separator,
+                        l + 1, cost.name, seconds * 1e3, cost.flops, cost.bytes);
+                fprintf(json, "\"gflop_per_s\": %.4f, \"gb_per_s\": %.4f}", seconds > 0 ? cost.flops / seconds * 1e-9 : 0.0,
+                        seconds > 0 ? cost.bytes / seconds * 1e-9 : 0.0);
+                separator = ",\n";
+            }
+            fprintf(json, "\n  ]\n}\n");
+            fclose(json);
+        }
+    }
+
+    if (options.trace_path && writeChromeTrace(&tinyANN, options.trace_path) == SUCCESS) {
+        printf("\nTrace written to %s\n", options.trace_path);
+    }
+
+    destroyExecutionContext(&tinyANN);
+    destroyModel(&model);
+
+    return 0;
+}
@@ -0,0 +1,205 @@
+#include "../include/cnn.h"
+
+#include <string>
+#include <vector>
+
+/*
+Generates the frozen inference translation unit (see frozen.h) for one network topology
+
+Usage: tinyann_codegen <network_config> <output.cpp>
+
+Reads the network_config format of loadModel(), infers the feature map shapes the same way and emits one
+frozen_kernels.h call per layer with its shapes as template arguments. conv -> relu -> max_pool and conv / fc -> relu
+are fused like the fusion pass of createExecutionContext() does.
+*/
+
+typedef struct Layer {
+    size_t info[MAX_LAYER_INFO_SIZE];
+    size_t channels; // of the layer's input map
+    size_t height;
+    size_t width;
+} Layer;
+
+static int readConfig(const char* network_config_path, size_t image[3], std::vector<Layer>& layers) {
+    FILE* network_config = fopen(network_config_path, "rb");
+    if (network_config == NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: File (%s) does not exist\n", network_config_path);
+        return FILE_NOT_READABLE;
+    }
+
+    size_t total_layers = 0;
+    int ok = fscanf(network_config, "%zu %zu %zu %zu", &image[0], &image[1], &image[2], &total_layers) == 4 && total_layers > 1;
+    layers.resize(ok ? total_layers : 0);
+    for (size_t l = 0; ok && l < total_layers; l++) {
+        for (size_t i = 0; ok && i < MAX_LAYER_INFO_SIZE; i++) {
+            ok = fscanf(network_config, "%zu", &layers[l].info[i]) == 1;
+        }
+    }
+    fclose(network_config);
+
+    if (!ok) {
+        fprintf(stderr, "ERROR TINY_ANN: Network config (%s) could not be parsed\n", network_config_path);
+        return INVALID_ARGUMENT;
+    }
+
+    // Same shapes as inferTensorShapes() in cnn.cpp
+    size_t height = image[1];
+    size_t width = image[2];
+    for (size_t l = 0; l < total_layers; l++) {
+        Layer* layer = &layers[l];
+        layer->channels = layer->info[_input];
+        layer->height = height;
+        layer->width = width;
+
+        size_t operation = layer->info[_operation];
+        if (l + 1 == total_layers || operation == _flatten || operation == _fully_connected) {
+            height = width = 1;
+            continue;
+        }
+        if (operation != _convolution && operation != _maxpool) {
+            fprintf(stderr, "ERROR TINY_ANN: Layer %zu has an operation (%zu) the code generator does not know\n", l + 1, operation);
+            return INVALID_ARGUMENT;
+        }
+        if (layer->info[_stride] == 0 || height + 2 * layer->info[_padding] < layer->info[_kernel_size] ||
+            width + 2 * layer->info[_padding] < layer->info[_kernel_size]) {
+            fprintf(stderr, "ERROR TINY_ANN: Layer %zu has an invalid window\n", l + 1);
+            return INVALID_ARGUMENT;
+        }
+        height = 1 + (height + 2 * layer->info[_padding] - layer->info[_kernel_size]) / layer->info[_stride];
+        width = 1 + (width + 2 * layer->info[_padding] - layer->info[_kernel_size]) / layer->info[_stride];
+    }
+
+    return SUCCESS;
+}
+
+static size_t mapSize(const Layer& layer) { return layer.channels * layer.height * layer.width; }
+
+// conv -> relu -> max_pool runs as one kernel, the conv output never reaches a buffer
+static int fusesMaxPool(const std::vector<Layer>& layers, size_t l) {
+    return layers[l].info[_operation] == _convolution && layers[l].info[_activation] == _relu && l + 2 < layers.size() &&
+           layers[l + 1].info[_operation] == _maxpool;
+}
+
+static std::string shape(const Layer& layer) {
+    char text[64];
+    snprintf(text, sizeof(text), "%zux%zux%zu", layer.channels, layer.height, layer.width);
+    return text;
+}
+
+static int writeSource(const char* network_config_path, const char* output_path, const size_t image[3], const std::vector<Layer>& layers) {
+    FILE* out = fopen(output_path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR TINY_ANN: File (%s) could not be opened for writing\n", output_path);
+        return FILE_NOT_READABLE;
+    }
+
+    size_t total_layers = layers.size();
+    size_t buffer_floats = 1;
+    for (size_t l = 1; l < total_layers; l++) {
+        if (!fusesMaxPool(layers, l - 1) && mapSize(layers[l]) > buffer_floats) {
+            buffer_floats = mapSize(layers[l]);
+        }
+    }
+
+    fprintf(out, "// Generated by tinyann_codegen from %s, do not edit\n\n", network_config_path);
+    fprintf(out, "#include \"frozen.h\"\n#include \"frozen_kernels.h\"\n\n");
+
+    fprintf(out, "static const size_t frozen_image[3] = {%zu, %zu, %zu};\n", image[0], image[1], image[2]);
+    fprintf(out, "static const size_t frozen_info[%zu][MAX_LAYER_INFO_SIZE] = {\n", total_layers);
+    for (size_t l = 0; l < total_layers; l++) {
+        fprintf(out, "    {");
+        for (size_t i = 0; i < MAX_LAYER_INFO_SIZE; i++) {
+            fprintf(out, "%zu%s", layers[l].info[i], i + 1 < MAX_LAYER_INFO_SIZE ? ", " : "");
+        }
+        fprintf(out, "},\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "// Largest feature map a layer writes, layers alternate between the two buffers\n");
+    fprintf(out, "#define FROZEN_BUFFER_FLOATS %zu\n\n", buffer_floats);
+    fprintf(out, "alignas(64) static thread_local float frozen_buffers[2][FROZEN_BUFFER_FLOATS];\n\n");
+
+    fprintf(out, "const char* frozenNetworkConfig() { return \"%s\"; }\n\n", network_config_path);
+    fprintf(out, "int frozenCheckModel(const Model* model) { return frozenModelMatches(model, frozen_image, %zu, frozen_info); }\n\n",
+            total_layers);
+
+    fprintf(out, "int frozenInference(const Model* model, const float* image) {\n");
+    fprintf(out, "    const Tensor* tensors = model->tensors;\n");
+    fprintf(out, "    const float* in = image;\n");
+    fprintf(out, "    float* out = frozen_buffers[0];\n");
+
+    // in / out swap after every layer that writes a new map
+    const char* swap = "    in = out;\n    out = out == frozen_buffers[0] ? frozen_buffers[1] : frozen_buffers[0];\n";
+
+    for (size_t l = 0; l + 1 < total_layers; l++) {
+        const Layer& layer = layers[l];
+        const Layer& next = layers[l + 1];
+        const size_t* info = layer.info;
+        int relu = info[_activation] == _relu;
+
+        fprintf(out, "\n");
+        switch (info[_operation]) {
+        case _convolution:
+            if (fusesMaxPool(layers, l)) {
+                const size_t* pool = next.info;
+                fprintf(out, "    // %zu: convolution %s -> %s, relu, %zu: max_pool -> %s\n", l + 1, shape(layer).c_str(), shape(next).c_str(), l + 2,
+                        shape(layers[l + 2]).c_str());
+                fprintf(out, "    frozen_convolution_max_pool<%zu, %zu, %zu, %zu, %zu, %zu, %zu, %zu, %zu, %zu>(in, tensors[%zu].weight_start, "
+                             "tensors[%zu].bias_start, out);\n",
+                        layer.channels, layer.height, layer.width, info[_output], info[_kernel_size], info[_stride], info[_padding],
+                        pool[_kernel_size], pool[_stride], pool[_padding], l, l);
+                l++;
+            } else {
+                fprintf(out, "    // %zu: convolution %s -> %s%s\n", l + 1, shape(layer).c_str(), shape(next).c_str(), relu ? ", relu" : "");
+                fprintf(out, "    frozen_convolution<%zu, %zu, %zu, %zu, %zu, %zu, %zu, %s>(in, tensors[%zu].weight_start, tensors[%zu].bias_start, out);\n",
+                        layer.channels, layer.height, layer.width, info[_output], info[_kernel_size], info[_stride], info[_padding],
+                        relu ? "true" : "false", l, l);
+            }
+            fprintf(out, "%s", swap);
+            break;
+        case _maxpool:
+            fprintf(out, "    // %zu: max_pool %s -> %s\n", l + 1, shape(layer).c_str(), shape(next).c_str());
+            fprintf(out, "    frozen_max_pool<%zu, %zu, %zu, %zu, %zu, %zu>(in, out);\n", layer.channels, layer.height, layer.width,
+                    info[_kernel_size], info[_stride], info[_padding]);
+            fprintf(out, "%s", swap);
+            break;
+        case _flatten:
+            fprintf(out, "    // %zu: flatten %s -> %zu, maps are stored unpadded so the layout already matches\n", l + 1, shape(layer).c_str(),
+                    mapSize(next));
+            break;
+        case _fully_connected:
+            fprintf(out, "    // %zu: fully_connected %zu -> %zu%s\n", l + 1, info[_input], info[_output], relu ? ", relu" : "");
+            fprintf(out, "    frozen_fully_connected<%zu, %zu, %s>(in, tensors[%zu].weight_start, tensors[%zu].bias_start, out);\n", info[_input],
+                    info[_output], relu ? "true" : "false", l, l);
+            fprintf(out, "%s", swap);
+            break;
+        }
+    }
+
+    fprintf(out, "\n    return frozen_argmax<%zu>(in);\n}\n\n", layers[total_layers - 1].channels);
+
+    fprintf(out, "int frozenInferenceBatch(const Model* model, const float* images, size_t n, int* out_classes) {\n");
+    fprintf(out, "    for (size_t b = 0; b < n; b++) {\n");
+    fprintf(out, "        out_classes[b] = frozenInference(model, images + b * %zu);\n", image[0] * image[1] * image[2]);
+    fprintf(out, "    }\n    return SUCCESS;\n}\n");
+
+    int status = ferror(out) ? FILE_NOT_READABLE : SUCCESS;
+    fclose(out);
+
+    return status;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <network_config> <output.cpp>\n", argv[0]);
+        return 1;
+    }
+
+    size_t image[3];
+    std::vector<Layer> layers;
+    if (readConfig(argv[1], image, layers) != SUCCESS || writeSource(argv[1], argv[2], image, layers) != SUCCESS) {
+        return 1;
+    }
+
+    return 0;
+}
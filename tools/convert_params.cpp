@@ -0,0 +1,49 @@
+#include "../include/cnn.h"
+#include "../include/params.h"
+
+/*
+Converts a text parameter file (extern/parameters.txt or the output of writeParamToFile() in main.cpp,
+both are whitespace separated floats in layer order) into the binary container loaded by mapParams(),
+or with fp16 / bf16 into the half container loaded by mapHalfParams() (see half.h)
+
+Usage: tinyann_convert_params <network_config> <text_params> <binary_params> [fp16|bf16]
+*/
+
+int main(int argc, char** argv) {
+    int format = _weights_fp32;
+    if (argc == 5 && strcmp(argv[4], "fp16") == 0) {
+        format = _weights_fp16;
+    } else if (argc == 5 && strcmp(argv[4], "bf16") == 0) {
+        format = _weights_bf16;
+    } else if (argc != 4) {
+        fprintf(stderr, "Usage: %s <network_config> <text_params> <binary_params> [fp16|bf16]\n", argv[0]);
+        return 1;
+    }
+
+    // A binary container can still be rounded to a half container
+    if (isBinaryParamFile(argv[2]) && format == _weights_fp32) {
+        fprintf(stderr, "ERROR TINY_ANN: File (%s) is already a binary parameter container\n", argv[2]);
+        return 1;
+    }
+
+    Model model;
+    if (loadModel(&model, argv[1], argv[2], NULL) != SUCCESS) {
+        return 1;
+    }
+
+    int status = format == _weights_fp32 ? writeParamsBinary(&model, argv[3]) : writeParamsHalf(&model, argv[3], format);
+    destroyModel(&model);
+
+    if (status != SUCCESS) {
+        return 1;
+    }
+
+    // Round trip through the mapping path so a bad container is caught here and not at worker startup
+    if (loadModel(&model, argv[1], argv[3], NULL) != SUCCESS) {
+        return 1;
+    }
+    destroyModel(&model);
+
+    printf("Wrote %s\n", argv[3]);
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include "../include/cnn.h"
+#include "../include/inference_queue.h"
+#include "../include/kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <thread>
+#include <vector>
+
+/*
+Open loop load generator for the inference queue
+
+Usage: tinyann_loadgen <network_config> <params> [--rate N] [--duration S] [--max-batch N] [--max-delay-us N]
+                       [--max-pending N] [--threads N] [--seed N]
+
+Submits single synthetic images with exponentially distributed gaps (Poisson arrivals at --rate requests/s) for
+--duration seconds, without waiting for results, then reports the end to end latency of every request, the throughput
+and the queue's batch size and depth histograms. --max-batch 1 --max-delay-us 0 is the one inference() per request
+baseline.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+typedef struct LoadOptions {
+    const char* network_config_path;
+    const char* param_path;
+    double rate;
+    double duration;
+    unsigned seed;
+    QueueOptions queue;
+    NetworkOptions network;
+} LoadOptions;
+
+// One submitted request, completed by the scheduler thread
+typedef struct RequestRecord {
+    Clock::time_point submitted;
+    double latency_seconds;
+    int class_id;
+} RequestRecord;
+
+static int parseOptions(int argc, char** argv, LoadOptions* options) {
+    if (argc < 3) {
+        return 0;
+    }
+
+    options->network_config_path = argv[1];
+    options->param_path = argv[2];
+    options->rate = 200.0;
+    options->duration = 5.0;
+    options->seed = 1;
+    options->queue = defaultQueueOptions();
+    options->queue.max_batch = 8;
+    options->network = defaultNetworkOptions();
+
+    for (int i = 3; i + 1 < argc; i += 2) {
+        const char* value = argv[i + 1];
+        if (strcmp(argv[i], "--rate") == 0) {
+            options->rate = strtod(value, NULL);
+        } else if (strcmp(argv[i], "--duration") == 0) {
+            options->duration = strtod(value, NULL);
+        } else if (strcmp(argv[i], "--max-batch") == 0) {
+            options->queue.max_batch = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--max-delay-us") == 0) {
+            options->queue.max_delay_us = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--max-pending") == 0) {
+            options->queue.max_pending = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            options->network.threads = strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            options->seed = strtoul(value, NULL, 10);
+        } else {
+            return 0;
+        }
+    }
+
+    options->network.max_batch = options->queue.max_batch;
+    return argc % 2 == 1 && options->rate > 0 && options->duration > 0 && options->queue.max_batch > 0;
+}
+
+static void fillSynthetic(float* data, size_t n, uint32_t seed) {
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        data[i] = (seed >> 8) / (float)(1 << 24) * 2.0f - 1.0f;
+    }
+}
+
+static void completeRequest(void* user_data, int status, int class_id) {
+    RequestRecord* record = (RequestRecord*)user_data;
+    record->latency_seconds = std::chrono::duration<double>(Clock::now() - record->submitted).count();
+    record->class_id = status == SUCCESS ? class_id : -1;
+}
+
+// Nearest rank percentile of sorted values
+static double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = (size_t)(p * sorted.size() + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+int main(int argc, char** argv) {
+    LoadOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        fprintf(stderr,
+                "Usage: %s <network_config> <params> [--rate N] [--duration S] [--max-batch N] [--max-delay-us N]\n"
+                "       [--max-pending N] [--threads N] [--seed N]\n",
+                argv[0]);
+        return 1;
+    }
+
+    TinyANN tinyANN;
+    if (initNetworkWithOptions(&tinyANN, options.network_config_path, options.param_path, &options.network) != SUCCESS) {
+        return 1;
+    }
+
+    // A few distinct images, requests cycle through them
+    size_t image_size = tinyANN.image_filters * tinyANN.image_rows * tinyANN.image_cols;
+    size_t image_count = 16;
+    std::vector<float> images(image_count * image_size);
+    fillSynthetic(images.data(), images.size(), options.seed);
+
+    InferenceQueue* queue = createInferenceQueue(&tinyANN, &options.queue);
+    if (queue == NULL) {
+        destroyNetwork(&tinyANN);
+        return 1;
+    }
+
+    std::mt19937 generator(options.seed);
+    std::exponential_distribution<double> gap(options.rate);
+    std::deque<RequestRecord> records; // push_back keeps the addresses handed to the callbacks
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration));
+    Clock::time_point arrival = start;
+    for (;;) {
+        arrival += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(gap(generator)));
+        if (arrival >= end) {
+            break;
+        }
+        // Open loop: a late generator submits at once instead of pushing the schedule back
+        std::this_thread::sleep_until(arrival);
+
+        records.push_back(RequestRecord());
+        RequestRecord* record = &records.back();
+        record->submitted = Clock::now();
+        record->latency_seconds = 0.0;
+        record->class_id = -1;
+        if (submitInference(queue, images.data() + (records.size() % image_count) * image_size, completeRequest, record) != SUCCESS) {
+            records.pop_back();
+            break;
+        }
+    }
+
+    // Waits for the last batch, the scheduler counts a request as completed after its callback
+    QueueStats stats;
+    for (;;) {
+        snapshotQueueStats(queue, &stats);
+        if (stats.completed == records.size()) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    destroyInferenceQueue(queue);
+
+    std::vector<double> latencies;
+    for (size_t i = 0; i < records.size(); i++) {
+        latencies.push_back(records[i].latency_seconds * 1e3);
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("\n%s  rate %.1f req/s  max_batch %zu  max_delay %zu us  kernels %s\n", options.network_config_path, options.rate,
+           options.queue.max_batch, options.queue.max_delay_us, tinyANN.kernels->name);
+    if (latencies.empty()) {
+        printf("no requests submitted\n");
+        destroyNetwork(&tinyANN);
+        return 0;
+    }
+    printf("requests %zu  throughput %.1f req/s  latency p50 %.3f ms  p99 %.3f ms  max %.3f ms\n", records.size(), records.size() / seconds,
+           percentile(latencies, 0.50), percentile(latencies, 0.99), latencies.back());
+    printf("batches %llu  mean batch %.2f  mean queue wait %.3f ms  inference %.3f ms/batch  max depth %zu\n\n",
+           (unsigned long long)stats.batches, (double)stats.completed / stats.batches, stats.wait_seconds / stats.completed * 1e3,
+           stats.inference_seconds / stats.batches * 1e3, stats.max_depth);
+
+    printf("%-12s %10s\n", "batch size", "batches");
+    for (size_t n = 1; n < QUEUE_BATCH_BINS; n++) {
+        if (stats.batch_sizes[n] > 0) {
+            printf("%-12zu %10llu\n", n, (unsigned long long)stats.batch_sizes[n]);
+        }
+    }
+
+    printf("\n%-12s %10s\n", "depth", "submits");
+    for (size_t bin = 0; bin < QUEUE_DEPTH_BINS; bin++) {
+        if (stats.depths[bin] > 0) {
+            size_t low = bin == 0 ? 0 : (size_t)1 << (bin - 1);
+            size_t high = bin == 0 ? 0 : ((size_t)1 << bin) - 1;
+            printf("%5zu-%-6zu %10llu\n", low, high, (unsigned long long)stats.depths[bin]);
+        }
+    }
+
+    destroyNetwork(&tinyANN);
+    return 0;
+}